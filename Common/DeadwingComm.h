@@ -0,0 +1,324 @@
+#pragma once
+
+/// \note wire format of the communication buffer, shared by SMM, DXE and KM drivers. Only
+/// types available in both EDK2 and WDK are used, EFI_STATUS should be defined by the includer. Every
+/// driver is x64, so pointers are 8 bytes wide everywhere
+
+// magic values of the commands
+#define CMD_DEADWING_PING_SMI             0xD700DEADULL
+#define CMD_DEADWING_READ_PHYS            0xD800AAABULL
+#define CMD_DEADWING_WRITE_PHYS           0xD800BBCDULL
+#define CMD_DEADWING_VIRT_TO_PHYS         0xD800FF11ULL
+#define CMD_DEADWING_READ_VIRTUAL         0xD900CCEFULL
+#define CMD_DEADWING_WRITE_VIRTUAL        0xD900DDAFULL
+#define CMD_DEADWING_PRIV_ESC             0xD100AC91ULL
+#define CMD_DEADWING_CACHE_SESSION_INFO   0xD110A110ULL
+#define CMD_DEADWING_HASH_RANGES          0xDA00E1A5ULL
+#define CMD_DEADWING_SCAN                 0xDA005CA9ULL
+#define CMD_DEADWING_SPARSE_READ          0xD900E11DULL
+#define CMD_DEADWING_TRACK_REGION         0xDA007EA1ULL
+#define CMD_DEADWING_CHANGES_SINCE        0xDA00C4A6ULL
+#define CMD_DEADWING_HARVEST_AD           0xDA00AD5EULL
+#define CMD_DEADWING_MONITOR_START        0xDA00DA30ULL
+#define CMD_DEADWING_MONITOR_SAMPLE       0xDA00DA31ULL
+#define CMD_DEADWING_ENTROPY_MAP          0xDA00E47BULL
+#define CMD_DEADWING_DRAIN_LOG            0xDA0010C5ULL
+#define CMD_DEADWING_DRAIN_TRACE          0xDA007ACEULL
+#define CMD_DEADWING_GET_STATS            0xDA0057A7ULL
+#define CMD_DEADWING_PROFILE_SAMPLE       0xDA00BF01ULL
+#define CMD_DEADWING_DRAIN_PROFILE        0xDA00BF02ULL
+#define CMD_DEADWING_SNAPSHOT_REGISTERS   0xDA00C9B0ULL
+#define CMD_DEADWING_DRAIN_RING           0xDA00D0A0ULL
+#define CMD_DEADWING_REGISTER_DOORBELL    0xDA00DB00ULL
+#define CMD_DEADWING_SET_MEMORY_MAP       0xDA00E820ULL
+#define CMD_DEADWING_GET_MEMORY_MAP       0xDA00E821ULL
+#define CMD_DEADWING_SET_RSDP             0xDA00AC00ULL
+#define CMD_DEADWING_GET_ACPI_TABLE       0xDA00AC01ULL
+
+/// \note offset of the inline data region from the start of the packet. Commands of the
+/// packet should end before it, size of the region is derived from the size of the communication buffer
+#define DEADWING_COMM_INLINE_OFFSET       0x1000
+
+// 'DWPK', marks packets of the current format
+#define DEADWING_PACKET_SIGNATURE         0x4B505744
+
+// every command starts at 8 bytes boundary
+#define DEADWING_COMMAND_ALIGNMENT        8
+
+// TSC cycles spent in each phase of the packet, filled by SMI handler on every SMI
+typedef struct _DEADWING_TIMING {
+	UINT64  Total;
+	UINT64  Validate;
+	UINT64  DirBase;
+	UINT64  TargetTranslate;
+	UINT64  ConsumerTranslate;
+	UINT64  Copy;
+	UINT64  Restore;
+} DEADWING_TIMING, *PDEADWING_TIMING;
+
+// header of the packet, commands follow it back to back. Status is the status of the packet itself:
+// EFI_NOT_READY if some command should be resumed by the next SMI or an error if packet is malformed
+typedef struct _DEADWING_PACKET {
+	UINT32           Signature;
+	UINT32           Count;
+	UINT64           Length;      // header with all commands
+	EFI_STATUS       Status;
+	UINT64           TscBudget;   // 0 - default budget of the SMI
+	DEADWING_TIMING  Timing;
+} DEADWING_PACKET, *PDEADWING_PACKET;
+
+// header of the command, payload of the command follows it. Command is executed while its status is
+// EFI_NOT_READY, so completed commands are skipped when the packet is resubmitted
+typedef struct _DEADWING_COMMAND {
+	UINT32      Command;
+	UINT32      Length;     // header with payload, aligned to DEADWING_COMMAND_ALIGNMENT
+	EFI_STATUS  Status;
+
+	struct {
+		UINT64  Cursor;
+		UINT64  State[2];
+	} Resume;
+} DEADWING_COMMAND, *PDEADWING_COMMAND;
+
+// payloads of the commands, ping and privileges escalation have no payload
+typedef struct _DEADWING_READ_PAYLOAD {
+	UINT64  ProcessId;   // ignored by physical reads
+	VOID   *Address;
+	VOID   *Buffer;      // NULL - data is returned in the inline data region, only one such read per packet
+	UINT64  Length;
+} DEADWING_READ_PAYLOAD, *PDEADWING_READ_PAYLOAD;
+
+typedef struct _DEADWING_WRITE_PAYLOAD {
+	UINT64  ProcessId;   // ignored by physical writes
+	VOID   *Address;
+	VOID   *Buffer;
+	UINT64  Length;
+} DEADWING_WRITE_PAYLOAD, *PDEADWING_WRITE_PAYLOAD;
+
+typedef struct _DEADWING_CACHE_PAYLOAD {
+	UINT64  ControllerProcessId;
+	VOID   *VaPsInitialSysProcess;
+	UINT64  DirBase;
+} DEADWING_CACHE_PAYLOAD, *PDEADWING_CACHE_PAYLOAD;
+
+typedef struct _DEADWING_VTOP_PAYLOAD {
+	UINT64  ProcessId;
+	VOID   *Address;
+	VOID   *Translated;
+} DEADWING_VTOP_PAYLOAD, *PDEADWING_VTOP_PAYLOAD;
+
+typedef struct _DEADWING_HASH_PAYLOAD {
+	VOID   *Request;
+	VOID   *PageDigests;
+	UINT64  PageDigestsLength;
+} DEADWING_HASH_PAYLOAD, *PDEADWING_HASH_PAYLOAD;
+
+typedef struct _DEADWING_SCAN_PAYLOAD {
+	VOID   *Request;
+	VOID   *Matches;
+	UINT64  MaxMatches;
+	UINT64  MatchCount;
+	UINT64  Truncated;
+} DEADWING_SCAN_PAYLOAD, *PDEADWING_SCAN_PAYLOAD;
+
+typedef struct _DEADWING_SPARSE_PAYLOAD {
+	VOID   *Request;
+	UINT64  DataPages;
+} DEADWING_SPARSE_PAYLOAD, *PDEADWING_SPARSE_PAYLOAD;
+
+typedef struct _DEADWING_TRACK_PAYLOAD {
+	UINT64  ProcessId;
+	VOID   *Address;
+	UINT64  Length;
+	UINT64  Handle;
+} DEADWING_TRACK_PAYLOAD, *PDEADWING_TRACK_PAYLOAD;
+
+typedef struct _DEADWING_CHANGES_PAYLOAD {
+	VOID   *Request;
+	UINT64  ChangeCount;
+	UINT64  Truncated;
+} DEADWING_CHANGES_PAYLOAD, *PDEADWING_CHANGES_PAYLOAD;
+
+typedef struct _DEADWING_HARVEST_PAYLOAD {
+	VOID   *Request;
+	UINT64  PageCount;
+	UINT64  Cleared;
+	UINT64  Truncated;
+} DEADWING_HARVEST_PAYLOAD, *PDEADWING_HARVEST_PAYLOAD;
+
+typedef struct _DEADWING_MONITOR_START_PAYLOAD {
+	VOID   *Request;
+} DEADWING_MONITOR_START_PAYLOAD, *PDEADWING_MONITOR_START_PAYLOAD;
+
+typedef struct _DEADWING_MONITOR_SAMPLE_PAYLOAD {
+	VOID   *Heatmap;
+	UINT64  MaxEntries;
+	UINT64  EntryCount;
+	UINT64  Samples;
+	UINT64  Aggregated;
+} DEADWING_MONITOR_SAMPLE_PAYLOAD, *PDEADWING_MONITOR_SAMPLE_PAYLOAD;
+
+typedef struct _DEADWING_ENTROPY_PAYLOAD {
+	VOID   *Request;
+} DEADWING_ENTROPY_PAYLOAD, *PDEADWING_ENTROPY_PAYLOAD;
+
+// drain of the log, trace and profiler rings
+typedef struct _DEADWING_DRAIN_PAYLOAD {
+	VOID   *Records;
+	UINT64  MaxRecords;
+	UINT64  RecordCount;
+	UINT64  Dropped;
+} DEADWING_DRAIN_PAYLOAD, *PDEADWING_DRAIN_PAYLOAD;
+
+typedef struct _DEADWING_STATS_PAYLOAD {
+	VOID   *Buffer;
+	UINT64  Reset;
+} DEADWING_STATS_PAYLOAD, *PDEADWING_STATS_PAYLOAD;
+
+typedef struct _DEADWING_PROFILE_PAYLOAD {
+	UINT64  SampleCount;
+} DEADWING_PROFILE_PAYLOAD, *PDEADWING_PROFILE_PAYLOAD;
+
+typedef struct _DEADWING_REGISTERS_PAYLOAD {
+	VOID   *Buffer;
+	UINT64  MaxCpus;
+	UINT64  CpuCount;
+} DEADWING_REGISTERS_PAYLOAD, *PDEADWING_REGISTERS_PAYLOAD;
+
+typedef struct _DEADWING_RING_PAYLOAD {
+	VOID   *Address;
+	UINT64  Completed;
+} DEADWING_RING_PAYLOAD, *PDEADWING_RING_PAYLOAD;
+
+typedef struct _DEADWING_DOORBELL_PAYLOAD {
+	VOID   *Channels;
+	UINT64  ChannelCount;
+	UINT64  ChannelSize;
+	UINT64  CommSize;
+	UINT64  SwSmiValue;
+} DEADWING_DOORBELL_PAYLOAD, *PDEADWING_DOORBELL_PAYLOAD;
+
+// UEFI memory map is placed by the DXE driver in the inline data region of the packet
+typedef struct _DEADWING_SET_MEMORY_MAP_PAYLOAD {
+	UINT64  MapSize;
+	UINT64  DescriptorSize;
+	UINT64  RangeCount;
+} DEADWING_SET_MEMORY_MAP_PAYLOAD, *PDEADWING_SET_MEMORY_MAP_PAYLOAD;
+
+typedef struct _DEADWING_MEMORY_MAP_PAYLOAD {
+	VOID   *Ranges;
+	UINT64  MaxRanges;
+	UINT64  RangeCount;
+} DEADWING_MEMORY_MAP_PAYLOAD, *PDEADWING_MEMORY_MAP_PAYLOAD;
+
+// RSDP is taken by the DXE driver from the configuration table of the system table
+typedef struct _DEADWING_RSDP_PAYLOAD {
+	UINT64  Address;
+} DEADWING_RSDP_PAYLOAD, *PDEADWING_RSDP_PAYLOAD;
+
+// signature 0 enumerates every indexed table, instance is the position in the index then
+typedef struct _DEADWING_ACPI_PAYLOAD {
+	UINT32  Signature;
+	UINT32  Instance;
+	VOID   *Buffer;
+	UINT64  MaxLength;
+	UINT64  Address;
+	UINT64  Length;
+} DEADWING_ACPI_PAYLOAD, *PDEADWING_ACPI_PAYLOAD;
+
+// view of any payload. It's never sent as is: length of the command covers only its own payload
+typedef union _DEADWING_PAYLOAD {
+	DEADWING_READ_PAYLOAD            Read;
+	DEADWING_WRITE_PAYLOAD           Write;
+	DEADWING_CACHE_PAYLOAD           Cache;
+	DEADWING_VTOP_PAYLOAD            Vtop;
+	DEADWING_HASH_PAYLOAD            Hash;
+	DEADWING_SCAN_PAYLOAD            Scan;
+	DEADWING_SPARSE_PAYLOAD          Sparse;
+	DEADWING_TRACK_PAYLOAD           Track;
+	DEADWING_CHANGES_PAYLOAD         Changes;
+	DEADWING_HARVEST_PAYLOAD         Harvest;
+	DEADWING_MONITOR_START_PAYLOAD   MonitorStart;
+	DEADWING_MONITOR_SAMPLE_PAYLOAD  MonitorSample;
+	DEADWING_ENTROPY_PAYLOAD         Entropy;
+	DEADWING_DRAIN_PAYLOAD           Drain;
+	DEADWING_STATS_PAYLOAD           Stats;
+	DEADWING_PROFILE_PAYLOAD         Profile;
+	DEADWING_REGISTERS_PAYLOAD       Registers;
+	DEADWING_RING_PAYLOAD            Ring;
+	DEADWING_DOORBELL_PAYLOAD        Doorbell;
+	DEADWING_SET_MEMORY_MAP_PAYLOAD  SetMemoryMap;
+	DEADWING_MEMORY_MAP_PAYLOAD      MemoryMap;
+	DEADWING_RSDP_PAYLOAD            Rsdp;
+	DEADWING_ACPI_PAYLOAD            Acpi;
+} DEADWING_PAYLOAD, *PDEADWING_PAYLOAD;
+
+// length of the command with payload of the given size
+#define DEADWING_COMMAND_LENGTH(PayloadSize) \
+	((UINT32)((sizeof(DEADWING_COMMAND) + (PayloadSize) + DEADWING_COMMAND_ALIGNMENT - 1) & ~(DEADWING_COMMAND_ALIGNMENT - 1)))
+
+// first command of the packet, payload of the command and the command which follows it
+#define DEADWING_PACKET_COMMANDS(Packet)   ((PDEADWING_COMMAND)((PDEADWING_PACKET)(Packet) + 1))
+#define DEADWING_COMMAND_PAYLOAD(Command)  ((PDEADWING_PAYLOAD)((PDEADWING_COMMAND)(Command) + 1))
+#define DEADWING_COMMAND_NEXT(Command)     ((PDEADWING_COMMAND)((UINT8 *)(Command) + (Command)->Length))
+
+// command queued by the KM driver in the submission ring. Cursor keeps progress of the partially performed command
+typedef struct _DEADWING_RING_SUBMISSION {
+	UINT64  UserData;
+	UINT32  Command;
+	UINT32  Reserved;
+	UINT64  ProcessId;
+	UINT64  Args[3];
+	UINT64  Cursor;
+} DEADWING_RING_SUBMISSION, *PDEADWING_RING_SUBMISSION;
+
+// status of the command posted by SMI handler to the completion ring, value is a result of the command (if any)
+typedef struct _DEADWING_RING_COMPLETION {
+	UINT64      UserData;
+	EFI_STATUS  Status;
+	UINT64      Value;
+} DEADWING_RING_COMPLETION, *PDEADWING_RING_COMPLETION;
+
+// header of the submission and completion rings, entries of both rings follow it. Indices
+// are free running: producer advances the tail and consumer advances the head of the ring
+typedef struct _DEADWING_RING {
+	UINT64  SqHead;
+	UINT64  SqTail;
+	UINT64  CqHead;
+	UINT64  CqTail;
+	UINT64  SqEntries;
+	UINT64  CqEntries;
+} DEADWING_RING, *PDEADWING_RING;
+
+// layout of the communication buffer, passed by the DXE driver to the KM driver through the runtime variable
+typedef struct _DEADWING_TRANSFER {
+	struct {
+		VOID   *CommBufVirtual;
+		VOID   *CommBufPhys;
+		UINT64  CommBufSize;
+		UINT64  DataOffset;
+		UINT64  DataSize;
+		UINT64  ChannelCount;
+		UINT64  ChannelSize;
+	} Buffer;
+
+	struct {
+		UINT64  Offset;
+		UINT64  Size;
+		UINT64  SqOffset;
+		UINT64  SqEntries;
+		UINT64  CqOffset;
+		UINT64  CqEntries;
+	} Ring;
+
+	struct {
+		UINT64  CommandPort;
+		UINT64  DataPort;
+		UINT64  SwSmiValue;
+	} Doorbell;
+
+	struct {
+		VOID   *AcquirePacketFunction;
+		VOID   *SubmitPacketFunction;
+	} API;
+} DEADWING_TRANSFER, *PDEADWING_TRANSFER;
@@ -0,0 +1,145 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "Log.h"
+#include "Acpi.h"
+
+// tables are indexed once, in order of the root table. DSDT and FACS follow FADT
+STATIC DEADWING_ACPI_TABLE gAcpiTables[DEADWING_ACPI_MAX_TABLES];
+STATIC UINTN gAcpiTableCount;
+STATIC BOOLEAN gAcpiIndexed;
+
+// RSDP of the configuration table, passed by the DXE driver at boot
+STATIC UINT64 gAcpiRsdp;
+
+
+/**
+ * \brief Checks if index of ACPI tables has been built
+ * 
+ * \return TRUE - Index is built
+ * \return FALSE - Index should be built
+ */
+BOOLEAN
+EFIAPI
+AcpiIsIndexed(
+	VOID
+) {
+	return gAcpiIndexed;
+}
+
+/**
+ * \brief Adds table to the index. Table referenced several times is indexed once
+ * 
+ * \param Signature Signature of the table
+ * \param Address   Physical address of the table
+ * \param Length    Length of the table
+ * 
+ * \return EFI_SUCCESS - Table has been added (or it's already indexed)
+ * \return EFI_OUT_OF_RESOURCES - Index is full
+ */
+EFI_STATUS
+EFIAPI
+AcpiAddTable(
+	IN UINT32 Signature,
+	IN UINT64 Address,
+	IN UINT64 Length
+) {
+	for(UINTN i = 0; i < gAcpiTableCount; i++) {
+		if(gAcpiTables[i].Address == Address)
+			return EFI_SUCCESS;
+	}
+
+	if(gAcpiTableCount == DEADWING_ACPI_MAX_TABLES) {
+		LOG_ERROR("[ SMM ] Index of ACPI tables is full\r\n");
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	gAcpiTables[gAcpiTableCount].Signature = Signature;
+	gAcpiTables[gAcpiTableCount].Reserved = 0;
+	gAcpiTables[gAcpiTableCount].Address = Address;
+	gAcpiTables[gAcpiTableCount].Length = Length;
+	gAcpiTableCount++;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Saves address of RSDP taken from the configuration table. Address is accepted only once
+ * 
+ * \param Address Physical address of RSDP
+ * 
+ * \return EFI_SUCCESS - Address has been saved
+ * \return EFI_ALREADY_STARTED - Address has been saved before
+ * \return EFI_INVALID_PARAMETER - Address is 0
+ */
+EFI_STATUS
+EFIAPI
+AcpiSetRsdp(
+	IN UINT64 Address
+) {
+	if(gAcpiRsdp != 0)
+		return EFI_ALREADY_STARTED;
+
+	if(Address == 0)
+		return EFI_INVALID_PARAMETER;
+
+	gAcpiRsdp = Address;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Returns address of RSDP passed by the DXE driver
+ * 
+ * \returns Physical address of RSDP, 0 if it hasn't been passed
+ */
+UINT64
+EFIAPI
+AcpiGetRsdp(
+	VOID
+) {
+	return gAcpiRsdp;
+}
+
+/**
+ * \brief Marks index as built, tables aren't looked up anymore
+ */
+VOID
+EFIAPI
+AcpiCompleteIndex(
+	VOID
+) {
+	gAcpiIndexed = TRUE;
+
+	LOG_INFO("[ SMM ] ACPI tables have been indexed\r\n");
+}
+
+/**
+ * \brief Finds indexed table
+ * 
+ * \param Signature Signature of the table or 0 to enumerate all tables
+ * \param Instance  Index of the table among tables with the same signature (SSDTs)
+ * 
+ * \returns Entry of the index or NULL, if there is no such table
+ */
+CONST DEADWING_ACPI_TABLE *
+EFIAPI
+AcpiFindTable(
+	IN UINT32 Signature,
+	IN UINTN  Instance
+) {
+	for(UINTN i = 0; i < gAcpiTableCount; i++) {
+		if(Signature != 0 && gAcpiTables[i].Signature != Signature)
+			continue;
+
+		if(Instance == 0)
+			return &gAcpiTables[i];
+
+		Instance--;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Conf.h"
+#include "Defs.h"
+
+BOOLEAN
+EFIAPI
+AcpiIsIndexed(
+	VOID
+);
+
+EFI_STATUS
+EFIAPI
+AcpiAddTable(
+	IN UINT32 Signature,
+	IN UINT64 Address,
+	IN UINT64 Length
+);
+
+EFI_STATUS
+EFIAPI
+AcpiSetRsdp(
+	IN UINT64 Address
+);
+
+UINT64
+EFIAPI
+AcpiGetRsdp(
+	VOID
+);
+
+VOID
+EFIAPI
+AcpiCompleteIndex(
+	VOID
+);
+
+CONST DEADWING_ACPI_TABLE *
+EFIAPI
+AcpiFindTable(
+	IN UINT32 Signature,
+	IN UINTN  Instance
+);
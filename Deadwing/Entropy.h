@@ -0,0 +1,9 @@
+#pragma once
+
+#include "Defs.h"
+
+UINT8
+EFIAPI
+EntropyClassifyPage(
+	IN CONST VOID *Page
+);
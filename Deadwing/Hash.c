@@ -0,0 +1,358 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "Hash.h"
+
+#define XXH64_PRIME_1 0x9E3779B185EBCA87ULL
+#define XXH64_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define XXH64_PRIME_3 0x165667B19E3779F9ULL
+#define XXH64_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define XXH64_PRIME_5 0x27D4EB2F165667C5ULL
+
+#define SHA256_ROTR(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA256_CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define SHA256_MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define SHA256_EP0(x)      (SHA256_ROTR(x, 2) ^ SHA256_ROTR(x, 13) ^ SHA256_ROTR(x, 22))
+#define SHA256_EP1(x)      (SHA256_ROTR(x, 6) ^ SHA256_ROTR(x, 11) ^ SHA256_ROTR(x, 25))
+#define SHA256_SIG0(x)     (SHA256_ROTR(x, 7) ^ SHA256_ROTR(x, 18) ^ ((x) >> 3))
+#define SHA256_SIG1(x)     (SHA256_ROTR(x, 17) ^ SHA256_ROTR(x, 19) ^ ((x) >> 10))
+
+STATIC CONST UINT32 gSha256K[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+
+/**
+ * \brief Returns size of the digest produced by algorithm
+ * 
+ * \param Algorithm Hash algorithm
+ * 
+ * \returns Size of digest in bytes, 0 if algorithm is not supported
+ */
+UINTN
+EFIAPI
+HashGetDigestSize(
+	IN UINT32 Algorithm
+) {
+	switch(Algorithm) {
+		case DEADWING_HASH_XXH64:
+			return sizeof(UINT64);
+		case DEADWING_HASH_SHA256:
+			return 32;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * \brief Single xxHash64 round
+ * 
+ * \param Acc   Accumulator
+ * \param Input Input lane
+ * 
+ * \returns Updated accumulator
+ */
+STATIC
+UINT64
+Xxh64Round(
+	IN UINT64 Acc,
+	IN UINT64 Input
+) {
+	Acc += Input * XXH64_PRIME_2;
+	Acc = LRotU64(Acc, 31);
+
+	return Acc * XXH64_PRIME_1;
+}
+
+/**
+ * \brief Merges accumulator into the final xxHash64 value
+ * 
+ * \param Hash Current value
+ * \param Acc  Accumulator
+ * 
+ * \returns Updated value
+ */
+STATIC
+UINT64
+Xxh64MergeRound(
+	IN UINT64 Hash,
+	IN UINT64 Acc
+) {
+	Hash ^= Xxh64Round(0, Acc);
+
+	return Hash * XXH64_PRIME_1 + XXH64_PRIME_4;
+}
+
+/**
+ * \brief Processes one 32-byte xxHash64 stripe
+ * 
+ * \param Ctx    Hash context
+ * \param Stripe Input stripe
+ */
+STATIC
+VOID
+Xxh64Stripe(
+	IN OUT PDEADWING_HASH_CONTEXT  Ctx,
+	IN     CONST UINT8            *Stripe
+) {
+	for(UINTN i = 0; i < 4; i++)
+		Ctx->Xxh64.Acc[i] = Xxh64Round(Ctx->Xxh64.Acc[i], ReadUnaligned64((CONST UINT64 *)(Stripe + i * sizeof(UINT64))));
+}
+
+/**
+ * \brief Processes one 64-byte SHA-256 block
+ * 
+ * \param Ctx   Hash context
+ * \param Block Input block
+ */
+STATIC
+VOID
+Sha256Block(
+	IN OUT PDEADWING_HASH_CONTEXT  Ctx,
+	IN     CONST UINT8            *Block
+) {
+	UINT32 W[64];
+	for(UINTN i = 0; i < 16; i++)
+		W[i] = ((UINT32)Block[i * 4] << 24) | ((UINT32)Block[i * 4 + 1] << 16) | ((UINT32)Block[i * 4 + 2] << 8) | Block[i * 4 + 3];
+
+	for(UINTN i = 16; i < 64; i++)
+		W[i] = SHA256_SIG1(W[i - 2]) + W[i - 7] + SHA256_SIG0(W[i - 15]) + W[i - 16];
+
+	UINT32 A = Ctx->Sha256.State[0];
+	UINT32 B = Ctx->Sha256.State[1];
+	UINT32 C = Ctx->Sha256.State[2];
+	UINT32 D = Ctx->Sha256.State[3];
+	UINT32 E = Ctx->Sha256.State[4];
+	UINT32 F = Ctx->Sha256.State[5];
+	UINT32 G = Ctx->Sha256.State[6];
+	UINT32 H = Ctx->Sha256.State[7];
+
+	for(UINTN i = 0; i < 64; i++) {
+		UINT32 T1 = H + SHA256_EP1(E) + SHA256_CH(E, F, G) + gSha256K[i] + W[i];
+		UINT32 T2 = SHA256_EP0(A) + SHA256_MAJ(A, B, C);
+
+		H = G;
+		G = F;
+		F = E;
+		E = D + T1;
+		D = C;
+		C = B;
+		B = A;
+		A = T1 + T2;
+	}
+
+	Ctx->Sha256.State[0] += A;
+	Ctx->Sha256.State[1] += B;
+	Ctx->Sha256.State[2] += C;
+	Ctx->Sha256.State[3] += D;
+	Ctx->Sha256.State[4] += E;
+	Ctx->Sha256.State[5] += F;
+	Ctx->Sha256.State[6] += G;
+	Ctx->Sha256.State[7] += H;
+}
+
+/**
+ * \brief Initializes hash context
+ * 
+ * \param Ctx       Hash context
+ * \param Algorithm Hash algorithm
+ */
+VOID
+EFIAPI
+HashInit(
+	OUT PDEADWING_HASH_CONTEXT Ctx,
+	IN  UINT32                 Algorithm
+) {
+	ZeroMem(Ctx, sizeof(DEADWING_HASH_CONTEXT));
+	Ctx->Algorithm = Algorithm;
+
+	if(Algorithm == DEADWING_HASH_XXH64) {
+		// seed is always zero
+		Ctx->Xxh64.Acc[0] = XXH64_PRIME_1 + XXH64_PRIME_2;
+		Ctx->Xxh64.Acc[1] = XXH64_PRIME_2;
+		Ctx->Xxh64.Acc[2] = 0;
+		Ctx->Xxh64.Acc[3] = 0 - XXH64_PRIME_1;
+	} else if(Algorithm == DEADWING_HASH_SHA256) {
+		Ctx->Sha256.State[0] = 0x6A09E667;
+		Ctx->Sha256.State[1] = 0xBB67AE85;
+		Ctx->Sha256.State[2] = 0x3C6EF372;
+		Ctx->Sha256.State[3] = 0xA54FF53A;
+		Ctx->Sha256.State[4] = 0x510E527F;
+		Ctx->Sha256.State[5] = 0x9B05688C;
+		Ctx->Sha256.State[6] = 0x1F83D9AB;
+		Ctx->Sha256.State[7] = 0x5BE0CD19;
+	}
+}
+
+/**
+ * \brief Feeds data into the hash context
+ * 
+ * \param Ctx    Hash context
+ * \param Data   Data to hash
+ * \param Length Length of data
+ */
+VOID
+EFIAPI
+HashUpdate(
+	IN OUT PDEADWING_HASH_CONTEXT  Ctx,
+	IN     CONST VOID             *Data,
+	IN     UINTN                   Length
+) {
+	CONST UINT8 *Input = (CONST UINT8 *)Data;
+
+	if(Ctx->Algorithm == DEADWING_HASH_XXH64) {
+		Ctx->Xxh64.TotalLength += Length;
+
+		// fill pending stripe first
+		if(Ctx->Xxh64.BufferSize != 0) {
+			UINTN Fill = MIN(Length, sizeof(Ctx->Xxh64.Buffer) - Ctx->Xxh64.BufferSize);
+			CopyMem(Ctx->Xxh64.Buffer + Ctx->Xxh64.BufferSize, Input, Fill);
+
+			Ctx->Xxh64.BufferSize += (UINT32)Fill;
+			Input += Fill;
+			Length -= Fill;
+
+			if(Ctx->Xxh64.BufferSize < sizeof(Ctx->Xxh64.Buffer))
+				return;
+
+			Xxh64Stripe(Ctx, Ctx->Xxh64.Buffer);
+			Ctx->Xxh64.BufferSize = 0;
+		}
+
+		for(; Length >= sizeof(Ctx->Xxh64.Buffer); Input += sizeof(Ctx->Xxh64.Buffer), Length -= sizeof(Ctx->Xxh64.Buffer))
+			Xxh64Stripe(Ctx, Input);
+
+		CopyMem(Ctx->Xxh64.Buffer, Input, Length);
+		Ctx->Xxh64.BufferSize = (UINT32)Length;
+	} else if(Ctx->Algorithm == DEADWING_HASH_SHA256) {
+		Ctx->Sha256.TotalLength += Length;
+
+		if(Ctx->Sha256.BufferSize != 0) {
+			UINTN Fill = MIN(Length, sizeof(Ctx->Sha256.Buffer) - Ctx->Sha256.BufferSize);
+			CopyMem(Ctx->Sha256.Buffer + Ctx->Sha256.BufferSize, Input, Fill);
+
+			Ctx->Sha256.BufferSize += (UINT32)Fill;
+			Input += Fill;
+			Length -= Fill;
+
+			if(Ctx->Sha256.BufferSize < sizeof(Ctx->Sha256.Buffer))
+				return;
+
+			Sha256Block(Ctx, Ctx->Sha256.Buffer);
+			Ctx->Sha256.BufferSize = 0;
+		}
+
+		for(; Length >= sizeof(Ctx->Sha256.Buffer); Input += sizeof(Ctx->Sha256.Buffer), Length -= sizeof(Ctx->Sha256.Buffer))
+			Sha256Block(Ctx, Input);
+
+		CopyMem(Ctx->Sha256.Buffer, Input, Length);
+		Ctx->Sha256.BufferSize = (UINT32)Length;
+	}
+}
+
+/**
+ * \brief Finalizes hash and stores digest. xxHash64 digest is stored
+ * in little-endian order, SHA-256 digest - in canonical big-endian order
+ * 
+ * \param Ctx    Hash context
+ * \param Digest Output digest, HashGetDigestSize bytes
+ */
+VOID
+EFIAPI
+HashFinal(
+	IN OUT PDEADWING_HASH_CONTEXT  Ctx,
+	OUT    UINT8                  *Digest
+) {
+	if(Ctx->Algorithm == DEADWING_HASH_XXH64) {
+		UINT64 Hash;
+		if(Ctx->Xxh64.TotalLength >= sizeof(Ctx->Xxh64.Buffer)) {
+			Hash = LRotU64(Ctx->Xxh64.Acc[0], 1) + LRotU64(Ctx->Xxh64.Acc[1], 7) + LRotU64(Ctx->Xxh64.Acc[2], 12) + LRotU64(Ctx->Xxh64.Acc[3], 18);
+
+			for(UINTN i = 0; i < 4; i++)
+				Hash = Xxh64MergeRound(Hash, Ctx->Xxh64.Acc[i]);
+		} else {
+			Hash = XXH64_PRIME_5;
+		}
+
+		Hash += Ctx->Xxh64.TotalLength;
+
+		// consume tail
+		CONST UINT8 *Tail = Ctx->Xxh64.Buffer;
+		UINTN Left = Ctx->Xxh64.BufferSize;
+		for(; Left >= sizeof(UINT64); Tail += sizeof(UINT64), Left -= sizeof(UINT64)) {
+			Hash ^= Xxh64Round(0, ReadUnaligned64((CONST UINT64 *)Tail));
+			Hash = LRotU64(Hash, 27) * XXH64_PRIME_1 + XXH64_PRIME_4;
+		}
+
+		if(Left >= sizeof(UINT32)) {
+			Hash ^= (UINT64)ReadUnaligned32((CONST UINT32 *)Tail) * XXH64_PRIME_1;
+			Hash = LRotU64(Hash, 23) * XXH64_PRIME_2 + XXH64_PRIME_3;
+			Tail += sizeof(UINT32);
+			Left -= sizeof(UINT32);
+		}
+
+		for(; Left; Tail++, Left--) {
+			Hash ^= *Tail * XXH64_PRIME_5;
+			Hash = LRotU64(Hash, 11) * XXH64_PRIME_1;
+		}
+
+		// avalanche
+		Hash ^= Hash >> 33;
+		Hash *= XXH64_PRIME_2;
+		Hash ^= Hash >> 29;
+		Hash *= XXH64_PRIME_3;
+		Hash ^= Hash >> 32;
+
+		WriteUnaligned64((UINT64 *)Digest, Hash);
+	} else if(Ctx->Algorithm == DEADWING_HASH_SHA256) {
+		UINT64 Bits = Ctx->Sha256.TotalLength * 8;
+
+		// pad message: 0x80, zeroes and length in bits
+		UINT8 Pad[72] = { 0x80 };
+		UINTN PadLength = (Ctx->Sha256.BufferSize < 56) ? (56 - Ctx->Sha256.BufferSize) : (120 - Ctx->Sha256.BufferSize);
+		for(UINTN i = 0; i < 8; i++)
+			Pad[PadLength + i] = (UINT8)(Bits >> (56 - i * 8));
+
+		HashUpdate(Ctx, Pad, PadLength + 8);
+
+		for(UINTN i = 0; i < 8; i++) {
+			Digest[i * 4] = (UINT8)(Ctx->Sha256.State[i] >> 24);
+			Digest[i * 4 + 1] = (UINT8)(Ctx->Sha256.State[i] >> 16);
+			Digest[i * 4 + 2] = (UINT8)(Ctx->Sha256.State[i] >> 8);
+			Digest[i * 4 + 3] = (UINT8)Ctx->Sha256.State[i];
+		}
+	}
+}
+
+/**
+ * \brief Hashes data in one go
+ * 
+ * \param Algorithm Hash algorithm
+ * \param Data      Data to hash
+ * \param Length    Length of data
+ * \param Digest    Output digest, HashGetDigestSize bytes
+ */
+VOID
+EFIAPI
+HashDigest(
+	IN  UINT32      Algorithm,
+	IN  CONST VOID *Data,
+	IN  UINTN       Length,
+	OUT UINT8      *Digest
+) {
+	DEADWING_HASH_CONTEXT Ctx;
+
+	HashInit(&Ctx, Algorithm);
+	HashUpdate(&Ctx, Data, Length);
+	HashFinal(&Ctx, Digest);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#define DEADWING_HASH_XXH64            1
+#define DEADWING_HASH_SHA256           2
+
+#define DEADWING_HASH_MAX_DIGEST_SIZE  32
+
+typedef struct _DEADWING_HASH_CONTEXT {
+	UINT32 Algorithm;
+
+	union {
+		struct {
+			UINT64 Acc[4];
+			UINT64 TotalLength;
+			UINT8  Buffer[32];
+			UINT32 BufferSize;
+		} Xxh64;
+
+		struct {
+			UINT32 State[8];
+			UINT64 TotalLength;
+			UINT8  Buffer[64];
+			UINT32 BufferSize;
+		} Sha256;
+	};
+} DEADWING_HASH_CONTEXT, *PDEADWING_HASH_CONTEXT;
+
+UINTN
+EFIAPI
+HashGetDigestSize(
+	IN UINT32 Algorithm
+);
+
+VOID
+EFIAPI
+HashInit(
+	OUT PDEADWING_HASH_CONTEXT Ctx,
+	IN  UINT32                 Algorithm
+);
+
+VOID
+EFIAPI
+HashUpdate(
+	IN OUT PDEADWING_HASH_CONTEXT  Ctx,
+	IN     CONST VOID             *Data,
+	IN     UINTN                   Length
+);
+
+VOID
+EFIAPI
+HashFinal(
+	IN OUT PDEADWING_HASH_CONTEXT  Ctx,
+	OUT    UINT8                  *Digest
+);
+
+VOID
+EFIAPI
+HashDigest(
+	IN  UINT32      Algorithm,
+	IN  CONST VOID *Data,
+	IN  UINTN       Length,
+	OUT UINT8      *Digest
+);
@@ -0,0 +1,117 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/SynchronizationLib.h>
+
+#include "Journal.h"
+
+// capacity of the journal should be a power of two
+#define JOURNAL_SLOT(Journal, Sequence) ((UINTN)(Sequence) & ((Journal)->Capacity - 1))
+
+
+/**
+ * \brief Reserves slot for the next record, oldest record is overwritten if journal is full.
+ * 
+ * Record isn't visible to the reader until it's committed. Lock-free, can be called on any CPU
+ * 
+ * \param Journal  Journal
+ * \param Sequence Receives sequence number of the record, it should be passed to JournalCommit
+ * 
+ * \returns Record which should be filled
+ */
+VOID *
+EFIAPI
+JournalReserve(
+	IN  PDEADWING_JOURNAL  Journal,
+	OUT UINT64            *Sequence
+) {
+	UINT64 Head;
+	do {
+		Head = Journal->Head;
+	} while(InterlockedCompareExchange64(&Journal->Head, Head, Head + 1) != Head);
+
+	UINTN Slot = JOURNAL_SLOT(Journal, Head);
+	Journal->Sequences[Slot] = 0;
+	MemoryFence();
+
+	*Sequence = Head;
+
+	return (UINT8 *)Journal->Records + Slot * Journal->RecordSize;
+}
+
+/**
+ * \brief Commits record filled after JournalReserve. Sequence number is written last
+ * 
+ * \param Journal  Journal
+ * \param Sequence Sequence number of the record
+ */
+VOID
+EFIAPI
+JournalCommit(
+	IN PDEADWING_JOURNAL Journal,
+	IN UINT64            Sequence
+) {
+	MemoryFence();
+	Journal->Sequences[JOURNAL_SLOT(Journal, Sequence)] = Sequence + 1;
+}
+
+/**
+ * \brief Copies oldest records of the journal which haven't been consumed yet.
+ * 
+ * Copy stops at the first record which is still being written by another CPU
+ * 
+ * \param Journal    Journal
+ * \param Records    Buffer which receives records
+ * \param MaxRecords Capacity of the buffer
+ * \param Dropped    Count of records overwritten before they have been read
+ * 
+ * \returns Count of copied records
+ */
+UINTN
+EFIAPI
+JournalRead(
+	IN  PDEADWING_JOURNAL  Journal,
+	OUT VOID              *Records,
+	IN  UINTN              MaxRecords,
+	OUT UINT64            *Dropped
+) {
+	UINT64 Head = Journal->Head;
+
+	// records behind the journal are lost
+	*Dropped = 0;
+	if(Head - Journal->Tail > Journal->Capacity) {
+		*Dropped = Head - Journal->Capacity - Journal->Tail;
+		Journal->Tail = Head - Journal->Capacity;
+	}
+
+	UINTN Count = 0;
+	while(Count < MaxRecords && Journal->Tail + Count < Head) {
+		UINT64 Sequence = Journal->Tail + Count;
+		UINTN Slot = JOURNAL_SLOT(Journal, Sequence);
+
+		if(Journal->Sequences[Slot] != Sequence + 1)
+			break;
+
+		CopyMem((UINT8 *)Records + Count * Journal->RecordSize, (UINT8 *)Journal->Records + Slot * Journal->RecordSize, Journal->RecordSize);
+		Count++;
+	}
+
+	return Count;
+}
+
+/**
+ * \brief Marks records returned by JournalRead as consumed
+ * 
+ * \param Journal Journal
+ * \param Count   Count of consumed records
+ */
+VOID
+EFIAPI
+JournalConsume(
+	IN PDEADWING_JOURNAL Journal,
+	IN UINTN             Count
+) {
+	Journal->Tail += Count;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Conf.h"
+#include "Defs.h"
+
+VOID *
+EFIAPI
+JournalReserve(
+	IN  PDEADWING_JOURNAL  Journal,
+	OUT UINT64            *Sequence
+);
+
+VOID
+EFIAPI
+JournalCommit(
+	IN PDEADWING_JOURNAL Journal,
+	IN UINT64            Sequence
+);
+
+UINTN
+EFIAPI
+JournalRead(
+	IN  PDEADWING_JOURNAL  Journal,
+	OUT VOID              *Records,
+	IN  UINTN              MaxRecords,
+	OUT UINT64            *Dropped
+);
+
+VOID
+EFIAPI
+JournalConsume(
+	IN PDEADWING_JOURNAL Journal,
+	IN UINTN             Count
+);
@@ -0,0 +1,66 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "Serial.h"
+#include "Journal.h"
+#include "Log.h"
+
+STATIC DEADWING_LOG_RECORD gLogRecords[DEADWING_LOG_RECORDS];
+STATIC volatile UINT64 gLogSequences[DEADWING_LOG_RECORDS];
+STATIC DEADWING_JOURNAL gLog = { gLogRecords, gLogSequences, sizeof(DEADWING_LOG_RECORD), DEADWING_LOG_RECORDS, 0, 0 };
+
+
+/**
+ * \brief Appends message to the log, oldest record is overwritten if log is full.
+ * 
+ * Lock-free, can be called on any CPU, including APs running MP workers
+ * 
+ * \param Level   Level of the message
+ * \param Message Message to append, truncated if it doesn't fit the record
+ */
+VOID
+EFIAPI
+LogWrite(
+	IN UINT32       Level,
+	IN CONST CHAR8 *Message
+) {
+	if(Message == NULL)
+		return;
+
+#ifdef DEADWING_LOG_SERIAL
+	SerialPrint(Message);
+#endif
+
+	UINT64 Sequence;
+	PDEADWING_LOG_RECORD Record = (PDEADWING_LOG_RECORD)JournalReserve(&gLog, &Sequence);
+
+	UINT32 Length = 0;
+	while(Length < DEADWING_LOG_MESSAGE_LENGTH - 1 && Message[Length] != '\0') {
+		Record->Message[Length] = Message[Length];
+		Length++;
+	}
+
+	Record->Message[Length] = '\0';
+	Record->Length = Length;
+	Record->Level = Level;
+	Record->Tsc = AsmReadTsc();
+	Record->Sequence = Sequence + 1;
+
+	JournalCommit(&gLog, Sequence);
+}
+
+/**
+ * \brief Returns journal of the log, records are drained by the controller
+ * 
+ * \returns Journal of DEADWING_LOG_RECORD
+ */
+PDEADWING_JOURNAL
+EFIAPI
+LogGetJournal(
+	VOID
+) {
+	return &gLog;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Conf.h"
+#include "Defs.h"
+
+VOID
+EFIAPI
+LogWrite(
+	IN UINT32       Level,
+	IN CONST CHAR8 *Message
+);
+
+PDEADWING_JOURNAL
+EFIAPI
+LogGetJournal(
+	VOID
+);
+
+#if DEADWING_LOG_LEVEL >= DEADWING_LOG_LEVEL_ERROR
+#define LOG_ERROR(Message) LogWrite(DEADWING_LOG_LEVEL_ERROR, Message)
+#else
+#define LOG_ERROR(Message) ((VOID)0)
+#endif
+
+#if DEADWING_LOG_LEVEL >= DEADWING_LOG_LEVEL_INFO
+#define LOG_INFO(Message)  LogWrite(DEADWING_LOG_LEVEL_INFO, Message)
+#else
+#define LOG_INFO(Message)  ((VOID)0)
+#endif
+
+#if DEADWING_LOG_LEVEL >= DEADWING_LOG_LEVEL_DEBUG
+#define LOG_DEBUG(Message) LogWrite(DEADWING_LOG_LEVEL_DEBUG, Message)
+#else
+#define LOG_DEBUG(Message) ((VOID)0)
+#endif
@@ -6,7 +6,10 @@
 #include "Globals.h"
 #include "PML4.h"
 #include "Defs.h"
-#include "Serial.h"
+#include "Log.h"
+#include "Trace.h"
+#include "Stats.h"
+#include "Memory.h"
 
 
 #define CR0_WP    BIT16
@@ -21,6 +24,19 @@
 
 #define IA32_AMD64_EFER 0xC0000080
 
+// page table of the last translation of every remap window, valid until the next SMI
+typedef struct _DEADWING_WALK_CACHE {
+	UINT64 Window;
+	UINT64 Epoch;
+	UINT64 Dir;
+	UINT64 Tag;
+	UINT64 PageTable;
+} DEADWING_WALK_CACHE, *PDEADWING_WALK_CACHE;
+
+STATIC DEADWING_WALK_CACHE gWalkCache[DEADWING_MP_MAX_CPUS + 1];
+STATIC UINTN gWalkCacheCount;
+STATIC UINT64 gWalkEpoch = 1;
+
 
 /**
  * \brief Copies information from source address to destination address
@@ -56,7 +72,7 @@ MemCheckPagingEnabled(
 	// check if PG bit is not set
 	UINT64 Cr0 = AsmReadCr0();
 	if(!(Cr0 & CR0_PG)) {
-		SerialPrint("[ SMM ] PG bit is not enabled\r\n");
+		LOG_ERROR("[ SMM ] PG bit is not enabled\r\n");
 		return FALSE;
 	}
 
@@ -69,7 +85,7 @@ MemCheckPagingEnabled(
 		// check if PSE set. If it's 1, halt next operations, because
 		// we're not working with 4MB pages
 		if(Cr4 & CR4_PSE) {
-			SerialPrint("[ SMM ] 4MB pages enabled, exiting from translation process\r\n");
+			LOG_ERROR("[ SMM ] 4MB pages enabled, exiting from translation process\r\n");
 			return FALSE;
 		}
 	}
@@ -77,7 +93,7 @@ MemCheckPagingEnabled(
 	// read EFER MSR to check if LMA set
 	UINT64 Efer = AsmReadMsr64(IA32_AMD64_EFER);
 	if(!(Efer & EFER_LMA)) {
-		SerialPrint("[ SMM ] LMA bit is not set\r\n");
+		LOG_ERROR("[ SMM ] LMA bit is not set\r\n");
 		return FALSE;
 	}
 
@@ -136,7 +152,9 @@ MemRemapAddress(
 
 			AsmWriteCr0(Cr0);
 
-			CpuFlushTlb(); 
+			CpuFlushTlb();
+			STATS_INC(Remaps);
+			STATS_INC(TlbFlushes);
 			
 			return TRUE;
 		}
@@ -161,6 +179,8 @@ MemRemapAddress(
 			AsmWriteCr0(Cr0);
 			
 			CpuFlushTlb();
+			STATS_INC(Remaps);
+			STATS_INC(TlbFlushes);
 
 			return TRUE;
 		}
@@ -183,6 +203,8 @@ MemRemapAddress(
 		AsmWriteCr0(Cr0);
 
 		CpuFlushTlb();
+		STATS_INC(Remaps);
+		STATS_INC(TlbFlushes);
 
 		return TRUE;
 	}
@@ -190,6 +212,54 @@ MemRemapAddress(
 	return FALSE;
 }
 
+/**
+ * \brief Checks if address is mapped by SMM page tables with its own 4KB PTE. Remapping
+ * of such address doesn't change translation of any other page
+ * 
+ * \param Address SMRAM address
+ * 
+ * \return TRUE - Address is mapped by 4KB page
+ * \return FALSE - Address is mapped by 2MB or 1GB page, or it isn't mapped at all
+ */
+BOOLEAN
+EFIAPI
+MemIsMappedBy4KbPage(
+	IN UINT64 Address
+) {
+	UINT64 SmmDir = AsmReadCr3() & 0xFFFFFFFFFFFFF000ULL;
+
+	PML4E Pml4;
+	Pml4.Value = *(UINT64 *)(sizeof(UINT64) * ((Address >> 39) & 0x1FF) + SmmDir);
+	if(!Pml4.Bits.Present)
+		return FALSE;
+
+	PPDPE Pdpe = (PPDPE)((Pml4.Bits.Pfn << EFI_PAGE_SHIFT) + ((Address >> 30) & 0x1FF) * sizeof(UINT64));
+	if(!Pdpe->Bits.Present || Pdpe->Bits.Size)
+		return FALSE;
+
+	PPDE Pde = (PPDE)((Pdpe->Bits.Pfn << EFI_PAGE_SHIFT) + ((Address >> 21) & 0x1FF) * sizeof(UINT64));
+	if(!Pde->Bits.Present || Pde->Bits.Size)
+		return FALSE;
+
+	PPTE Pte = (PPTE)((Pde->Bits.Pfn << EFI_PAGE_SHIFT) + ((Address >> 12) & 0x1FF) * sizeof(UINT64));
+
+	return Pte->Bits.Present ? TRUE : FALSE;
+}
+
+/**
+ * \brief Restores mapping of the given remap window after memory manipulations
+ * 
+ * \param Window Remap window
+ */
+VOID
+EFIAPI
+MemRestoreSmramMappingsEx(
+	IN UINT64 Window
+) {
+	UINT64 SmmDir = AsmReadCr3() & 0xFFFFFFFFFFFFF000ULL;
+	MemRemapAddress(Window, Window, SmmDir, NULL);
+}
+
 /**
  * \brief Restores memory mapping after memory manipulations 
  */
@@ -198,167 +268,274 @@ EFIAPI
 MemRestoreSmramMappings(
 	VOID
 ) {
-	UINT64 SmmDir = AsmReadCr3() & 0xFFFFFFFFFFFFF000ULL;
-	MemRemapAddress(gRemapPage, gRemapPage, SmmDir, NULL);
+	MemRestoreSmramMappingsEx(gRemapPage);
+}
+
+
+/**
+ * \brief Registers remap window in the walk cache, called once for every window during initialization
+ * 
+ * \param Window Remap window
+ */
+VOID
+EFIAPI
+MemRegisterWindow(
+	IN UINT64 Window
+) {
+	if(gWalkCacheCount >= ARRAY_SIZE(gWalkCache))
+		return;
+
+	gWalkCache[gWalkCacheCount].Window = Window;
+	gWalkCache[gWalkCacheCount].Epoch = 0;
+	gWalkCacheCount++;
+}
+
+/**
+ * \brief Invalidates walk cache of all remap windows.
+ * 
+ * OS is stopped while we're in SMM, so paging structures don't change during the SMI
+ * unless they are written by the command itself
+ */
+VOID
+EFIAPI
+MemInvalidateWalkCache(
+	VOID
+) {
+	gWalkEpoch++;
+}
+
+/**
+ * \brief Returns walk cache of the remap window
+ * 
+ * \param Window Remap window
+ * 
+ * \returns Walk cache or NULL if window is not registered
+ */
+PDEADWING_WALK_CACHE
+EFIAPI
+MemGetWalkCache(
+	IN UINT64 Window
+) {
+	for(UINTN i = 0; i < gWalkCacheCount; i++) {
+		if(gWalkCache[i].Window == Window)
+			return &gWalkCache[i];
+	}
+
+	return NULL;
 }
 
 
 /**
  * \brief Translates virtual address to the physical by identity
- * remapping
+ * remapping through the given remap window.
+ * 
+ * Page table of the last translation is cached per window, so translation of the neighbour
+ * page within the same 2mb region takes a single remap instead of four
  * 
  * \param Address Virtual address which should be converted
  * \param Dir     Directory table base
+ * \param Window  Remap window
  * 
  * \returns Translated address or 0 if we cannot translate it
  */
 UINT64 
 EFIAPI
-MemTranslateVirtualToPhys(
+MemTranslateVirtualToPhysEx(
 	IN VOID   *Address,
-	IN UINT64  Dir
+	IN UINT64  Dir,
+	IN UINT64  Window
 ) {
 	UINT64 TargetAddress;
 	UINT64 ReadAddress;
+	UINT64 PageTable = 0;
 
 	/// \todo @0x00Alchemist: add support to LA57 platforms
 
 	Dir &= 0xFFFFFFFFFFFFF000ULL;
 	UINT64 SmmDir = AsmReadCr3() & 0xFFFFFFFFFFFFF000ULL;
-
-	// remap PML4
-	PML4E Pml4;
 	UINT8 PageSize = EDeadwingPage4Kb;
-	if(MemRemapAddress(gRemapPage, Dir, SmmDir, &PageSize)) {
-		TargetAddress = gRemapPage;
 
-		if(PageSize == EDeadwingPage1Gb) {
-			TargetAddress += Dir & 0x3FFFFFF;
-		} else if (PageSize == EDeadwingPage2Mb) {
-			TargetAddress += Dir & 0x1FFFFF;
+	// neighbour pages share the page table, reuse it if it's known
+	PDEADWING_WALK_CACHE Cache = MemGetWalkCache(Window);
+	if(Cache != NULL) {
+		if(Cache->Epoch == gWalkEpoch && Cache->Dir == Dir && Cache->Tag == ((UINT64)Address >> 21)) {
+			PageTable = Cache->PageTable;
+			STATS_INC(TranslateCacheHits);
 		} else {
-			TargetAddress += Dir & 0xFFF;
+			STATS_INC(TranslateCacheMisses);
 		}
-
-		Pml4.Value = *(UINT64 *)(TargetAddress + (((UINT64)Address >> 39) & 0x1FF) * sizeof(UINT64));
-
-		MemRestoreSmramMappings();
-	} else {
-		SerialPrint("[ SMM ] Unable to remap PML4\r\n");
-		return 0;
 	}
 
-	// remap PDP
-	PDPE Pdpe;
-	if(Pml4.Bits.Present) {
-		ReadAddress = Pml4.Bits.Pfn << EFI_PAGE_SHIFT;
-		if(MemRemapAddress(gRemapPage, ReadAddress, SmmDir, &PageSize)) {
-			TargetAddress = gRemapPage;
+	if(PageTable == 0) {
+		// remap PML4
+		PML4E Pml4;
+		if(MemRemapAddress(Window, Dir, SmmDir, &PageSize)) {
+			TargetAddress = Window;
 
 			if(PageSize == EDeadwingPage1Gb) {
-				TargetAddress += ReadAddress & 0x3FFFFFF;
-			} else if(PageSize == EDeadwingPage2Mb) {
-				TargetAddress += ReadAddress & 0x1FFFFF;
+				TargetAddress += Dir & 0x3FFFFFF;
+			} else if (PageSize == EDeadwingPage2Mb) {
+				TargetAddress += Dir & 0x1FFFFF;
 			} else {
-				TargetAddress += ReadAddress & 0xFFF;
+				TargetAddress += Dir & 0xFFF;
 			}
 
-			Pdpe.Value = *(UINT64 *)(TargetAddress + (((UINT64)Address >> 30) & 0x1FF) * sizeof(UINT64));
-			
-			MemRestoreSmramMappings();
+			Pml4.Value = *(UINT64 *)(TargetAddress + (((UINT64)Address >> 39) & 0x1FF) * sizeof(UINT64));
+			STATS_INC(WalkPml4);
+
+			MemRestoreSmramMappingsEx(Window);
 		} else {
-			SerialPrint("[ SMM ] Unable to remap PDPE\r\n");
+			LOG_ERROR("[ SMM ] Unable to remap PML4\r\n");
 			return 0;
 		}
-	} else {
-		SerialPrint("[ SMM ] PML4 is not present for current virtual address\r\n");
-		return 0;
-	}
-	
-	// remap PDE
-	PDE Pde;
-	if(Pdpe.Bits.Present) {
-		// check if page is 1gb size, translate if it's true
-		if(Pdpe.Bits.Size)
-			return ((Pdpe.Bits.Pfn << EFI_PAGE_SHIFT) + ((UINT64)Address & 0x3FFFFFF));
 
-		ReadAddress = Pdpe.Bits.Pfn << EFI_PAGE_SHIFT;
-		if(MemRemapAddress(gRemapPage, ReadAddress, SmmDir, &PageSize)) {
-			TargetAddress = gRemapPage;
-
-			if(PageSize == EDeadwingPage1Gb) {
-				TargetAddress += ReadAddress & 0x3FFFFFF;
-			} else if(PageSize == EDeadwingPage2Mb) {
-				TargetAddress += ReadAddress & 0x1FFFFF;
+		// remap PDP
+		PDPE Pdpe;
+		if(Pml4.Bits.Present) {
+			ReadAddress = Pml4.Bits.Pfn << EFI_PAGE_SHIFT;
+			if(MemRemapAddress(Window, ReadAddress, SmmDir, &PageSize)) {
+				TargetAddress = Window;
+
+				if(PageSize == EDeadwingPage1Gb) {
+					TargetAddress += ReadAddress & 0x3FFFFFF;
+				} else if(PageSize == EDeadwingPage2Mb) {
+					TargetAddress += ReadAddress & 0x1FFFFF;
+				} else {
+					TargetAddress += ReadAddress & 0xFFF;
+				}
+
+				Pdpe.Value = *(UINT64 *)(TargetAddress + (((UINT64)Address >> 30) & 0x1FF) * sizeof(UINT64));
+				STATS_INC(WalkPdpt);
+
+				MemRestoreSmramMappingsEx(Window);
 			} else {
-				TargetAddress += ReadAddress & 0xFFF;
+				LOG_ERROR("[ SMM ] Unable to remap PDPE\r\n");
+				return 0;
 			}
+		} else {
+			LOG_DEBUG("[ SMM ] PML4 is not present for current virtual address\r\n");
+			TRACE(DEADWING_TRACE_TRANSLATE_FAULT, 3, Address, Dir, 4, 0);
+			return 0;
+		}
 
-			Pde.Value = *(UINT64 *)(TargetAddress + (((UINT64)Address >> 21) & 0x1FF) * sizeof(UINT64));
-		
-			MemRestoreSmramMappings();
+		// remap PDE
+		PDE Pde;
+		if(Pdpe.Bits.Present) {
+			// check if page is 1gb size, translate if it's true
+			if(Pdpe.Bits.Size)
+				return ((Pdpe.Bits.Pfn << EFI_PAGE_SHIFT) + ((UINT64)Address & 0x3FFFFFF));
+
+			ReadAddress = Pdpe.Bits.Pfn << EFI_PAGE_SHIFT;
+			if(MemRemapAddress(Window, ReadAddress, SmmDir, &PageSize)) {
+				TargetAddress = Window;
+
+				if(PageSize == EDeadwingPage1Gb) {
+					TargetAddress += ReadAddress & 0x3FFFFFF;
+				} else if(PageSize == EDeadwingPage2Mb) {
+					TargetAddress += ReadAddress & 0x1FFFFF;
+				} else {
+					TargetAddress += ReadAddress & 0xFFF;
+				}
+
+				Pde.Value = *(UINT64 *)(TargetAddress + (((UINT64)Address >> 21) & 0x1FF) * sizeof(UINT64));
+				STATS_INC(WalkPd);
+
+				MemRestoreSmramMappingsEx(Window);
+			} else {
+				LOG_ERROR("[ SMM ] Unable to remap PDE\r\n");
+				return 0;
+			}
 		} else {
-			SerialPrint("[ SMM ] Unable to remap PDE\r\n");
+			LOG_DEBUG("[ SMM ] PDPE is not present for current virtual address\r\n");
+			TRACE(DEADWING_TRACE_TRANSLATE_FAULT, 3, Address, Dir, 3, 0);
+			return 0;
+		}
+
+		if(!Pde.Bits.Present) {
+			LOG_DEBUG("[ SMM ] PDE is not present for current virtual address\r\n");
+			TRACE(DEADWING_TRACE_TRANSLATE_FAULT, 3, Address, Dir, 2, 0);
 			return 0;
 		}
-	} else {
-		SerialPrint("[ SMM ] PDPE is not present for current virtual address\r\n");
-		return 0;
-	}
 
-	// remap PTE
-	PTE Pte;
-	if(Pde.Bits.Present) {
 		// check if page is 2mb size, translate if it's true
 		if(Pde.Bits.Size)
 			return ((Pde.Bits.Pfn << EFI_PAGE_SHIFT) + ((UINT64)Address & 0x1FFFFF));
-		
-		ReadAddress = Pde.Bits.Pfn << EFI_PAGE_SHIFT;
-		if(MemRemapAddress(gRemapPage, ReadAddress, SmmDir, &PageSize)) {
-			TargetAddress = gRemapPage;
 
-			if(PageSize == EDeadwingPage2Mb) {
-				TargetAddress += ReadAddress & 0x1FFFFF;
-			} else {
-				TargetAddress += ReadAddress & 0xFFF;
-			}
+		PageTable = Pde.Bits.Pfn << EFI_PAGE_SHIFT;
+
+		if(Cache != NULL) {
+			Cache->Dir = Dir;
+			Cache->Tag = (UINT64)Address >> 21;
+			Cache->PageTable = PageTable;
+			Cache->Epoch = gWalkEpoch;
+		}
+	}
 
-			Pte.Value = *(UINT64 *)(TargetAddress + (((UINT64)Address >> 12) & 0x1FF) * sizeof(UINT64));
+	// remap PTE
+	PTE Pte;
+	if(MemRemapAddress(Window, PageTable, SmmDir, &PageSize)) {
+		TargetAddress = Window;
 
-			MemRestoreSmramMappings();
+		if(PageSize == EDeadwingPage2Mb) {
+			TargetAddress += PageTable & 0x1FFFFF;
 		} else {
-			SerialPrint("[ SMM ] Unable to remap PTE\r\n");
-			return 0;
+			TargetAddress += PageTable & 0xFFF;
 		}
+
+		Pte.Value = *(UINT64 *)(TargetAddress + (((UINT64)Address >> 12) & 0x1FF) * sizeof(UINT64));
+		STATS_INC(WalkPt);
+
+		MemRestoreSmramMappingsEx(Window);
 	} else {
-		SerialPrint("[ SMM ] PDE is not present for current virtual address\r\n");
+		LOG_ERROR("[ SMM ] Unable to remap PTE\r\n");
 		return 0;
 	}
 
 	if(Pte.Bits.Present)
 		return ((Pte.Bits.Pfn << EFI_PAGE_SHIFT) + ((UINT64)Address & 0xFFF));
-	else
-		SerialPrint("[ SMM ] PTE is not present for current virtual address\r\n");
+
+	LOG_DEBUG("[ SMM ] PTE is not present for current virtual address\r\n");
+	TRACE(DEADWING_TRACE_TRANSLATE_FAULT, 3, Address, Dir, 1, 0);
 
 	return 0;
 }
 
 /**
- * \brief Maps physical address into the SMRAM
+ * \brief Translates virtual address to the physical by identity
+ * remapping
+ * 
+ * \param Address Virtual address which should be converted
+ * \param Dir     Directory table base
+ * 
+ * \returns Translated address or 0 if we cannot translate it
+ */
+UINT64 
+EFIAPI
+MemTranslateVirtualToPhys(
+	IN VOID   *Address,
+	IN UINT64  Dir
+) {
+	return MemTranslateVirtualToPhysEx(Address, Dir, gRemapPage);
+}
+
+/**
+ * \brief Maps physical address into the SMRAM through the given remap window
  * 
  * \param PhysAddress Physical address which should be mapped into SMRAM
+ * \param Window      Remap window
  * 
  * \return Mapped address or 0 if we cannot map it
  */
 UINT64
 EFIAPI
-MemProcessOutsideSmramPhysMemory(
-	IN UINT64 PhysAddress
+MemProcessOutsideSmramPhysMemoryEx(
+	IN UINT64 PhysAddress,
+	IN UINT64 Window
 ) {
 	UINT8 PageSize = EDeadwingPage4Kb;
-	UINT64 RemapedMemory = gRemapPage;
+	UINT64 RemapedMemory = Window;
 	UINT64 SmmDir = AsmReadCr3();
-	if(MemRemapAddress(gRemapPage, PhysAddress, SmmDir, &PageSize)) {		
+	if(MemRemapAddress(Window, PhysAddress, SmmDir, &PageSize)) {		
 		if(PageSize == EDeadwingPage1Gb) {
 			RemapedMemory += PhysAddress & 0x3FFFFFF;
 		} else if(PageSize == EDeadwingPage2Mb) {
@@ -374,20 +551,37 @@ MemProcessOutsideSmramPhysMemory(
 }
 
 /**
- * \brief Translates and maps virtual address content into SMRAM 
+ * \brief Maps physical address into the SMRAM
+ * 
+ * \param PhysAddress Physical address which should be mapped into SMRAM
+ * 
+ * \return Mapped address or 0 if we cannot map it
+ */
+UINT64
+EFIAPI
+MemProcessOutsideSmramPhysMemory(
+	IN UINT64 PhysAddress
+) {
+	return MemProcessOutsideSmramPhysMemoryEx(PhysAddress, gRemapPage);
+}
+
+/**
+ * \brief Translates and maps virtual address content into SMRAM through the given remap window
  * 
  * \param VirtualAddress  Virtual address which should be translated
  * \param DirBase         Directory table base
  * \param UnmappedAddress Unmapped physical address if requested
+ * \param Window          Remap window
  * 
  * \returns Mapped physical address or 0 if we cannot translate/map it
  */
 UINT64
 EFIAPI
-MemMapVirtualAddress(
+MemMapVirtualAddressEx(
 	IN  VOID    *VirtualAddress,
 	IN  UINT64   DirBase,
-	OUT VOID   **UnmappedAddress
+	OUT VOID   **UnmappedAddress,
+	IN  UINT64   Window
 ) {
 	UINT64 TranslatedAddress;
 	UINT64 PhysRemaped;
@@ -401,10 +595,10 @@ MemMapVirtualAddress(
 		return 0;
 
 	// translate virtual address to physical
-	TranslatedAddress = MemTranslateVirtualToPhys(VirtualAddress, DirBase);
+	TranslatedAddress = MemTranslateVirtualToPhysEx(VirtualAddress, DirBase, Window);
 	if(TranslatedAddress != 0) {
 		// map physical address into the SMRAM memory 
-		PhysRemaped = MemProcessOutsideSmramPhysMemory(TranslatedAddress, gRemapPage);
+		PhysRemaped = MemProcessOutsideSmramPhysMemoryEx(TranslatedAddress, Window);
 		if(PhysRemaped == 0)
 			return 0;
 	}
@@ -414,3 +608,167 @@ MemMapVirtualAddress(
 
 	return PhysRemaped;
 }
+
+/**
+ * \brief Translates and maps virtual address content into SMRAM 
+ * 
+ * \param VirtualAddress  Virtual address which should be translated
+ * \param DirBase         Directory table base
+ * \param UnmappedAddress Unmapped physical address if requested
+ * 
+ * \returns Mapped physical address or 0 if we cannot translate/map it
+ */
+UINT64
+EFIAPI
+MemMapVirtualAddress(
+	IN  VOID    *VirtualAddress,
+	IN  UINT64   DirBase,
+	OUT VOID   **UnmappedAddress
+) {
+	return MemMapVirtualAddressEx(VirtualAddress, DirBase, UnmappedAddress, gRemapPage);
+}
+
+/**
+ * \brief Reads entry of the paging structure through the given remap window
+ * 
+ * \param Table  Physical address of the paging structure
+ * \param Index  Index of the entry
+ * \param Window Remap window
+ * \param Entry  Value of the entry
+ * 
+ * \return TRUE if entry has been read
+ */
+BOOLEAN
+EFIAPI
+MemReadTableEntryEx(
+	IN  UINT64  Table,
+	IN  UINT64  Index,
+	IN  UINT64  Window,
+	OUT UINT64 *Entry
+) {
+	UINT64 Mapped = MemProcessOutsideSmramPhysMemoryEx(Table + Index * sizeof(UINT64), Window);
+	if(Mapped == 0)
+		return FALSE;
+
+	*Entry = *(volatile UINT64 *)Mapped;
+
+	MemRestoreSmramMappingsEx(Window);
+
+	return TRUE;
+}
+
+/**
+ * \brief Walks leaf entries of the paging structures which map [Address, End), single step.
+ * 
+ * Step processes one page table (up to 512 PTEs), one large page or skips region which
+ * is not mapped by the upper level entry. Callback receives pointer to the mapped leaf entry
+ * and may modify it, remap window is busy while callback runs. If callback refuses the
+ * entry, walk stops on it
+ * 
+ * \param Dir      Directory table base
+ * \param Address  Virtual address to start from
+ * \param End      Virtual address after the last one
+ * \param Window   Remap window
+ * \param Callback Callback called for every present leaf entry
+ * \param Context  Context of the callback
+ * 
+ * \returns Virtual address to continue from, 0 if paging structures can't be mapped
+ */
+UINT64
+EFIAPI
+MemWalkPageTablesStepEx(
+	IN UINT64                      Dir,
+	IN UINT64                      Address,
+	IN UINT64                      End,
+	IN UINT64                      Window,
+	IN DEADWING_PAGE_WALK_CALLBACK Callback,
+	IN VOID                       *Context
+) {
+	/// \todo @0x00Alchemist: add support to LA57 platforms
+
+	Dir &= 0xFFFFFFFFFFFFF000ULL;
+
+	// PML4
+	PML4E Pml4;
+	if(!MemReadTableEntryEx(Dir, (Address >> 39) & 0x1FF, Window, &Pml4.Value))
+		return 0;
+
+	STATS_INC(WalkPml4);
+
+	if(!Pml4.Bits.Present)
+		return MIN((Address | (BASE_512GB - 1)) + 1, End);
+
+	// PDP
+	PDPE Pdpe;
+	UINT64 Table = Pml4.Bits.Pfn << EFI_PAGE_SHIFT;
+	if(!MemReadTableEntryEx(Table, (Address >> 30) & 0x1FF, Window, &Pdpe.Value))
+		return 0;
+
+	STATS_INC(WalkPdpt);
+
+	UINT64 Next = MIN((Address | (EFI_PAGE_1GB - 1)) + 1, End);
+	if(!Pdpe.Bits.Present)
+		return Next;
+
+	UINT64 Mapped;
+	if(Pdpe.Bits.Size) {
+		// 1gb page
+		Mapped = MemProcessOutsideSmramPhysMemoryEx(Table + ((Address >> 30) & 0x1FF) * sizeof(UINT64), Window);
+		if(Mapped == 0)
+			return 0;
+
+		BOOLEAN Taken = Callback(Context, Address & ~(UINT64)(EFI_PAGE_1GB - 1), EFI_PAGE_1GB, (UINT64 *)Mapped);
+
+		MemRestoreSmramMappingsEx(Window);
+
+		return Taken ? Next : Address;
+	}
+
+	// PD
+	PDE Pde;
+	Table = Pdpe.Bits.Pfn << EFI_PAGE_SHIFT;
+	if(!MemReadTableEntryEx(Table, (Address >> 21) & 0x1FF, Window, &Pde.Value))
+		return 0;
+
+	STATS_INC(WalkPd);
+
+	Next = MIN((Address | (EFI_PAGE_2MB - 1)) + 1, End);
+	if(!Pde.Bits.Present)
+		return Next;
+
+	if(Pde.Bits.Size) {
+		// 2mb page
+		Mapped = MemProcessOutsideSmramPhysMemoryEx(Table + ((Address >> 21) & 0x1FF) * sizeof(UINT64), Window);
+		if(Mapped == 0)
+			return 0;
+
+		BOOLEAN Taken = Callback(Context, Address & ~(UINT64)(EFI_PAGE_2MB - 1), EFI_PAGE_2MB, (UINT64 *)Mapped);
+
+		MemRestoreSmramMappingsEx(Window);
+
+		return Taken ? Next : Address;
+	}
+
+	// PT, the whole table lies on a single page
+	Mapped = MemProcessOutsideSmramPhysMemoryEx(Pde.Bits.Pfn << EFI_PAGE_SHIFT, Window);
+	if(Mapped == 0)
+		return 0;
+
+	STATS_INC(WalkPt);
+
+	PPTE Pte = (PPTE)Mapped;
+	for(UINT64 Page = Address & ~(UINT64)EFI_PAGE_MASK; Page < Next; Page += EFI_PAGE_SIZE) {
+		PPTE Entry = &Pte[(Page >> 12) & 0x1FF];
+		if(!Entry->Bits.Present)
+			continue;
+
+		if(!Callback(Context, Page, EFI_PAGE_4KB, &Entry->Value)) {
+			Next = MAX(Page, Address);
+			break;
+		}
+	}
+
+	MemRestoreSmramMappingsEx(Window);
+
+	return Next;
+}
@@ -1,5 +1,11 @@
 #pragma once
 
+typedef BOOLEAN (EFIAPI *DEADWING_PAGE_WALK_CALLBACK)(
+	IN VOID   *Context,
+	IN UINT64  VirtualAddress,
+	IN UINT64  PageSize,
+	IN UINT64 *Entry
+);
 
 VOID
 EFIAPI
@@ -9,18 +15,57 @@ PhysMemCpy(
 	IN UINT32  Len
 );
 
+BOOLEAN
+EFIAPI
+MemIsMappedBy4KbPage(
+	IN UINT64 Address
+);
+
+VOID
+EFIAPI
+MemRestoreSmramMappingsEx(
+	IN UINT64 Window
+);
+
 VOID
 EFIAPI
 MemRestoreSmramMappings(
 	VOID
 );
 
+VOID
+EFIAPI
+MemRegisterWindow(
+	IN UINT64 Window
+);
+
+VOID
+EFIAPI
+MemInvalidateWalkCache(
+	VOID
+);
+
+UINT64
+EFIAPI
+MemProcessOutsideSmramPhysMemoryEx(
+	IN UINT64 PhysAddress,
+	IN UINT64 Window
+);
+
 UINT64
 EFIAPI
 MemProcessOutsideSmramPhysMemory(
 	IN UINT64 PhysAddress
 );
 
+UINT64
+EFIAPI
+MemTranslateVirtualToPhysEx(
+	IN VOID   *Address,
+	IN UINT64  Dir,
+	IN UINT64  Window
+);
+
 UINT64
 EFIAPI
 MemTranslateVirtualToPhys(
@@ -28,6 +73,15 @@ MemTranslateVirtualToPhys(
 	IN UINT64  Dir
 );
 
+UINT64
+EFIAPI
+MemMapVirtualAddressEx(
+	IN  VOID    *VirtualAddress,
+	IN  UINT64   DirBase,
+	OUT VOID   **UnmappedAddress,
+	IN  UINT64   Window
+);
+
 UINT64
 EFIAPI
 MemMapVirtualAddress(
@@ -35,3 +89,14 @@ MemMapVirtualAddress(
 	IN UINT64   DirBase,
 	OUT VOID  **UnmappedAddress
 );
+
+UINT64
+EFIAPI
+MemWalkPageTablesStepEx(
+	IN UINT64                      Dir,
+	IN UINT64                      Address,
+	IN UINT64                      End,
+	IN UINT64                      Window,
+	IN DEADWING_PAGE_WALK_CALLBACK Callback,
+	IN VOID                       *Context
+);
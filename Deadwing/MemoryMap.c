@@ -0,0 +1,229 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "Log.h"
+#include "MemoryMap.h"
+
+// ranges are sorted by base and don't overlap. Map is set once, before ExitBootServices, and read only afterwards
+STATIC DEADWING_MEMORY_RANGE gMemoryRanges[DEADWING_MEMORY_MAP_MAX_RANGES];
+STATIC UINTN gMemoryRangeCount;
+
+
+/**
+ * \brief Checks if memory of the given type is backed by RAM
+ * 
+ * \param Type EFI_MEMORY_TYPE of the range
+ * 
+ * \return TRUE - Range is RAM and can be read
+ * \return FALSE - Range is reserved, unusable, MMIO or of unknown type
+ */
+STATIC
+BOOLEAN
+EFIAPI
+MemoryMapIsRamType(
+	IN UINT32 Type
+) {
+	switch(Type) {
+		case EfiLoaderCode:
+		case EfiLoaderData:
+		case EfiBootServicesCode:
+		case EfiBootServicesData:
+		case EfiRuntimeServicesCode:
+		case EfiRuntimeServicesData:
+		case EfiConventionalMemory:
+		case EfiACPIReclaimMemory:
+		case EfiACPIMemoryNVS:
+		case EfiPersistentMemory:
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+
+/**
+ * \brief Inserts range into the sorted table. Range is merged with its
+ * neighbours if they are contiguous and have the same type and attributes
+ * 
+ * \param Base      Physical base of the range
+ * \param Length    Length of the range
+ * \param Type      EFI_MEMORY_TYPE of the range
+ * \param Attribute Attributes of the range
+ * 
+ * \return EFI_SUCCESS - Range has been inserted
+ * \return EFI_INVALID_PARAMETER - Range overlaps another one
+ * \return EFI_OUT_OF_RESOURCES - Table is full
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+MemoryMapInsert(
+	IN UINT64 Base,
+	IN UINT64 Length,
+	IN UINT32 Type,
+	IN UINT64 Attribute
+) {
+	// find the first range which starts after the new one
+	UINTN Low = 0;
+	UINTN High = gMemoryRangeCount;
+	while(Low < High) {
+		UINTN Middle = (Low + High) / 2;
+		if(gMemoryRanges[Middle].Base <= Base)
+			Low = Middle + 1;
+		else
+			High = Middle;
+	}
+
+	PDEADWING_MEMORY_RANGE Prev = Low != 0 ? &gMemoryRanges[Low - 1] : NULL;
+	PDEADWING_MEMORY_RANGE Next = Low < gMemoryRangeCount ? &gMemoryRanges[Low] : NULL;
+
+	if((Prev != NULL && Base - Prev->Base < Prev->Length) || (Next != NULL && Next->Base - Base < Length))
+		return EFI_INVALID_PARAMETER;
+
+	BOOLEAN MergePrev = Prev != NULL && Prev->Base + Prev->Length == Base && Prev->Type == Type && Prev->Attribute == Attribute;
+	BOOLEAN MergeNext = Next != NULL && Base + Length == Next->Base && Next->Type == Type && Next->Attribute == Attribute;
+
+	if(MergePrev && MergeNext) {
+		Prev->Length += Length + Next->Length;
+		CopyMem(Next, Next + 1, (gMemoryRangeCount - Low - 1) * sizeof(DEADWING_MEMORY_RANGE));
+		gMemoryRangeCount--;
+	} else if(MergePrev) {
+		Prev->Length += Length;
+	} else if(MergeNext) {
+		Next->Base = Base;
+		Next->Length += Length;
+	} else {
+		if(gMemoryRangeCount == DEADWING_MEMORY_MAP_MAX_RANGES)
+			return EFI_OUT_OF_RESOURCES;
+
+		CopyMem(&gMemoryRanges[Low + 1], &gMemoryRanges[Low], (gMemoryRangeCount - Low) * sizeof(DEADWING_MEMORY_RANGE));
+
+		gMemoryRanges[Low].Base = Base;
+		gMemoryRanges[Low].Length = Length;
+		gMemoryRanges[Low].Type = Type;
+		gMemoryRanges[Low].Reserved = 0;
+		gMemoryRanges[Low].Attribute = Attribute;
+		gMemoryRangeCount++;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Builds SMRAM copy of the UEFI memory map. Map is accepted only once,
+ * so it should be set before ExitBootServices while the buffer is still trusted
+ * 
+ * \param Descriptors    UEFI memory map
+ * \param MapSize        Size of the map
+ * \param DescriptorSize Size of a single descriptor
+ * \param RangeCount     Count of ranges left after merge
+ * 
+ * \return EFI_SUCCESS - Map has been set
+ * \return EFI_ALREADY_STARTED - Map has been set before
+ * \return EFI_INVALID_PARAMETER - Map is malformed
+ * \return EFI_OUT_OF_RESOURCES - Map doesn't fit the table
+ */
+EFI_STATUS
+EFIAPI
+MemoryMapSet(
+	IN  VOID   *Descriptors,
+	IN  UINTN   MapSize,
+	IN  UINTN   DescriptorSize,
+	OUT UINT64 *RangeCount
+) {
+	if(gMemoryRangeCount != 0)
+		return EFI_ALREADY_STARTED;
+
+	if(DescriptorSize < sizeof(EFI_MEMORY_DESCRIPTOR) || MapSize < DescriptorSize)
+		return EFI_INVALID_PARAMETER;
+
+	for(UINTN Offset = 0; Offset + DescriptorSize <= MapSize; Offset += DescriptorSize) {
+		EFI_MEMORY_DESCRIPTOR Descriptor;
+		CopyMem(&Descriptor, (UINT8 *)Descriptors + Offset, sizeof(EFI_MEMORY_DESCRIPTOR));
+
+		if(Descriptor.NumberOfPages == 0)
+			continue;
+
+		UINT64 Length = LShiftU64(Descriptor.NumberOfPages, EFI_PAGE_SHIFT);
+		if(Descriptor.NumberOfPages > RShiftU64(MAX_UINT64, EFI_PAGE_SHIFT) || Descriptor.PhysicalStart > MAX_UINT64 - Length) {
+			gMemoryRangeCount = 0;
+			return EFI_INVALID_PARAMETER;
+		}
+
+		EFI_STATUS Status = MemoryMapInsert(Descriptor.PhysicalStart, Length, Descriptor.Type, Descriptor.Attribute);
+		if(EFI_ERROR(Status)) {
+			// partial map would hide RAM, reads go as is then
+			gMemoryRangeCount = 0;
+			return Status;
+		}
+	}
+
+	*RangeCount = gMemoryRangeCount;
+
+	LOG_INFO("[ SMM ] Physical memory map has been cached\r\n");
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Finds range of the map which covers the address. Every read of the
+ * physical memory goes through it, so it's a binary search over sorted table
+ * 
+ * \param Address Physical address
+ * \param Extent  Count of bytes from the address to the end of the range (or hole)
+ * 
+ * \return TRUE - Address is backed by RAM or map hasn't been set
+ * \return FALSE - Address lies in a hole, reserved, unusable or MMIO range
+ */
+BOOLEAN
+EFIAPI
+MemoryMapLookup(
+	IN  UINT64  Address,
+	OUT UINT64 *Extent
+) {
+	// without the map every address is treated as RAM
+	if(gMemoryRangeCount == 0) {
+		*Extent = MAX_UINT64 - Address;
+		return TRUE;
+	}
+
+	// find the first range which starts after the address
+	UINTN Low = 0;
+	UINTN High = gMemoryRangeCount;
+	while(Low < High) {
+		UINTN Middle = (Low + High) / 2;
+		if(gMemoryRanges[Middle].Base <= Address)
+			Low = Middle + 1;
+		else
+			High = Middle;
+	}
+
+	if(Low != 0 && Address - gMemoryRanges[Low - 1].Base < gMemoryRanges[Low - 1].Length) {
+		*Extent = gMemoryRanges[Low - 1].Length - (Address - gMemoryRanges[Low - 1].Base);
+		return MemoryMapIsRamType(gMemoryRanges[Low - 1].Type);
+	}
+
+	// hole lasts until the next range
+	*Extent = Low < gMemoryRangeCount ? gMemoryRanges[Low].Base - Address : MAX_UINT64 - Address;
+
+	return FALSE;
+}
+
+/**
+ * \brief Returns SMRAM copy of the memory map
+ * 
+ * \param RangeCount Count of ranges of the map, 0 if it hasn't been set
+ * 
+ * \returns Sorted table of ranges
+ */
+CONST DEADWING_MEMORY_RANGE *
+EFIAPI
+MemoryMapGet(
+	OUT UINTN *RangeCount
+) {
+	*RangeCount = gMemoryRangeCount;
+
+	return gMemoryRanges;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Conf.h"
+#include "Defs.h"
+
+EFI_STATUS
+EFIAPI
+MemoryMapSet(
+	IN  VOID   *Descriptors,
+	IN  UINTN   MapSize,
+	IN  UINTN   DescriptorSize,
+	OUT UINT64 *RangeCount
+);
+
+BOOLEAN
+EFIAPI
+MemoryMapLookup(
+	IN  UINT64  Address,
+	OUT UINT64 *Extent
+);
+
+CONST DEADWING_MEMORY_RANGE *
+EFIAPI
+MemoryMapGet(
+	OUT UINTN *RangeCount
+);
@@ -0,0 +1,356 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/SynchronizationLib.h>
+
+#include "Conf.h"
+#include "PML4.h"
+#include "Serial.h"
+#include "Memory.h"
+#include "Monitor.h"
+
+typedef struct _DEADWING_MONITOR_REGION {
+	UINT64 Start;
+	UINT64 End;
+	UINT64 SamplePage;
+	UINT32 Accesses;
+	UINT32 LastAccesses;
+	UINT32 Age;
+} DEADWING_MONITOR_REGION, *PDEADWING_MONITOR_REGION;
+
+typedef struct _DEADWING_MONITOR {
+	BOOLEAN Active;
+	UINT64  ProcessId;
+	UINT32  MinRegions;
+	UINT32  MaxRegions;
+	UINT32  AggregationSamples;
+	UINT32  Samples;
+	UINT64  TotalSize;
+	UINT64  Seed;
+	UINTN   RegionCount;
+	DEADWING_MONITOR_REGION Regions[DEADWING_MONITOR_MAX_REGIONS];
+} DEADWING_MONITOR, *PDEADWING_MONITOR;
+
+// monitor state lives in SMRAM between SMIs, scratch is used to rebuild regions
+STATIC DEADWING_MONITOR gMonitor;
+STATIC DEADWING_MONITOR_REGION gMonitorScratch[DEADWING_MONITOR_MAX_REGIONS];
+
+
+/**
+ * \brief Returns next pseudo-random number (xorshift64)
+ * 
+ * \returns Pseudo-random number
+ */
+STATIC
+UINT64
+EFIAPI
+MonitorRandom(
+	VOID
+) {
+	UINT64 X = gMonitor.Seed;
+	X ^= X << 13;
+	X ^= X >> 7;
+	X ^= X << 17;
+	gMonitor.Seed = X;
+
+	return X;
+}
+
+/**
+ * \brief Returns random page of the region
+ * 
+ * \param Region Monitored region
+ * 
+ * \returns Address of the page
+ */
+STATIC
+UINT64
+EFIAPI
+MonitorRandomPage(
+	IN PDEADWING_MONITOR_REGION Region
+) {
+	UINT64 Pages = (Region->End - Region->Start) >> EFI_PAGE_SHIFT;
+
+	return Region->Start + (MonitorRandom() % Pages) * EFI_PAGE_SIZE;
+}
+
+/**
+ * \brief Reads and clears accessed bit of the leaf entry
+ * 
+ * \param Context        Receives TRUE if accessed bit was set
+ * \param VirtualAddress Unused
+ * \param PageSize       Unused
+ * \param Entry          Mapped leaf entry
+ * 
+ * \return TRUE
+ */
+STATIC
+BOOLEAN
+EFIAPI
+MonitorAccessCallback(
+	IN VOID   *Context,
+	IN UINT64  VirtualAddress,
+	IN UINT64  PageSize,
+	IN UINT64 *Entry
+) {
+	UINT64 Old;
+	do {
+		Old = *(volatile UINT64 *)Entry;
+	} while(InterlockedCompareExchange64(Entry, Old, Old & ~(UINT64)PAGE_ENTRY_ACCESSED) != Old);
+
+	*(BOOLEAN *)Context = (Old & PAGE_ENTRY_ACCESSED) != 0;
+
+	return TRUE;
+}
+
+/**
+ * \brief Starts monitoring of the process ranges.
+ * 
+ * Previous monitor is replaced once the request is validated. Every range is split into regions
+ * proportionally to its size, so there're at least min and at most max regions in total. Max
+ * regions is capped by DEADWING_MONITOR_MAX_REGIONS
+ * 
+ * \param Request Monitored process, ranges and limits
+ * 
+ * \return EFI_SUCCESS - Monitor has been started
+ * \return EFI_INVALID_PARAMETER - Ranges or limits are invalid
+ */
+EFI_STATUS
+EFIAPI
+MonitorStart(
+	IN CONST DEADWING_MONITOR_REQUEST *Request
+) {
+	if(Request->RangeCount == 0 || Request->RangeCount > DEADWING_MONITOR_MAX_RANGES)
+		return EFI_INVALID_PARAMETER;
+
+	UINT32 MaxRegions = MIN(Request->MaxRegions, DEADWING_MONITOR_MAX_REGIONS);
+	if(Request->MinRegions < Request->RangeCount || Request->MinRegions > MaxRegions)
+		return EFI_INVALID_PARAMETER;
+
+	if(Request->AggregationSamples == 0 || Request->AggregationSamples > MAX_UINT16)
+		return EFI_INVALID_PARAMETER;
+
+	// ranges are monitored by whole pages
+	UINT64 TotalSize = 0;
+	for(UINT32 i = 0; i < Request->RangeCount; i++) {
+		UINT64 Start = Request->Ranges[i].Address & ~(UINT64)EFI_PAGE_MASK;
+		UINT64 End = (Request->Ranges[i].Address + Request->Ranges[i].Length + EFI_PAGE_MASK) & ~(UINT64)EFI_PAGE_MASK;
+		if(Request->Ranges[i].Length == 0 || End <= Start)
+			return EFI_INVALID_PARAMETER;
+
+		TotalSize += End - Start;
+	}
+
+	// request is valid, running monitor can be replaced
+	ZeroMem(&gMonitor, sizeof(DEADWING_MONITOR));
+
+	for(UINT32 i = 0; i < Request->RangeCount; i++) {
+		UINT64 Start = Request->Ranges[i].Address & ~(UINT64)EFI_PAGE_MASK;
+		UINT64 End = (Request->Ranges[i].Address + Request->Ranges[i].Length + EFI_PAGE_MASK) & ~(UINT64)EFI_PAGE_MASK;
+		UINT64 Pages = (End - Start) >> EFI_PAGE_SHIFT;
+
+		// share of min regions, every range gets at least one
+		UINT64 Count = MultU64x64(Request->MinRegions, End - Start) / TotalSize;
+		Count = MAX(MIN(Count, Pages), 1);
+		Count = MIN(Count, MaxRegions - gMonitor.RegionCount - (Request->RangeCount - 1 - i));
+
+		UINT64 PagesPerRegion = Pages / Count;
+		for(UINT64 j = 0; j < Count; j++) {
+			PDEADWING_MONITOR_REGION Region = &gMonitor.Regions[gMonitor.RegionCount++];
+			Region->Start = Start + j * PagesPerRegion * EFI_PAGE_SIZE;
+			Region->End = (j + 1 == Count) ? End : Region->Start + PagesPerRegion * EFI_PAGE_SIZE;
+		}
+	}
+
+	gMonitor.Active = TRUE;
+	gMonitor.ProcessId = Request->ProcessId;
+	gMonitor.MinRegions = Request->MinRegions;
+	gMonitor.MaxRegions = MaxRegions;
+	gMonitor.AggregationSamples = Request->AggregationSamples;
+	gMonitor.TotalSize = TotalSize;
+	gMonitor.Seed = AsmReadTsc() | 1;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Checks if monitor has been started
+ * 
+ * \returns TRUE if monitor is active
+ */
+BOOLEAN
+EFIAPI
+MonitorIsActive(
+	VOID
+) {
+	return gMonitor.Active;
+}
+
+/**
+ * \brief Returns ID of the monitored process
+ * 
+ * \returns Process ID
+ */
+UINT64
+EFIAPI
+MonitorGetProcessId(
+	VOID
+) {
+	return gMonitor.ProcessId;
+}
+
+/**
+ * \brief Takes single sample of every region.
+ * 
+ * Accessed bit of the page sampled previously is checked and cleared, then the next
+ * random page of the region is prepared by clearing its accessed bit. Caller should
+ * flush TLBs of the OS afterwards, otherwise CPUs won't set bits again
+ * 
+ * \param DirBase Directory table base of the monitored process
+ * \param Window  Remap window
+ * \param Samples Count of samples taken since the last aggregation
+ * 
+ * \returns TRUE if aggregation interval is over
+ */
+BOOLEAN
+EFIAPI
+MonitorSample(
+	IN  UINT64  DirBase,
+	IN  UINT64  Window,
+	OUT UINT64 *Samples
+) {
+	for(UINTN i = 0; i < gMonitor.RegionCount; i++) {
+		PDEADWING_MONITOR_REGION Region = &gMonitor.Regions[i];
+
+		BOOLEAN Accessed = FALSE;
+		if(Region->SamplePage != 0) {
+			MemWalkPageTablesStepEx(DirBase, Region->SamplePage, Region->SamplePage + 1, Window, MonitorAccessCallback, &Accessed);
+			if(Accessed)
+				Region->Accesses++;
+		}
+
+		Region->SamplePage = MonitorRandomPage(Region);
+		MemWalkPageTablesStepEx(DirBase, Region->SamplePage, Region->SamplePage + 1, Window, MonitorAccessCallback, &Accessed);
+	}
+
+	gMonitor.Samples++;
+	*Samples = gMonitor.Samples;
+
+	return gMonitor.Samples >= gMonitor.AggregationSamples;
+}
+
+/**
+ * \brief Writes heatmap of the current regions
+ * 
+ * \param Entries    Output entries
+ * \param MaxEntries Capacity of the output
+ * 
+ * \returns Count of written entries
+ */
+UINTN
+EFIAPI
+MonitorGetHeatmap(
+	OUT PDEADWING_MONITOR_ENTRY Entries,
+	IN  UINTN                   MaxEntries
+) {
+	UINTN Count = MIN(gMonitor.RegionCount, MaxEntries);
+
+	for(UINTN i = 0; i < Count; i++) {
+		Entries[i].Address = gMonitor.Regions[i].Start;
+		Entries[i].Pages = (UINT32)MIN((gMonitor.Regions[i].End - gMonitor.Regions[i].Start) >> EFI_PAGE_SHIFT, MAX_UINT32);
+		Entries[i].Accesses = (UINT16)gMonitor.Regions[i].Accesses;
+		Entries[i].Age = (UINT16)MIN(gMonitor.Regions[i].Age, MAX_UINT16);
+	}
+
+	return Count;
+}
+
+/**
+ * \brief Finishes aggregation interval.
+ * 
+ * Ages are updated, adjacent regions with similar access frequency are merged,
+ * counters are reset and regions are split at random points while there're less
+ * than half of max regions, so the regions adapt to the access pattern
+ */
+VOID
+EFIAPI
+MonitorAggregate(
+	VOID
+) {
+	UINT32 Threshold = MAX(gMonitor.AggregationSamples / 10, 1);
+	UINT64 MaxSize = MAX(gMonitor.TotalSize / gMonitor.MinRegions, EFI_PAGE_SIZE);
+
+	// regions with stable frequency get older
+	for(UINTN i = 0; i < gMonitor.RegionCount; i++) {
+		PDEADWING_MONITOR_REGION Region = &gMonitor.Regions[i];
+
+		UINT32 Diff = (Region->Accesses > Region->LastAccesses) ? Region->Accesses - Region->LastAccesses : Region->LastAccesses - Region->Accesses;
+		Region->Age = (Diff > Threshold) ? 0 : Region->Age + 1;
+	}
+
+	// merge adjacent regions with similar frequency
+	UINTN Count = 0;
+	for(UINTN i = 0; i < gMonitor.RegionCount; i++) {
+		PDEADWING_MONITOR_REGION Region = &gMonitor.Regions[i];
+
+		if(Count != 0) {
+			PDEADWING_MONITOR_REGION Prev = &gMonitor.Regions[Count - 1];
+
+			UINT64 PrevSize = Prev->End - Prev->Start;
+			UINT64 Size = Region->End - Region->Start;
+			UINT32 Diff = (Region->Accesses > Prev->Accesses) ? Region->Accesses - Prev->Accesses : Prev->Accesses - Region->Accesses;
+
+			if(Prev->End == Region->Start && Diff <= Threshold && PrevSize + Size <= MaxSize) {
+				// weighted by size
+				Prev->Accesses = (UINT32)((Prev->Accesses * PrevSize + Region->Accesses * Size) / (PrevSize + Size));
+				Prev->Age = (UINT32)((Prev->Age * PrevSize + Region->Age * Size) / (PrevSize + Size));
+				Prev->End = Region->End;
+				continue;
+			}
+		}
+
+		gMonitor.Regions[Count++] = *Region;
+	}
+
+	gMonitor.RegionCount = Count;
+
+	for(UINTN i = 0; i < gMonitor.RegionCount; i++) {
+		gMonitor.Regions[i].LastAccesses = gMonitor.Regions[i].Accesses;
+		gMonitor.Regions[i].Accesses = 0;
+	}
+
+	// split every region into two while there's enough room
+	if(gMonitor.RegionCount < gMonitor.MaxRegions / 2) {
+		CopyMem(gMonitorScratch, gMonitor.Regions, gMonitor.RegionCount * sizeof(DEADWING_MONITOR_REGION));
+
+		Count = 0;
+		for(UINTN i = 0; i < gMonitor.RegionCount; i++) {
+			DEADWING_MONITOR_REGION Region = gMonitorScratch[i];
+			UINT64 Pages = (Region.End - Region.Start) >> EFI_PAGE_SHIFT;
+
+			// keep room for the rest of regions
+			if(Pages < 2 || Count + (gMonitor.RegionCount - i) + 1 > gMonitor.MaxRegions) {
+				gMonitor.Regions[Count++] = Region;
+				continue;
+			}
+
+			UINT64 Split = Region.Start + (1 + MonitorRandom() % (Pages - 1)) * EFI_PAGE_SIZE;
+
+			gMonitor.Regions[Count] = Region;
+			gMonitor.Regions[Count].End = Split;
+			gMonitor.Regions[Count].SamplePage = 0;
+			Count++;
+
+			gMonitor.Regions[Count] = Region;
+			gMonitor.Regions[Count].Start = Split;
+			gMonitor.Regions[Count].SamplePage = 0;
+			Count++;
+		}
+
+		gMonitor.RegionCount = Count;
+	}
+
+	gMonitor.Samples = 0;
+}
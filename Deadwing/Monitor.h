@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Defs.h"
+
+EFI_STATUS
+EFIAPI
+MonitorStart(
+	IN CONST DEADWING_MONITOR_REQUEST *Request
+);
+
+BOOLEAN
+EFIAPI
+MonitorIsActive(
+	VOID
+);
+
+UINT64
+EFIAPI
+MonitorGetProcessId(
+	VOID
+);
+
+BOOLEAN
+EFIAPI
+MonitorSample(
+	IN  UINT64  DirBase,
+	IN  UINT64  Window,
+	OUT UINT64 *Samples
+);
+
+UINTN
+EFIAPI
+MonitorGetHeatmap(
+	OUT PDEADWING_MONITOR_ENTRY Entries,
+	IN  UINTN                   MaxEntries
+);
+
+VOID
+EFIAPI
+MonitorAggregate(
+	VOID
+);
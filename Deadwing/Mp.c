@@ -0,0 +1,321 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "Conf.h"
+#include "Globals.h"
+#include "Defs.h"
+#include "Log.h"
+#include "Trace.h"
+#include "Stats.h"
+#include "Memory.h"
+#include "Mp.h"
+
+typedef struct _DEADWING_MP_JOB {
+	DEADWING_MP_WORKER  Worker;
+	VOID               *Context;
+	UINT64              Start;
+	UINT64              End;
+	EFI_STATUS          Status;
+	BOOLEAN             Deferred;
+	volatile BOOLEAN    Done;
+} DEADWING_MP_JOB, *PDEADWING_MP_JOB;
+
+typedef struct _DEADWING_MP_SLOT {
+	DEADWING_MP_CPU Cpu;
+	DEADWING_MP_JOB Job;
+} DEADWING_MP_SLOT, *PDEADWING_MP_SLOT;
+
+// per-CPU remap windows and bounce pages, allocated on the first dispatch
+STATIC DEADWING_MP_SLOT *gMpSlots;
+STATIC UINTN gMpCpuCount;
+
+// APs take part in dispatching only if every window has its own PTE
+STATIC BOOLEAN gMpParallel;
+
+
+/**
+ * \brief Allocates remap window and bounce page for every CPU.
+ * 
+ * Count of CPUs is known only inside SMI, so allocation is done lazily. Windows
+ * are allocated page-by-page, so every CPU remaps only its own PTE. If SMM page tables
+ * map some window with a large page, remap would change the shared PDE (PDPE) and
+ * stale TLBs of other CPUs, so everything is processed by the BSP then
+ * 
+ * \return EFI_SUCCESS - Per-CPU contexts are ready
+ * \return Other - Unable to allocate contexts
+ */
+EFI_STATUS
+EFIAPI
+MpInitialize(
+	VOID
+) {
+	if(gMpSlots != NULL)
+		return EFI_SUCCESS;
+
+	UINTN Count = MIN(gSmst2->NumberOfCpus, DEADWING_MP_MAX_CPUS);
+	if(Count == 0)
+		Count = 1;
+
+	DEADWING_MP_SLOT *Slots;
+	EFI_STATUS Status = gSmst2->SmmAllocatePool(EfiRuntimeServicesData, sizeof(DEADWING_MP_SLOT) * Count, (VOID **)&Slots);
+	if(EFI_ERROR(Status)) {
+		LOG_ERROR("[ SMM ] Unable to allocate per-CPU contexts\r\n");
+		return Status;
+	}
+
+	ZeroMem(Slots, sizeof(DEADWING_MP_SLOT) * Count);
+
+	for(UINTN i = 0; i < Count; i++) {
+		Status = gSmst2->SmmAllocatePages(AllocateAnyPages, EfiRuntimeServicesData, 1, &Slots[i].Cpu.Window);
+		if(EFI_ERROR(Status))
+			break;
+
+		Status = gSmst2->SmmAllocatePages(AllocateAnyPages, EfiRuntimeServicesData, 1, &Slots[i].Cpu.Bounce);
+		if(EFI_ERROR(Status))
+			break;
+	}
+
+	if(EFI_ERROR(Status)) {
+		LOG_ERROR("[ SMM ] Unable to allocate per-CPU remap windows\r\n");
+
+		for(UINTN i = 0; i < Count; i++) {
+			if(Slots[i].Cpu.Window)
+				gSmst2->SmmFreePages(Slots[i].Cpu.Window, 1);
+
+			if(Slots[i].Cpu.Bounce)
+				gSmst2->SmmFreePages(Slots[i].Cpu.Bounce, 1);
+		}
+
+		gSmst2->SmmFreePool(Slots);
+
+		return Status;
+	}
+
+	gMpParallel = TRUE;
+	for(UINTN i = 0; i < Count; i++) {
+		MemRegisterWindow(Slots[i].Cpu.Window);
+
+		if(gMpParallel && !MemIsMappedBy4KbPage(Slots[i].Cpu.Window)) {
+			LOG_INFO("[ SMM ] Remap window is mapped by a large page, APs aren't used\r\n");
+			gMpParallel = FALSE;
+		}
+	}
+
+	STATS_ADD(InterimPages, Count * 2);
+
+	gMpCpuCount = Count;
+	gMpSlots = Slots;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Returns count of CPUs which can take part in dispatching
+ * 
+ * \returns Count of CPUs, 0 if per-CPU contexts can't be allocated
+ */
+UINTN
+EFIAPI
+MpGetCpuCount(
+	VOID
+) {
+	if(EFI_ERROR(MpInitialize()))
+		return 0;
+
+	return gMpCpuCount;
+}
+
+/**
+ * \brief Returns length of data processed by all CPUs between two budget checks
+ * 
+ * \returns Batch length in bytes
+ */
+UINT64
+EFIAPI
+MpGetBatchLength(
+	VOID
+) {
+	UINTN Count = MpGetCpuCount();
+	if(!gMpParallel)
+		Count = 1;
+
+	return MAX(Count, 1) * DEADWING_MP_BATCH_PAGES * EFI_PAGE_SIZE;
+}
+
+/**
+ * \brief Returns remap window and bounce page of the current CPU
+ * 
+ * \returns Context of the current CPU, NULL if per-CPU contexts can't be allocated
+ */
+PDEADWING_MP_CPU
+EFIAPI
+MpGetCurrentCpu(
+	VOID
+) {
+	if(MpGetCpuCount() == 0 || gSmst2->CurrentlyExecutingCpu >= gMpCpuCount)
+		return NULL;
+
+	return &gMpSlots[gSmst2->CurrentlyExecutingCpu].Cpu;
+}
+
+/**
+ * \brief Clears phase timings of all CPUs before the next command
+ */
+VOID
+EFIAPI
+MpResetTiming(
+	VOID
+) {
+	for(UINTN i = 0; i < MpGetCpuCount(); i++)
+		ZeroMem(&gMpSlots[i].Cpu.Timing, sizeof(DEADWING_TIMING));
+}
+
+/**
+ * \brief Sums phase timings of all CPUs.
+ * 
+ * Phases which were executed in parallel are accounted as total CPU time, so sum of phases
+ * can exceed wall time of the command
+ * 
+ * \param Timing Summed phase timings
+ */
+VOID
+EFIAPI
+MpCollectTiming(
+	OUT PDEADWING_TIMING Timing
+) {
+	ZeroMem(Timing, sizeof(DEADWING_TIMING));
+
+	for(UINTN i = 0; i < MpGetCpuCount(); i++) {
+		DEADWING_TIMING *Cpu = &gMpSlots[i].Cpu.Timing;
+
+		Timing->DirBase           += Cpu->DirBase;
+		Timing->TargetTranslate   += Cpu->TargetTranslate;
+		Timing->ConsumerTranslate += Cpu->ConsumerTranslate;
+		Timing->Copy              += Cpu->Copy;
+		Timing->Restore           += Cpu->Restore;
+	}
+}
+
+/**
+ * \brief AP procedure, runs a single job on the remap window of the current AP
+ * 
+ * \param Buffer CPU slot
+ */
+VOID
+EFIAPI
+MpApProcedure(
+	IN OUT VOID *Buffer
+) {
+	DEADWING_MP_SLOT *Slot = (DEADWING_MP_SLOT *)Buffer;
+
+	Slot->Job.Status = Slot->Job.Worker(&Slot->Cpu, Slot->Job.Context, Slot->Job.Start, Slot->Job.End);
+
+	MemoryFence();
+
+	Slot->Job.Done = TRUE;
+}
+
+/**
+ * \brief Splits range between all available CPUs and waits for results.
+ * 
+ * Range is split into slices aligned to granularity, one per CPU. APs are started via 
+ * SmmStartupThisAp, the BSP processes its own slice and then slices of APs which
+ * can't be started (not checked in, busy, etc.). Worker always receives remap window 
+ * and bounce page of the CPU it runs on
+ * 
+ * \param Worker      Routine which processes [Start, End) part of the range
+ * \param Context     Worker context
+ * \param Start       Start of the range
+ * \param Length      Length of the range
+ * \param Granularity Min length of a slice, ranges not longer than it are processed by the BSP
+ * 
+ * \return EFI_SUCCESS - All slices are processed
+ * \return EFI_OUT_OF_RESOURCES - Unable to allocate per-CPU contexts
+ * \return Other - First error returned by worker
+ */
+EFI_STATUS
+EFIAPI
+MpDispatch(
+	IN DEADWING_MP_WORKER  Worker,
+	IN VOID               *Context,
+	IN UINT64              Start,
+	IN UINT64              Length,
+	IN UINT64              Granularity
+) {
+	UINTN Count = MpGetCpuCount();
+	if(Count == 0)
+		return EFI_OUT_OF_RESOURCES;
+
+	UINTN Bsp = gSmst2->CurrentlyExecutingCpu;
+	if(Bsp >= Count) {
+		// BSP has no context in the table, nothing to do
+		LOG_ERROR("[ SMM ] Current CPU is out of per-CPU contexts\r\n");
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	// small requests are not worth the IPIs, APs can't remap if windows share large pages
+	if(!gMpParallel || Count == 1 || Granularity == 0 || Length <= Granularity)
+		return Worker(&gMpSlots[Bsp].Cpu, Context, Start, Start + Length);
+
+#ifdef DEADWING_TRACE
+	UINT64 Tsc = AsmReadTsc();
+#endif
+
+	UINT64 Slice = DivU64x64Remainder(Length + Count - 1, Count, NULL);
+	Slice = MultU64x64(DivU64x64Remainder(Slice + Granularity - 1, Granularity, NULL), Granularity);
+
+	// start APs
+	UINT64 Offset = Start;
+	for(UINTN i = 0; i < Count; i++) {
+		DEADWING_MP_JOB *Job = &gMpSlots[i].Job;
+
+		Job->Worker = Worker;
+		Job->Context = Context;
+		Job->Start = MIN(Offset, Start + Length);
+		Job->End = MIN(Offset + Slice, Start + Length);
+		Job->Status = EFI_SUCCESS;
+		Job->Deferred = TRUE;
+		Job->Done = FALSE;
+
+		Offset = Job->End;
+
+		if(i == Bsp || Job->Start == Job->End)
+			continue;
+
+		MemoryFence();
+
+		if(!EFI_ERROR(gSmst2->SmmStartupThisAp(MpApProcedure, i, &gMpSlots[i])))
+			Job->Deferred = FALSE;
+	}
+
+	// process own slice and slices of APs which aren't started
+	for(UINTN i = 0; i < Count; i++) {
+		DEADWING_MP_JOB *Job = &gMpSlots[i].Job;
+		if(!Job->Deferred)
+			continue;
+
+		if(Job->Start != Job->End)
+			Job->Status = Worker(&gMpSlots[Bsp].Cpu, Context, Job->Start, Job->End);
+
+		Job->Done = TRUE;
+	}
+
+	// join results
+	EFI_STATUS Status = EFI_SUCCESS;
+	for(UINTN i = 0; i < Count; i++) {
+		DEADWING_MP_JOB *Job = &gMpSlots[i].Job;
+
+		while(!Job->Done)
+			CpuPause();
+
+		if(EFI_ERROR(Job->Status) && !EFI_ERROR(Status))
+			Status = Job->Status;
+	}
+
+	TRACE(DEADWING_TRACE_MP_DISPATCH, 4, Start, Length, Count, AsmReadTsc() - Tsc);
+
+	return Status;
+}
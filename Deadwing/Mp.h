@@ -0,0 +1,55 @@
+#pragma once
+
+typedef struct _DEADWING_MP_CPU {
+	UINT64 Window;
+	UINT64 Bounce;
+
+	DEADWING_TIMING Timing;
+} DEADWING_MP_CPU, *PDEADWING_MP_CPU;
+
+typedef EFI_STATUS (EFIAPI *DEADWING_MP_WORKER)(
+	IN PDEADWING_MP_CPU  Cpu,
+	IN VOID             *Context,
+	IN UINT64            Start,
+	IN UINT64            End
+);
+
+UINTN
+EFIAPI
+MpGetCpuCount(
+	VOID
+);
+
+UINT64
+EFIAPI
+MpGetBatchLength(
+	VOID
+);
+
+PDEADWING_MP_CPU
+EFIAPI
+MpGetCurrentCpu(
+	VOID
+);
+
+VOID
+EFIAPI
+MpResetTiming(
+	VOID
+);
+
+VOID
+EFIAPI
+MpCollectTiming(
+	OUT PDEADWING_TIMING Timing
+);
+
+EFI_STATUS
+EFIAPI
+MpDispatch(
+	IN DEADWING_MP_WORKER  Worker,
+	IN VOID               *Context,
+	IN UINT64              Start,
+	IN UINT64              Length,
+	IN UINT64              Granularity
+);
@@ -3,7 +3,8 @@
 #include "Globals.h"
 #include "Defs.h"
 #include "Utils.h"
-#include "Serial.h"
+#include "Log.h"
+#include "Stats.h"
 #include "Memory.h"
 
 #define NT_SYSTEM_PID 4
@@ -14,6 +15,15 @@
 #define EPROCESS_ACTIVE_PROCESS_LINKS_OFFSET 0x448
 #define EPROCESS_TOKEN_OFFSET                0x4B8
 
+typedef struct _DEADWING_PID_CACHE_ENTRY {
+	UINT64 ProcessId;
+	UINT64 DirBase;
+	UINT64 Eprocess;
+} DEADWING_PID_CACHE_ENTRY, *PDEADWING_PID_CACHE_ENTRY;
+
+STATIC DEADWING_PID_CACHE_ENTRY gPidCache[DEADWING_PID_CACHE_ENTRIES];
+STATIC UINTN gPidCacheNext;
+
 
 /**
  * \brief Gets the dir base of a particular process by searching for 
@@ -62,7 +72,7 @@ NtGetDirBaseByPid(
 
 				TargetDirBase = *(UINT64 *)((UINT8 *)CurrentEprocess + EPROCESS_DIRBASE_OFFSET);
 
-				SerialPrint("[ SMM ] Process located\r\n");
+				LOG_DEBUG("[ SMM ] Process located\r\n");
 
 				break;
 			}
@@ -76,6 +86,96 @@ NtGetDirBaseByPid(
 	return TargetDirBase;
 }
 
+/**
+ * \brief Reads field of EPROCESS, field may lie on the other page than the beginning of EPROCESS
+ * 
+ * \param Eprocess Physical address of EPROCESS
+ * \param Offset   Offset of the field
+ * \param Value    Value of the field
+ * 
+ * \return TRUE if field has been read
+ */
+BOOLEAN
+EFIAPI
+NtReadEprocessField(
+	IN  UINT64  Eprocess,
+	IN  UINT64  Offset,
+	OUT UINT64 *Value
+) {
+	UINT64 Mapped = MemProcessOutsideSmramPhysMemory(Eprocess + Offset);
+	if(Mapped == 0)
+		return FALSE;
+
+	*Value = *(UINT64 *)Mapped;
+
+	MemRestoreSmramMappings();
+
+	return TRUE;
+}
+
+/**
+ * \brief Looks up dir base of the process in the PID cache.
+ * 
+ * Entry is valid only if EPROCESS it came from still has the same PID and dir base,
+ * otherwise entry is dropped
+ * 
+ * \param ProcessId Target PID
+ * 
+ * \returns Dir base of the target process or 0, if there's no valid entry
+ */
+UINT64
+EFIAPI
+NtLookupCachedDirBase(
+	IN UINT64 ProcessId
+) {
+	for(UINTN i = 0; i < DEADWING_PID_CACHE_ENTRIES; i++) {
+		PDEADWING_PID_CACHE_ENTRY Entry = &gPidCache[i];
+		if(Entry->Eprocess == 0 || Entry->ProcessId != ProcessId)
+			continue;
+
+		UINT64 Pid;
+		UINT64 DirBase;
+		if(NtReadEprocessField(Entry->Eprocess, EPROCESS_UNIQUE_PROCESS_ID_OFFSET, &Pid) && Pid == ProcessId &&
+		   NtReadEprocessField(Entry->Eprocess, EPROCESS_DIRBASE_OFFSET, &DirBase) && DirBase == Entry->DirBase) {
+			STATS_INC(PidCacheHits);
+			return DirBase;
+		}
+
+		// process has gone, EPROCESS may be reused
+		Entry->Eprocess = 0;
+		break;
+	}
+
+	STATS_INC(PidCacheMisses);
+
+	return 0;
+}
+
+/**
+ * \brief Remembers dir base of the process, the oldest entry is replaced
+ * 
+ * \param ProcessId Target PID
+ * \param DirBase   Dir base of the target process
+ * \param Eprocess  Physical address of EPROCESS of the target process
+ */
+VOID
+EFIAPI
+NtCacheDirBase(
+	IN UINT64 ProcessId,
+	IN UINT64 DirBase,
+	IN UINT64 Eprocess
+) {
+	if(DirBase == 0 || Eprocess == 0)
+		return;
+
+	PDEADWING_PID_CACHE_ENTRY Entry = &gPidCache[gPidCacheNext];
+	Entry->ProcessId = ProcessId;
+	Entry->DirBase = DirBase;
+	Entry->Eprocess = Eprocess;
+
+	gPidCacheNext = (gPidCacheNext + 1) % DEADWING_PID_CACHE_ENTRIES;
+}
+
 /**
  * \brief Changes token of controller process
  * 
@@ -96,7 +196,7 @@ NtExchangeProcessToken(
 	if(SysMapped != 0) {
 		// check if token valid
 		if(((UINT8 *)SysMapped + EPROCESS_TOKEN_OFFSET) == 0) {
-			SerialPrint("[ SMM ] Invalid system token\r\n");
+			LOG_ERROR("[ SMM ] Invalid system token\r\n");
 			return EFI_ABORTED;
 		}
 
@@ -107,14 +207,14 @@ NtExchangeProcessToken(
 		// map controller EPROCESS
 		UINT64 ControllerMapped = MemProcessOutsideSmramPhysMemory(ControllerEprocess);
 		if(ControllerEprocess == 0) {
-			SerialPrint("[ SMM ] Unable to map controller EPROCESS into SMRAM\r\n");
+			LOG_ERROR("[ SMM ] Unable to map controller EPROCESS into SMRAM\r\n");
 			return EFI_ABORTED;
 		}
 
 		// copy token
 		PhysMemCpy(((UINT8 *)ControllerMapped + EPROCESS_TOKEN_OFFSET), &SysToken, sizeof(UINT64));
 	} else {
-		SerialPrint("[ SMM ] Unable to map system EPROCESS into SMRAM\r\n");
+		LOG_ERROR("[ SMM ] Unable to map system EPROCESS into SMRAM\r\n");
 		return EFI_ABORTED;
 	}
 
@@ -9,6 +9,20 @@ NtGetDirBaseByPid(
 	OUT VOID   **TargetEprocess OPTIONAL
 );
 
+UINT64
+EFIAPI
+NtLookupCachedDirBase(
+	IN UINT64 ProcessId
+);
+
+VOID
+EFIAPI
+NtCacheDirBase(
+	IN UINT64 ProcessId,
+	IN UINT64 DirBase,
+	IN UINT64 Eprocess
+);
+
 EFI_STATUS
 EFIAPI
 NtExchangeProcessToken(
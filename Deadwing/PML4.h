@@ -1,5 +1,9 @@
 #pragma once
 
+// accessed and dirty bits have the same position in every leaf entry (PTE, 2MB PDE, 1GB PDPE)
+#define PAGE_ENTRY_ACCESSED  BIT5
+#define PAGE_ENTRY_DIRTY     BIT6
+
 #pragma pack(1)
 
 typedef union _PML4E {
@@ -0,0 +1,79 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "Globals.h"
+#include "SaveState.h"
+#include "Journal.h"
+#include "Profile.h"
+
+STATIC DEADWING_PROFILE_SAMPLE gProfileSamples[DEADWING_PROFILE_SAMPLES];
+STATIC volatile UINT64 gProfileSequences[DEADWING_PROFILE_SAMPLES];
+STATIC DEADWING_JOURNAL gProfile = { gProfileSamples, gProfileSequences, sizeof(DEADWING_PROFILE_SAMPLE), DEADWING_PROFILE_SAMPLES, 0, 0 };
+
+
+/**
+ * \brief Records interrupted context of every CPU from its save state into the journal.
+ * 
+ * Sample of the CPU which triggered the SMI always points to the trigger itself.
+ * Oldest samples are overwritten once the journal is full
+ * 
+ * \param SampleCount Count of recorded samples
+ * 
+ * \return EFI_SUCCESS - Samples have been recorded
+ * \return EFI_UNSUPPORTED - SMM CPU protocol is not available
+ */
+EFI_STATUS
+EFIAPI
+ProfileSample(
+	OUT UINTN *SampleCount
+) {
+	*SampleCount = 0;
+
+	UINT64 Tsc = AsmReadTsc();
+
+	for(UINTN Cpu = 0; Cpu < gSmst2->NumberOfCpus; Cpu++) {
+		DEADWING_PROFILE_SAMPLE Sample;
+		UINT32 Cs = 0;
+
+		// CPU may be absent or not rendezvoused
+		EFI_STATUS Status = SaveStateRead(Cpu, EFI_SMM_SAVE_STATE_REGISTER_RIP, sizeof(UINT64), &Sample.Rip);
+		if(Status == EFI_UNSUPPORTED)
+			return Status;
+
+		if(EFI_ERROR(Status))
+			continue;
+
+		SaveStateRead(Cpu, EFI_SMM_SAVE_STATE_REGISTER_RSP, sizeof(UINT64), &Sample.Rsp);
+		SaveStateRead(Cpu, EFI_SMM_SAVE_STATE_REGISTER_CR3, sizeof(UINT64), &Sample.Cr3);
+		SaveStateRead(Cpu, EFI_SMM_SAVE_STATE_REGISTER_CS, sizeof(UINT32), &Cs);
+
+		Sample.Tsc = Tsc;
+		Sample.Cpu = (UINT32)Cpu;
+		Sample.Cpl = (UINT8)(Cs & 3);
+		ZeroMem(Sample.Reserved, sizeof(Sample.Reserved));
+
+		UINT64 Sequence;
+		CopyMem(JournalReserve(&gProfile, &Sequence), &Sample, sizeof(DEADWING_PROFILE_SAMPLE));
+		JournalCommit(&gProfile, Sequence);
+
+		(*SampleCount)++;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Returns journal of the profiler, samples are drained by the controller
+ * 
+ * \returns Journal of DEADWING_PROFILE_SAMPLE
+ */
+PDEADWING_JOURNAL
+EFIAPI
+ProfileGetJournal(
+	VOID
+) {
+	return &gProfile;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "Conf.h"
+#include "Defs.h"
+
+EFI_STATUS
+EFIAPI
+ProfileSample(
+	OUT UINTN *SampleCount
+);
+
+PDEADWING_JOURNAL
+EFIAPI
+ProfileGetJournal(
+	VOID
+);
@@ -0,0 +1,131 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/SmmMemLib.h>
+
+#include "Log.h"
+#include "Ring.h"
+
+#define RING_SIZE (sizeof(DEADWING_RING) + DEADWING_RING_SQ_ENTRIES * sizeof(DEADWING_RING_SUBMISSION) + DEADWING_RING_CQ_ENTRIES * sizeof(DEADWING_RING_COMPLETION))
+
+// entries follow the header, ring sizes should be a power of two
+#define RING_SQ(Ring)              ((PDEADWING_RING_SUBMISSION)((Ring) + 1))
+#define RING_CQ(Ring)              ((PDEADWING_RING_COMPLETION)(RING_SQ(Ring) + DEADWING_RING_SQ_ENTRIES))
+#define RING_SQ_SLOT(Sequence)     ((UINTN)(Sequence) & (DEADWING_RING_SQ_ENTRIES - 1))
+#define RING_CQ_SLOT(Sequence)     ((UINTN)(Sequence) & (DEADWING_RING_CQ_ENTRIES - 1))
+
+
+/**
+ * \brief Validates rings passed by the KM driver
+ * 
+ * \param Address Address of the rings
+ * 
+ * \return EFI_SUCCESS - Rings can be used
+ * \return EFI_INVALID_PARAMETER - Rings are absent or their layout doesn't match SMM one
+ * \return EFI_SECURITY_VIOLATION - Rings overlap SMRAM
+ */
+EFI_STATUS
+EFIAPI
+RingValidate(
+	IN VOID *Address
+) {
+	if(Address == NULL)
+		return EFI_INVALID_PARAMETER;
+
+	if(!SmmIsBufferOutsideSmmValid((EFI_PHYSICAL_ADDRESS)(UINTN)Address, RING_SIZE)) {
+		LOG_ERROR("[ SMM ] Rings overlap SMRAM!\r\n");
+		return EFI_SECURITY_VIOLATION;
+	}
+
+	PDEADWING_RING Ring = (PDEADWING_RING)Address;
+	if(Ring->SqEntries != DEADWING_RING_SQ_ENTRIES || Ring->CqEntries != DEADWING_RING_CQ_ENTRIES) {
+		LOG_ERROR("[ SMM ] Layout of the rings doesn't match\r\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Copies command at the head of the submission ring into SMRAM. Command
+ * isn't taken if there's no free slot for its completion
+ * 
+ * \param Ring  Rings
+ * \param Entry Receives the command
+ * 
+ * \return EFI_SUCCESS - Command has been copied
+ * \return EFI_NOT_FOUND - Submission ring is empty
+ * \return EFI_OUT_OF_RESOURCES - Completion ring is full
+ * \return EFI_COMPROMISED_DATA - Indices of the rings are corrupted
+ */
+EFI_STATUS
+EFIAPI
+RingPeek(
+	IN  PDEADWING_RING            Ring,
+	OUT PDEADWING_RING_SUBMISSION Entry
+) {
+	UINT64 SqHead = Ring->SqHead;
+	UINT64 SqTail = Ring->SqTail;
+	UINT64 CqHead = Ring->CqHead;
+	UINT64 CqTail = Ring->CqTail;
+
+	if(SqTail - SqHead > DEADWING_RING_SQ_ENTRIES || CqTail - CqHead > DEADWING_RING_CQ_ENTRIES)
+		return EFI_COMPROMISED_DATA;
+
+	if(SqHead == SqTail)
+		return EFI_NOT_FOUND;
+
+	if(CqTail - CqHead == DEADWING_RING_CQ_ENTRIES)
+		return EFI_OUT_OF_RESOURCES;
+
+	// ring is shared with the OS, so command is used only from the copy
+	CopyMem(Entry, &RING_SQ(Ring)[RING_SQ_SLOT(SqHead)], sizeof(DEADWING_RING_SUBMISSION));
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Saves progress of the partially performed command at the head of the submission ring
+ * 
+ * \param Ring   Rings
+ * \param Cursor Resume cursor of the command
+ */
+VOID
+EFIAPI
+RingSaveCursor(
+	IN PDEADWING_RING Ring,
+	IN UINT64         Cursor
+) {
+	RING_SQ(Ring)[RING_SQ_SLOT(Ring->SqHead)].Cursor = Cursor;
+}
+
+/**
+ * \brief Posts status of the command at the head of the submission ring and
+ * removes it from the ring. Caller should check free slot with RingPeek first
+ * 
+ * \param Ring     Rings
+ * \param UserData Tag of the command
+ * \param Status   Status of the command
+ * \param Value    Result of the command (if any)
+ */
+VOID
+EFIAPI
+RingComplete(
+	IN PDEADWING_RING Ring,
+	IN UINT64         UserData,
+	IN EFI_STATUS     Status,
+	IN UINT64         Value
+) {
+	PDEADWING_RING_COMPLETION Completion = &RING_CQ(Ring)[RING_CQ_SLOT(Ring->CqTail)];
+	Completion->UserData = UserData;
+	Completion->Status = Status;
+	Completion->Value = Value;
+
+	// completion should be visible before the tail
+	MemoryFence();
+
+	Ring->CqTail++;
+	Ring->SqHead++;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Conf.h"
+#include "Defs.h"
+
+EFI_STATUS
+EFIAPI
+RingValidate(
+	IN VOID *Address
+);
+
+EFI_STATUS
+EFIAPI
+RingPeek(
+	IN  PDEADWING_RING            Ring,
+	OUT PDEADWING_RING_SUBMISSION Entry
+);
+
+VOID
+EFIAPI
+RingSaveCursor(
+	IN PDEADWING_RING Ring,
+	IN UINT64         Cursor
+);
+
+VOID
+EFIAPI
+RingComplete(
+	IN PDEADWING_RING Ring,
+	IN UINT64         UserData,
+	IN EFI_STATUS     Status,
+	IN UINT64         Value
+);
@@ -0,0 +1,97 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "Globals.h"
+#include "Log.h"
+#include "SaveState.h"
+
+STATIC EFI_SMM_CPU_PROTOCOL *gSmmCpu;
+
+// general purpose registers in the order of DEADWING_CPU_REGISTERS
+STATIC CONST EFI_SMM_SAVE_STATE_REGISTER gGprRegisters[] = {
+	EFI_SMM_SAVE_STATE_REGISTER_RAX, EFI_SMM_SAVE_STATE_REGISTER_RBX, EFI_SMM_SAVE_STATE_REGISTER_RCX, EFI_SMM_SAVE_STATE_REGISTER_RDX,
+	EFI_SMM_SAVE_STATE_REGISTER_RSI, EFI_SMM_SAVE_STATE_REGISTER_RDI, EFI_SMM_SAVE_STATE_REGISTER_RBP, EFI_SMM_SAVE_STATE_REGISTER_RSP,
+	EFI_SMM_SAVE_STATE_REGISTER_R8,  EFI_SMM_SAVE_STATE_REGISTER_R9,  EFI_SMM_SAVE_STATE_REGISTER_R10, EFI_SMM_SAVE_STATE_REGISTER_R11,
+	EFI_SMM_SAVE_STATE_REGISTER_R12, EFI_SMM_SAVE_STATE_REGISTER_R13, EFI_SMM_SAVE_STATE_REGISTER_R14, EFI_SMM_SAVE_STATE_REGISTER_R15
+};
+
+
+/**
+ * \brief Reads register from the save state of the given CPU.
+ * 
+ * SMM CPU protocol is located on first use, it's installed after our driver is loaded
+ * 
+ * \param Cpu      CPU index
+ * \param Register Save state register
+ * \param Width    Width of the register
+ * \param Value    Value of the register, zero extended
+ * 
+ * \return EFI_SUCCESS - Register has been read
+ * \return EFI_UNSUPPORTED - SMM CPU protocol is not available
+ * \return Other - CPU has no save state or register is not available
+ */
+EFI_STATUS
+EFIAPI
+SaveStateRead(
+	IN  UINTN                        Cpu,
+	IN  EFI_SMM_SAVE_STATE_REGISTER  Register,
+	IN  UINTN                        Width,
+	OUT UINT64                      *Value
+) {
+	*Value = 0;
+
+	if(gSmmCpu == NULL) {
+		EFI_STATUS Status = gSmst2->SmmLocateProtocol(&gEfiSmmCpuProtocolGuid, NULL, (VOID **)&gSmmCpu);
+		if(EFI_ERROR(Status)) {
+			LOG_ERROR("[ SMM ] Unable to locate SMM CPU protocol\r\n");
+			gSmmCpu = NULL;
+			return EFI_UNSUPPORTED;
+		}
+	}
+
+	return gSmmCpu->ReadSaveState(gSmmCpu, Width, Register, Cpu, Value);
+}
+
+/**
+ * \brief Reads interrupted register context of the given CPU from its save state
+ * 
+ * \param Cpu       CPU index
+ * \param Registers Receives registers, Valid is 0 if CPU has no save state
+ * 
+ * \return EFI_SUCCESS - Registers have been read
+ * \return EFI_UNSUPPORTED - SMM CPU protocol is not available
+ * \return Other - CPU has no save state
+ */
+EFI_STATUS
+EFIAPI
+SaveStateSnapshot(
+	IN  UINTN                    Cpu,
+	OUT PDEADWING_CPU_REGISTERS  Registers
+) {
+	ZeroMem(Registers, sizeof(DEADWING_CPU_REGISTERS));
+	Registers->Cpu = (UINT32)Cpu;
+
+	// CPU may be absent or not rendezvoused
+	EFI_STATUS Status = SaveStateRead(Cpu, EFI_SMM_SAVE_STATE_REGISTER_RIP, sizeof(UINT64), &Registers->Rip);
+	if(EFI_ERROR(Status))
+		return Status;
+
+	for(UINTN i = 0; i < ARRAY_SIZE(gGprRegisters); i++)
+		SaveStateRead(Cpu, gGprRegisters[i], sizeof(UINT64), &Registers->Gpr[i]);
+
+	SaveStateRead(Cpu, EFI_SMM_SAVE_STATE_REGISTER_RFLAGS, sizeof(UINT64), &Registers->Rflags);
+	SaveStateRead(Cpu, EFI_SMM_SAVE_STATE_REGISTER_CR0, sizeof(UINT64), &Registers->Cr0);
+	SaveStateRead(Cpu, EFI_SMM_SAVE_STATE_REGISTER_CR3, sizeof(UINT64), &Registers->Cr3);
+	SaveStateRead(Cpu, EFI_SMM_SAVE_STATE_REGISTER_CR4, sizeof(UINT64), &Registers->Cr4);
+	SaveStateRead(Cpu, EFI_SMM_SAVE_STATE_REGISTER_CS, sizeof(UINT32), &Registers->Cs);
+
+	// EFER is not exposed by the protocol, LMA reports mode of the CPU (32 or 64). Only byte access is supported
+	SaveStateRead(Cpu, EFI_SMM_SAVE_STATE_REGISTER_LMA, sizeof(UINT8), &Registers->Lma);
+
+	Registers->Valid = 1;
+
+	return EFI_SUCCESS;
+}
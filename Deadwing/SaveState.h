@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Protocol/SmmCpu.h>
+
+#include "Conf.h"
+#include "Defs.h"
+
+EFI_STATUS
+EFIAPI
+SaveStateRead(
+	IN  UINTN                        Cpu,
+	IN  EFI_SMM_SAVE_STATE_REGISTER  Register,
+	IN  UINTN                        Width,
+	OUT UINT64                      *Value
+);
+
+EFI_STATUS
+EFIAPI
+SaveStateSnapshot(
+	IN  UINTN                    Cpu,
+	OUT PDEADWING_CPU_REGISTERS  Registers
+);
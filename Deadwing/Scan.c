@@ -0,0 +1,193 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "Defs.h"
+#include "Scan.h"
+
+#define SCAN_LOW_BITS  0x0101010101010101ULL
+#define SCAN_HIGH_BITS 0x8080808080808080ULL
+
+
+/**
+ * \brief Compiles patterns for the word-at-a-time matcher.
+ * 
+ * Bytes of every pattern are pre-masked and packed into 64-bit words. Anchor is
+ * a fully masked byte which is searched with SWAR zero-byte test over 8 positions
+ * at once, full comparison is done only for candidates. Bytes which are common
+ * in memory (0x00, 0xFF) are avoided as anchors if possible. 
+ * 
+ * \note SSE/AVX are not used: SMM entry code doesn't save XMM/YMM state of the
+ * interrupted context, so plain 64-bit arithmetic is the safe option here
+ * 
+ * \param Matcher      Output matcher
+ * \param Patterns     Patterns with masks (0xFF - byte must match, 0x00 - wildcard)
+ * \param PatternCount Count of patterns
+ * 
+ * \return TRUE - Patterns have been compiled
+ * \return FALSE - Count or length of any pattern is invalid
+ */
+BOOLEAN
+EFIAPI
+ScanCompile(
+	OUT PDEADWING_SCAN_MATCHER  Matcher,
+	IN  CONST DEADWING_SCAN_PATTERN *Patterns,
+	IN  UINT32                  PatternCount
+) {
+	if(PatternCount == 0 || PatternCount > DEADWING_SCAN_MAX_PATTERNS)
+		return FALSE;
+
+	ZeroMem(Matcher, sizeof(DEADWING_SCAN_MATCHER));
+	Matcher->PatternCount = PatternCount;
+
+	for(UINT32 i = 0; i < PatternCount; i++) {
+		CONST DEADWING_SCAN_PATTERN *Pattern = &Patterns[i];
+		DEADWING_SCAN_COMPILED *Compiled = &Matcher->Patterns[i];
+
+		if(Pattern->Length == 0 || Pattern->Length > DEADWING_SCAN_MAX_PATTERN_LENGTH)
+			return FALSE;
+
+		Compiled->Length = Pattern->Length;
+		Compiled->Anchor = -1;
+
+		// bytes beyond the pattern stay with zero mask
+		UINT8 *Bytes = (UINT8 *)Compiled->Bytes;
+		UINT8 *Mask = (UINT8 *)Compiled->Mask;
+		for(UINT32 j = 0; j < Pattern->Length; j++) {
+			Mask[j] = Pattern->Mask[j];
+			Bytes[j] = Pattern->Bytes[j] & Pattern->Mask[j];
+
+			if(Mask[j] != 0xFF)
+				continue;
+
+			// pick the first fully masked byte, prefer rare ones
+			if(Compiled->Anchor < 0 || ((Bytes[Compiled->Anchor] == 0x00 || Bytes[Compiled->Anchor] == 0xFF) && Bytes[j] != 0x00 && Bytes[j] != 0xFF))
+				Compiled->Anchor = (INT32)j;
+		}
+
+		if(Compiled->Anchor >= 0)
+			Compiled->Broadcast = Bytes[Compiled->Anchor] * SCAN_LOW_BITS;
+
+		Matcher->MaxLength = MAX(Matcher->MaxLength, Pattern->Length);
+	}
+
+	return TRUE;
+}
+
+/**
+ * \brief Compares candidate with compiled pattern
+ * 
+ * \param Pattern   Compiled pattern
+ * \param Data      Candidate
+ * \param Available Count of bytes which can be read from candidate
+ * 
+ * \return TRUE - Candidate matches pattern
+ * \return FALSE - Candidate doesn't match pattern
+ */
+STATIC
+BOOLEAN
+ScanVerify(
+	IN CONST DEADWING_SCAN_COMPILED *Pattern,
+	IN CONST UINT8                  *Data,
+	IN UINTN                         Available
+) {
+	CONST UINT8 *Bytes = (CONST UINT8 *)Pattern->Bytes;
+	CONST UINT8 *Mask = (CONST UINT8 *)Pattern->Mask;
+
+	for(UINTN j = 0; j < Pattern->Length; j += sizeof(UINT64)) {
+		// whole word can be compared at once, padding has zero mask
+		if(j + sizeof(UINT64) <= Available) {
+			if((ReadUnaligned64((CONST UINT64 *)(Data + j)) & Pattern->Mask[j / sizeof(UINT64)]) != Pattern->Bytes[j / sizeof(UINT64)])
+				return FALSE;
+
+			continue;
+		}
+
+		for(UINTN k = j; k < Pattern->Length; k++) {
+			if((Data[k] & Mask[k]) != Bytes[k])
+				return FALSE;
+		}
+
+		break;
+	}
+
+	return TRUE;
+}
+
+/**
+ * \brief Searches compiled patterns in the block of data.
+ * 
+ * Only matches which start in [From, PosLimit), fit into the block and end after
+ * MinEnd are reported. MinEnd is used for stitched page boundaries, where matches 
+ * lying entirely in the previous page are already reported. Block is processed 8 
+ * positions at a time, scan stops early if there's no room for matches of the next
+ * 8 positions
+ * 
+ * \param Matcher     Compiled patterns
+ * \param Data        Block of data
+ * \param DataLength  Length of block
+ * \param From        First position to check
+ * \param PosLimit    Position after the last one to check
+ * \param MinEnd      Matches should end after this position
+ * \param BaseAddress Address of the first byte of block
+ * \param Matches     Output matches
+ * \param MatchCount  Count of matches in output
+ * \param Capacity    Capacity of output
+ * 
+ * \returns Position where scan stopped, PosLimit if whole block is processed
+ */
+UINTN
+EFIAPI
+ScanBlock(
+	IN     CONST DEADWING_SCAN_MATCHER *Matcher,
+	IN     CONST UINT8                 *Data,
+	IN     UINTN                        DataLength,
+	IN     UINTN                        From,
+	IN     UINTN                        PosLimit,
+	IN     UINTN                        MinEnd,
+	IN     UINT64                       BaseAddress,
+	OUT    PDEADWING_SCAN_MATCH         Matches,
+	IN OUT UINTN                       *MatchCount,
+	IN     UINTN                        Capacity
+) {
+	for(UINTN Pos = From; Pos < PosLimit; Pos += 8) {
+		if(*MatchCount + 8 * Matcher->PatternCount > Capacity)
+			return Pos;
+
+		UINTN BlockEnd = MIN(Pos + 8, PosLimit);
+
+		for(UINT32 k = 0; k < Matcher->PatternCount; k++) {
+			CONST DEADWING_SCAN_COMPILED *Pattern = &Matcher->Patterns[k];
+			if(Pos + Pattern->Length > DataLength)
+				continue;
+
+			// SWAR zero-byte test: high bit is set for every byte equal to the anchor. False 
+			// positives are possible above a real match, they're dropped by verification
+			UINT64 Candidates = SCAN_HIGH_BITS;
+			if(Pattern->Anchor >= 0 && Pos + Pattern->Anchor + sizeof(UINT64) <= DataLength) {
+				UINT64 X = ReadUnaligned64((CONST UINT64 *)(Data + Pos + Pattern->Anchor)) ^ Pattern->Broadcast;
+				Candidates = (X - SCAN_LOW_BITS) & ~X & SCAN_HIGH_BITS;
+			}
+
+			while(Candidates) {
+				UINTN At = Pos + ((UINTN)LowBitSet64(Candidates) >> 3);
+				Candidates &= Candidates - 1;
+
+				if(At >= BlockEnd || At + Pattern->Length > DataLength || At + Pattern->Length <= MinEnd)
+					continue;
+
+				if(!ScanVerify(Pattern, Data + At, DataLength - At))
+					continue;
+
+				Matches[*MatchCount].Address = BaseAddress + At;
+				Matches[*MatchCount].PatternIndex = k;
+				Matches[*MatchCount].Reserved = 0;
+				(*MatchCount)++;
+			}
+		}
+	}
+
+	return PosLimit;
+}
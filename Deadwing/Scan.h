@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Defs.h"
+
+typedef struct _DEADWING_SCAN_COMPILED {
+	UINT32 Length;
+	INT32  Anchor;
+	UINT64 Broadcast;
+	UINT64 Bytes[DEADWING_SCAN_MAX_PATTERN_LENGTH / sizeof(UINT64)];
+	UINT64 Mask[DEADWING_SCAN_MAX_PATTERN_LENGTH / sizeof(UINT64)];
+} DEADWING_SCAN_COMPILED, *PDEADWING_SCAN_COMPILED;
+
+typedef struct _DEADWING_SCAN_MATCHER {
+	UINT32                 PatternCount;
+	UINT32                 MaxLength;
+	DEADWING_SCAN_COMPILED Patterns[DEADWING_SCAN_MAX_PATTERNS];
+} DEADWING_SCAN_MATCHER, *PDEADWING_SCAN_MATCHER;
+
+BOOLEAN
+EFIAPI
+ScanCompile(
+	OUT PDEADWING_SCAN_MATCHER  Matcher,
+	IN  CONST DEADWING_SCAN_PATTERN *Patterns,
+	IN  UINT32                  PatternCount
+);
+
+UINTN
+EFIAPI
+ScanBlock(
+	IN     CONST DEADWING_SCAN_MATCHER *Matcher,
+	IN     CONST UINT8                 *Data,
+	IN     UINTN                        DataLength,
+	IN     UINTN                        From,
+	IN     UINTN                        PosLimit,
+	IN     UINTN                        MinEnd,
+	IN     UINT64                       BaseAddress,
+	OUT    PDEADWING_SCAN_MATCH         Matches,
+	IN OUT UINTN                       *MatchCount,
+	IN     UINTN                        Capacity
+);
@@ -2,6 +2,7 @@
 #include <Base.h>
 
 #include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
 #include <Library/IoLib.h>
 
 #include "Conf.h"
@@ -31,6 +32,14 @@
 #define LSR_TXRDY               0x20
 #define LSR_RXDA                0x01
 #define DLAB                    0x01
+#define FCR_FIFO_ENABLE         0x01
+#define FCR_RX_RESET            0x02
+#define FCR_TX_RESET            0x04
+#define MCR_DTR                 0x01
+#define MCR_RTS                 0x02
+
+/// \note 16550 TX FIFO is empty once LSR_TXRDY is set, so it takes 16 bytes at once
+#define UART_FIFO_SIZE          16
 
 /// \note @0x00Alchemist: Serial max baudrate
 #define SERIAL_BAUDRATE_MAX 115200
@@ -41,9 +50,11 @@
 #define UART_PARITY       0
 #define UART_BREAK_SET    0
 
+STATIC BOOLEAN gSerialInitialized = FALSE;
+
 
 /**
- * \brief Initializes UART port for data output
+ * \brief Initializes UART port for data output, enables FIFOs
  * 
  * \param Port     Port to initialize
  * \param Baudrate Baudrate for port which will be initialized, baudrate should be less or equal SERIAL_BAUDRATE_MAX
@@ -54,21 +65,16 @@ SerialInitialize(
 	IN UINT16 Port,
 	IN UINT64 Baudrate
 ) {
-	UINT16 DPort;
-
 	UINT8 Data;
+	UINT8 OutputData;
 	UINT64 BaudrateDivisor;
-	UINT64 OutputData;
-
-	// save port value
-	DPort = Port + LCR_OFFSET;
 
 	// map data
 	Data = (UINT8)(UART_DATA - 5);
 
-	/// configure port communication format
+	// configure port communication format, divisor latch is accessible now
 	OutputData = (UINT8)((DLAB << 7) | (UART_BREAK_SET << 6) | (UART_PARITY << 3) | (UART_STOP << 2) | Data);
-	IoWrite8(Port, OutputData);
+	IoWrite8(Port + LCR_OFFSET, OutputData);
 
 	// calculate baudrate divisor for baud generator
 	BaudrateDivisor = (UINT64)(SERIAL_BAUDRATE_MAX / Baudrate);
@@ -77,9 +83,14 @@ SerialInitialize(
 	IoWrite8((Port + BAUD_HIGH_OFFSET), (UINT8)(BaudrateDivisor >> 8));
 	IoWrite8((Port + BAUD_LOW_OFFSET), (UINT8)(BaudrateDivisor & 0xFF));
 
-	// switch back. Port should be initialized for data output now
-	OutputData = (UINT8)((~DLAB << 7) | (UART_BREAK_SET << 6) | (UART_PARITY << 3) | (UART_STOP << 2) | Data);
-	IoWrite8(DPort, OutputData);
+	// switch back
+	OutputData = (UINT8)((UART_BREAK_SET << 6) | (UART_PARITY << 3) | (UART_STOP << 2) | Data);
+	IoWrite8(Port + LCR_OFFSET, OutputData);
+
+	// no interrupts, FIFOs are enabled and cleared
+	IoWrite8(Port + IER_OFFSET, 0);
+	IoWrite8(Port + FCR_OFFSET, FCR_FIFO_ENABLE | FCR_RX_RESET | FCR_TX_RESET);
+	IoWrite8(Port + MCR_OFFSET, MCR_DTR | MCR_RTS);
 }
 
 /**
@@ -94,16 +105,9 @@ SerialWrite(
 	IN UINT16 Port,
 	IN UINT8  Value
 ) {
-	UINT8 Status;
-	UINT16 DPort;
-
-	DPort = Port + LSR_OFFSET;
-
 	// wait until port will be free
-	Status = 0;
-	do {
-		Status = IoRead8(DPort);
-	} while(Status & LSR_TXRDY == 0);
+	while((IoRead8(Port + LSR_OFFSET) & LSR_TXRDY) == 0)
+		CpuPause();
 
 	// write data
 	IoWrite8(Port, Value);
@@ -121,18 +125,52 @@ EFIAPI
 SerialRead(
 	IN UINT16 Port
 ) {
-	UINT8 Status;
-	UINT16 DPort;
+	// wait until data will be available
+	while((IoRead8(Port + LSR_OFFSET) & LSR_RXDA) == 0)
+		CpuPause();
 
-	DPort = Port + LSR_OFFSET;
+	return IoRead8(Port);
+}
 
-	// wait until port will be free
-	Status = 0;
-	do {
-		Status = IoRead8(DPort);
-	} while(Status & LSR_RXDA == 0);
+/**
+ * \brief Writes as many bytes as fit the TX FIFO right now, never waits
+ * 
+ * \param Buffer Data to write
+ * \param Length Length of the data
+ * 
+ * \return Count of written bytes, 0 if FIFO is still busy
+ */
+UINTN
+EFIAPI
+SerialTryWrite(
+	IN CONST UINT8 *Buffer,
+	IN UINTN        Length
+) {
+	if(Buffer == NULL || Length == 0)
+		return 0;
 
-	return IoRead8(Port);
+#ifndef DEADWING_QEMU_FIRMWARE
+	if(!gSerialInitialized) {
+		SerialInitialize(SERIAL_PORT_0, SERIAL_BAUDRATE_MAX);
+		gSerialInitialized = TRUE;
+	}
+
+	// FIFO is drained completely once holding register is empty
+	if((IoRead8(SERIAL_PORT_0 + LSR_OFFSET) & LSR_TXRDY) == 0)
+		return 0;
+
+	UINTN Count = MIN(Length, UART_FIFO_SIZE);
+	for(UINTN i = 0; i < Count; i++)
+		IoWrite8(SERIAL_PORT_0, Buffer[i]);
+
+	return Count;
+#else
+	// debug port never blocks
+	for(UINTN i = 0; i < Length; i++)
+		IoWrite8(OVMF_DEBUG_PORT, Buffer[i]);
+
+	return Length;
+#endif
 }
 
 /**
@@ -148,16 +186,14 @@ SerialPrint(
 	if(Message == NULL)
 		return;
 
-#ifndef DEADWING_QEMU_FIRMWARE
-	// initialize serial port
-	SerialInitialize(SERIAL_PORT_0, SERIAL_BAUDRATE_MAX);
+	UINTN Length = AsciiStrLen(Message);
 
-	// send data to serial port
-	for(INT32 i = 0; i < AsciiStrLen(Message); i++)
-		SerialWrite(SERIAL_PORT_0, Message[i]);
-#else
-	// send data to QEMU debug port
-	for(INT32 i = 0; i < AsciiStrLen(Message); i++)
-		IoWrite8(OVMF_DEBUG_PORT, Message[i]);
-#endif
+	// send data by FIFO-sized bursts
+	for(UINTN Offset = 0; Offset < Length;) {
+		UINTN Written = SerialTryWrite((CONST UINT8 *)Message + Offset, Length - Offset);
+		if(Written == 0)
+			CpuPause();
+
+		Offset += Written;
+	}
 }
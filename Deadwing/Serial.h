@@ -4,4 +4,11 @@ VOID
 EFIAPI
 SerialPrint(
 	IN CONST CHAR8 *Message
+);
+
+UINTN
+EFIAPI
+SerialTryWrite(
+	IN CONST UINT8 *Buffer,
+	IN UINTN        Length
 );
\ No newline at end of file
@@ -6,17 +6,84 @@
 #include <Library/SmmMemLib.h>
 
 #include <Protocol/MmCommunication2.h>
+#include <Protocol/SmmSwDispatch2.h>
 
 #include "Conf.h"
 #include "Globals.h"
 #include "Defs.h"
-#include "Serial.h"
+#include "Log.h"
+#include "Trace.h"
+#include "Stats.h"
 #include "Utils.h"
 #include "Memory.h"
 #include "Commands.h"
+#include "Mp.h"
+#include "Smi.h"
 
 #define DEADWING_COMMUNICATE_HEADER_SIZE (OFFSET_OF(EFI_MM_COMMUNICATE_HEADER, Data))
 
+// channels of the communication buffer registered by the DXE driver, validated once at registration
+typedef struct _DEADWING_DOORBELL {
+	UINT8  *Channels;
+	UINTN   ChannelCount;
+	UINTN   ChannelSize;
+	UINTN   PayloadSize;
+} DEADWING_DOORBELL, *PDEADWING_DOORBELL;
+
+STATIC DEADWING_DOORBELL gDoorbell;
+
+// set once SMM core installs its ExitBootServices protocol. Boot time commands trust
+// buffers of the DXE driver, so they are rejected afterwards
+STATIC BOOLEAN gBootServicesExited;
+
+
+/**
+ * \brief Executes commands of validated packet and reports statuses and timings in the same packet
+ * 
+ * \param Packet      Packet which lies outside SMRAM
+ * \param PayloadSize Size of the packet with its inline data region
+ * \param Tsc         TSC on entry to the SMI handler
+ */
+VOID
+EFIAPI
+SmiProcessPacket(
+	IN PDEADWING_PACKET Packet,
+	IN UINTN            PayloadSize,
+	IN UINT64           Tsc
+) {
+	// inline data region follows the commands if DXE driver has allocated it
+	UINTN PacketSize = PayloadSize;
+	VOID *InlineData = NULL;
+	UINTN InlineSize = 0;
+	if(PayloadSize > DEADWING_COMM_INLINE_OFFSET) {
+		PacketSize = DEADWING_COMM_INLINE_OFFSET;
+		InlineData = (UINT8 *)Packet + DEADWING_COMM_INLINE_OFFSET;
+		InlineSize = PayloadSize - DEADWING_COMM_INLINE_OFFSET;
+	}
+
+	UINT64 Validated = AsmReadTsc();
+
+	// first command represents the packet in traces and stats
+	PDEADWING_COMMAND First = DEADWING_PACKET_COMMANDS(Packet);
+
+	TRACE(DEADWING_TRACE_SMI_ENTER, 3, First->Command, First->Resume.Cursor, Packet, 0);
+
+	MpResetTiming();
+	MemInvalidateWalkCache();
+
+	// dispatch commands and save status of the packet
+	Packet->Status = CmdMainHandler(Packet, PacketSize, InlineData, InlineSize);
+
+	// report phase timings of the packet
+	MpCollectTiming(&Packet->Timing);
+	Packet->Timing.Validate = Validated - Tsc;
+	Packet->Timing.Total = AsmReadTsc() - Tsc;
+
+	STATS_RECORD_SMI(First->Command, Packet->Timing.Total);
+
+	TRACE(DEADWING_TRACE_SMI_EXIT, 4, First->Command, Packet->Status, AsmReadTsc() - Tsc, First->Resume.Cursor);
+}
+
 
 /**
  * \brief Main SMI handler.
@@ -39,30 +106,28 @@
  *     /                     /|
  *    +---------------------+ | <- Start of communication structure
  *    |                     | |
- *    |    Command Value    | | <- Command magic value
- *    |                     | | 
- *    +---------------------+ |  
- *    |                     | |
- *    |    Return Status    | | <- Real handler's returned status, which
- *    |                     | |    will be interpreted by OS module(s)
- *    +---------------------+ |
- *    |                     | |
- *    |     Buffer Size     | | <- Size of communication buffer which was
- *    |                     | |    allocated at DXE phase
+ *    |    Packet Header    | | <- Signature, count of commands, length of the packet,
+ *    |                     | |    status of the packet, TSC budget and timings
  *    +---------------------+ |
  *    |                     | |
- *    |         Data        | | <- Data which will be consumed by SMI handler
+ *    |       Commands      | | <- Commands which will be consumed by SMI handler
  *    |    +--------------+ | |
  *    |   /              /| | |
  *    |  +--------------+ | | |
- *    |  |    Value 1   | | | | <- Specific value for specified command (for example,
- *    |  +--------------+ | | |    address of something)
+ *    |  |   Command 1  | | | | <- Magic value, length, real handler's returned status
+ *    |  |    Payload   | | | |    and resume state of the command, then its own payload
+ *    |  +--------------+ | | |
  *    |  |      ...     | | | |
  *    |  +--------------+ | | |
- *    |  |    Value N   |/  | |
+ *    |  |   Command N  |/  | |
  *    |  +--------------+   | |
+ *    |                     | |
+ *    +---------------------+ | <- DEADWING_COMM_INLINE_OFFSET from the start of the structure
+ *    |                     | |
+ *    |     Inline Data     | | <- Results of reads without consumer buffer, up to the
+ *    |                     | |    end of communication buffer
  *    |                     | +
- *    +---------------------+/  <- End of communication sturcture
+ *    +---------------------+/  <- End of communication buffer
  * 
  * \return EFI_SUCCESS - SMI handler performed operation successfully. The actual statuses of the handler are 
  *                       communicated through the structure for communication. This is done to avoid calling other handlers 
@@ -79,42 +144,203 @@ DeadwingSmiHandler(
 	EFI_STATUS Status;
 	UINTN TempSize;
 	UINTN PayloadSize;
-	PDEADWING_COMMUNICATION SmiCommCtx;
+	PDEADWING_PACKET Packet;
+	UINT64 Tsc = AsmReadTsc();
 	
-	SerialPrint("[ SMM ] Hit Deadwing SMI handler\r\n");
+	LOG_DEBUG("[ SMM ] Hit Deadwing SMI handler\r\n");
 
 	if(CommBuffer == NULL || CommBufferSize == 0) {
-		SerialPrint("[ SMM ] Invalid communication buffer pointer or size\r\n");
+		LOG_ERROR("[ SMM ] Invalid communication buffer pointer or size\r\n");
 		return EFI_SUCCESS;
 	}
 
 	TempSize = *CommBufferSize;
+	if(TempSize < DEADWING_COMMUNICATE_HEADER_SIZE + sizeof(DEADWING_PACKET) + sizeof(DEADWING_COMMAND)) {
+		LOG_ERROR("[ SMM ] Communication buffer is too small\r\n");
+		return EFI_SUCCESS;
+	}
+
 	PayloadSize = TempSize - DEADWING_COMMUNICATE_HEADER_SIZE;
 
 	// validate passed buffer
 	if(!SmmIsBufferOutsideSmmValid((UINTN)CommBuffer, PayloadSize)) {
-		SerialPrint("[ SMM ] Communication buffer overlaps SMRAM!\r\n");
+		LOG_ERROR("[ SMM ] Communication buffer overlaps SMRAM!\r\n");
 		return EFI_SUCCESS;
 	}
 	
 	// store record
-	SmiCommCtx = (PDEADWING_COMMUNICATION)CommBuffer;
+	Packet = (PDEADWING_PACKET)CommBuffer;
 
 	/// \note @0x00Alchemist: call SpeculationBarrier function to 
 	/// ensure the check for CommBuffer have been completed
 	SpeculationBarrier(); 
 
-	// dispatch command and save real status
-	SmiCommCtx->SmiRetStatus = CmdMainHandler(SmiCommCtx);
+	SmiProcessPacket(Packet, PayloadSize, Tsc);
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Doorbell SMI handler.
+ * 
+ * Conveys packet of the registered channel without the communication protocol: the KM driver
+ * writes index of the channel to the data port and the doorbell value to the command port. 
+ * Channels have been validated at registration, so the packet is processed right away
+ * 
+ * \param DispatchHandle The unique handle which assigned by platform to this SMI handler
+ * \param Context        Register context of the software SMI
+ * \param CommBuffer     Software SMI context with the value of the data port
+ * \param CommBufferSize Size of the software SMI context
+ * 
+ * \return EFI_SUCCESS - Always, status of the command is returned in the packet
+ */
+EFI_STATUS
+EFIAPI
+DeadwingDoorbellHandler(
+	IN           EFI_HANDLE  DispatchHandle,
+	IN     CONST VOID       *Context        OPTIONAL,
+	IN OUT       VOID       *CommBuffer     OPTIONAL,
+	IN OUT       UINTN      *CommBufferSize OPTIONAL
+) {
+	UINT64 Tsc = AsmReadTsc();
+
+	if(gDoorbell.Channels == NULL || CommBuffer == NULL)
+		return EFI_SUCCESS;
+
+	UINTN Channel = ((EFI_SMM_SW_CONTEXT *)CommBuffer)->DataPort;
+	if(Channel >= gDoorbell.ChannelCount) {
+		LOG_ERROR("[ SMM ] Doorbell rang for unknown channel\r\n");
+		return EFI_SUCCESS;
+	}
+
+	SpeculationBarrier();
+
+	// packet follows the communicate header of the channel, header itself isn't used
+	UINT8 *CommHeader = gDoorbell.Channels + Channel * gDoorbell.ChannelSize;
+	SmiProcessPacket((PDEADWING_PACKET)(CommHeader + DEADWING_COMMUNICATE_HEADER_SIZE), gDoorbell.PayloadSize, Tsc);
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Notifies driver that ExitBootServices has been called
+ * 
+ * \param Protocol  GUID of the installed protocol
+ * \param Interface Interface of the protocol
+ * \param Handle    Handle the protocol is installed on
+ * 
+ * \return EFI_SUCCESS - Always
+ */
+STATIC
+EFI_STATUS
+EFIAPI
+SmiExitBootServicesNotify(
+	IN CONST EFI_GUID *Protocol,
+	IN VOID           *Interface,
+	IN EFI_HANDLE      Handle
+) {
+	gBootServicesExited = TRUE;
+
+	LOG_INFO("[ SMM ] ExitBootServices has been called, boot time commands are rejected\r\n");
 
 	return EFI_SUCCESS;
 }
 
 /**
- * \brief Registers a SMI handler int the platform
+ * \brief Checks if ExitBootServices has been called
+ * 
+ * \return TRUE - OS owns the memory, boot time commands should be rejected
+ * \return FALSE - Boot services are still available
+ */
+BOOLEAN
+EFIAPI
+SmiIsBootServicesExited(
+	VOID
+) {
+	return gBootServicesExited;
+}
+
+/**
+ * \brief Registers channels of the communication buffer and doorbell SMI handler.
+ * 
+ * Channels can be registered only once, DXE driver does it before ExitBootServices.
+ * Buffer is validated here, so the doorbell doesn't validate it on every SMI
+ * 
+ * \param Channels     Physical address of the first channel
+ * \param ChannelCount Count of channels
+ * \param ChannelSize  Distance between channels
+ * \param CommSize     Size of the communication buffer of every channel (message length)
+ * \param SwSmiValue   Receives value of the software SMI which should be written to the command port
+ * 
+ * \return EFI_SUCCESS - Doorbell has been registered
+ * \return EFI_ALREADY_STARTED - Channels have been registered already
+ * \return EFI_ACCESS_DENIED - ExitBootServices has been called
+ * \return EFI_INVALID_PARAMETER - Layout of channels is invalid
+ * \return EFI_SECURITY_VIOLATION - Channels overlap SMRAM
+ * \return EFI_UNSUPPORTED - Doorbell is disabled or platform doesn't provide SW dispatch protocol
+ * \return Other - Unable to register doorbell SMI handler
+ */
+EFI_STATUS
+EFIAPI
+SmiRegisterDoorbell(
+	IN  VOID   *Channels,
+	IN  UINT64  ChannelCount,
+	IN  UINT64  ChannelSize,
+	IN  UINT64  CommSize,
+	OUT UINT64 *SwSmiValue
+) {
+#ifdef DEADWING_DOORBELL_SW_SMI
+	if(gDoorbell.Channels != NULL)
+		return EFI_ALREADY_STARTED;
+
+	if(gBootServicesExited) {
+		LOG_ERROR("[ SMM ] Doorbell can't be registered after ExitBootServices\r\n");
+		return EFI_ACCESS_DENIED;
+	}
+
+	if(Channels == NULL || ChannelCount == 0 || ChannelCount > MAX_UINT8 || CommSize < DEADWING_COMMUNICATE_HEADER_SIZE + sizeof(DEADWING_PACKET) + sizeof(DEADWING_COMMAND) || CommSize > ChannelSize)
+		return EFI_INVALID_PARAMETER;
+
+	if(ChannelSize > MAX_UINTN / ChannelCount || !SmmIsBufferOutsideSmmValid((EFI_PHYSICAL_ADDRESS)(UINTN)Channels, ChannelCount * ChannelSize)) {
+		LOG_ERROR("[ SMM ] Doorbell channels overlap SMRAM!\r\n");
+		return EFI_SECURITY_VIOLATION;
+	}
+
+	EFI_SMM_SW_DISPATCH2_PROTOCOL *SwDispatch;
+	EFI_STATUS Status = gSmst2->SmmLocateProtocol(&gEfiSmmSwDispatch2ProtocolGuid, NULL, (VOID **)&SwDispatch);
+	if(EFI_ERROR(Status)) {
+		LOG_INFO("[ SMM ] SW dispatch protocol is absent, doorbell is disabled\r\n");
+		return EFI_UNSUPPORTED;
+	}
+
+	EFI_SMM_SW_REGISTER_CONTEXT SwContext;
+	SwContext.SwSmiInputValue = DEADWING_DOORBELL_SW_SMI;
+
+	EFI_HANDLE Handle;
+	Status = SwDispatch->Register(SwDispatch, DeadwingDoorbellHandler, &SwContext, &Handle);
+	if(EFI_ERROR(Status)) {
+		LOG_ERROR("[ SMM ] Unable to register doorbell SMI handler\r\n");
+		return Status;
+	}
+
+	gDoorbell.Channels = (UINT8 *)Channels;
+	gDoorbell.ChannelCount = (UINTN)ChannelCount;
+	gDoorbell.ChannelSize = (UINTN)ChannelSize;
+	gDoorbell.PayloadSize = (UINTN)CommSize - DEADWING_COMMUNICATE_HEADER_SIZE;
+
+	*SwSmiValue = SwContext.SwSmiInputValue;
+
+	return EFI_SUCCESS;
+#else
+	return EFI_UNSUPPORTED;
+#endif
+}
+
+/**
+ * \brief Registers a SMI handler int the platform and ExitBootServices notification
  * 
  * \return EFI_SUCCESS - SMI handler was registered
- * \return Other - Cannot register SMI handler
+ * \return Other - Cannot register SMI handler or notification
  */
 EFI_STATUS
 EFIAPI
@@ -123,11 +349,24 @@ SmiRegisterHandler(
 ) {
 	STATIC CONST EFI_GUID gDeadwingSmiHandlerGuid = { 0x2BFADA50, 0xAF38, 0x49A1, { 0x85, 0x34, 0x08, 0xF6, 0xAE, 0x1B, 0x4C, 0x96 } };
 
+	// gEdkiiSmmExitBootServicesProtocolGuid, installed by SMM core on ExitBootServices
+	STATIC CONST EFI_GUID gDeadwingSmmExitBootServicesGuid = { 0x296EB418, 0xC4C8, 0x4E05, { 0xAB, 0x59, 0x39, 0xE8, 0xAF, 0x56, 0xF0, 0x0A } };
+
 	// register child SMI handler with custom HandlerType (GUID)
 	EFI_HANDLE Handle;
 	EFI_STATUS Status = gSmst2->SmiHandlerRegister(DeadwingSmiHandler, &gDeadwingSmiHandlerGuid, &Handle);
-	if(EFI_ERROR(Status))
-		SerialPrint("[ SMM ] Unable to register child SMI handler\r\n");
+	if(EFI_ERROR(Status)) {
+		LOG_ERROR("[ SMM ] Unable to register child SMI handler\r\n");
+		return Status;
+	}
+
+	VOID *Registration;
+	Status = gSmst2->SmmRegisterProtocolNotify(&gDeadwingSmmExitBootServicesGuid, SmiExitBootServicesNotify, &Registration);
+	if(EFI_ERROR(Status)) {
+		// boot time commands can't be rejected after ExitBootServices without the notification
+		LOG_ERROR("[ SMM ] Unable to register ExitBootServices notification\r\n");
+		gSmst2->SmiHandlerUnRegister(Handle);
+	}
 
 	return Status;
 }
@@ -5,3 +5,19 @@ EFIAPI
 SmiRegisterHandler(
 	VOID
 );
+
+BOOLEAN
+EFIAPI
+SmiIsBootServicesExited(
+	VOID
+);
+
+EFI_STATUS
+EFIAPI
+SmiRegisterDoorbell(
+	IN  VOID   *Channels,
+	IN  UINT64  ChannelCount,
+	IN  UINT64  ChannelSize,
+	IN  UINT64  CommSize,
+	OUT UINT64 *SwSmiValue
+);
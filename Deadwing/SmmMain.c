@@ -19,6 +19,8 @@
 #include "Smi.h"
 #include "Serial.h"
 #include "Utils.h"
+#include "Stats.h"
+#include "Memory.h"
 #include "Relocations.h"
 
 typedef EFI_STATUS(EFIAPI *__EfiEntry)(IN EFI_HANDLE, IN EFI_SYSTEM_TABLE *);
@@ -49,6 +51,9 @@ InitializeSmmContext(
 		}
 
 		gBS->SetMem(gRemapPage, EFI_PAGE_SIZE, 0);
+
+		MemRegisterWindow(gRemapPage);
+		STATS_INC(InterimPages);
 	} else {
 		SerialPrint("[ SMM ] Unable to register SMI handler\r\n");
 	}
@@ -0,0 +1,84 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/SynchronizationLib.h>
+
+#include "Stats.h"
+
+DEADWING_STATS gStats;
+
+
+/**
+ * \brief Adds value to the counter, can be called on any CPU
+ * 
+ * \param Counter Counter of the statistics
+ * \param Value   Value to add
+ */
+VOID
+EFIAPI
+StatsAdd(
+	IN OUT volatile UINT64 *Counter,
+	IN              UINT64  Value
+) {
+	UINT64 Old;
+	do {
+		Old = *Counter;
+	} while(InterlockedCompareExchange64(Counter, Old, Old + Value) != Old);
+}
+
+/**
+ * \brief Accounts handled SMI and its residency, called by the BSP on SMI exit
+ * 
+ * \param Command Command of the SMI
+ * \param Tsc     TSC ticks spent in the SMI handler
+ */
+VOID
+EFIAPI
+StatsRecordSmi(
+	IN UINT32 Command,
+	IN UINT64 Tsc
+) {
+	gStats.Smis++;
+	gStats.SmiTscTotal += Tsc;
+	gStats.SmiTscMax = MAX(gStats.SmiTscMax, Tsc);
+
+	for(UINT64 i = 0; i < gStats.CommandCount; i++) {
+		if(gStats.Commands[i].Command == Command) {
+			gStats.Commands[i].Smis++;
+			return;
+		}
+	}
+
+	// new commands aren't accounted once the table is full
+	if(gStats.CommandCount < DEADWING_STATS_MAX_COMMANDS) {
+		gStats.Commands[gStats.CommandCount].Command = Command;
+		gStats.Commands[gStats.CommandCount].Smis = 1;
+		gStats.CommandCount++;
+	}
+}
+
+/**
+ * \brief Copies counters
+ * 
+ * \param Stats Buffer which receives counters
+ */
+VOID
+EFIAPI
+StatsSnapshot(
+	OUT PDEADWING_STATS Stats
+) {
+	CopyMem(Stats, &gStats, sizeof(DEADWING_STATS));
+}
+
+/**
+ * \brief Clears counters, runs on the BSP while APs are idle
+ */
+VOID
+EFIAPI
+StatsReset(
+	VOID
+) {
+	ZeroMem(&gStats, sizeof(DEADWING_STATS));
+}
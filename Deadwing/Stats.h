@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Conf.h"
+#include "Defs.h"
+
+extern DEADWING_STATS gStats;
+
+VOID
+EFIAPI
+StatsAdd(
+	IN OUT volatile UINT64 *Counter,
+	IN              UINT64  Value
+);
+
+VOID
+EFIAPI
+StatsRecordSmi(
+	IN UINT32 Command,
+	IN UINT64 Tsc
+);
+
+VOID
+EFIAPI
+StatsSnapshot(
+	OUT PDEADWING_STATS Stats
+);
+
+VOID
+EFIAPI
+StatsReset(
+	VOID
+);
+
+#ifdef DEADWING_COLLECT_STATS
+#define STATS_ADD(Counter, Value)      StatsAdd(&gStats.Counter, (UINT64)(Value))
+#define STATS_RECORD_SMI(Command, Tsc) StatsRecordSmi(Command, Tsc)
+#else
+#define STATS_ADD(Counter, Value)      ((VOID)0)
+#define STATS_RECORD_SMI(Command, Tsc) ((VOID)0)
+#endif
+
+#define STATS_INC(Counter) STATS_ADD(Counter, 1)
@@ -0,0 +1,80 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "Serial.h"
+#include "Journal.h"
+#include "Trace.h"
+
+STATIC DEADWING_TRACE_RECORD gTraceRecords[DEADWING_TRACE_RECORDS];
+STATIC volatile UINT64 gTraceSequences[DEADWING_TRACE_RECORDS];
+STATIC DEADWING_JOURNAL gTrace = { gTraceRecords, gTraceSequences, sizeof(DEADWING_TRACE_RECORD), DEADWING_TRACE_RECORDS, 0, 0 };
+
+
+/**
+ * \brief Emits binary trace record.
+ * 
+ * Record is appended to the journal in SMRAM or sent to the port, only ArgCount arguments
+ * are sent to the port. Lock-free, can be called on any CPU
+ * 
+ * \param Event    Event ID
+ * \param ArgCount Count of valid arguments, up to DEADWING_TRACE_MAX_ARGS
+ * \param Arg0     First argument
+ * \param Arg1     Second argument
+ * \param Arg2     Third argument
+ * \param Arg3     Fourth argument
+ */
+VOID
+EFIAPI
+TraceEmit(
+	IN UINT16 Event,
+	IN UINT8  ArgCount,
+	IN UINT64 Arg0,
+	IN UINT64 Arg1,
+	IN UINT64 Arg2,
+	IN UINT64 Arg3
+) {
+	DEADWING_TRACE_RECORD Record;
+	Record.Sync = DEADWING_TRACE_SYNC;
+	Record.Event = Event;
+	Record.ArgCount = MIN(ArgCount, DEADWING_TRACE_MAX_ARGS);
+	Record.Source = DEADWING_TRACE_SOURCE_SMM;
+	Record.Reserved = 0;
+	Record.Tsc = AsmReadTsc();
+	Record.Args[0] = Arg0;
+	Record.Args[1] = Arg1;
+	Record.Args[2] = Arg2;
+	Record.Args[3] = Arg3;
+
+#ifdef DEADWING_TRACE_PORT
+	CONST UINT8 *Bytes = (CONST UINT8 *)&Record;
+	UINTN Length = OFFSET_OF(DEADWING_TRACE_RECORD, Args) + Record.ArgCount * sizeof(UINT64);
+
+	for(UINTN Offset = 0; Offset < Length;) {
+		UINTN Written = SerialTryWrite(Bytes + Offset, Length - Offset);
+		if(Written == 0)
+			CpuPause();
+
+		Offset += Written;
+	}
+#else
+	UINT64 Sequence;
+	CopyMem(JournalReserve(&gTrace, &Sequence), &Record, sizeof(DEADWING_TRACE_RECORD));
+	JournalCommit(&gTrace, Sequence);
+#endif
+}
+
+/**
+ * \brief Returns journal of the trace, records are drained by the controller
+ * 
+ * \returns Journal of DEADWING_TRACE_RECORD
+ */
+PDEADWING_JOURNAL
+EFIAPI
+TraceGetJournal(
+	VOID
+) {
+	return &gTrace;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Conf.h"
+#include "Defs.h"
+
+/// \note should be in sync with DwTrace.py
+#define DEADWING_TRACE_SMI_ENTER         0x0101
+#define DEADWING_TRACE_SMI_EXIT          0x0102
+#define DEADWING_TRACE_MP_DISPATCH       0x0103
+#define DEADWING_TRACE_TRANSLATE_FAULT   0x0104
+
+VOID
+EFIAPI
+TraceEmit(
+	IN UINT16 Event,
+	IN UINT8  ArgCount,
+	IN UINT64 Arg0,
+	IN UINT64 Arg1,
+	IN UINT64 Arg2,
+	IN UINT64 Arg3
+);
+
+PDEADWING_JOURNAL
+EFIAPI
+TraceGetJournal(
+	VOID
+);
+
+#ifdef DEADWING_TRACE
+#define TRACE(Event, ArgCount, A0, A1, A2, A3) TraceEmit(Event, ArgCount, (UINT64)(A0), (UINT64)(A1), (UINT64)(A2), (UINT64)(A3))
+#else
+#define TRACE(Event, ArgCount, A0, A1, A2, A3) ((VOID)0)
+#endif
@@ -0,0 +1,191 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+
+#include "Conf.h"
+#include "Globals.h"
+#include "Log.h"
+#include "Track.h"
+
+// handle keeps index of the slot in the low byte and generation in the rest
+#define TRACK_HANDLE_SLOT(Handle) ((UINTN)((Handle) & 0xFF) - 1)
+
+// regions and their page digests, digests of all regions are packed one after another
+STATIC DEADWING_TRACK_REGION gTrackRegions[DEADWING_TRACK_MAX_REGIONS];
+STATIC UINT64 *gTrackDigests;
+STATIC UINT64 gTrackUsedPages;
+STATIC UINT64 gTrackGeneration;
+STATIC UINT64 gTrackTick;
+
+
+/**
+ * \brief Evicts region and compacts digests of the regions behind it
+ * 
+ * \param Region Region to evict
+ */
+VOID
+EFIAPI
+TrackRelease(
+	IN PDEADWING_TRACK_REGION Region
+) {
+	if(Region == NULL || Region->Handle == 0)
+		return;
+
+	UINT64 End = Region->FirstDigest + Region->Pages;
+
+	// move digests of the following regions down
+	if(End < gTrackUsedPages)
+		CopyMem(&gTrackDigests[Region->FirstDigest], &gTrackDigests[End], (UINTN)((gTrackUsedPages - End) * sizeof(UINT64)));
+
+	for(UINTN i = 0; i < DEADWING_TRACK_MAX_REGIONS; i++) {
+		if(gTrackRegions[i].Handle != 0 && gTrackRegions[i].FirstDigest >= End)
+			gTrackRegions[i].FirstDigest -= Region->Pages;
+	}
+
+	gTrackUsedPages -= Region->Pages;
+
+	ZeroMem(Region, sizeof(DEADWING_TRACK_REGION));
+}
+
+/**
+ * \brief Evicts least recently used region
+ * 
+ * \return TRUE if region has been evicted, FALSE if table is empty
+ */
+STATIC
+BOOLEAN
+EFIAPI
+TrackEvictLru(
+	VOID
+) {
+	PDEADWING_TRACK_REGION Victim = NULL;
+
+	for(UINTN i = 0; i < DEADWING_TRACK_MAX_REGIONS; i++) {
+		if(gTrackRegions[i].Handle == 0)
+			continue;
+
+		if(Victim == NULL || gTrackRegions[i].LastUsed < Victim->LastUsed)
+			Victim = &gTrackRegions[i];
+	}
+
+	if(Victim == NULL)
+		return FALSE;
+
+	LOG_INFO("[ SMM ] Tracking table is full, evicting least recently used region\r\n");
+
+	TrackRelease(Victim);
+
+	return TRUE;
+}
+
+/**
+ * \brief Allocates region in the tracking table.
+ * 
+ * Region which tracks the same range is replaced. If there's no free slot or
+ * digests don't fit the table, least recently used regions are evicted
+ * 
+ * \param ProcessId Target process ID or 0, if range is physical
+ * \param Address   Start of the range
+ * \param Length    Length of the range
+ * \param Region    Allocated region, not ready until its baseline is recorded
+ * 
+ * \return EFI_SUCCESS - Region has been allocated
+ * \return EFI_BUFFER_TOO_SMALL - Range is larger than the whole table
+ * \return Other - Unable to allocate table
+ */
+EFI_STATUS
+EFIAPI
+TrackAllocate(
+	IN  UINT64                  ProcessId,
+	IN  UINT64                  Address,
+	IN  UINT64                  Length,
+	OUT PDEADWING_TRACK_REGION *Region
+) {
+	if(gTrackDigests == NULL) {
+		EFI_STATUS Status = gSmst2->SmmAllocatePool(EfiRuntimeServicesData, DEADWING_TRACK_MAX_PAGES * sizeof(UINT64), (VOID **)&gTrackDigests);
+		if(EFI_ERROR(Status)) {
+			LOG_ERROR("[ SMM ] Unable to allocate tracking table\r\n");
+			return Status;
+		}
+	}
+
+	UINT64 Pages = ((Address + Length - 1) >> EFI_PAGE_SHIFT) - (Address >> EFI_PAGE_SHIFT) + 1;
+	if(Pages > DEADWING_TRACK_MAX_PAGES)
+		return EFI_BUFFER_TOO_SMALL;
+
+	// baseline of the same range is recorded again
+	for(UINTN i = 0; i < DEADWING_TRACK_MAX_REGIONS; i++) {
+		if(gTrackRegions[i].Handle != 0 && gTrackRegions[i].ProcessId == ProcessId && gTrackRegions[i].Address == Address && gTrackRegions[i].Length == Length)
+			TrackRelease(&gTrackRegions[i]);
+	}
+
+	PDEADWING_TRACK_REGION Slot = NULL;
+	while(TRUE) {
+		for(UINTN i = 0; i < DEADWING_TRACK_MAX_REGIONS && Slot == NULL; i++) {
+			if(gTrackRegions[i].Handle == 0)
+				Slot = &gTrackRegions[i];
+		}
+
+		if(Slot != NULL && gTrackUsedPages + Pages <= DEADWING_TRACK_MAX_PAGES)
+			break;
+
+		Slot = NULL;
+		if(!TrackEvictLru())
+			return EFI_BUFFER_TOO_SMALL;
+	}
+
+	UINTN Index = (UINTN)(Slot - gTrackRegions);
+
+	Slot->Handle = (++gTrackGeneration << 8) | (Index + 1);
+	Slot->ProcessId = ProcessId;
+	Slot->Address = Address;
+	Slot->Length = Length;
+	Slot->Pages = Pages;
+	Slot->FirstDigest = gTrackUsedPages;
+	Slot->LastUsed = ++gTrackTick;
+	Slot->Ready = FALSE;
+
+	gTrackUsedPages += Pages;
+
+	*Region = Slot;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * \brief Finds region by handle and marks it as recently used
+ * 
+ * \param Handle Handle of the region
+ * 
+ * \returns Region or NULL if handle is invalid or region has been evicted
+ */
+PDEADWING_TRACK_REGION
+EFIAPI
+TrackLookup(
+	IN UINT64 Handle
+) {
+	UINTN Index = TRACK_HANDLE_SLOT(Handle);
+	if(Index >= DEADWING_TRACK_MAX_REGIONS || gTrackRegions[Index].Handle != Handle)
+		return NULL;
+
+	gTrackRegions[Index].LastUsed = ++gTrackTick;
+
+	return &gTrackRegions[Index];
+}
+
+/**
+ * \brief Returns page digests of the region
+ * 
+ * \param Region Tracked region
+ * 
+ * \returns Pointer to the first page digest
+ */
+UINT64 *
+EFIAPI
+TrackGetDigests(
+	IN PDEADWING_TRACK_REGION Region
+) {
+	return &gTrackDigests[Region->FirstDigest];
+}
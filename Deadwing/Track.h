@@ -0,0 +1,39 @@
+#pragma once
+
+typedef struct _DEADWING_TRACK_REGION {
+	UINT64  Handle;
+	UINT64  ProcessId;
+	UINT64  Address;
+	UINT64  Length;
+	UINT64  Pages;
+	UINT64  FirstDigest;
+	UINT64  LastUsed;
+	BOOLEAN Ready;
+} DEADWING_TRACK_REGION, *PDEADWING_TRACK_REGION;
+
+EFI_STATUS
+EFIAPI
+TrackAllocate(
+	IN  UINT64                  ProcessId,
+	IN  UINT64                  Address,
+	IN  UINT64                  Length,
+	OUT PDEADWING_TRACK_REGION *Region
+);
+
+PDEADWING_TRACK_REGION
+EFIAPI
+TrackLookup(
+	IN UINT64 Handle
+);
+
+UINT64 *
+EFIAPI
+TrackGetDigests(
+	IN PDEADWING_TRACK_REGION Region
+);
+
+VOID
+EFIAPI
+TrackRelease(
+	IN PDEADWING_TRACK_REGION Region
+);
@@ -0,0 +1,49 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+
+#include "Conf.h"
+
+// TSC value after which resumable commands should save their progress and stop
+STATIC UINT64 gYieldDeadline;
+
+
+/**
+ * \brief Arms TSC budget for the current SMI.
+ * 
+ * Should be called once per SMI before command dispatching. Long-running
+ * commands poll YieldBudgetExhausted between their steps and, if the budget
+ * is gone, save progress in the cursor and return EFI_NOT_READY
+ * 
+ * \param TscBudget Budget in TSC ticks, zero selects DEADWING_SMI_TSC_BUDGET, clamped to DEADWING_SMI_TSC_BUDGET_MAX
+ */
+VOID
+EFIAPI
+YieldArmBudget(
+	IN UINT64 TscBudget
+) {
+	if(TscBudget == 0)
+		TscBudget = DEADWING_SMI_TSC_BUDGET;
+
+	TscBudget = MIN(TscBudget, DEADWING_SMI_TSC_BUDGET_MAX);
+
+	gYieldDeadline = AsmReadTsc() + TscBudget;
+}
+
+/**
+ * \brief Checks if TSC budget of the current SMI is exhausted
+ * 
+ * \return TRUE - Command should save its progress and yield
+ * \return FALSE - Command can continue its work
+ */
+BOOLEAN
+EFIAPI
+YieldBudgetExhausted(
+	VOID
+) {
+	if(gYieldDeadline == 0)
+		return FALSE;
+
+	return AsmReadTsc() >= gYieldDeadline;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+VOID
+EFIAPI
+YieldArmBudget(
+	IN UINT64 TscBudget
+);
+
+BOOLEAN
+EFIAPI
+YieldBudgetExhausted(
+	VOID
+);
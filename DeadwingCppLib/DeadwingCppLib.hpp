@@ -1,5 +1,6 @@
 ﻿#include <Windows.h>
 #include <iostream>
+#include <vector>
 
 #define IOCTL_DEADWING_PING_SMI        CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD000, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_DEADWING_CACHE_SESSION   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD002, METHOD_BUFFERED, FILE_ANY_ACCESS)
@@ -9,6 +10,301 @@
 #define IOCTL_DEADWING_WRITE_VIRTUAL   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD006, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_DEADWING_VIRT_TO_PHYS    CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD008, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_DEADWING_PRIV_ESC        CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD00A, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_SET_RATE_LIMIT  CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD00C, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_HASH_RANGES     CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD00D, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_SCAN            CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD00E, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_SPARSE_READ     CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD00F, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_TRACK_REGION    CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD010, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_CHANGES_SINCE   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD011, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_HARVEST_AD      CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD012, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_MONITOR_START   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD013, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_MONITOR_SAMPLE  CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD014, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_ENTROPY_MAP     CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD015, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_DRAIN_LOG       CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD016, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_DRAIN_TRACE     CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD017, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_GET_STATS       CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD018, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_PROFILE_START   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD019, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_PROFILE_STOP    CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD01A, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_DRAIN_PROFILE   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD01B, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_SNAPSHOT_REGS   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD01C, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_SUBMIT_BATCH    CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD01D, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_GET_MEMORY_MAP  CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD01E, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_GET_ACPI_TABLE  CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD01F, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+/// \note requests larger than one page are split across several SMIs by the KM driver
+#define DEADWING_MAX_TRANSFER_LENGTH   0x1000000ULL
+
+/// \note should be in sync with Deadwing/Hash.h and Deadwing/Conf.h
+#define DEADWING_HASH_XXH64            1
+#define DEADWING_HASH_SHA256           2
+#define DEADWING_HASH_MAX_RANGES       1024
+
+typedef struct _DEADWING_HASH_RANGE {
+	UINT64 ProcessId;
+	UINT64 Address;
+	UINT64 Length;
+	UINT8  Digest[32];
+} DEADWING_HASH_RANGE, *PDEADWING_HASH_RANGE;
+
+typedef struct _DEADWING_HASH_REQUEST {
+	UINT32              Algorithm;
+	UINT32              RangeCount;
+	DEADWING_HASH_RANGE Ranges[1];
+} DEADWING_HASH_REQUEST, *PDEADWING_HASH_REQUEST;
+
+/// \note should be in sync with Deadwing/Defs.h and DeadwingKM/Defs.h
+#define DEADWING_SCAN_MAX_PATTERNS        16
+#define DEADWING_SCAN_MAX_PATTERN_LENGTH  32
+#define DEADWING_SCAN_MAX_MATCHES         0x100000ULL
+
+typedef struct _DEADWING_SCAN_PATTERN {
+	UINT32 Length;
+	UINT32 Reserved;
+	UINT8  Bytes[DEADWING_SCAN_MAX_PATTERN_LENGTH];
+	UINT8  Mask[DEADWING_SCAN_MAX_PATTERN_LENGTH];
+} DEADWING_SCAN_PATTERN, *PDEADWING_SCAN_PATTERN;
+
+typedef struct _DEADWING_SCAN_REQUEST {
+	UINT64                ProcessId;
+	UINT64                Address;
+	UINT64                Length;
+	UINT32                PatternCount;
+	UINT32                Reserved;
+	DEADWING_SCAN_PATTERN Patterns[DEADWING_SCAN_MAX_PATTERNS];
+} DEADWING_SCAN_REQUEST, *PDEADWING_SCAN_REQUEST;
+
+typedef struct _DEADWING_SCAN_MATCH {
+	UINT64 Address;
+	UINT32 PatternIndex;
+	UINT32 Reserved;
+} DEADWING_SCAN_MATCH, *PDEADWING_SCAN_MATCH;
+
+/// \note should be in sync with Deadwing/Defs.h
+#define DEADWING_SPARSE_PAGE_ABSENT       0
+#define DEADWING_SPARSE_PAGE_ZERO         1
+#define DEADWING_SPARSE_PAGE_DATA         2
+
+typedef struct _DEADWING_SPARSE_REQUEST {
+	UINT64 ProcessId;
+	UINT64 Address;
+	UINT64 Length;
+	UINT64 Bitmap;
+	UINT64 Data;
+	UINT64 DataLength;
+} DEADWING_SPARSE_REQUEST, *PDEADWING_SPARSE_REQUEST;
+
+/// \note should be in sync with Deadwing/Defs.h
+#define DEADWING_PAGE_CLASS_ABSENT        0
+#define DEADWING_PAGE_CLASS_ZERO          1
+#define DEADWING_PAGE_CLASS_ASCII         2
+#define DEADWING_PAGE_CLASS_UTF16         3
+#define DEADWING_PAGE_CLASS_CODE          4
+#define DEADWING_PAGE_CLASS_HIGH_ENTROPY  5
+#define DEADWING_PAGE_CLASS_DATA          6
+
+#define DEADWING_PAGE_CLASS_SHIFT         5
+#define DEADWING_PAGE_ENTROPY_MASK        0x1F
+
+#define DEADWING_PAGE_CLASS(Entry)        ((UINT8)(Entry) >> DEADWING_PAGE_CLASS_SHIFT)
+#define DEADWING_PAGE_ENTROPY(Entry)      (((UINT8)(Entry) & DEADWING_PAGE_ENTROPY_MASK) / 4.0)
+
+typedef struct _DEADWING_ENTROPY_REQUEST {
+	UINT64 ProcessId;
+	UINT64 Address;
+	UINT64 Length;
+	UINT64 Map;
+} DEADWING_ENTROPY_REQUEST, *PDEADWING_ENTROPY_REQUEST;
+
+/// \note should be in sync with Deadwing/Defs.h
+#define DEADWING_LOG_LEVEL_NONE           0
+#define DEADWING_LOG_LEVEL_ERROR          1
+#define DEADWING_LOG_LEVEL_INFO           2
+#define DEADWING_LOG_LEVEL_DEBUG          3
+
+#define DEADWING_LOG_MESSAGE_LENGTH       112
+
+typedef struct _DEADWING_LOG_RECORD {
+	UINT64 Sequence;
+	UINT64 Tsc;
+	UINT32 Level;
+	UINT32 Length;
+	CHAR   Message[DEADWING_LOG_MESSAGE_LENGTH];
+} DEADWING_LOG_RECORD, *PDEADWING_LOG_RECORD;
+
+/// \note should be in sync with Deadwing/Defs.h
+#define DEADWING_TRACE_SYNC               0xD7A3
+#define DEADWING_TRACE_MAX_ARGS           4
+
+typedef struct _DEADWING_TRACE_RECORD {
+	UINT16 Sync;
+	UINT16 Event;
+	UINT8  ArgCount;
+	UINT8  Source;
+	UINT16 Reserved;
+	UINT64 Tsc;
+	UINT64 Args[DEADWING_TRACE_MAX_ARGS];
+} DEADWING_TRACE_RECORD, *PDEADWING_TRACE_RECORD;
+
+/// \note should be in sync with Deadwing/Defs.h
+#define DEADWING_STATS_MAX_COMMANDS       32
+
+typedef struct _DEADWING_STATS_COMMAND {
+	UINT32 Command;
+	UINT32 Reserved;
+	UINT64 Smis;
+} DEADWING_STATS_COMMAND, *PDEADWING_STATS_COMMAND;
+
+typedef struct _DEADWING_STATS {
+	UINT64                 Smis;
+	UINT64                 SmiTscTotal;
+	UINT64                 SmiTscMax;
+	UINT64                 Remaps;
+	UINT64                 TlbFlushes;
+	UINT64                 WalkPml4;
+	UINT64                 WalkPdpt;
+	UINT64                 WalkPd;
+	UINT64                 WalkPt;
+	UINT64                 TranslateCacheHits;
+	UINT64                 TranslateCacheMisses;
+	UINT64                 PidCacheHits;
+	UINT64                 PidCacheMisses;
+	UINT64                 BytesCopied;
+	UINT64                 InterimPages;
+	UINT64                 CommandCount;
+	DEADWING_STATS_COMMAND Commands[DEADWING_STATS_MAX_COMMANDS];
+} DEADWING_STATS, *PDEADWING_STATS;
+
+/// \note should be in sync with Deadwing/Defs.h
+typedef struct _DEADWING_PROFILE_SAMPLE {
+	UINT64 Tsc;
+	UINT64 Rip;
+	UINT64 Rsp;
+	UINT64 Cr3;
+	UINT32 Cpu;
+	UINT8  Cpl;
+	UINT8  Reserved[3];
+} DEADWING_PROFILE_SAMPLE, *PDEADWING_PROFILE_SAMPLE;
+
+// capacity of the register snapshot
+#define DEADWING_MAX_CPUS                 1024
+
+/// \note should be in sync with Deadwing/Defs.h
+typedef struct _DEADWING_CPU_REGISTERS {
+	UINT32 Cpu;
+	UINT32 Valid;
+	UINT64 Gpr[16];
+	UINT64 Rip;
+	UINT64 Rflags;
+	UINT64 Cr0;
+	UINT64 Cr3;
+	UINT64 Cr4;
+	UINT64 Cs;
+	UINT64 Lma;
+} DEADWING_CPU_REGISTERS, *PDEADWING_CPU_REGISTERS;
+
+// capacity of the memory map, should be in sync with Deadwing/Conf.h
+#define DEADWING_MAX_MEMORY_RANGES        512
+
+/// \note should be in sync with Deadwing/Defs.h. Type is EFI_MEMORY_TYPE
+typedef struct _DEADWING_MEMORY_RANGE {
+	UINT64 Base;
+	UINT64 Length;
+	UINT32 Type;
+	UINT32 Reserved;
+	UINT64 Attribute;
+} DEADWING_MEMORY_RANGE, *PDEADWING_MEMORY_RANGE;
+
+/// \note commands which can be batched, should be in sync with Deadwing/Commands.c
+#define DEADWING_BATCH_PING               0xD700DEADULL
+#define DEADWING_BATCH_READ_PHYS          0xD800AAABULL
+#define DEADWING_BATCH_WRITE_PHYS         0xD800BBCDULL
+#define DEADWING_BATCH_VIRT_TO_PHYS       0xD800FF11ULL
+#define DEADWING_BATCH_READ_VIRTUAL       0xD900CCEFULL
+#define DEADWING_BATCH_WRITE_VIRTUAL      0xD900DDAFULL
+
+// max count of commands in a single batch
+#define DEADWING_MAX_BATCH                0x10000
+
+/// \note should be in sync with DeadwingKM/Defs.h. Arguments are (address, buffer, length)
+/// for reads and writes and (address) for translation. Status is EFI_STATUS of the command, value is
+/// the translated address
+typedef struct _DEADWING_BATCH_ENTRY {
+	UINT64 Command;
+	UINT64 ProcessId;
+	UINT64 Args[3];
+	UINT64 Status;
+	UINT64 Value;
+} DEADWING_BATCH_ENTRY, *PDEADWING_BATCH_ENTRY;
+
+typedef struct _DEADWING_TRACK_CHANGES_REQUEST {
+	UINT64 Handle;
+	UINT64 Changes;
+	UINT64 Data;
+	UINT64 MaxChanges;
+} DEADWING_TRACK_CHANGES_REQUEST, *PDEADWING_TRACK_CHANGES_REQUEST;
+
+typedef struct _DEADWING_TRACK_CHANGE {
+	UINT64 Address;
+	UINT32 Length;
+	UINT32 Present;
+} DEADWING_TRACK_CHANGE, *PDEADWING_TRACK_CHANGE;
+
+/// \note should be in sync with Deadwing/Defs.h
+#define DEADWING_HARVEST_ACCESSED         1
+#define DEADWING_HARVEST_DIRTY            2
+#define DEADWING_HARVEST_CLEAR            4
+
+typedef struct _DEADWING_HARVEST_REQUEST {
+	UINT64 ProcessId;
+	UINT64 Address;
+	UINT64 Length;
+	UINT64 Pages;
+	UINT64 MaxPages;
+	UINT32 Flags;
+	UINT32 Reserved;
+} DEADWING_HARVEST_REQUEST, *PDEADWING_HARVEST_REQUEST;
+
+typedef struct _DEADWING_HARVEST_PAGE {
+	UINT64 Address;
+	UINT32 PageSize;
+	UINT32 Flags;
+} DEADWING_HARVEST_PAGE, *PDEADWING_HARVEST_PAGE;
+
+/// \note should be in sync with Deadwing/Defs.h and Deadwing/Conf.h
+#define DEADWING_MONITOR_MAX_RANGES       8
+#define DEADWING_MONITOR_MAX_REGIONS      128
+
+typedef struct _DEADWING_MONITOR_RANGE {
+	UINT64 Address;
+	UINT64 Length;
+} DEADWING_MONITOR_RANGE, *PDEADWING_MONITOR_RANGE;
+
+typedef struct _DEADWING_MONITOR_REQUEST {
+	UINT64                 ProcessId;
+	UINT32                 MinRegions;
+	UINT32                 MaxRegions;
+	UINT32                 AggregationSamples;
+	UINT32                 RangeCount;
+	DEADWING_MONITOR_RANGE Ranges[DEADWING_MONITOR_MAX_RANGES];
+} DEADWING_MONITOR_REQUEST, *PDEADWING_MONITOR_REQUEST;
+
+typedef struct _DEADWING_MONITOR_ENTRY {
+	UINT64 Address;
+	UINT32 Pages;
+	UINT16 Accesses;
+	UINT16 Age;
+} DEADWING_MONITOR_ENTRY, *PDEADWING_MONITOR_ENTRY;
+
+/// \note should be in sync with Deadwing/Defs.h
+typedef struct _DEADWING_TIMING {
+	UINT64 Total;
+	UINT64 Validate;
+	UINT64 DirBase;
+	UINT64 TargetTranslate;
+	UINT64 ConsumerTranslate;
+	UINT64 Copy;
+	UINT64 Restore;
+} DEADWING_TIMING, *PDEADWING_TIMING;
 
 typedef struct _DEADWING_UM_KM_COMMUNICATION {
 	UINT64 ProcessId;
@@ -31,10 +327,292 @@ typedef struct _DEADWING_UM_KM_COMMUNICATION {
 		PVOID  AddressToTranslate;
 		UINT64 Translated;
 	} Vtop;
+
+	struct {
+		UINT64 MaxSmiPerSecond;
+		UINT64 MaxSmmUsPerSecond;
+		UINT64 AverageSmiCostUs;
+	} RateLimit;
+
+	struct {
+		PVOID  Request;
+		PVOID  PageDigests;
+		UINT64 PageDigestsLength;
+	} Hash;
+
+	struct {
+		PVOID  Request;
+		PVOID  Matches;
+		UINT64 MaxMatches;
+		UINT64 MatchCount;
+		UINT64 Truncated;
+	} Scan;
+
+	struct {
+		PVOID  Request;
+		UINT64 DataPages;
+	} Sparse;
+
+	struct {
+		PVOID  Address;
+		UINT64 Length;
+		UINT64 Handle;
+		PVOID  Request;
+		UINT64 ChangeCount;
+		UINT64 Truncated;
+	} Track;
+
+	struct {
+		PVOID  Request;
+		UINT64 PageCount;
+		UINT64 Truncated;
+	} Harvest;
+
+	struct {
+		PVOID  Request;
+		PVOID  Heatmap;
+		UINT64 MaxEntries;
+		UINT64 EntryCount;
+		UINT64 Samples;
+		UINT64 Aggregated;
+	} Monitor;
+
+	struct {
+		PVOID  Request;
+	} Entropy;
+
+	struct {
+		PVOID  Records;
+		UINT64 MaxRecords;
+		UINT64 RecordCount;
+		UINT64 Dropped;
+	} Log;
+
+	struct {
+		PVOID  Records;
+		UINT64 MaxRecords;
+		UINT64 RecordCount;
+		UINT64 Dropped;
+	} Trace;
+
+	struct {
+		PVOID  Buffer;
+		UINT64 Reset;
+	} Stats;
+
+	struct {
+		UINT64 IntervalUs;
+		PVOID  Samples;
+		UINT64 MaxSamples;
+		UINT64 SampleCount;
+		UINT64 Dropped;
+	} Profile;
+
+	struct {
+		PVOID  Buffer;
+		UINT64 MaxCpus;
+		UINT64 CpuCount;
+	} Registers;
+
+	struct {
+		PVOID  Entries;
+		UINT64 Count;
+		UINT64 Completed;
+	} Batch;
+
+	struct {
+		PVOID  Ranges;
+		UINT64 MaxRanges;
+		UINT64 RangeCount;
+	} MemoryMap;
+
+	struct {
+		UINT32 Signature;
+		UINT32 Instance;
+		PVOID  Buffer;
+		UINT64 MaxLength;
+		UINT64 Address;
+		UINT64 Length;
+	} Acpi;
+
+	DEADWING_TIMING Timing;
+	UINT64          SmiCount;
 } DEADWING_UM_KM_COMMUNICATION, *PDEADWING_UM_KM_COMMUNICATION;
 
 
 namespace Deadwing {
+	/**
+	 * \brief Result of the sparse read.
+	 * 
+	 * Keeps state of every page and only data pages, packed. Pages are expanded on demand,
+	 * zero and absent pages are read as zeros
+	 */
+	class SparseRange {
+		public:
+			SparseRange() = default;
+			SparseRange(const SparseRange &) = delete;
+			SparseRange &operator=(const SparseRange &) = delete;
+
+			~SparseRange() {
+				Reset();
+			}
+
+			/**
+			 * \brief Gets state of the page
+			 * 
+			 * \param Page Index of the page in the range
+			 * 
+			 * \returns DEADWING_SPARSE_PAGE_ABSENT, DEADWING_SPARSE_PAGE_ZERO or DEADWING_SPARSE_PAGE_DATA
+			 */
+			UINT8
+			WINAPI
+			GetPageState(
+				_In_ const UINT64 Page
+			) const {
+				if(Page >= __Pages)
+					return DEADWING_SPARSE_PAGE_ABSENT;
+
+				return (__Bitmap[Page / 4] >> ((Page % 4) * 2)) & 3;
+			}
+
+			/**
+			 * \brief Expands single page of the range
+			 * 
+			 * \param Page   Index of the page in the range
+			 * \param Buffer Buffer which receives 4096 bytes of the page
+			 * 
+			 * \returns false if page index is out of range
+			 */
+			bool
+			WINAPI
+			ReadPage(
+				_In_  const UINT64 Page,
+				_Out_ PVOID        Buffer
+			) const {
+				if(Page >= __Pages || Buffer == nullptr)
+					return false;
+
+				if(GetPageState(Page) != DEADWING_SPARSE_PAGE_DATA) {
+					std::memset(Buffer, 0, 0x1000);
+					return true;
+				}
+
+				// count data pages before the requested one
+				UINT64 Index = __Rank[Page / 64];
+				for(UINT64 i = Page & ~63ULL; i < Page; i++) {
+					if(GetPageState(i) == DEADWING_SPARSE_PAGE_DATA)
+						Index++;
+				}
+
+				std::memcpy(Buffer, (UINT8 *)__Data + Index * 0x1000, 0x1000);
+
+				return true;
+			}
+
+			/**
+			 * \brief Expands whole range
+			 * 
+			 * \param Buffer Buffer which receives GetLength() bytes
+			 * 
+			 * \returns false if range is empty
+			 */
+			bool
+			WINAPI
+			Expand(
+				_Out_ PVOID Buffer
+			) const {
+				if(__Pages == 0 || Buffer == nullptr)
+					return false;
+
+				UINT64 Index = 0;
+				for(UINT64 Page = 0; Page < __Pages; Page++) {
+					UINT8 *Dest = (UINT8 *)Buffer + Page * 0x1000;
+
+					if(GetPageState(Page) == DEADWING_SPARSE_PAGE_DATA)
+						std::memcpy(Dest, (UINT8 *)__Data + (Index++) * 0x1000, 0x1000);
+					else
+						std::memset(Dest, 0, 0x1000);
+				}
+
+				return true;
+			}
+
+			UINT64 GetAddress() const { return __Address; }
+			UINT64 GetLength() const { return __Pages * 0x1000; }
+			UINT64 GetPageCount() const { return __Pages; }
+			UINT64 GetDataPageCount() const { return __DataPages; }
+
+		private:
+			friend class Commands;
+
+			bool
+			WINAPI
+			Allocate(
+				_In_ const UINT64 Address,
+				_In_ const UINT64 Length
+			) {
+				Reset();
+
+				__Data = VirtualAlloc(nullptr, Length, (MEM_RESERVE | MEM_COMMIT), PAGE_READWRITE);
+				if(__Data == nullptr)
+					return false;
+
+				// SMM driver can't handle page faults, buffer should be resident
+				std::memset(__Data, 0, Length);
+
+				__Address = Address;
+				__Pages = Length / 0x1000;
+				__Bitmap.assign((size_t)((__Pages + 3) / 4), 0);
+
+				return true;
+			}
+
+			void
+			WINAPI
+			Finalize(
+				_In_ const UINT64 DataPages
+			) {
+				__DataPages = DataPages;
+
+				// release tail of the data buffer which has not been used
+				if(__DataPages < __Pages)
+					VirtualFree((UINT8 *)__Data + __DataPages * 0x1000, (__Pages - __DataPages) * 0x1000, MEM_DECOMMIT);
+
+				// count of data pages before every group of 64 pages
+				__Rank.assign((size_t)(__Pages / 64 + 1), 0);
+				for(UINT64 Page = 0, Count = 0; Page < __Pages; Page++) {
+					if((Page % 64) == 0)
+						__Rank[Page / 64] = Count;
+
+					if(GetPageState(Page) == DEADWING_SPARSE_PAGE_DATA)
+						Count++;
+				}
+			}
+
+			void
+			WINAPI
+			Reset(
+				void
+			) {
+				if(__Data != nullptr)
+					VirtualFree(__Data, 0, MEM_RELEASE);
+
+				__Data = nullptr;
+				__Address = 0;
+				__Pages = 0;
+				__DataPages = 0;
+				__Bitmap.clear();
+				__Rank.clear();
+			}
+
+			UINT64 __Address = 0;
+			UINT64 __Pages = 0;
+			UINT64 __DataPages = 0;
+			PVOID  __Data = nullptr;
+			std::vector<UINT8>  __Bitmap;
+			std::vector<UINT64> __Rank;
+	};
+
 	class Commands {
 		public:
 			/**
@@ -80,11 +658,10 @@ namespace Deadwing {
 			Ping(
 				void
 			) {
-				DWORD Ret = 0;
 				DEADWING_UM_KM_COMMUNICATION Dummy = { 0 };
 
 				// send ping packet to the driver
-				if(!DeviceIoControl(__hDriver, IOCTL_DEADWING_PING_SMI, &Dummy, sizeof(DEADWING_UM_KM_COMMUNICATION), NULL, 0, &Ret, NULL))
+				if(!__Control(IOCTL_DEADWING_PING_SMI, &Dummy))
 					return false;
 
 				return true;
@@ -109,7 +686,7 @@ namespace Deadwing {
 				// 2. allocate buffer for the result
 				// 3. fill the packet
 				// 4. send it to the driver
-				if((Address == 0 || (LengthToRead > 0x1000 || LengthToRead == 0)))
+				if((Address == 0 || (LengthToRead > DEADWING_MAX_TRANSFER_LENGTH || LengthToRead == 0)))
 					return nullptr;
 
 				PVOID Buf = VirtualAlloc(NULL, LengthToRead, (MEM_RESERVE | MEM_COMMIT), PAGE_READWRITE);
@@ -123,8 +700,7 @@ namespace Deadwing {
 				Packet.Read.VaReadResultAddress = (PVOID)Buf;
 				Packet.Read.ReadLength = LengthToRead;
 
-				DWORD Ret = 0;
-				if(!DeviceIoControl(__hDriver, IOCTL_DEADWING_READ_PHYS, &Packet, sizeof(DEADWING_UM_KM_COMMUNICATION), NULL, 0, &Ret, NULL)) {
+				if(!__Control(IOCTL_DEADWING_READ_PHYS, &Packet)) {
 					VirtualFree(Buf, 0, MEM_RELEASE);
 					return nullptr;
 				}
@@ -153,7 +729,7 @@ namespace Deadwing {
 				// 2. allocate buffer for the result
 				// 3. fill the packet
 				// 4. send it to the driver
-				if((Address == 0 || ProcessId == 0 || (LengthToRead > 0x1000 || LengthToRead == 0)))
+				if((Address == 0 || ProcessId == 0 || (LengthToRead > DEADWING_MAX_TRANSFER_LENGTH || LengthToRead == 0)))
 					return nullptr;
 				
 
@@ -169,8 +745,7 @@ namespace Deadwing {
 				Packet.Read.VaReadResultAddress = (PVOID)Buf;
 				Packet.Read.ReadLength = LengthToRead;
 
-				DWORD Ret = 0;
-				if(!DeviceIoControl(__hDriver, IOCTL_DEADWING_READ_VIRTUAL, &Packet, sizeof(DEADWING_UM_KM_COMMUNICATION), NULL, 0, &Ret, NULL)) {
+				if(!__Control(IOCTL_DEADWING_READ_VIRTUAL, &Packet)) {
 					VirtualFree(Buf, 0, MEM_RELEASE);
 					return nullptr;
 				}
@@ -199,7 +774,7 @@ namespace Deadwing {
 				// 2. allocate buffer for the data which will be written and copy data to the buffer
 				// 3. fill the packet
 				// 4. send it to the driver
-				if(!Data || Address == 0 || (LengthToWrite > 0x1000 || LengthToWrite == 0))
+				if(!Data || Address == 0 || (LengthToWrite > DEADWING_MAX_TRANSFER_LENGTH || LengthToWrite == 0))
 					return false;
 
 				PVOID Buf = VirtualAlloc(nullptr, LengthToWrite, (MEM_RESERVE | MEM_COMMIT), PAGE_READWRITE);
@@ -213,8 +788,7 @@ namespace Deadwing {
 				Packet.Write.VaDataAddress = (PVOID)Buf;
 				Packet.Write.WriteLength = LengthToWrite;
 
-				DWORD Ret = 0;
-				if(!DeviceIoControl(__hDriver, IOCTL_DEADWING_WRITE_PHYS, &Packet, sizeof(DEADWING_UM_KM_COMMUNICATION), NULL, 0, &Ret, NULL)) {
+				if(!__Control(IOCTL_DEADWING_WRITE_PHYS, &Packet)) {
 					VirtualFree(Buf, 0, MEM_RELEASE);
 					return false;
 				}
@@ -247,7 +821,7 @@ namespace Deadwing {
 				// 2. allocate buffer for the data which will be written and copy data to the buffer
 				// 3. fill the packet
 				// 4. send it to the driver
-				if(!Data || Address == 0 || ProcessId == 0 || (LengthToWrite > 0x1000 || LengthToWrite == 0))
+				if(!Data || Address == 0 || ProcessId == 0 || (LengthToWrite > DEADWING_MAX_TRANSFER_LENGTH || LengthToWrite == 0))
 					return false;
 
 				PVOID Buf = VirtualAlloc(nullptr, LengthToWrite, (MEM_RESERVE | MEM_COMMIT), PAGE_READWRITE);
@@ -262,8 +836,7 @@ namespace Deadwing {
 				Packet.Write.VaDataAddress = (PVOID)Buf;
 				Packet.Write.WriteLength = LengthToWrite;
 
-				DWORD Ret = 0;
-				if(!DeviceIoControl(__hDriver, IOCTL_DEADWING_WRITE_VIRTUAL, &Packet, sizeof(DEADWING_UM_KM_COMMUNICATION), NULL, 0, &Ret, NULL)) {
+				if(!__Control(IOCTL_DEADWING_WRITE_VIRTUAL, &Packet)) {
 					VirtualFree(Buf, 0, MEM_RELEASE);
 					return false;
 				}
@@ -300,8 +873,7 @@ namespace Deadwing {
 				Packet.Vtop.AddressToTranslate = (PVOID)Address;
 				Packet.Vtop.Translated = 0;
 
-				DWORD Ret = 0;
-				if(!DeviceIoControl(__hDriver, IOCTL_DEADWING_VIRT_TO_PHYS, &Packet, sizeof(DEADWING_UM_KM_COMMUNICATION), &Output, sizeof(DEADWING_UM_KM_COMMUNICATION), &Ret, NULL))
+				if(!__Control(IOCTL_DEADWING_VIRT_TO_PHYS, &Packet, &Output))
 					return 0;
 
 				return Output.Vtop.Translated;
@@ -318,9 +890,8 @@ namespace Deadwing {
 				void
 			) {
 				// send priv esc packet ot the driver
-				DWORD Ret = 0;
 				DEADWING_UM_KM_COMMUNICATION Dummy = { 0 };
-				if(!DeviceIoControl(__hDriver, IOCTL_DEADWING_PRIV_ESC, &Dummy, sizeof(DEADWING_UM_KM_COMMUNICATION), NULL, 0, &Ret, NULL))
+				if(!__Control(IOCTL_DEADWING_PRIV_ESC, &Dummy))
 					return false;
 
 				PROCESS_INFORMATION Pi = { 0 };
@@ -332,7 +903,826 @@ namespace Deadwing {
 
 				return true;
 			}
-		private:
+
+			/**
+			 * \brief Hashes list of ranges inside SMM.
+			 * 
+			 * Range with zero PID is physical. Every page of every range is hashed separately, 
+			 * page digests are stored one after another in the PageDigests buffer. Digest of
+			 * the range is a hash over digests of its pages and is stored in the request
+			 * 
+			 * \param Request           Algorithm and list of ranges, receives range digests
+			 * \param PageDigests       Buffer for page digests (8 bytes per page for xxHash64, 32 bytes for SHA-256)
+			 * \param PageDigestsLength Length of the page digests buffer
+			 * 
+			 * \returns false if request is invalid, ranges can't be hashed or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			HashRanges(
+				_Inout_ PDEADWING_HASH_REQUEST Request,
+				_Out_   PVOID                  PageDigests,
+				_In_    const UINT64           PageDigestsLength
+			) {
+				if(Request == nullptr || PageDigests == nullptr || PageDigestsLength == 0)
+					return false;
+
+				if(Request->RangeCount == 0 || Request->RangeCount > DEADWING_HASH_MAX_RANGES)
+					return false;
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Hash.Request = (PVOID)Request;
+				Packet.Hash.PageDigests = PageDigests;
+				Packet.Hash.PageDigestsLength = PageDigestsLength;
+
+				if(!__Control(IOCTL_DEADWING_HASH_RANGES, &Packet))
+					return false;
+
+				return true;
+			}
+
+			/**
+			 * \brief Scans physical or virtual range for byte patterns inside SMM.
+			 * 
+			 * Range with zero PID is physical. Zero byte of the pattern mask marks wildcard.
+			 * Only addresses of matches and indices of matched patterns are returned, matches
+			 * are not sorted
+			 * 
+			 * \param Request    Range and patterns to search for
+			 * \param Matches    Buffer which receives matches
+			 * \param MaxMatches Capacity of the matches buffer
+			 * \param MatchCount Receives count of matches written to the buffer
+			 * \param Truncated  Optional, receives true if some matches don't fit the buffer
+			 * 
+			 * \returns false if request is invalid, range can't be scanned or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			Scan(
+				_In_      PDEADWING_SCAN_REQUEST Request,
+				_Out_     PDEADWING_SCAN_MATCH   Matches,
+				_In_      const UINT64           MaxMatches,
+				_Out_     UINT64                &MatchCount,
+				_Out_opt_ bool                  *Truncated = nullptr
+			) {
+				if(Request == nullptr || Matches == nullptr || MaxMatches == 0 || MaxMatches > DEADWING_SCAN_MAX_MATCHES)
+					return false;
+
+				if(Request->PatternCount == 0 || Request->PatternCount > DEADWING_SCAN_MAX_PATTERNS)
+					return false;
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Scan.Request = (PVOID)Request;
+				Packet.Scan.Matches = (PVOID)Matches;
+				Packet.Scan.MaxMatches = MaxMatches;
+
+				if(!__Control(IOCTL_DEADWING_SCAN, &Packet))
+					return false;
+
+				MatchCount = Packet.Scan.MatchCount;
+				if(Truncated != nullptr)
+					*Truncated = (Packet.Scan.Truncated != 0);
+
+				return true;
+			}
+
+			/**
+			 * \brief Reads physical or virtual range, eliding all-zero and non-present pages.
+			 * 
+			 * Only pages with data are transferred, result is expanded on demand
+			 * 
+			 * \param ProcessId Target process ID (0 - physical range)
+			 * \param Address   Page aligned address
+			 * \param Length    Page aligned length
+			 * \param Range     Receives states of pages and data pages
+			 * 
+			 * \returns false if range is invalid, can't be read or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			SparseRead(
+				_In_  const UINT64  ProcessId,
+				_In_  const UINT64  Address,
+				_In_  const UINT64  Length,
+				_Out_ SparseRange  &Range
+			) {
+				if(Address == 0 || Length == 0 || ((Address | Length) & 0xFFF) != 0)
+					return false;
+
+				if(!Range.Allocate(Address, Length))
+					return false;
+
+				DEADWING_SPARSE_REQUEST Request = { 0 };
+				Request.ProcessId = ProcessId;
+				Request.Address = Address;
+				Request.Length = Length;
+				Request.Bitmap = (UINT64)Range.__Bitmap.data();
+				Request.Data = (UINT64)Range.__Data;
+				Request.DataLength = Length;
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Sparse.Request = (PVOID)&Request;
+
+				if(!__Control(IOCTL_DEADWING_SPARSE_READ, &Packet)) {
+					Range.Reset();
+					return false;
+				}
+
+				Range.Finalize(Packet.Sparse.DataPages);
+
+				return true;
+			}
+
+			/**
+			 * \brief Records per-page hash baseline of the range inside SMRAM.
+			 * 
+			 * Baseline of the same range is replaced. Least recently used regions are evicted
+			 * by the SMM driver once its tracking table is full
+			 * 
+			 * \param ProcessId Target process ID (0 - physical range)
+			 * \param Address   Start of the range
+			 * \param Length    Length of the range
+			 * \param Handle    Receives handle of the tracked region
+			 * 
+			 * \returns false if range is invalid, doesn't fit the table or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			TrackRegion(
+				_In_  const UINT64  ProcessId,
+				_In_  const UINT64  Address,
+				_In_  const UINT64  Length,
+				_Out_ UINT64       &Handle
+			) {
+				if(Address == 0 || Length == 0)
+					return false;
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.ProcessId = ProcessId;
+				Packet.Track.Address = (PVOID)Address;
+				Packet.Track.Length = Length;
+
+				if(!__Control(IOCTL_DEADWING_TRACK_REGION, &Packet))
+					return false;
+
+				Handle = Packet.Track.Handle;
+
+				return true;
+			}
+
+			/**
+			 * \brief Returns pages of the tracked region which have changed since the last call.
+			 * 
+			 * Baseline of every reported page is updated. Changes which don't fit the buffer are
+			 * reported by the next call
+			 * 
+			 * \param Handle      Handle of the tracked region
+			 * \param Changes     Buffer which receives changed pages
+			 * \param MaxChanges  Capacity of the changes buffer
+			 * \param Data        Optional, buffer of MaxChanges * 4096 bytes which receives new contents of changed pages
+			 * \param ChangeCount Receives count of changes written to the buffer
+			 * \param Truncated   Optional, receives true if some changes don't fit the buffer
+			 * 
+			 * \returns false if region has been evicted or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			ChangesSince(
+				_In_      const UINT64           Handle,
+				_Out_     PDEADWING_TRACK_CHANGE Changes,
+				_In_      const UINT64           MaxChanges,
+				_Out_opt_ PVOID                  Data,
+				_Out_     UINT64                &ChangeCount,
+				_Out_opt_ bool                  *Truncated = nullptr
+			) {
+				if(Handle == 0 || Changes == nullptr || MaxChanges == 0)
+					return false;
+
+				DEADWING_TRACK_CHANGES_REQUEST Request = { 0 };
+				Request.Handle = Handle;
+				Request.Changes = (UINT64)Changes;
+				Request.Data = (UINT64)Data;
+				Request.MaxChanges = MaxChanges;
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Track.Request = (PVOID)&Request;
+
+				if(!__Control(IOCTL_DEADWING_CHANGES_SINCE, &Packet))
+					return false;
+
+				ChangeCount = Packet.Track.ChangeCount;
+				if(Truncated != nullptr)
+					*Truncated = (Packet.Track.Truncated != 0);
+
+				return true;
+			}
+
+			/**
+			 * \brief Reports pages of the process with accessed and/or dirty bit set.
+			 * 
+			 * Page tables are walked inside SMM, reported bits are cleared atomically if
+			 * DEADWING_HARVEST_CLEAR is passed, TLBs are flushed by the KM driver afterwards.
+			 * Pages which don't fit the buffer keep their bits and are reported by the next call
+			 * 
+			 * \warning OS memory manager relies on the dirty bit. Clear it only for memory which
+			 * is never paged out, otherwise modifications may be lost
+			 * 
+			 * \param ProcessId Target process ID
+			 * \param Address   Start of the virtual range
+			 * \param Length    Length of the virtual range
+			 * \param Flags     DEADWING_HARVEST_ACCESSED, DEADWING_HARVEST_DIRTY, DEADWING_HARVEST_CLEAR
+			 * \param Pages     Buffer which receives pages
+			 * \param MaxPages  Capacity of the pages buffer
+			 * \param PageCount Receives count of pages written to the buffer
+			 * \param Truncated Optional, receives true if some pages don't fit the buffer
+			 * 
+			 * \returns false if request is invalid, page tables can't be walked or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			HarvestAccessDirty(
+				_In_      const UINT64           ProcessId,
+				_In_      const UINT64           Address,
+				_In_      const UINT64           Length,
+				_In_      const UINT32           Flags,
+				_Out_     PDEADWING_HARVEST_PAGE Pages,
+				_In_      const UINT64           MaxPages,
+				_Out_     UINT64                &PageCount,
+				_Out_opt_ bool                  *Truncated = nullptr
+			) {
+				if(ProcessId == 0 || Length == 0 || Pages == nullptr || MaxPages == 0)
+					return false;
+
+				if((Flags & (DEADWING_HARVEST_ACCESSED | DEADWING_HARVEST_DIRTY)) == 0)
+					return false;
+
+				DEADWING_HARVEST_REQUEST Request = { 0 };
+				Request.ProcessId = ProcessId;
+				Request.Address = Address;
+				Request.Length = Length;
+				Request.Pages = (UINT64)Pages;
+				Request.MaxPages = MaxPages;
+				Request.Flags = Flags;
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Harvest.Request = (PVOID)&Request;
+
+				if(!__Control(IOCTL_DEADWING_HARVEST_AD, &Packet))
+					return false;
+
+				PageCount = Packet.Harvest.PageCount;
+				if(Truncated != nullptr)
+					*Truncated = (Packet.Harvest.Truncated != 0);
+
+				return true;
+			}
+
+			/**
+			 * \brief Starts access monitor of the process ranges.
+			 * 
+			 * Ranges are split into regions, every sample checks one random page per region.
+			 * Regions with similar access counts are merged and busy regions are split once
+			 * aggregation interval is over. Previous monitor is replaced
+			 * 
+			 * \param ProcessId          Target process ID
+			 * \param Ranges             Virtual ranges to monitor
+			 * \param RangeCount         Count of ranges, up to DEADWING_MONITOR_MAX_RANGES
+			 * \param MinRegions         Min count of regions, at least RangeCount
+			 * \param MaxRegions         Max count of regions, up to DEADWING_MONITOR_MAX_REGIONS
+			 * \param AggregationSamples Count of samples in the aggregation interval
+			 * 
+			 * \returns false if request is invalid or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			MonitorStart(
+				_In_ const UINT64                 ProcessId,
+				_In_ const DEADWING_MONITOR_RANGE *Ranges,
+				_In_ const UINT32                 RangeCount,
+				_In_ const UINT32                 MinRegions,
+				_In_ const UINT32                 MaxRegions,
+				_In_ const UINT32                 AggregationSamples
+			) {
+				if(ProcessId == 0 || Ranges == nullptr || RangeCount == 0 || RangeCount > DEADWING_MONITOR_MAX_RANGES)
+					return false;
+
+				if(MinRegions < RangeCount || MinRegions > MaxRegions || MaxRegions > DEADWING_MONITOR_MAX_REGIONS || AggregationSamples == 0)
+					return false;
+
+				DEADWING_MONITOR_REQUEST Request = { 0 };
+				Request.ProcessId = ProcessId;
+				Request.MinRegions = MinRegions;
+				Request.MaxRegions = MaxRegions;
+				Request.AggregationSamples = AggregationSamples;
+				Request.RangeCount = RangeCount;
+				for(UINT32 i = 0; i < RangeCount; i++)
+					Request.Ranges[i] = Ranges[i];
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Monitor.Request = (PVOID)&Request;
+
+				return __Control(IOCTL_DEADWING_MONITOR_START, &Packet);
+			}
+
+			/**
+			 * \brief Takes single sample of the monitored regions.
+			 * 
+			 * Accesses of the entry is count of samples in which the page of the region has been accessed.
+			 * Once aggregation interval is over, heatmap of the whole interval is returned and
+			 * regions are rebuilt for the next one. Call it periodically, e.g. every few milliseconds
+			 * 
+			 * \param Heatmap    Buffer which receives heatmap
+			 * \param MaxEntries Capacity of the heatmap buffer, DEADWING_MONITOR_MAX_REGIONS is enough
+			 * \param EntryCount Receives count of entries written to the buffer
+			 * \param Aggregated Optional, receives true if aggregation interval is over
+			 * 
+			 * \returns false if monitor is not started or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			MonitorSample(
+				_Out_     PDEADWING_MONITOR_ENTRY Heatmap,
+				_In_      const UINT64            MaxEntries,
+				_Out_     UINT64                 &EntryCount,
+				_Out_opt_ bool                   *Aggregated = nullptr
+			) {
+				if(Heatmap == nullptr || MaxEntries == 0)
+					return false;
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Monitor.Heatmap = (PVOID)Heatmap;
+				Packet.Monitor.MaxEntries = MaxEntries;
+
+				if(!__Control(IOCTL_DEADWING_MONITOR_SAMPLE, &Packet))
+					return false;
+
+				EntryCount = Packet.Monitor.EntryCount;
+				if(Aggregated != nullptr)
+					*Aggregated = (Packet.Monitor.Aggregated != 0);
+
+				return true;
+			}
+
+			/**
+			 * \brief Builds entropy and content class map of physical or virtual range.
+			 * 
+			 * Every page is classified inside SMM, only one byte per page is transferred.
+			 * Use DEADWING_PAGE_CLASS and DEADWING_PAGE_ENTROPY to decode entries
+			 * 
+			 * \param ProcessId Target process ID (0 - physical range)
+			 * \param Address   Page aligned address
+			 * \param Length    Page aligned length
+			 * \param Map       Receives one entry per page
+			 * 
+			 * \returns false if range is invalid, can't be classified or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			EntropyMap(
+				_In_  const UINT64        ProcessId,
+				_In_  const UINT64        Address,
+				_In_  const UINT64        Length,
+				_Out_ std::vector<UINT8> &Map
+			) {
+				if(Address == 0 || Length == 0 || ((Address | Length) & 0xFFF) != 0)
+					return false;
+
+				// zero initialized, so buffer is resident before SMM writes to it
+				Map.assign((size_t)(Length >> 12), 0);
+
+				DEADWING_ENTROPY_REQUEST Request = { 0 };
+				Request.ProcessId = ProcessId;
+				Request.Address = Address;
+				Request.Length = Length;
+				Request.Map = (UINT64)Map.data();
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Entropy.Request = (PVOID)&Request;
+
+				return __Control(IOCTL_DEADWING_ENTROPY_MAP, &Packet);
+			}
+
+			/**
+			 * \brief Drains records of the SMM log ring.
+			 * 
+			 * SMM driver appends messages to the ring in SMRAM instead of printing them to the
+			 * serial port. Every record is returned once, oldest records are overwritten if the
+			 * ring is not drained in time
+			 * 
+			 * \param Records     Buffer which receives records
+			 * \param MaxRecords  Capacity of the records buffer
+			 * \param RecordCount Receives count of records written to the buffer
+			 * \param Dropped     Optional, receives count of records lost since the last drain
+			 * 
+			 * \returns false if buffer is invalid or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			DrainLog(
+				_Out_     PDEADWING_LOG_RECORD Records,
+				_In_      const UINT64         MaxRecords,
+				_Out_     UINT64              &RecordCount,
+				_Out_opt_ UINT64              *Dropped = nullptr
+			) {
+				if(Records == nullptr || MaxRecords == 0)
+					return false;
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Log.Records = (PVOID)Records;
+				Packet.Log.MaxRecords = MaxRecords;
+
+				if(!__Control(IOCTL_DEADWING_DRAIN_LOG, &Packet))
+					return false;
+
+				RecordCount = Packet.Log.RecordCount;
+				if(Dropped != nullptr)
+					*Dropped = Packet.Log.Dropped;
+
+				return true;
+			}
+
+			/**
+			 * \brief Drains records of the SMM binary trace ring.
+			 * 
+			 * Records are returned in full size, only ArgCount arguments of every record are valid.
+			 * Write Sync..Args[ArgCount - 1] of every record to get the stream decoded by DwTrace.py
+			 * 
+			 * \param Records     Buffer which receives records
+			 * \param MaxRecords  Capacity of the records buffer
+			 * \param RecordCount Receives count of records written to the buffer
+			 * \param Dropped     Optional, receives count of records lost since the last drain
+			 * 
+			 * \returns false if buffer is invalid or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			DrainTrace(
+				_Out_     PDEADWING_TRACE_RECORD Records,
+				_In_      const UINT64           MaxRecords,
+				_Out_     UINT64                &RecordCount,
+				_Out_opt_ UINT64                *Dropped = nullptr
+			) {
+				if(Records == nullptr || MaxRecords == 0)
+					return false;
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Trace.Records = (PVOID)Records;
+				Packet.Trace.MaxRecords = MaxRecords;
+
+				if(!__Control(IOCTL_DEADWING_DRAIN_TRACE, &Packet))
+					return false;
+
+				RecordCount = Packet.Trace.RecordCount;
+				if(Dropped != nullptr)
+					*Dropped = Packet.Trace.Dropped;
+
+				return true;
+			}
+
+			/**
+			 * \brief Reads performance counters of the SMM driver
+			 * 
+			 * \param Stats Receives counters accumulated since driver load or the last reset
+			 * \param Reset Clears counters once they have been read
+			 * 
+			 * \returns false if KM driver can't be reached or SMM driver can't write counters
+			 */
+			bool
+			WINAPI
+			GetStats(
+				_Out_ DEADWING_STATS &Stats,
+				_In_  const bool      Reset = false
+			) {
+				std::memset(&Stats, 0, sizeof(DEADWING_STATS));
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Stats.Buffer = (PVOID)&Stats;
+				Packet.Stats.Reset = Reset ? 1 : 0;
+
+				return __Control(IOCTL_DEADWING_GET_STATS, &Packet);
+			}
+
+			/**
+			 * \brief Starts system-wide sampling profiler.
+			 * 
+			 * KM driver fires SMI every interval, SMM driver records RIP, RSP, CR3 and CPL
+			 * of every CPU from its save state. Samples are kept in SMRAM until drained
+			 * 
+			 * \param IntervalUs Interval between samples in microseconds, at least 1000
+			 * 
+			 * \returns false if interval is invalid, profiler is already running or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			ProfileStart(
+				_In_ const UINT64 IntervalUs
+			) {
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Profile.IntervalUs = IntervalUs;
+
+				return __Control(IOCTL_DEADWING_PROFILE_START, &Packet);
+			}
+
+			/**
+			 * \brief Stops sampling profiler
+			 * 
+			 * \param SampleCount Optional, receives count of samples taken since start
+			 * \param Skipped     Optional, receives count of intervals without sample
+			 * 
+			 * \returns false if profiler is not running or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			ProfileStop(
+				_Out_opt_ UINT64 *SampleCount = nullptr,
+				_Out_opt_ UINT64 *Skipped = nullptr
+			) {
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				if(!__Control(IOCTL_DEADWING_PROFILE_STOP, &Packet))
+					return false;
+
+				if(SampleCount != nullptr)
+					*SampleCount = Packet.Profile.SampleCount;
+
+				if(Skipped != nullptr)
+					*Skipped = Packet.Profile.Dropped;
+
+				return true;
+			}
+
+			/**
+			 * \brief Drains samples of the SMM profiler ring
+			 * 
+			 * \param Samples     Buffer which receives samples
+			 * \param MaxSamples  Capacity of the samples buffer
+			 * \param SampleCount Receives count of samples written to the buffer
+			 * \param Dropped     Optional, receives count of samples lost since the last drain
+			 * 
+			 * \returns false if buffer is invalid or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			DrainProfile(
+				_Out_     PDEADWING_PROFILE_SAMPLE Samples,
+				_In_      const UINT64             MaxSamples,
+				_Out_     UINT64                  &SampleCount,
+				_Out_opt_ UINT64                  *Dropped = nullptr
+			) {
+				if(Samples == nullptr || MaxSamples == 0)
+					return false;
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Profile.Samples = (PVOID)Samples;
+				Packet.Profile.MaxSamples = MaxSamples;
+
+				if(!__Control(IOCTL_DEADWING_DRAIN_PROFILE, &Packet))
+					return false;
+
+				SampleCount = Packet.Profile.SampleCount;
+				if(Dropped != nullptr)
+					*Dropped = Packet.Profile.Dropped;
+
+				return true;
+			}
+
+			/**
+			 * \brief Reads interrupted registers of every CPU inside one SMI.
+			 * 
+			 * Entries of CPUs without save state (absent or not rendezvoused) have Valid set to 0
+			 * 
+			 * \param Registers Receives registers of every CPU
+			 * 
+			 * \returns false if KM driver can't be reached or save states can't be read
+			 */
+			bool
+			WINAPI
+			SnapshotRegisters(
+				_Out_ std::vector<DEADWING_CPU_REGISTERS> &Registers
+			) {
+				Registers.resize(DEADWING_MAX_CPUS);
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Registers.Buffer = (PVOID)Registers.data();
+				Packet.Registers.MaxCpus = Registers.size();
+
+				if(!__Control(IOCTL_DEADWING_SNAPSHOT_REGS, &Packet)) {
+					Registers.clear();
+					return false;
+				}
+
+				Registers.resize(Packet.Registers.CpuCount);
+
+				return true;
+			}
+
+			/**
+			 * \brief Reads physical memory map cached by SMI handler at boot.
+			 * 
+			 * Ranges are sorted by base, contiguous ranges of the same type are merged. Physical
+			 * reads return zeros for holes and for ranges which aren't RAM (reserved, MMIO etc.)
+			 * 
+			 * \param Ranges Receives ranges of the map
+			 * 
+			 * \returns false if KM driver can't be reached or map hasn't been cached
+			 */
+			bool
+			WINAPI
+			GetMemoryMap(
+				_Out_ std::vector<DEADWING_MEMORY_RANGE> &Ranges
+			) {
+				Ranges.resize(DEADWING_MAX_MEMORY_RANGES);
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.MemoryMap.Ranges = (PVOID)Ranges.data();
+				Packet.MemoryMap.MaxRanges = Ranges.size();
+
+				if(!__Control(IOCTL_DEADWING_GET_MEMORY_MAP, &Packet)) {
+					Ranges.clear();
+					return false;
+				}
+
+				// map never exceeds capacity of SMRAM table
+				if(Packet.MemoryMap.RangeCount < Ranges.size())
+					Ranges.resize(Packet.MemoryMap.RangeCount);
+
+				return true;
+			}
+
+			/**
+			 * \brief Copies ACPI table indexed by SMI handler.
+			 * 
+			 * Tables are found by signature ('FACP', 'APIC', 'MCFG', 'DSDT', etc.), several
+			 * tables with the same signature (SSDTs) are told apart by instance. Signature 0
+			 * enumerates all indexed tables
+			 * 
+			 * \param Signature Signature of the table or 0, receives signature of the table
+			 * \param Instance  Index of the table among tables with the same signature (or among all tables)
+			 * \param Table     Receives the table
+			 * \param Address   Optional, receives physical address of the table
+			 * 
+			 * \returns false if KM driver can't be reached or there is no such table
+			 */
+			bool
+			WINAPI
+			GetAcpiTable(
+				_Inout_   UINT32             &Signature,
+				_In_      UINT32              Instance,
+				_Out_     std::vector<UINT8> &Table,
+				_Out_opt_ UINT64             *Address = nullptr
+			) {
+				Table.resize(0x10000);
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				for(int Attempt = 0; Attempt < 2; Attempt++) {
+					Packet.Acpi.Signature = Signature;
+					Packet.Acpi.Instance = Instance;
+					Packet.Acpi.Buffer = (PVOID)Table.data();
+					Packet.Acpi.MaxLength = Table.size();
+
+					if(!__Control(IOCTL_DEADWING_GET_ACPI_TABLE, &Packet)) {
+						Table.clear();
+						return false;
+					}
+
+					// retry once if the table is larger than the buffer
+					if(Packet.Acpi.Length <= Table.size())
+						break;
+
+					Table.resize(Packet.Acpi.Length);
+				}
+
+				Table.resize(Packet.Acpi.Length);
+				Signature = Packet.Acpi.Signature;
+
+				if(Address != nullptr)
+					*Address = Packet.Acpi.Address;
+
+				return true;
+			}
+
+			/**
+			 * \brief Executes batch of reads, writes and translations with a single SMI.
+			 * 
+			 * Commands are queued in the submission ring shared with SMI handler and drained
+			 * together, every command gets its own status. Buffers of reads and writes should be
+			 * valid until the call returns
+			 * 
+			 * \param Entries   Commands, receive statuses and values
+			 * \param Completed Optional, receives count of succesfully completed commands
+			 * 
+			 * \returns false if KM driver can't be reached or the batch can't be executed
+			 */
+			bool
+			WINAPI
+			SubmitBatch(
+				_Inout_   std::vector<DEADWING_BATCH_ENTRY> &Entries,
+				_Out_opt_ UINT64                            *Completed = nullptr
+			) {
+				if(Entries.empty() || Entries.size() > DEADWING_MAX_BATCH)
+					return false;
+
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.Batch.Entries = (PVOID)Entries.data();
+				Packet.Batch.Count = Entries.size();
+
+				if(!__Control(IOCTL_DEADWING_SUBMIT_BATCH, &Packet))
+					return false;
+
+				if(Completed != nullptr)
+					*Completed = Packet.Batch.Completed;
+
+				return true;
+			}
+
+			/**
+			 * \brief Returns per-phase timing of the last command sent to the driver.
+			 * 
+			 * Timing is summed over all SMIs of the command, phases which were executed
+			 * in parallel by several CPUs are accounted as total CPU time
+			 * 
+			 * \param Timing   Receives TSC cycles spent in each phase
+			 * \param SmiCount Optional, receives count of SMIs fired to complete the command
+			 */
+			void
+			WINAPI
+			GetLastTiming(
+				_Out_     DEADWING_TIMING &Timing,
+				_Out_opt_ UINT64          *SmiCount = nullptr
+			) {
+				Timing = __LastTiming;
+				if(SmiCount != nullptr)
+					*SmiCount = __LastSmiCount;
+			}
+
+			/**
+			 * \brief Changes limits of the SMI scheduler in the KM driver
+			 * 
+			 * \param MaxSmiPerSecond   Max count of SMIs per second, 0 - unlimited
+			 * \param MaxSmmUsPerSecond Max time in microseconds spent in SMM per second, 0 - unlimited
+			 * \param AverageCostUs     Optional, receives measured average cost of the SMI round-trip
+			 * 
+			 * \returns false if limits are invalid or KM driver can't be reached
+			 */
+			bool
+			WINAPI
+			SetRateLimit(
+				_In_      const UINT64 MaxSmiPerSecond,
+				_In_      const UINT64 MaxSmmUsPerSecond,
+				_Out_opt_ UINT64       *AverageCostUs = nullptr
+			) {
+				DEADWING_UM_KM_COMMUNICATION Output = { 0 };
+				DEADWING_UM_KM_COMMUNICATION Packet = { 0 };
+				Packet.RateLimit.MaxSmiPerSecond = MaxSmiPerSecond;
+				Packet.RateLimit.MaxSmmUsPerSecond = MaxSmmUsPerSecond;
+
+				if(!__Control(IOCTL_DEADWING_SET_RATE_LIMIT, &Packet, &Output))
+					return false;
+
+				if(AverageCostUs != nullptr)
+					*AverageCostUs = Output.RateLimit.AverageSmiCostUs;
+
+				return true;
+			}
+		private:
+			/**
+			 * \brief Sends packet to the driver and saves timing of the command
+			 * 
+			 * \param IoControlCode Control code of the command
+			 * \param Packet        Packet for the driver
+			 * \param Output        Optional, receives output of the driver. Output is written back to the packet by default
+			 * 
+			 * \returns true if command has been executed, otherwise false
+			 */
+			bool
+			WINAPI
+			__Control(
+				_In_      const DWORD                   IoControlCode,
+				_Inout_   PDEADWING_UM_KM_COMMUNICATION Packet,
+				_Out_opt_ PDEADWING_UM_KM_COMMUNICATION Output = nullptr
+			) {
+				if(Output == nullptr)
+					Output = Packet;
+
+				Packet->SmiCount = 0;
+				std::memset(&Packet->Timing, 0, sizeof(DEADWING_TIMING));
+
+				DWORD Ret = 0;
+				bool Status = DeviceIoControl(__hDriver, IoControlCode, Packet, sizeof(DEADWING_UM_KM_COMMUNICATION), Output, sizeof(DEADWING_UM_KM_COMMUNICATION), &Ret, NULL) != FALSE;
+
+				// driver reports timing only for completed commands
+				__LastTiming = { };
+				__LastSmiCount = 0;
+
+				if(Status && Ret == sizeof(DEADWING_UM_KM_COMMUNICATION)) {
+					__LastTiming = Output->Timing;
+					__LastSmiCount = Output->SmiCount;
+				}
+
+				return Status;
+			}
+
 			HANDLE __hDriver = { };
+			DEADWING_TIMING __LastTiming = { };
+			UINT64 __LastSmiCount = 0;
 	};
 };
@@ -5,3 +5,28 @@
 
 /// \note @0x00Alchemist: uncomment this if you run driver on Qemu
 //#define DEADWING_QEMU_FIRMWARE
+
+/// \note uncomment this to send binary trace records (decoded by DwTrace.py) to the
+/// serial (or QEMU debug) port. Every SMM communication is traced, so keep it off on real hardware
+//#define DEADWING_TRACE
+
+/// \note the packet in the communication buffer is followed by the inline data region
+/// (64KB - 4MB). Reads return data there, so the KM driver copies it to the caller and SMM doesn't
+/// translate the controller buffer. Offset of the region from the packet is defined by Common/DeadwingComm.h
+#define DEADWING_COMM_DATA_SIZE      0x100000
+
+/// \note every channel is a separate communication buffer with its own packet and inline 
+/// data region, so the KM driver can keep several requests in flight. Each channel costs the inline data 
+/// region of runtime memory, there is no point to have more channels than CPUs issuing requests (max 64)
+#define DEADWING_COMM_CHANNELS       4
+
+/// \note submission and completion rings shared by the KM driver and SMI handler follow
+/// the channels. Counts of entries should be in sync with Deadwing/Conf.h and be a power of two
+#define DEADWING_RING_SQ_ENTRIES     256
+#define DEADWING_RING_CQ_ENTRIES     256
+
+/// \note APM ports of the chipset. Channels are registered for the doorbell before ExitBootServices,
+/// then the KM driver writes index of the channel to the data port and doorbell SMI value to the command port 
+/// instead of calling SubmitPacket. Doorbell isn't advertised if SMM driver can't register it
+#define DEADWING_DOORBELL_COMMAND_PORT 0xB2
+#define DEADWING_DOORBELL_DATA_PORT    0xB3
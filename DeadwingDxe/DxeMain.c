@@ -2,11 +2,13 @@
 #include <Base.h>
 
 #include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
 
 #include <Protocol/LoadedImage.h>
 #include <Protocol/MmCommunication2.h>
 
 #include <Guid/EventGroup.h>
+#include <Guid/Acpi.h>
 
 #include "Conf.h"
 
@@ -18,73 +20,141 @@
 #include "Globals.h"
 #include "Utils.h"
 #include "Serial.h"
+#include "Trace.h"
 #include "Relocations.h"
 
 #define EFI_OBLIGATORY_PTR 0x0 
 
-#define CMD_DEADWING_PING_SMI 0xD700DEADULL
-
 #define DEADWING_COMMUNICATE_HEADER_SIZE (OFFSET_OF(EFI_MM_COMMUNICATE_HEADER, Data))
 
+// rings follow the channels
+#define DEADWING_RING_OFFSET (gChannelSize * DEADWING_COMM_CHANNELS)
+
+// pages of all channels and rings
+#define DEADWING_COMM_PAGES EFI_SIZE_TO_PAGES(DEADWING_RING_OFFSET + gRingSize)
+
 typedef EFI_STATUS(EFIAPI *__EfiEntry)(IN EFI_HANDLE, IN EFI_SYSTEM_TABLE *);
 __EfiEntry Entry;
 
 
 /**
- * \brief Setups communication buffer for convoying into the SMM environment.
+ * \brief Prepares header of the channel and returns its packet, so the caller
+ * builds the command right in the communication buffer.
  * 
  * This API is exposed for use by kernel module(s)
  * 
- * \param CommunicationPacket Communication packet with data which will be convoyed
- * \param DataSize            Size of packet
+ * \param Channel Index of the channel
  * 
- * \return EFI_SUCCESS - Buffer succesfully setuped 
- * \return EFI_INVALID_PARAMETER - Packet size overlaps communication buffer
+ * \returns Packet of the channel or NULL, if channel doesn't exist
  */
-EFI_STATUS
+PDEADWING_PACKET
 EFIAPI
-SetupCommunicationBuffer(
-	IN PDEADWING_COMMUNICATION CommunicationPacket,
-	IN UINTN                   DataSize
+AcquirePacket(
+	IN UINTN Channel
 ) {
-	if(DataSize > gCommSize)
-		return EFI_INVALID_PARAMETER;
-	
-	EFI_MM_COMMUNICATE_HEADER *CommHeader = (EFI_MM_COMMUNICATE_HEADER *)gCommBuf;
+	if(Channel >= DEADWING_COMM_CHANNELS)
+		return NULL;
+
+	EFI_MM_COMMUNICATE_HEADER *CommHeader = (EFI_MM_COMMUNICATE_HEADER *)((UINT8 *)gCommBuf + Channel * gChannelSize);
 
-	// fill header
+	// fill header, packet is filled by the caller
 	CopyMemory(&CommHeader->HeaderGuid, &gDeadwingSmiHandlerGuid, sizeof(EFI_GUID));
-	CopyMemory(&CommHeader->Data, CommunicationPacket, sizeof(DEADWING_COMMUNICATION));
 	CommHeader->MessageLength = gCommSize;
 
-	return EFI_SUCCESS;
+	return (PDEADWING_PACKET)CommHeader->Data;
 }
 
 /**
- * \brief Main function for communication.
+ * \brief Conveys packet of the channel to the SMM environment. SMI handler
+ * fills the same packet, so it can be resubmitted as is to resume the command.
  * 
- * This API is exposed for use by kernel module(s)
+ * This API is exposed for use by kernel module(s). Channels are independent, but
+ * caller should serialize the calls: SMM communication protocol is not reentrant
+ * 
+ * \param Channel Index of the channel
  * 
  * \returns NULL if Communicate service fails or CommPacket with
  * info from SMM environment
  */
-PDEADWING_COMMUNICATION
+PDEADWING_PACKET
 EFIAPI
-DeadwingSmmCommunicate(
-	VOID
+SubmitPacket(
+	IN UINTN Channel
 ) {
+	if(Channel >= DEADWING_COMM_CHANNELS)
+		return NULL;
+
+	EFI_MM_COMMUNICATE_HEADER *CommHeader = (EFI_MM_COMMUNICATE_HEADER *)((UINT8 *)gCommBuf + Channel * gChannelSize);
+	PDEADWING_PACKET CommPacket = (PDEADWING_PACKET)CommHeader->Data;
+
+#ifdef DEADWING_TRACE
+	UINT64 Tsc = AsmReadTsc();
+#endif
+
 	// convey data to child SMI handler
 	UINTN CommSize = gCommSize;
-	EFI_STATUS Status = gMmCommunicate2->Communicate(gMmCommunicate2, gPhysCommBuf, gCommBuf, &CommSize);
+	EFI_STATUS Status = gMmCommunicate2->Communicate(gMmCommunicate2, (UINT8 *)gPhysCommBuf + Channel * gChannelSize, CommHeader, &CommSize);
+
+	TRACE(DEADWING_TRACE_DXE_COMMUNICATE, 4, DEADWING_PACKET_COMMANDS(CommPacket)->Command, Status, CommPacket->Status, AsmReadTsc() - Tsc);
+
 	if(EFI_ERROR(Status))
 		return NULL;
-	
-	EFI_MM_COMMUNICATE_HEADER *CommHeader = (EFI_MM_COMMUNICATE_HEADER *)gCommBuf;
-	PDEADWING_COMMUNICATION CommPacket = (PDEADWING_COMMUNICATION)CommHeader->Data;
 
 	return CommPacket;
 }
 
+/**
+ * \brief Forms packet with a single command in the channel
+ * 
+ * \param Channel     Index of the channel
+ * \param Command     Command magic number
+ * \param PayloadSize Size of the payload of the command
+ * 
+ * \returns Command of the packet, its payload is zeroed
+ */
+PDEADWING_COMMAND
+EFIAPI
+FormPacket(
+	IN UINTN   Channel,
+	IN UINT32  Command,
+	IN UINTN   PayloadSize
+) {
+	PDEADWING_PACKET CommPacket = AcquirePacket(Channel);
+	PDEADWING_COMMAND CommCommand = DEADWING_PACKET_COMMANDS(CommPacket);
+
+	gBS->SetMem(CommPacket, sizeof(DEADWING_PACKET) + DEADWING_COMMAND_LENGTH(PayloadSize), 0);
+
+	// status of the packet stays untouched if SMI handler is absent
+	CommPacket->Signature = DEADWING_PACKET_SIGNATURE;
+	CommPacket->Count = 1;
+	CommPacket->Length = sizeof(DEADWING_PACKET) + DEADWING_COMMAND_LENGTH(PayloadSize);
+	CommPacket->Status = EFI_COMPROMISED_DATA;
+
+	CommCommand->Command = Command;
+	CommCommand->Length = DEADWING_COMMAND_LENGTH(PayloadSize);
+	CommCommand->Status = EFI_NOT_READY;
+
+	return CommCommand;
+}
+
+/**
+ * \brief Returns status of the single command packet
+ * 
+ * \param CommPacket Packet returned by SMI handler
+ * 
+ * \returns Status of the packet if it hasn't been processed, otherwise status of its command
+ */
+EFI_STATUS
+EFIAPI
+PacketStatus(
+	IN PDEADWING_PACKET CommPacket
+) {
+	if(EFI_ERROR(CommPacket->Status))
+		return CommPacket->Status;
+
+	return DEADWING_PACKET_COMMANDS(CommPacket)->Status;
+}
+
 /**
  * \brief Sample function for firing SMI's
  * 
@@ -97,21 +167,135 @@ DeadwingSmmCommunicate(
 EFI_STATUS
 EFIAPI
 FireSmi(
-	IN UINT64                 Command
+	IN UINT32  Command
+) {
+	FormPacket(0, Command, 0);
+
+	PDEADWING_PACKET OutputPacket = SubmitPacket(0);
+	if(OutputPacket == NULL)
+		return EFI_ABORTED;
+
+	// packet lies in the buffer which is cleared below
+	EFI_STATUS Status = PacketStatus(OutputPacket);
+
+	gBS->SetMem(gCommBuf, gCommSize, 0);
+
+	return Status;
+}
+
+/**
+ * \brief Registers channels of the communication buffer for the doorbell SMI.
+ * 
+ * SMI handler validates channels only once, at registration, so it should be done
+ * before ExitBootServices while the buffer is still trusted
+ * 
+ * \return EFI_SUCCESS - Doorbell has been registered
+ * \return EFI_ABORTED - Unable to communicate with handler
+ * \return Other - SMI handler can't register doorbell
+ */
+EFI_STATUS
+EFIAPI
+RegisterDoorbell(
+	VOID
+) {
+	PDEADWING_COMMAND CommCommand = FormPacket(0, CMD_DEADWING_REGISTER_DOORBELL, sizeof(DEADWING_DOORBELL_PAYLOAD));
+
+	PDEADWING_DOORBELL_PAYLOAD Doorbell = &DEADWING_COMMAND_PAYLOAD(CommCommand)->Doorbell;
+	Doorbell->Channels = gPhysCommBuf;
+	Doorbell->ChannelCount = DEADWING_COMM_CHANNELS;
+	Doorbell->ChannelSize = gChannelSize;
+	Doorbell->CommSize = gCommSize;
+
+	PDEADWING_PACKET OutputPacket = SubmitPacket(0);
+	if(OutputPacket == NULL)
+		return EFI_ABORTED;
+
+	EFI_STATUS Status = PacketStatus(OutputPacket);
+	if(!EFI_ERROR(Status)) {
+		gDoorbellSwSmi = Doorbell->SwSmiValue;
+		gDoorbellRegistered = TRUE;
+	}
+
+	gBS->SetMem(gCommBuf, gCommSize, 0);
+
+	return Status;
+}
+
+/**
+ * \brief Caches UEFI memory map in SMRAM, so SMI handler skips holes, reserved
+ * and MMIO ranges on physical reads. SMI handler accepts the map only once
+ * 
+ * \return EFI_SUCCESS - Memory map has been cached
+ * \return EFI_ABORTED - Unable to communicate with handler
+ * \return Other - Unable to get memory map or SMI handler can't cache it
+ */
+EFI_STATUS
+EFIAPI
+SendMemoryMap(
+	VOID
+) {
+	PDEADWING_COMMAND CommCommand = FormPacket(0, CMD_DEADWING_SET_MEMORY_MAP, sizeof(DEADWING_SET_MEMORY_MAP_PAYLOAD));
+
+	// map is written right to the inline data region, so nothing is allocated at ExitBootServices
+	UINTN MapSize = DEADWING_COMM_DATA_SIZE;
+	UINTN MapKey;
+	UINTN DescriptorSize;
+	UINT32 DescriptorVersion;
+	EFI_STATUS Status = gBS->GetMemoryMap(&MapSize, (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)AcquirePacket(0) + DEADWING_COMM_INLINE_OFFSET), &MapKey, &DescriptorSize, &DescriptorVersion);
+	if(EFI_ERROR(Status)) {
+		gBS->SetMem(gCommBuf, gCommSize, 0);
+		return Status;
+	}
+
+	PDEADWING_SET_MEMORY_MAP_PAYLOAD MemoryMap = &DEADWING_COMMAND_PAYLOAD(CommCommand)->SetMemoryMap;
+	MemoryMap->MapSize = MapSize;
+	MemoryMap->DescriptorSize = DescriptorSize;
+
+	PDEADWING_PACKET OutputPacket = SubmitPacket(0);
+	if(OutputPacket == NULL)
+		return EFI_ABORTED;
+
+	Status = PacketStatus(OutputPacket);
+
+	gBS->SetMem(gCommBuf, gCommSize, 0);
+
+	return Status;
+}
+
+/**
+ * \brief Passes RSDP of the configuration table to the SMI handler, so it doesn't scan memory for it
+ * 
+ * \return EFI_SUCCESS - RSDP has been passed
+ * \return EFI_NOT_FOUND - Configuration table has no RSDP
+ * \return EFI_ABORTED - Unable to communicate with handler
+ * \return Other - SMI handler can't save RSDP
+ */
+EFI_STATUS
+EFIAPI
+SendRsdp(
+	VOID
 ) {
-	DEADWING_COMMUNICATION CommPacket;
-	CommPacket.Command = Command;
-	CommPacket.SmiRetStatus = EFI_COMPROMISED_DATA;
+	// ACPI 2.0 RSDP supersedes ACPI 1.0 one
+	VOID *Rsdp = NULL;
+	EFI_STATUS Status = EfiGetSystemConfigurationTable(&gEfiAcpi20TableGuid, &Rsdp);
+	if(EFI_ERROR(Status))
+		Status = EfiGetSystemConfigurationTable(&gEfiAcpi10TableGuid, &Rsdp);
 
-	SetupCommunicationBuffer(&CommPacket, sizeof(CommPacket));
+	if(EFI_ERROR(Status) || Rsdp == NULL)
+		return EFI_NOT_FOUND;
 
-	PDEADWING_COMMUNICATION OutputPacket = DeadwingSmmCommunicate();
+	PDEADWING_COMMAND CommCommand = FormPacket(0, CMD_DEADWING_SET_RSDP, sizeof(DEADWING_RSDP_PAYLOAD));
+	DEADWING_COMMAND_PAYLOAD(CommCommand)->Rsdp.Address = (UINT64)(UINTN)Rsdp;
+
+	PDEADWING_PACKET OutputPacket = SubmitPacket(0);
 	if(OutputPacket == NULL)
 		return EFI_ABORTED;
 
+	Status = PacketStatus(OutputPacket);
+
 	gBS->SetMem(gCommBuf, gCommSize, 0);
 
-	return OutputPacket->SmiRetStatus;
+	return Status;
 }
 
 /**
@@ -130,24 +314,44 @@ DeadwingDxeGoneVirtual(
 	SerialPrint("[ DXE ] Hit virtual address change callback\r\n");
 
 	VOID *VirtualBuf = gPhysCommBuf;
-	VOID *SetupCommBufFunc = SetupCommunicationBuffer;
-	VOID *DeadwingSmmCommFunc = DeadwingSmmCommunicate;
+	VOID *AcquirePacketFunc = AcquirePacket;
+	VOID *SubmitPacketFunc = SubmitPacket;
 
 	// convert necessary stuff
 	gRT->ConvertPointer(EFI_OBLIGATORY_PTR, (VOID **)&gMmCommunicate2);
 	gRT->ConvertPointer(EFI_OBLIGATORY_PTR, (VOID **)&VirtualBuf);
-	gRT->ConvertPointer(EFI_OBLIGATORY_PTR, (VOID **)&SetupCommBufFunc);
-	gRT->ConvertPointer(EFI_OBLIGATORY_PTR, (VOID **)&DeadwingSmmCommFunc);
+	gRT->ConvertPointer(EFI_OBLIGATORY_PTR, (VOID **)&AcquirePacketFunc);
+	gRT->ConvertPointer(EFI_OBLIGATORY_PTR, (VOID **)&SubmitPacketFunc);
 
 	gCommBuf = VirtualBuf;
 
+	TRACE(DEADWING_TRACE_DXE_GONE_VIRTUAL, 2, gPhysCommBuf, gCommBuf, 0, 0);
+
 	// fill transfer packet
 	DEADWING_TRANSFER Transfer = { 0 };
 	Transfer.Buffer.CommBufPhys = gPhysCommBuf;
 	Transfer.Buffer.CommBufVirtual = gCommBuf;
-	Transfer.Buffer.BufSize = gCommSize;
-	Transfer.API.SetupBufFunction = SetupCommBufFunc;
-	Transfer.API.SmmCommunicateFunction = DeadwingSmmCommFunc;
+	Transfer.Buffer.CommBufSize = gCommSize;
+	Transfer.Buffer.DataOffset = DEADWING_COMMUNICATE_HEADER_SIZE + DEADWING_COMM_INLINE_OFFSET;
+	Transfer.Buffer.DataSize = DEADWING_COMM_DATA_SIZE;
+	Transfer.Buffer.ChannelCount = DEADWING_COMM_CHANNELS;
+	Transfer.Buffer.ChannelSize = gChannelSize;
+	Transfer.Ring.Offset = DEADWING_RING_OFFSET;
+	Transfer.Ring.Size = gRingSize;
+	Transfer.Ring.SqOffset = sizeof(DEADWING_RING);
+	Transfer.Ring.SqEntries = DEADWING_RING_SQ_ENTRIES;
+	Transfer.Ring.CqOffset = sizeof(DEADWING_RING) + DEADWING_RING_SQ_ENTRIES * sizeof(DEADWING_RING_SUBMISSION);
+	Transfer.Ring.CqEntries = DEADWING_RING_CQ_ENTRIES;
+
+	// KM driver uses the doorbell only if it's advertised
+	if(gDoorbellRegistered) {
+		Transfer.Doorbell.CommandPort = DEADWING_DOORBELL_COMMAND_PORT;
+		Transfer.Doorbell.DataPort = DEADWING_DOORBELL_DATA_PORT;
+		Transfer.Doorbell.SwSmiValue = gDoorbellSwSmi;
+	}
+
+	Transfer.API.AcquirePacketFunction = AcquirePacketFunc;
+	Transfer.API.SubmitPacketFunction = SubmitPacketFunc;
 
 	// finally, publish full transfer packet
 	EFI_STATUS Status = gRT->SetVariable(L"DeadwingTransfer", &gDeadwingTransferVarGuid, (EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS), sizeof(DEADWING_TRANSFER), &Transfer);
@@ -178,6 +382,15 @@ DeadwingBeforeExitBootServices(
 	if(EFI_ERROR(Status)) {
 		SerialPrint("[ DXE ] Unable to ping SMI handler\r\n");
 		gBS->CloseEvent(gGoneVirtual);
+	} else {
+		if(EFI_ERROR(SendMemoryMap()))
+			SerialPrint("[ DXE ] Memory map isn't cached, physical reads aren't filtered\r\n");
+
+		if(EFI_ERROR(SendRsdp()))
+			SerialPrint("[ DXE ] RSDP isn't passed, SMI handler scans legacy BIOS area for it\r\n");
+
+		if(EFI_ERROR(RegisterDoorbell()))
+			SerialPrint("[ DXE ] Doorbell isn't available, packets are conveyed through the communication protocol\r\n");
 	}
 
 	gBS->CloseEvent(gExitBs);
@@ -203,7 +416,7 @@ MmCommProtocolRegistrationCallback(
 		SerialPrint("[ DXE ] Unable to locate EFI_MM_COMMUNICATION2_PROTOCOL protocol\r\n");
 		
 		gBS->CloseEvent(gGoneVirtual);
-		gBS->FreePool(gCommBuf);
+		gBS->FreePages((EFI_PHYSICAL_ADDRESS)gPhysCommBuf, DEADWING_COMM_PAGES);
 	} else {
 		SerialPrint("[ DXE ] EFI_MM_COMMUNICATION2_PROTOCOL protocol discovered\r\n");
 	}
@@ -229,21 +442,31 @@ DeadwingDxeMain(
 ) {
 	SerialPrint("=[ Deadwing DXE ]=\r\n");
 
-	// calculate comm buffer size
-	gCommSize = sizeof(DEADWING_COMMUNICATION) + DEADWING_COMMUNICATE_HEADER_SIZE;
+	// calculate comm buffer size, packet is followed by the inline data region
+	gCommSize = DEADWING_COMMUNICATE_HEADER_SIZE + DEADWING_COMM_INLINE_OFFSET + DEADWING_COMM_DATA_SIZE;
+	gChannelSize = EFI_PAGES_TO_SIZE(EFI_SIZE_TO_PAGES(gCommSize));
+	gRingSize = EFI_PAGES_TO_SIZE(EFI_SIZE_TO_PAGES(sizeof(DEADWING_RING) + DEADWING_RING_SQ_ENTRIES * sizeof(DEADWING_RING_SUBMISSION) + DEADWING_RING_CQ_ENTRIES * sizeof(DEADWING_RING_COMPLETION)));
 
 	/// \note @0x00Alchemist: Technically, all allocated memory in the SMM context remains in SMRAM. 
 	/// Therefore, the communication buffer is allocated in the DXE driver. This buffer must later be 
-	/// visible to the SMM context
-	EFI_STATUS Status = gBS->AllocatePool(EfiRuntimeServicesData, gCommSize, &gPhysCommBuf);
+	/// visible to the SMM context. Channels are page aligned and lie one after another, rings follow them
+	EFI_PHYSICAL_ADDRESS CommBuf;
+	EFI_STATUS Status = gBS->AllocatePages(AllocateAnyPages, EfiRuntimeServicesData, DEADWING_COMM_PAGES, &CommBuf);
 	if(EFI_ERROR(Status)) {
 		SerialPrint("[ DXE ] Unable to allocate communication buffer\r\n");
 		return Status;
 	}
 
-	gBS->SetMem(gPhysCommBuf, gCommSize, 0);
+	gPhysCommBuf = (VOID *)CommBuf;
+
+	gBS->SetMem(gPhysCommBuf, DEADWING_RING_OFFSET + gRingSize, 0);
 	gCommBuf = gPhysCommBuf;
 
+	// rings are empty, SMI handler checks their layout
+	PDEADWING_RING Ring = (PDEADWING_RING)((UINT8 *)gPhysCommBuf + DEADWING_RING_OFFSET);
+	Ring->SqEntries = DEADWING_RING_SQ_ENTRIES;
+	Ring->CqEntries = DEADWING_RING_CQ_ENTRIES;
+
 	// locate and cache EFI_MM_COMMUNICATION2_PROTOCOL protocol
 	VOID *Registration;
 	BOOLEAN IsAwaitingForRegistartion = FALSE;
@@ -259,7 +482,7 @@ DeadwingDxeMain(
 		Status = gBS->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK, MmCommProtocolRegistrationCallback, NULL, &gRegNotify);
 		if(EFI_ERROR(Status)) {
 			SerialPrint("[ DXE ] Unable to register MmCommProtocolRegistrationCallback callback\r\n");
-			gBS->FreePool(gCommBuf);
+			gBS->FreePages((EFI_PHYSICAL_ADDRESS)gPhysCommBuf, DEADWING_COMM_PAGES);
 			return Status;
 		}
 
@@ -269,7 +492,7 @@ DeadwingDxeMain(
 			SerialPrint("[ DXE ] Unable to register MmCommProtocolRegistrationCallback notifier\r\n");
 			
 			gBS->CloseEvent(gRegNotify);
-			gBS->FreePool(gCommBuf);
+			gBS->FreePages((EFI_PHYSICAL_ADDRESS)gPhysCommBuf, DEADWING_COMM_PAGES);
 
 			return Status;
 		}
@@ -283,7 +506,7 @@ DeadwingDxeMain(
 	if(EFI_ERROR(Status)) {
 		SerialPrint("[ DXE ] Cannot create ExitBootServices callback\r\n");
 
-		gBS->FreePool(gCommBuf);
+		gBS->FreePages((EFI_PHYSICAL_ADDRESS)gPhysCommBuf, DEADWING_COMM_PAGES);
 
 		if(IsAwaitingForRegistartion)
 			gBS->CloseEvent(gRegNotify);
@@ -296,7 +519,7 @@ DeadwingDxeMain(
 	if(EFI_ERROR(Status)) {
 		SerialPrint("[ DXE ] Cannot create virtual address change callback\r\n");
 
-		gBS->FreePool(gCommBuf);
+		gBS->FreePages((EFI_PHYSICAL_ADDRESS)gPhysCommBuf, DEADWING_COMM_PAGES);
 		gBS->CloseEvent(gExitBs);
 
 		if(IsAwaitingForRegistartion)
@@ -12,9 +12,14 @@ STATIC CONST EFI_GUID gDeadwingTransferVarGuid = { 0xE8E00F56, 0x2350, 0x49BF, {
 STATIC CONST EFI_GUID gDeadwingSmiHandlerGuid = { 0x2BFADA50, 0xAF38, 0x49A1, { 0x85, 0x34, 0x08, 0xF6, 0xAE, 0x1B, 0x4C, 0x96 } };
 
 UINTN gCommSize;
+UINTN gChannelSize;
+UINTN gRingSize;
 VOID *gPhysCommBuf;
 VOID *gCommBuf;
 
+BOOLEAN gDoorbellRegistered;
+UINT64 gDoorbellSwSmi;
+
 EFI_EVENT gGoneVirtual;
 EFI_EVENT gRegNotify;
 EFI_EVENT gExitBs;
@@ -5,3 +5,10 @@ EFIAPI
 SerialPrint(
 	IN CONST CHAR8 *Message
 );
+
+UINTN
+EFIAPI
+SerialTryWrite(
+	IN CONST UINT8 *Buffer,
+	IN UINTN        Length
+);
\ No newline at end of file
@@ -0,0 +1,54 @@
+#include <Uefi.h>
+
+#include <Library/UefiLib.h>
+#include <Library/BaseLib.h>
+
+#include "Serial.h"
+#include "Trace.h"
+
+
+/**
+ * \brief Sends binary trace record to the serial (or QEMU debug) port.
+ * 
+ * Only ArgCount arguments are sent. Can be called after the OS took control
+ * 
+ * \param Event    Event ID
+ * \param ArgCount Count of valid arguments, up to DEADWING_TRACE_MAX_ARGS
+ * \param Arg0     First argument
+ * \param Arg1     Second argument
+ * \param Arg2     Third argument
+ * \param Arg3     Fourth argument
+ */
+VOID
+EFIAPI
+TraceEmit(
+	IN UINT16 Event,
+	IN UINT8  ArgCount,
+	IN UINT64 Arg0,
+	IN UINT64 Arg1,
+	IN UINT64 Arg2,
+	IN UINT64 Arg3
+) {
+	DEADWING_TRACE_RECORD Record;
+	Record.Sync = DEADWING_TRACE_SYNC;
+	Record.Event = Event;
+	Record.ArgCount = MIN(ArgCount, DEADWING_TRACE_MAX_ARGS);
+	Record.Source = DEADWING_TRACE_SOURCE_DXE;
+	Record.Reserved = 0;
+	Record.Tsc = AsmReadTsc();
+	Record.Args[0] = Arg0;
+	Record.Args[1] = Arg1;
+	Record.Args[2] = Arg2;
+	Record.Args[3] = Arg3;
+
+	CONST UINT8 *Bytes = (CONST UINT8 *)&Record;
+	UINTN Length = OFFSET_OF(DEADWING_TRACE_RECORD, Args) + Record.ArgCount * sizeof(UINT64);
+
+	for(UINTN Offset = 0; Offset < Length;) {
+		UINTN Written = SerialTryWrite(Bytes + Offset, Length - Offset);
+		if(Written == 0)
+			CpuPause();
+
+		Offset += Written;
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Conf.h"
+
+/// \note should be in sync with Deadwing/Defs.h and DwTrace.py
+#define DEADWING_TRACE_SYNC              0xD7A3
+#define DEADWING_TRACE_MAX_ARGS          4
+#define DEADWING_TRACE_SOURCE_DXE        2
+
+#define DEADWING_TRACE_DXE_COMMUNICATE   0x0201
+#define DEADWING_TRACE_DXE_GONE_VIRTUAL  0x0202
+
+typedef struct _DEADWING_TRACE_RECORD {
+	UINT16  Sync;
+	UINT16  Event;
+	UINT8   ArgCount;
+	UINT8   Source;
+	UINT16  Reserved;
+	UINT64  Tsc;
+	UINT64  Args[DEADWING_TRACE_MAX_ARGS];
+} DEADWING_TRACE_RECORD, *PDEADWING_TRACE_RECORD;
+
+VOID
+EFIAPI
+TraceEmit(
+	IN UINT16 Event,
+	IN UINT8  ArgCount,
+	IN UINT64 Arg0,
+	IN UINT64 Arg1,
+	IN UINT64 Arg2,
+	IN UINT64 Arg3
+);
+
+#ifdef DEADWING_TRACE
+#define TRACE(Event, ArgCount, A0, A1, A2, A3) TraceEmit(Event, ArgCount, (UINT64)(A0), (UINT64)(A1), (UINT64)(A2), (UINT64)(A3))
+#else
+#define TRACE(Event, ArgCount, A0, A1, A2, A3) ((VOID)0)
+#endif
@@ -3,6 +3,7 @@
 #include "Defs.h"
 #include "Utils.h"
 #include "Triggers.h"
+#include "Scheduler.h"
 
 /// \note @0x00Alchemist: EPROCESS 21H2+ offset
 #define EPROCESS_DIR_BASE_OFFSET 0x28
@@ -15,33 +16,220 @@
 #define IOCTL_DEADWING_WRITE_VIRTUAL   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD006, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_DEADWING_VIRT_TO_PHYS    CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD008, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_DEADWING_PRIV_ESC        CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD00A, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_SET_RATE_LIMIT  CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD00C, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_HASH_RANGES     CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD00D, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_SCAN            CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD00E, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_SPARSE_READ     CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD00F, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_TRACK_REGION    CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD010, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_CHANGES_SINCE   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD011, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_HARVEST_AD      CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD012, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_MONITOR_START   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD013, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_MONITOR_SAMPLE  CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD014, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_ENTROPY_MAP     CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD015, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_DRAIN_LOG       CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD016, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_DRAIN_TRACE     CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD017, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_GET_STATS       CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD018, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_PROFILE_START   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD019, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_PROFILE_STOP    CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD01A, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_DRAIN_PROFILE   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD01B, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_SNAPSHOT_REGS   CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD01C, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_SUBMIT_BATCH    CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD01D, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_GET_MEMORY_MAP  CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD01E, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_DEADWING_GET_ACPI_TABLE  CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD01F, METHOD_BUFFERED, FILE_ANY_ACCESS)
 
+/// \note shortest interval between profiler SMIs. System timer resolution makes
+/// shorter intervals pointless anyway, and every sample still has to pass the SMI scheduler
+#define PROFILE_MIN_INTERVAL_US 1000
+
+/// \note requests own a channel for their whole lifetime, so several of them can be 
+/// in flight. SMM communication protocol isn't reentrant though, so only the SMI round trip is serialized
+#define COMM_MAX_CHANNELS       64
+
+// max count of commands in a single batch, larger batches just wait for free slots of the submission ring
+#define COMM_MAX_BATCH          0x10000
+
+#define COMM_POOL_TAG           'gwDK'
+
+// status of the packet which hasn't reached SMI handler, handler never returns it
+#define COMM_STATUS_PENDING     0xFFFFFFFFFFFFFFFFULL
+
+// commands of the batch queued in the submission ring. Ring lock guards the count of remaining commands
+typedef struct _COMM_RING_BATCH {
+	PDEADWING_BATCH_ENTRY Entries;
+	UINT64                Count;
+	UINT64                Queued;
+	UINT64                Remaining;
+} COMM_RING_BATCH, *PCOMM_RING_BATCH;
+
+// tag of the queued command, address of the request is passed to SMI handler as user data
+typedef struct _COMM_RING_REQUEST {
+	PCOMM_RING_BATCH      Batch;
+	PDEADWING_BATCH_ENTRY Entry;
+} COMM_RING_REQUEST, *PCOMM_RING_REQUEST;
+
+DEADWING_CHANNEL gChannels[COMM_MAX_CHANNELS];
+volatile LONG64 gChannelBusy;
+KSEMAPHORE gChannelFree;
+KEVENT gTriggerLock;
+
+// guards tail of the submission ring and head of the completion ring
+KEVENT gRingLock;
+
+// profiler thread state, start and stop are serialized by the lock
+KEVENT gProfileLock;
+KEVENT gProfileStop;
+PETHREAD gProfileThread;
+UINT64 gProfileIntervalUs;
+UINT64 gProfileSamples;
+UINT64 gProfileSkipped;
+
+
+/**
+ * \brief Initializes channels of the communication buffer and profiler state
+ */
+VOID
+NTAPI
+CommInitialize(
+	VOID
+) {
+	gChannelCount = min(gChannelCount, COMM_MAX_CHANNELS);
+
+	for(UINT64 i = 0; i < gChannelCount; i++) {
+		gChannels[i].Index = i;
+		gChannels[i].InlineData = (PUINT8)gCommBuf + i * gChannelSize + gInlineOffset;
+	}
+
+	gChannelBusy = 0;
+	KeInitializeSemaphore(&gChannelFree, (LONG)gChannelCount, (LONG)gChannelCount);
+	KeInitializeEvent(&gTriggerLock, SynchronizationEvent, TRUE);
+	KeInitializeEvent(&gRingLock, SynchronizationEvent, TRUE);
+	KeInitializeEvent(&gProfileLock, SynchronizationEvent, TRUE);
+	KeInitializeEvent(&gProfileStop, NotificationEvent, FALSE);
+
+	gProfileThread = NULL;
+}
+
+/**
+ * \brief Takes free channel of the communication buffer
+ * 
+ * \param Wait Wait for a channel if all of them are busy
+ * 
+ * \returns Channel with cleared timings or NULL, if there are no free channels and caller doesn't wait
+ */
+PDEADWING_CHANNEL
+NTAPI
+CommAcquireChannel(
+	_In_ BOOLEAN Wait
+) {
+	LARGE_INTEGER NoWait;
+	NoWait.QuadPart = 0;
+
+	// semaphore counts free channels, so the loop below always finds one
+	if(KeWaitForSingleObject(&gChannelFree, Executive, KernelMode, FALSE, Wait ? NULL : &NoWait) == STATUS_TIMEOUT)
+		return NULL;
+
+	UINT64 Index = 0;
+	while(InterlockedBitTestAndSet64(&gChannelBusy, (LONG64)Index))
+		Index = (Index + 1) % gChannelCount;
+
+	PDEADWING_CHANNEL Channel = &gChannels[Index];
+	RtlZeroMemory(&Channel->Timing, sizeof(Channel->Timing));
+	Channel->SmiCount = 0;
+
+	return Channel;
+}
+
+/**
+ * \brief Returns channel taken by CommAcquireChannel
+ * 
+ * \param Channel Channel of the communication buffer
+ */
+VOID
+NTAPI
+CommReleaseChannel(
+	_In_ PDEADWING_CHANNEL Channel
+) {
+	InterlockedBitTestAndReset64(&gChannelBusy, (LONG64)Channel->Index);
+	KeReleaseSemaphore(&gChannelFree, IO_NO_INCREMENT, 1, FALSE);
+}
+
+/**
+ * \brief Conveys packet of the channel to SMI handler. Trigger lock should be held by caller.
+ * 
+ * Doorbell SMI skips the communication protocol: channels have been validated by SMI handler
+ * at boot, so the packet is processed right away. SW SMI is synchronous, the handler is done
+ * before the write to the command port retires. If nobody answers the doorbell, it's disabled
+ * and the packet is conveyed through SubmitPacket
+ * 
+ * \param Channel Channel of the communication buffer
+ * \param Packet  Packet of the channel
+ * 
+ * \returns Packet filled by SMI handler or NULL
+ */
+PDEADWING_PACKET
+NTAPI
+CommSubmit(
+	_In_ PDEADWING_CHANNEL Channel,
+	_In_ PDEADWING_PACKET  Packet
+) {
+	if(gDoorbellCommandPort != 0) {
+		// SMI handler always overwrites the status
+		Packet->Status = COMM_STATUS_PENDING;
+
+		// nothing else should get between writes to the data and command ports on this CPU
+		KIRQL Irql;
+		KeRaiseIrql(HIGH_LEVEL, &Irql);
+
+		__outbyte((USHORT)gDoorbellDataPort, (UCHAR)Channel->Index);
+		__outbyte((USHORT)gDoorbellCommandPort, (UCHAR)gDoorbellSwSmi);
+
+		KeLowerIrql(Irql);
+
+		if(Packet->Status != COMM_STATUS_PENDING)
+			return Packet;
+
+		KdPrint(("[ DeadwingKM ] Doorbell isn't answered, falling back to the communication protocol\n"));
+		gDoorbellCommandPort = 0;
+	}
+
+	return SubmitPacket(Channel->Index);
+}
 
 /**
- * \brief Forms a packet for SMI handler and fires SMI
+ * \brief Forms a packet for SMI handler and fires SMI.
+ * 
+ * Packet with a single command is formed right in the channel. If SMI handler reports partial completion 
+ * (EFI_NOT_READY), the packet with the updated resume cursor is conveyed again until the command is done. Between SMIs
+ * the OS gets control back, so long operations don't stall the whole machine.
+ * Every SMI is paced by the scheduler, see Scheduler.c
  * 
+ * \param Channel   Channel of the communication buffer
  * \param Command   Command magic value
  * \param ProcessId Target process id
  * \param Arg1      Optional argument 1
  * \param Arg2      Optional argument 2
  * \param Arg3      Optional argument 3
  * 
- * \returns Pointer to buffer with filled information from SMI handler (or NULL) 
+ * \returns Pointer to the command with filled information from SMI handler (or NULL) 
  */
-PDEADWING_COMMUNICATION
+PDEADWING_COMMAND
 NTAPI
 CommFireSmi(
-	_In_     UINT64 Command,
-	_In_opt_ UINT64 ProcessId,
-	_In_opt_ UINT64 Arg1, 
-	_In_opt_ UINT64 Arg2,
-	_In_opt_ UINT64 Arg3
+	_In_     PDEADWING_CHANNEL Channel,
+	_In_     UINT64            Command,
+	_In_opt_ UINT64            ProcessId,
+	_In_opt_ UINT64            Arg1,
+	_In_opt_ UINT64            Arg2,
+	_In_opt_ UINT64            Arg3
 ) {
-	DEADWING_COMMUNICATION ConveyPacket = { 0 };
-	PDEADWING_COMMUNICATION ResultPacket = NULL;
+	// form a packet right in the communication buffer of the channel
+	PDEADWING_PACKET Packet = AcquirePacket(Channel->Index);
+	if(Packet == NULL) {
+		KdPrint(("[ DeadwingKM ] Unable to acquire packet of the channel\n"));
+		return NULL;
+	}
 
-	// form a packet 
-	NTSTATUS Status = FormPacket(Command, ProcessId, Arg1, Arg2, Arg3, &ConveyPacket);
+	NTSTATUS Status = FormPacket(Command, ProcessId, Arg1, Arg2, Arg3, Packet);
 	if(!NT_SUCCESS(Status)) {
 		KdPrint(("[ DeadwingKM ] Unable to form request packet (0x%X)\n", Status));
 		return NULL;
@@ -49,22 +237,69 @@ CommFireSmi(
 
 	/// \note @0x00Alchemist: refer to the DeadwingDxe/DxeMain.c for more information about the API below
 
-	// setup buffer
-	SetupCommunicationBuffer(&ConveyPacket, sizeof(ConveyPacket));
+	PDEADWING_COMMAND Result = DEADWING_PACKET_COMMANDS(Packet);
+	while(TRUE) {
+		// SMI handler updates resume position in place, keep the old one to check the progress
+		UINT64 Cursor = Result->Resume.Cursor;
+		UINT64 State[ARRAYSIZE(Result->Resume.State)];
+		RtlCopyMemory(State, Result->Resume.State, sizeof(State));
 
-	// fire SMI
-	ResultPacket = DeadwingSmmCommunicate();
-	if(ResultPacket == NULL) {
-		KdPrint(("[ DeadwingKM ] Unable to communicate with SMI handler\n"));
-		return NULL;
+		// wait for the scheduler and fire SMI. Measured round-trip cost adapts the time budget
+		UINT64 Reserved = SchedAcquire();
+
+		KeWaitForSingleObject(&gTriggerLock, Executive, KernelMode, FALSE, NULL);
+		LARGE_INTEGER Start = KeQueryPerformanceCounter(NULL);
+
+		PDEADWING_PACKET ResultPacket = CommSubmit(Channel, Packet);
+
+		LARGE_INTEGER End = KeQueryPerformanceCounter(NULL);
+		KeSetEvent(&gTriggerLock, IO_NO_INCREMENT, FALSE);
+
+		SchedComplete(Reserved, (UINT64)(End.QuadPart - Start.QuadPart));
+
+		if(ResultPacket == NULL) {
+			KdPrint(("[ DeadwingKM ] Unable to communicate with SMI handler\n"));
+			return NULL;
+		}
+
+		// accumulate timings of resumed SMIs
+		Channel->Timing.Total             += ResultPacket->Timing.Total;
+		Channel->Timing.Validate          += ResultPacket->Timing.Validate;
+		Channel->Timing.DirBase           += ResultPacket->Timing.DirBase;
+		Channel->Timing.TargetTranslate   += ResultPacket->Timing.TargetTranslate;
+		Channel->Timing.ConsumerTranslate += ResultPacket->Timing.ConsumerTranslate;
+		Channel->Timing.Copy              += ResultPacket->Timing.Copy;
+		Channel->Timing.Restore           += ResultPacket->Timing.Restore;
+		Channel->SmiCount++;
+
+		// packet has been rejected as a whole, the command wasn't touched
+		if(ResultPacket->Status != EFI_SUCCESS && ResultPacket->Status != EFI_NOT_READY) {
+			KdPrint(("[ DeadwingKM ] SMI handler rejected the packet (0x%llX)\n", ResultPacket->Status));
+			Result->Status = ResultPacket->Status;
+			break;
+		}
+
+		if(Result->Status != EFI_NOT_READY)
+			break;
+
+		// handler should always move the cursor, otherwise we'll spin forever
+		if(Result->Resume.Cursor == Cursor && RtlCompareMemory(Result->Resume.State, State, sizeof(State)) == sizeof(State)) {
+			KdPrint(("[ DeadwingKM ] SMI handler doesn't make progress, aborting command\n"));
+			Result->Status = EFI_ABORTED;
+			break;
+		}
+
+		// packet already holds the saved position, so it's resubmitted as is
 	}
 
-	return ResultPacket;
+	return Result;
 }
 
 /**
  * \brief Pings SMI handler
  * 
+ * \param Channel Channel of the communication buffer
+ * 
  * \return STATUS_SUCCESS - SMI handler responded succesfully
  * \return STATUS_UNSUCCESFUL - Cannot fire SMI
  * \return Other - SMI handler doesnt responds
@@ -72,19 +307,20 @@ CommFireSmi(
 NTSTATUS
 NTAPI
 CommPingSmi(
-	VOID
+	_In_ PDEADWING_CHANNEL Channel
 ) {
-	PDEADWING_COMMUNICATION ResultPacket = CommFireSmi(CMD_DEADWING_PING_SMI, 0, 0, 0, 0);
-	if(ResultPacket == NULL)
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_PING_SMI, 0, 0, 0, 0);
+	if(Result == NULL)
 		return STATUS_UNSUCCESSFUL;
 
 	// convert EFI_STATUS to NTSTATUS
-	return EfiStatusToNtStatus(ResultPacket->SmiRetStatus);
+	return EfiStatusToNtStatus(Result->Status);
 }
 
 /**
  * \brief Caches information about the current session
  * 
+ * \param Channel   Channel of the communication buffer
  * \param ProcessId Controller PID for locating controller EPROCESS
  * 
  * \return STATUS_SUCCESS - SMI handler executed the command successfully 
@@ -95,7 +331,8 @@ CommPingSmi(
 NTSTATUS
 NTAPI
 CommCacheSessionInfo(
-	_In_ UINT64 ProcessId
+	_In_ PDEADWING_CHANNEL Channel,
+	_In_ UINT64            ProcessId
 ) {
 	if(!ProcessId) {
 		KdPrint(("[ DeadwingKM ] Invalid process identifier\n"));
@@ -105,17 +342,72 @@ CommCacheSessionInfo(
 	// get system dir base
 	UINT64 DirBase = *(UINT64 *)((PUINT8)PsInitialSystemProcess + EPROCESS_DIR_BASE_OFFSET);
 
-	PDEADWING_COMMUNICATION ResultPacket = CommFireSmi(CMD_DEADWING_CACHE_SESSION_INFO, ProcessId, PsInitialSystemProcess, DirBase, 0);
-	if(ResultPacket == NULL)
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_CACHE_SESSION_INFO, ProcessId, PsInitialSystemProcess, DirBase, 0);
+	if(Result == NULL)
 		return STATUS_UNSUCCESSFUL;
 
 	// convert EFI_STATUS to NTSTATUS
-	return EfiStatusToNtStatus(ResultPacket->SmiRetStatus);
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Reads data through the inline data region of the communication buffer.
+ * 
+ * Data is read in chunks which fit the region and copied to the caller buffer
+ * 
+ * \param Channel       Channel of the communication buffer
+ * \param Command       Read command for SMI handler
+ * \param ProcessId     Target PID or 0, if address is physical
+ * \param AddressToRead Address from which the information will be read
+ * \param ReceivedData  Pointer to the buffer into which the information will be copied
+ * \param ReadLength    Read length
+ * 
+ * \return STATUS_SUCCESS - Data has been read
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return STATUS_ACCESS_VIOLATION - Caller buffer is not writable
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommInlineRead(
+	_In_ PDEADWING_CHANNEL Channel,
+	_In_ UINT64            Command,
+	_In_ UINT64            ProcessId,
+	_In_ PVOID             AddressToRead,
+	_In_ PVOID             ReceivedData,
+	_In_ UINT64            ReadLength
+) {
+	for(UINT64 Offset = 0; Offset < ReadLength; ) {
+		UINT64 Chunk = min(ReadLength - Offset, gInlineSize);
+
+		// NULL destination tells SMI handler to return data inline
+		PDEADWING_COMMAND Result = CommFireSmi(Channel, Command, ProcessId, (UINT64)AddressToRead + Offset, 0, Chunk);
+		if(Result == NULL)
+			return STATUS_UNSUCCESSFUL;
+
+		NTSTATUS Status = EfiStatusToNtStatus(Result->Status);
+		if(!NT_SUCCESS(Status))
+			return Status;
+
+		// caller buffer is a user-mode one
+		__try {
+			ProbeForWrite((PUINT8)ReceivedData + Offset, Chunk, 1);
+			RtlCopyMemory((PUINT8)ReceivedData + Offset, Channel->InlineData, Chunk);
+		} __except(EXCEPTION_EXECUTE_HANDLER) {
+			KdPrint(("[ DeadwingKM ] Unable to copy inline data to the caller buffer\n"));
+			return STATUS_ACCESS_VIOLATION;
+		}
+
+		Offset += Chunk;
+	}
+
+	return STATUS_SUCCESS;
 }
 
 /**
  * \brief Physical read command handler
  * 
+ * \param Channel       Channel of the communication buffer
  * \param AddressToRead The physical address from which the information will be read
  * \param ReceivedData  Pointer to the buffer into which the information will be copied
  * \param ReadLength    Read length
@@ -128,26 +420,31 @@ CommCacheSessionInfo(
 NTSTATUS
 NTAPI
 CommPhysRead(
-	_In_ PVOID  AddressToRead,
-	_In_ PVOID  ReceivedData,
-	_In_ UINT64 ReadLength
+	_In_ PDEADWING_CHANNEL Channel,
+	_In_ PVOID             AddressToRead,
+	_In_ PVOID             ReceivedData,
+	_In_ UINT64            ReadLength
 ) {
-	if((!AddressToRead || !ReceivedData || !ReadLength) || ReadLength > 0x1000) {
+	if((!AddressToRead || !ReceivedData || !ReadLength) || ReadLength > DEADWING_MAX_TRANSFER_LENGTH) {
 		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the virtual memory read function\n"));
 		return STATUS_INVALID_PARAMETER;
 	}
 
-	PDEADWING_COMMUNICATION ResultPacket = CommFireSmi(CMD_DEADWING_READ_PHYS, 0, AddressToRead, ReceivedData, ReadLength);
-	if(ResultPacket == NULL)
+	if(gInlineSize != 0)
+		return CommInlineRead(Channel, CMD_DEADWING_READ_PHYS, 0, AddressToRead, ReceivedData, ReadLength);
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_READ_PHYS, 0, AddressToRead, ReceivedData, ReadLength);
+	if(Result == NULL)
 		return STATUS_UNSUCCESSFUL;
 
 	// convert EFI_STATUS to NTSTATUS
-	return EfiStatusToNtStatus(ResultPacket->SmiRetStatus);
+	return EfiStatusToNtStatus(Result->Status);
 }
 
 /**
  * \brief Virtual read command handler
  * 
+ * \param Channel         Channel of the communication buffer
  * \param TargetProcessId Target process ID for Dir Base retrieval
  * \param AddressToRead   The virtual address from which the information will be read
  * \param ReceivedData    Pointer to the buffer into which the information will be copied
@@ -161,26 +458,32 @@ CommPhysRead(
 NTSTATUS
 NTAPI
 CommVirtualRead(
-	_In_ UINT64  TargetProcessId,
-	_In_ PVOID   AddressToRead,
-	_In_ PVOID   ReceivedData,
-	_In_ UINT64  ReadLength
+	_In_ PDEADWING_CHANNEL Channel,
+	_In_ UINT64            TargetProcessId,
+	_In_ PVOID             AddressToRead,
+	_In_ PVOID             ReceivedData,
+	_In_ UINT64            ReadLength
 ) {
-	if((!AddressToRead || !ReceivedData || !ReadLength) || ReadLength > 0x1000 || !TargetProcessId) {
+	if((!AddressToRead || !ReceivedData || !ReadLength) || ReadLength > DEADWING_MAX_TRANSFER_LENGTH || !TargetProcessId) {
 		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the virtual memory read function\n"));
 		return STATUS_INVALID_PARAMETER;
 	}
-	PDEADWING_COMMUNICATION ResultPacket = CommFireSmi(CMD_DEADWING_READ_VIRTUAL, TargetProcessId, AddressToRead, ReceivedData, ReadLength);
-	if(ResultPacket == NULL)
+
+	if(gInlineSize != 0)
+		return CommInlineRead(Channel, CMD_DEADWING_READ_VIRTUAL, TargetProcessId, AddressToRead, ReceivedData, ReadLength);
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_READ_VIRTUAL, TargetProcessId, AddressToRead, ReceivedData, ReadLength);
+	if(Result == NULL)
 		return STATUS_UNSUCCESSFUL;
 
 	// convert EFI_STATUS to NTSTATUS
-	return EfiStatusToNtStatus(ResultPacket->SmiRetStatus);
+	return EfiStatusToNtStatus(Result->Status);
 }
 
 /**
  * \brief Physical write command handler
  * 
+ * \param Channel        Channel of the communication buffer
  * \param AddressToWrite Physical address where the data will be written
  * \param DataToWrite    Buffer with data to be written
  * \param LengthOfData   Length of data to write
@@ -193,26 +496,28 @@ CommVirtualRead(
 NTSTATUS
 NTAPI
 CommPhysWrite(
-	_In_ PVOID  AddressToWrite,
-	_In_ PVOID  DataToWrite,
-	_In_ UINT64 LengthOfData
+	_In_ PDEADWING_CHANNEL Channel,
+	_In_ PVOID             AddressToWrite,
+	_In_ PVOID             DataToWrite,
+	_In_ UINT64            LengthOfData
 ) {
-	if((!AddressToWrite || !DataToWrite || !LengthOfData) || LengthOfData > 0x1000) {
+	if((!AddressToWrite || !DataToWrite || !LengthOfData) || LengthOfData > DEADWING_MAX_TRANSFER_LENGTH) {
 		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the physical memory write function\n"));
 		return STATUS_INVALID_PARAMETER;
 	}
 
-	PDEADWING_COMMUNICATION ResultPacket = CommFireSmi(CMD_DEADWING_WRITE_PHYS, 0, AddressToWrite, DataToWrite, LengthOfData);
-	if(ResultPacket == NULL)
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_WRITE_PHYS, 0, AddressToWrite, DataToWrite, LengthOfData);
+	if(Result == NULL)
 		return STATUS_UNSUCCESSFUL;
 
 	// convert EFI_STATUS to NTSTATUS
-	return EfiStatusToNtStatus(ResultPacket->SmiRetStatus);
+	return EfiStatusToNtStatus(Result->Status);
 }
 
 /**
  * \brief Virtual write command handler
  * 
+ * \param Channel         Channel of the communication buffer
  * \param TargetProcessId Target process ID for Dir Base retrieval
  * \param AddressToWrite  Virtual address where the data will be written
  * \param DataToWrite     Buffer with data to be written
@@ -226,27 +531,29 @@ CommPhysWrite(
 NTSTATUS
 NTAPI
 CommVirtualWrite(
-	_In_ UINT64  TargetProcessId,
-	_In_ PVOID   AddressToWrite,
-	_In_ PVOID   DataToWrite,
-	_In_ UINT64  LengthOfData
+	_In_ PDEADWING_CHANNEL Channel,
+	_In_ UINT64            TargetProcessId,
+	_In_ PVOID             AddressToWrite,
+	_In_ PVOID             DataToWrite,
+	_In_ UINT64            LengthOfData
 ) {
-	if((!AddressToWrite || !DataToWrite || !LengthOfData) || LengthOfData > 0x1000 || !TargetProcessId) {
+	if((!AddressToWrite || !DataToWrite || !LengthOfData) || LengthOfData > DEADWING_MAX_TRANSFER_LENGTH || !TargetProcessId) {
 		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the virtual memory write function\n"));
 		return STATUS_INVALID_PARAMETER;
 	}
 
-	PDEADWING_COMMUNICATION ResultPacket = CommFireSmi(CMD_DEADWING_WRITE_VIRTUAL, TargetProcessId, AddressToWrite, DataToWrite, LengthOfData);
-	if(ResultPacket == NULL)
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_WRITE_VIRTUAL, TargetProcessId, AddressToWrite, DataToWrite, LengthOfData);
+	if(Result == NULL)
 		return STATUS_UNSUCCESSFUL;
 
 	// convert EFI_STATUS to NTSTATUS
-	return EfiStatusToNtStatus(ResultPacket->SmiRetStatus);
+	return EfiStatusToNtStatus(Result->Status);
 }
 
 /**
  * \brief Virtual-To-Physical command handler
  * 
+ * \param Channel            Channel of the communication buffer
  * \param TargetProcessId    Target process ID for Dir Base retrieval
  * \param AddressToTranslate Virtual address to be translated
  * \param Translated         Translated address to be sent to the controller
@@ -259,29 +566,32 @@ CommVirtualWrite(
 NTSTATUS
 NTAPI
 CommVtop(
-	_In_  UINT64  TargetProcessId,
-	_In_  PVOID   AddressToTranslate,
-	_Out_ PUINT64 Translated
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  UINT64            TargetProcessId,
+	_In_  PVOID             AddressToTranslate,
+	_Out_ PUINT64           Translated
 ) {
 	if(!TargetProcessId || !AddressToTranslate || !Translated) {
 		KdPrint(("[ DeadwingKM ] Invalid parameters\n"));
 		return STATUS_INVALID_PARAMETER;
 	}
 
-	PDEADWING_COMMUNICATION ResultPacket = CommFireSmi(CMD_DEADWING_VIRT_TO_PHYS, TargetProcessId, AddressToTranslate, 0, 0);
-	if(ResultPacket == NULL)
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_VIRT_TO_PHYS, TargetProcessId, AddressToTranslate, 0, 0);
+	if(Result == NULL)
 		return STATUS_UNSUCCESSFUL;
 
 	/// \note @0x00Alchemist: Vtop.Translated filled by SMM driver
-	*Translated = ResultPacket->Vtop.Translated;
+	*Translated = DEADWING_COMMAND_PAYLOAD(Result)->Vtop.Translated;
 
 	// convert EFI_STATUS to NTSTATUS
-	return EfiStatusToNtStatus(ResultPacket->SmiRetStatus);
+	return EfiStatusToNtStatus(Result->Status);
 }
 
 /**
  * \brief Modifies the controller process token
  * 
+ * \param Channel Channel of the communication buffer
+ * 
  * \return STATUS_SUCCESS - SMI handler executed the command successfully 
  * \return STATUS_UNSUCCESFUL - Cannot fire SMI 
  * \return Other - SMI handler cannot process command
@@ -289,93 +599,1253 @@ CommVtop(
 NTSTATUS
 NTAPI
 CommPrivEsc(
-	VOID
+	_In_ PDEADWING_CHANNEL Channel
 ) {
-	PDEADWING_COMMUNICATION ResultPacket = CommFireSmi(CMD_DEADWING_PRIV_ESC, 0, 0, 0, 0);
-	if(ResultPacket == NULL)
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_PRIV_ESC, 0, 0, 0, 0);
+	if(Result == NULL)
 		return STATUS_UNSUCCESSFUL;
 
 	// convert EFI_STATUS to NTSTATUS
-	return EfiStatusToNtStatus(ResultPacket->SmiRetStatus);
+	return EfiStatusToNtStatus(Result->Status);
 }
 
 /**
- * \brief Processes commands from controller process
+ * \brief Hash ranges command handler
  * 
- * \param Irp         I/O Request Packet
- * \param IoStack     I/O Stack
- * \param OutputValue Optional value for the I/O manager if the controller requires output values
+ * \param Channel           Channel of the communication buffer
+ * \param Request           Controller buffer with algorithm and list of ranges, receives range digests
+ * \param PageDigests       Controller buffer which receives digests of every page
+ * \param PageDigestsLength Length of the page digests buffer
  * 
- * \return STATUS_SUCCESS - The command was executed successfully
- * \return Other - The command was not executed
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
  */
 NTSTATUS
 NTAPI
-CommUmCmdHandler(
-	_In_  PIRP               Irp,
-	_In_  PIO_STACK_LOCATION IoStack,
-	_Out_ PUINT64            OutputValue
+CommHashRanges(
+	_In_ PDEADWING_CHANNEL Channel,
+	_In_ PVOID             Request,
+	_In_ PVOID             PageDigests,
+	_In_ UINT64            PageDigestsLength
 ) {
-	NTSTATUS Status;
-	
-	UINT64 Out = 0;
-	UINT64 VtopMem = 0;
-	PDEADWING_UM_KM_COMMUNICATION UmPacket = (PDEADWING_UM_KM_COMMUNICATION)Irp->AssociatedIrp.SystemBuffer;
+	if(!Request || !PageDigests || !PageDigestsLength) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the hash function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
 
-	// dispatch request
-	switch(IoStack->Parameters.DeviceIoControl.IoControlCode) {
-		case IOCTL_DEADWING_PING_SMI:
-			Status = CommPingSmi();
-			if(!NT_SUCCESS(Status))
-				KdPrint(("[ DeadwingKM ] SMI handler is unavailable\n"));
-		break;
-		case IOCTL_DEADWING_CACHE_SESSION:
-			Status = CommCacheSessionInfo(UmPacket->ProcessId);
-			if(!NT_SUCCESS(Status))
-				KdPrint(("[ DeadwingKM ] Unable to cache session info\n"));
-		break;
-		case IOCTL_DEADWING_READ_PHYS:
-			Status = CommPhysRead(UmPacket->Read.PhysReadAddress, UmPacket->Read.VaReadResultAddress, UmPacket->Read.ReadLength);
-			if(!NT_SUCCESS(Status))
-				KdPrint(("[ DeadwingKM ] Unable to read from physical address\n"));
-		break;
-		case IOCTL_DEADWING_READ_VIRTUAL:
-			Status = CommVirtualRead(UmPacket->ProcessId, UmPacket->Read.VaReadAddress, UmPacket->Read.VaReadResultAddress, UmPacket->Read.ReadLength);
-			if(!NT_SUCCESS(Status))
-				KdPrint(("[ DeadwingKM ] Unable to read data from provided address\n"));
-		break;
-		case IOCTL_DEADWING_WRITE_PHYS:
-			Status = CommPhysWrite(UmPacket->Write.PhysWriteAddress, UmPacket->Write.VaDataAddress, UmPacket->Write.WriteLength);
-			if(!NT_SUCCESS(Status))
-				KdPrint(("[ DeadwingKM ] Unable to write data to the provided physical address\n"));
-		break;
-		case IOCTL_DEADWING_WRITE_VIRTUAL:
-			Status = CommVirtualWrite(UmPacket->ProcessId, UmPacket->Write.VaWriteAddress, UmPacket->Write.VaDataAddress, UmPacket->Write.WriteLength);
-			if(!NT_SUCCESS(Status))
-				KdPrint(("[ DeadwingKM ] Unable to write data to the provided address\n"));
-		break;
-		case IOCTL_DEADWING_VIRT_TO_PHYS:
-			Status = CommVtop(UmPacket->ProcessId, UmPacket->Vtop.AddressToTranslate, &VtopMem);
-			if(!NT_SUCCESS(Status)) {
-				KdPrint(("[ DeadwingKM ] Unable to translate virtual address to physical\n"));
-				break;
-			}
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_HASH_RANGES, 0, Request, PageDigests, PageDigestsLength);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
 
-			// fill output request
-			UmPacket->Vtop.Translated = VtopMem;
-			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
-		break;
-		case IOCTL_DEADWING_PRIV_ESC:
-			Status = CommPrivEsc();
-			if(!NT_SUCCESS(Status))
-				KdPrint(("[ DeadwingKM ] Unable to leverage privileges\n"));
-		break;
-		default:
-			KdPrint(("[ DeadwingKM ] Received unknown command\n"));
-			Status = STATUS_INVALID_DEVICE_REQUEST;
-		break;
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Scan command handler
+ * 
+ * \param Channel    Channel of the communication buffer
+ * \param Request    Controller buffer with range and patterns
+ * \param Matches    Controller buffer which receives matches
+ * \param MaxMatches Capacity of the matches buffer
+ * \param MatchCount Count of matches written to the buffer
+ * \param Truncated  Receives TRUE if some matches don't fit the buffer
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommScan(
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  PVOID             Request,
+	_In_  PVOID             Matches,
+	_In_  UINT64            MaxMatches,
+	_Out_ PUINT64           MatchCount,
+	_Out_ PUINT64           Truncated
+) {
+	if(!Request || !Matches || !MaxMatches || MaxMatches > DEADWING_SCAN_MAX_MATCHES) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the scan function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_SCAN, 0, Request, Matches, MaxMatches);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	*MatchCount = DEADWING_COMMAND_PAYLOAD(Result)->Scan.MatchCount;
+	*Truncated = DEADWING_COMMAND_PAYLOAD(Result)->Scan.Truncated;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Sparse read command handler
+ * 
+ * \param Channel   Channel of the communication buffer
+ * \param Request   Controller buffer with range, bitmap and data buffers
+ * \param DataPages Receives count of data pages packed into the data buffer
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommSparseRead(
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  PVOID             Request,
+	_Out_ PUINT64           DataPages
+) {
+	if(!Request) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the sparse read function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_SPARSE_READ, 0, Request, 0, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	*DataPages = DEADWING_COMMAND_PAYLOAD(Result)->Sparse.DataPages;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Track region command handler
+ * 
+ * \param Channel   Channel of the communication buffer
+ * \param ProcessId Target process ID or 0, if range is physical
+ * \param Address   Start of the range
+ * \param Length    Length of the range
+ * \param Handle    Receives handle of the tracked region
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommTrackRegion(
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  UINT64            ProcessId,
+	_In_  PVOID             Address,
+	_In_  UINT64            Length,
+	_Out_ PUINT64           Handle
+) {
+	if(!Address || !Length) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the track function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_TRACK_REGION, ProcessId, Address, Length, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	*Handle = DEADWING_COMMAND_PAYLOAD(Result)->Track.Handle;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Changes since command handler
+ * 
+ * \param Channel     Channel of the communication buffer
+ * \param Request     Controller buffer with handle, changes and data buffers
+ * \param ChangeCount Receives count of changes written to the buffer
+ * \param Truncated   Receives TRUE if some changes don't fit the buffer
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommChangesSince(
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  PVOID             Request,
+	_Out_ PUINT64           ChangeCount,
+	_Out_ PUINT64           Truncated
+) {
+	if(!Request) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the changes function\n"));
+		return STATUS_INVALID_PARAMETER;
 	}
 
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_CHANGES_SINCE, 0, Request, 0, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	*ChangeCount = DEADWING_COMMAND_PAYLOAD(Result)->Changes.ChangeCount;
+	*Truncated = DEADWING_COMMAND_PAYLOAD(Result)->Changes.Truncated;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Harvest accessed/dirty bits command handler
+ * 
+ * SMI handler can't flush TLBs of the OS, so they're flushed here once any bit
+ * has been cleared. Otherwise CPUs won't set bits again for cached translations
+ * 
+ * \param Channel   Channel of the communication buffer
+ * \param Request   Controller buffer with range, flags and pages buffer
+ * \param PageCount Receives count of pages written to the buffer
+ * \param Truncated Receives TRUE if some pages don't fit the buffer
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommHarvestAccessDirty(
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  PVOID             Request,
+	_Out_ PUINT64           PageCount,
+	_Out_ PUINT64           Truncated
+) {
+	if(!Request) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the harvest function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_HARVEST_AD, 0, Request, 0, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	// flush even if command failed in the middle
+	if(DEADWING_COMMAND_PAYLOAD(Result)->Harvest.Cleared != 0)
+		FlushTbAllProcessors();
+
+	*PageCount = DEADWING_COMMAND_PAYLOAD(Result)->Harvest.PageCount;
+	*Truncated = DEADWING_COMMAND_PAYLOAD(Result)->Harvest.Truncated;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Monitor start command handler
+ * 
+ * \param Channel Channel of the communication buffer
+ * \param Request Controller buffer with process, ranges and limits
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommMonitorStart(
+	_In_ PDEADWING_CHANNEL Channel,
+	_In_ PVOID             Request
+) {
+	if(!Request) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the monitor function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_MONITOR_START, 0, Request, 0, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Monitor sample command handler
+ * 
+ * Accessed bits are cleared by every sample, so TLBs are flushed afterwards
+ * 
+ * \param Channel    Channel of the communication buffer
+ * \param Heatmap    Controller buffer which receives heatmap
+ * \param MaxEntries Capacity of the heatmap buffer
+ * \param EntryCount Receives count of heatmap entries
+ * \param Samples    Receives count of samples in the current aggregation interval
+ * \param Aggregated Receives TRUE if aggregation interval is over
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommMonitorSample(
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  PVOID             Heatmap,
+	_In_  UINT64            MaxEntries,
+	_Out_ PUINT64           EntryCount,
+	_Out_ PUINT64           Samples,
+	_Out_ PUINT64           Aggregated
+) {
+	if(!Heatmap || !MaxEntries) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the monitor function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_MONITOR_SAMPLE, 0, Heatmap, MaxEntries, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	FlushTbAllProcessors();
+
+	*EntryCount = DEADWING_COMMAND_PAYLOAD(Result)->MonitorSample.EntryCount;
+	*Samples = DEADWING_COMMAND_PAYLOAD(Result)->MonitorSample.Samples;
+	*Aggregated = DEADWING_COMMAND_PAYLOAD(Result)->MonitorSample.Aggregated;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Entropy map command handler
+ * 
+ * \param Channel Channel of the communication buffer
+ * \param Request Controller buffer with range and map buffer
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommEntropyMap(
+	_In_ PDEADWING_CHANNEL Channel,
+	_In_ PVOID             Request
+) {
+	if(!Request) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the entropy map function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_ENTROPY_MAP, 0, Request, 0, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Drain log command handler
+ * 
+ * \param Channel     Channel of the communication buffer
+ * \param Records     Controller buffer which receives log records
+ * \param MaxRecords  Capacity of the records buffer
+ * \param RecordCount Receives count of records
+ * \param Dropped     Receives count of records lost since the last drain
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommDrainLog(
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  PVOID             Records,
+	_In_  UINT64            MaxRecords,
+	_Out_ PUINT64           RecordCount,
+	_Out_ PUINT64           Dropped
+) {
+	if(!Records || !MaxRecords) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the drain log function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_DRAIN_LOG, 0, Records, MaxRecords, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	*RecordCount = DEADWING_COMMAND_PAYLOAD(Result)->Drain.RecordCount;
+	*Dropped = DEADWING_COMMAND_PAYLOAD(Result)->Drain.Dropped;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Drain trace command handler
+ * 
+ * \param Channel     Channel of the communication buffer
+ * \param Records     Controller buffer which receives trace records
+ * \param MaxRecords  Capacity of the records buffer
+ * \param RecordCount Receives count of records
+ * \param Dropped     Receives count of records lost since the last drain
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommDrainTrace(
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  PVOID             Records,
+	_In_  UINT64            MaxRecords,
+	_Out_ PUINT64           RecordCount,
+	_Out_ PUINT64           Dropped
+) {
+	if(!Records || !MaxRecords) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the drain trace function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_DRAIN_TRACE, 0, Records, MaxRecords, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	*RecordCount = DEADWING_COMMAND_PAYLOAD(Result)->Drain.RecordCount;
+	*Dropped = DEADWING_COMMAND_PAYLOAD(Result)->Drain.Dropped;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Get stats command handler
+ * 
+ * \param Channel Channel of the communication buffer
+ * \param Stats   Controller buffer which receives SMM counters
+ * \param Reset   Counters are cleared once they have been copied if not 0
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommGetStats(
+	_In_ PDEADWING_CHANNEL Channel,
+	_In_ PVOID             Stats,
+	_In_ UINT64            Reset
+) {
+	if(!Stats) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the get stats function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_GET_STATS, 0, Stats, Reset, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Profiler thread, fires sampling SMI every interval until stop is requested.
+ * 
+ * Tick is skipped if all channels are busy with controller requests,
+ * waiting for them would skew the sampling period
+ * 
+ * \param Context Unused
+ */
+VOID
+NTAPI
+CommProfileThread(
+	_In_ PVOID Context
+) {
+	UNREFERENCED_PARAMETER(Context);
+
+	LARGE_INTEGER Interval;
+	Interval.QuadPart = -(LONGLONG)(gProfileIntervalUs * 10);
+
+	while(KeWaitForSingleObject(&gProfileStop, Executive, KernelMode, FALSE, &Interval) == STATUS_TIMEOUT) {
+		PDEADWING_CHANNEL Channel = CommAcquireChannel(FALSE);
+		if(Channel == NULL) {
+			gProfileSkipped++;
+			continue;
+		}
+
+		PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_PROFILE_SAMPLE, 0, 0, 0, 0);
+		if(Result != NULL && Result->Status == EFI_SUCCESS)
+			gProfileSamples += DEADWING_COMMAND_PAYLOAD(Result)->Profile.SampleCount;
+		else
+			gProfileSkipped++;
+
+		CommReleaseChannel(Channel);
+	}
+
+	PsTerminateSystemThread(STATUS_SUCCESS);
+}
+
+/**
+ * \brief Starts profiler thread
+ * 
+ * \param IntervalUs Interval between samples in microseconds
+ * 
+ * \return STATUS_SUCCESS - Profiler has been started
+ * \return STATUS_INVALID_PARAMETER - Interval is too short
+ * \return STATUS_ALREADY_REGISTERED - Profiler is already running
+ * \return Other - Unable to create profiler thread
+ */
+NTSTATUS
+NTAPI
+CommProfileStart(
+	_In_ UINT64 IntervalUs
+) {
+	if(IntervalUs < PROFILE_MIN_INTERVAL_US) {
+		KdPrint(("[ DeadwingKM ] Profiler interval should be at least %d us\n", PROFILE_MIN_INTERVAL_US));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	KeWaitForSingleObject(&gProfileLock, Executive, KernelMode, FALSE, NULL);
+
+	if(gProfileThread != NULL) {
+		KeSetEvent(&gProfileLock, IO_NO_INCREMENT, FALSE);
+		return STATUS_ALREADY_REGISTERED;
+	}
+
+	gProfileIntervalUs = IntervalUs;
+	gProfileSamples = 0;
+	gProfileSkipped = 0;
+	KeClearEvent(&gProfileStop);
+
+	HANDLE Thread;
+	NTSTATUS Status = PsCreateSystemThread(&Thread, THREAD_ALL_ACCESS, NULL, NULL, NULL, CommProfileThread, NULL);
+	if(!NT_SUCCESS(Status)) {
+		KdPrint(("[ DeadwingKM ] Unable to create profiler thread (0x%X)\n", Status));
+		KeSetEvent(&gProfileLock, IO_NO_INCREMENT, FALSE);
+		return Status;
+	}
+
+	// keep the thread object to wait for it on stop
+	Status = ObReferenceObjectByHandle(Thread, THREAD_ALL_ACCESS, *PsThreadType, KernelMode, (PVOID *)&gProfileThread, NULL);
+	ZwClose(Thread);
+
+	if(!NT_SUCCESS(Status)) {
+		KeSetEvent(&gProfileStop, IO_NO_INCREMENT, FALSE);
+		gProfileThread = NULL;
+	}
+
+	KeSetEvent(&gProfileLock, IO_NO_INCREMENT, FALSE);
+
+	return Status;
+}
+
+/**
+ * \brief Stops profiler thread and waits for its termination
+ * 
+ * \param SampleCount Receives count of samples taken by SMI handler
+ * \param Skipped     Receives count of skipped ticks
+ * 
+ * \return STATUS_SUCCESS - Profiler has been stopped
+ * \return STATUS_NOT_FOUND - Profiler is not running
+ */
+NTSTATUS
+NTAPI
+CommProfileStop(
+	_Out_opt_ PUINT64 SampleCount,
+	_Out_opt_ PUINT64 Skipped
+) {
+	KeWaitForSingleObject(&gProfileLock, Executive, KernelMode, FALSE, NULL);
+
+	if(gProfileThread == NULL) {
+		KeSetEvent(&gProfileLock, IO_NO_INCREMENT, FALSE);
+		return STATUS_NOT_FOUND;
+	}
+
+	KeSetEvent(&gProfileStop, IO_NO_INCREMENT, FALSE);
+	KeWaitForSingleObject(gProfileThread, Executive, KernelMode, FALSE, NULL);
+
+	ObDereferenceObject(gProfileThread);
+	gProfileThread = NULL;
+
+	if(SampleCount)
+		*SampleCount = gProfileSamples;
+
+	if(Skipped)
+		*Skipped = gProfileSkipped;
+
+	KeSetEvent(&gProfileLock, IO_NO_INCREMENT, FALSE);
+
+	return STATUS_SUCCESS;
+}
+
+/**
+ * \brief Drain profile command handler
+ * 
+ * \param Channel     Channel of the communication buffer
+ * \param Samples     Controller buffer which receives profiler samples
+ * \param MaxSamples  Capacity of the samples buffer
+ * \param SampleCount Receives count of samples
+ * \param Dropped     Receives count of samples lost since the last drain
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommDrainProfile(
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  PVOID             Samples,
+	_In_  UINT64            MaxSamples,
+	_Out_ PUINT64           SampleCount,
+	_Out_ PUINT64           Dropped
+) {
+	if(!Samples || !MaxSamples) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the drain profile function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_DRAIN_PROFILE, 0, Samples, MaxSamples, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	*SampleCount = DEADWING_COMMAND_PAYLOAD(Result)->Drain.RecordCount;
+	*Dropped = DEADWING_COMMAND_PAYLOAD(Result)->Drain.Dropped;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Snapshot registers command handler
+ * 
+ * \param Channel   Channel of the communication buffer
+ * \param Registers Controller buffer which receives registers of every CPU
+ * \param MaxCpus   Capacity of the registers buffer
+ * \param CpuCount  Receives count of CPUs
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommSnapshotRegisters(
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  PVOID             Registers,
+	_In_  UINT64            MaxCpus,
+	_Out_ PUINT64           CpuCount
+) {
+	if(!Registers || !MaxCpus) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the snapshot registers function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_SNAPSHOT_REGISTERS, 0, Registers, MaxCpus, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	*CpuCount = DEADWING_COMMAND_PAYLOAD(Result)->Registers.CpuCount;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Memory map command handler
+ * 
+ * \param Channel    Channel of the communication buffer
+ * \param Ranges     Controller buffer which receives ranges of the physical memory map
+ * \param MaxRanges  Capacity of the ranges buffer
+ * \param RangeCount Receives count of ranges of the map, can exceed capacity of the buffer
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommGetMemoryMap(
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  PVOID             Ranges,
+	_In_  UINT64            MaxRanges,
+	_Out_ PUINT64           RangeCount
+) {
+	if(!Ranges || !MaxRanges) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the memory map function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_GET_MEMORY_MAP, 0, Ranges, MaxRanges, 0);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	*RangeCount = DEADWING_COMMAND_PAYLOAD(Result)->MemoryMap.RangeCount;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief ACPI table command handler
+ * 
+ * \param Channel   Channel of the communication buffer
+ * \param Signature Signature of the table or 0 to enumerate all tables, receives signature of the table
+ * \param Instance  Index of the table among tables with the same signature (or among all tables)
+ * \param Buffer    Controller buffer which receives the table
+ * \param MaxLength Capacity of the buffer
+ * \param Address   Receives physical address of the table
+ * \param Length    Receives length of the table, can exceed capacity of the buffer
+ * 
+ * \return STATUS_SUCCESS - SMI handler executed the command successfully
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ * \return Other - SMI handler cannot process command
+ */
+NTSTATUS
+NTAPI
+CommGetAcpiTable(
+	_In_    PDEADWING_CHANNEL Channel,
+	_Inout_ PUINT32           Signature,
+	_In_    UINT32            Instance,
+	_In_    PVOID             Buffer,
+	_In_    UINT64            MaxLength,
+	_Out_   PUINT64           Address,
+	_Out_   PUINT64           Length
+) {
+	if(!Buffer || !MaxLength) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the ACPI table function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_GET_ACPI_TABLE, 0, (UINT64)*Signature | ((UINT64)Instance << 32), Buffer, MaxLength);
+	if(Result == NULL)
+		return STATUS_UNSUCCESSFUL;
+
+	PDEADWING_ACPI_PAYLOAD Acpi = &DEADWING_COMMAND_PAYLOAD(Result)->Acpi;
+	*Signature = Acpi->Signature;
+	*Address = Acpi->Address;
+	*Length = Acpi->Length;
+
+	// convert EFI_STATUS to NTSTATUS
+	return EfiStatusToNtStatus(Result->Status);
+}
+
+/**
+ * \brief Completes the command of the batch. Ring lock should be held by caller
+ * 
+ * \param Request Tag of the command
+ * \param Status  Status of the command
+ * \param Value   Result of the command
+ */
+VOID
+NTAPI
+CommRingComplete(
+	_In_ PCOMM_RING_REQUEST Request,
+	_In_ EFI_STATUS         Status,
+	_In_ UINT64             Value
+) {
+	Request->Entry->Status = Status;
+	Request->Entry->Value = Value;
+	Request->Batch->Remaining--;
+}
+
+/**
+ * \brief Consumes all completions posted by SMI handler, no matter which batch they belong to.
+ * Ring lock should be held by caller
+ */
+VOID
+NTAPI
+CommRingReap(
+	VOID
+) {
+	UINT64 CqTail = gRing->CqTail;
+
+	// completions are written before the tail
+	KeMemoryBarrier();
+
+	for(UINT64 i = gRing->CqHead; i < CqTail; i++) {
+		PDEADWING_RING_COMPLETION Completion = &gRingCq[i & (gRing->CqEntries - 1)];
+		CommRingComplete((PCOMM_RING_REQUEST)Completion->UserData, Completion->Status, Completion->Value);
+	}
+
+	gRing->CqHead = CqTail;
+}
+
+/**
+ * \brief Queues as many commands of the batch as fit the submission ring.
+ * Ring lock should be held by caller
+ * 
+ * \param Batch    Batch of commands
+ * \param Requests Tags of the commands of the batch
+ */
+VOID
+NTAPI
+CommRingQueue(
+	_In_ PCOMM_RING_BATCH   Batch,
+	_In_ PCOMM_RING_REQUEST Requests
+) {
+	UINT64 SqTail = gRing->SqTail;
+
+	while(Batch->Queued < Batch->Count && SqTail - gRing->SqHead < gRing->SqEntries) {
+		PDEADWING_BATCH_ENTRY Entry = &Batch->Entries[Batch->Queued];
+		PDEADWING_RING_SUBMISSION Submission = &gRingSq[SqTail & (gRing->SqEntries - 1)];
+
+		Submission->UserData = (UINT64)&Requests[Batch->Queued];
+		Submission->Command = (UINT32)Entry->Command;
+		Submission->Reserved = 0;
+		Submission->ProcessId = Entry->ProcessId;
+		Submission->Args[0] = Entry->Args[0];
+		Submission->Args[1] = Entry->Args[1];
+		Submission->Args[2] = Entry->Args[2];
+		Submission->Cursor = 0;
+
+		Batch->Queued++;
+		SqTail++;
+	}
+
+	// commands should be visible before the tail
+	KeMemoryBarrier();
+
+	gRing->SqTail = SqTail;
+}
+
+/**
+ * \brief Fails all queued commands, no matter which batch they belong to.
+ * Ring lock should be held by caller
+ * 
+ * \param Status Status of failed commands
+ */
+VOID
+NTAPI
+CommRingAbort(
+	_In_ EFI_STATUS Status
+) {
+	CommRingReap();
+
+	for(UINT64 i = gRing->SqHead; i < gRing->SqTail; i++)
+		CommRingComplete((PCOMM_RING_REQUEST)gRingSq[i & (gRing->SqEntries - 1)].UserData, Status, 0);
+
+	gRing->SqHead = gRing->SqTail;
+}
+
+/**
+ * \brief Executes batch of commands through the submission and completion rings.
+ * 
+ * Commands are appended to the submission ring and a single SMI drains them, so a batch costs 
+ * one SMI (or a few, if SMI handler runs out of its time budget) instead of one SMI per command.
+ * Batches of concurrent requests share the rings, so the SMI fired by one of them completes
+ * commands of the others as well. Only reads, writes, translation and ping can be batched
+ * 
+ * \param Channel   Channel of the communication buffer
+ * \param Entries   Controller buffer with commands of the batch, receives their statuses and values
+ * \param Count     Count of commands
+ * \param Completed Receives count of succesfully completed commands
+ * 
+ * \return STATUS_SUCCESS - Batch has been executed, every command has its own status
+ * \return STATUS_INVALID_PARAMETER - One or more of the passed parameters are incorrect
+ * \return STATUS_NOT_SUPPORTED - DXE driver doesn't provide rings
+ * \return STATUS_INSUFFICIENT_RESOURCES - Unable to allocate copy of the batch
+ * \return STATUS_ACCESS_VIOLATION - Controller buffer is not accessible
+ * \return STATUS_UNSUCCESFUL - Cannot fire SMI
+ */
+NTSTATUS
+NTAPI
+CommSubmitBatch(
+	_In_  PDEADWING_CHANNEL Channel,
+	_In_  PVOID             Entries,
+	_In_  UINT64            Count,
+	_Out_ PUINT64           Completed
+) {
+	*Completed = 0;
+
+	if(!Entries || !Count || Count > COMM_MAX_BATCH) {
+		KdPrint(("[ DeadwingKM ] Incorrect parameters were passed to the batch function\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	if(gRing == NULL)
+		return STATUS_NOT_SUPPORTED;
+
+	// commands and their tags are kept in non-paged memory, they are accessed under the ring lock
+	UINT64 Length = Count * sizeof(DEADWING_BATCH_ENTRY);
+	PDEADWING_BATCH_ENTRY Copy = (PDEADWING_BATCH_ENTRY)ExAllocatePool2(POOL_FLAG_NON_PAGED, Length + Count * sizeof(COMM_RING_REQUEST), COMM_POOL_TAG);
+	if(Copy == NULL)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	PCOMM_RING_REQUEST Requests = (PCOMM_RING_REQUEST)((PUINT8)Copy + Length);
+
+	__try {
+		ProbeForRead(Entries, Length, 1);
+		RtlCopyMemory(Copy, Entries, Length);
+	} __except(EXCEPTION_EXECUTE_HANDLER) {
+		KdPrint(("[ DeadwingKM ] Unable to copy batch from the controller buffer\n"));
+		ExFreePoolWithTag(Copy, COMM_POOL_TAG);
+		return STATUS_ACCESS_VIOLATION;
+	}
+
+	COMM_RING_BATCH Batch;
+	Batch.Entries = Copy;
+	Batch.Count = Count;
+	Batch.Queued = 0;
+	Batch.Remaining = Count;
+
+	for(UINT64 i = 0; i < Count; i++) {
+		Requests[i].Batch = &Batch;
+		Requests[i].Entry = &Copy[i];
+		Copy[i].Status = EFI_NOT_READY;
+		Copy[i].Value = 0;
+	}
+
+	NTSTATUS Status = STATUS_SUCCESS;
+	while(TRUE) {
+		KeWaitForSingleObject(&gRingLock, Executive, KernelMode, FALSE, NULL);
+
+		CommRingReap();
+		CommRingQueue(&Batch, Requests);
+
+		// SMI handler should either take the head command or move its cursor
+		UINT64 SqHead = gRing->SqHead;
+		UINT64 Cursor = gRingSq[SqHead & (gRing->SqEntries - 1)].Cursor;
+		UINT64 Remaining = Batch.Remaining;
+
+		KeSetEvent(&gRingLock, IO_NO_INCREMENT, FALSE);
+
+		// commands could be completed by SMIs of concurrent batches
+		if(Remaining == 0)
+			break;
+
+		PDEADWING_COMMAND Result = CommFireSmi(Channel, CMD_DEADWING_DRAIN_RING, 0, gRingPhys, 0, 0);
+
+		KeWaitForSingleObject(&gRingLock, Executive, KernelMode, FALSE, NULL);
+
+		if(Result == NULL || Result->Status != EFI_SUCCESS) {
+			KdPrint(("[ DeadwingKM ] Unable to drain submission ring\n"));
+			Status = STATUS_UNSUCCESSFUL;
+		} else if(gRing->SqHead == SqHead && gRingSq[SqHead & (gRing->SqEntries - 1)].Cursor == Cursor && gRing->CqTail - gRing->CqHead < gRing->CqEntries) {
+			KdPrint(("[ DeadwingKM ] SMI handler doesn't make progress, aborting batch\n"));
+			Status = STATUS_UNSUCCESSFUL;
+		}
+
+		// rings can't be drained, so nothing queued will ever complete
+		if(!NT_SUCCESS(Status)) {
+			CommRingAbort(EFI_ABORTED);
+
+			for(; Batch.Queued < Batch.Count; Batch.Queued++)
+				CommRingComplete(&Requests[Batch.Queued], EFI_ABORTED, 0);
+		}
+
+		KeSetEvent(&gRingLock, IO_NO_INCREMENT, FALSE);
+
+		if(!NT_SUCCESS(Status))
+			break;
+	}
+
+	for(UINT64 i = 0; i < Count; i++) {
+		if(Copy[i].Status == EFI_SUCCESS)
+			(*Completed)++;
+	}
+
+	// statuses are reported even if the batch has been aborted
+	__try {
+		ProbeForWrite(Entries, Length, 1);
+		RtlCopyMemory(Entries, Copy, Length);
+	} __except(EXCEPTION_EXECUTE_HANDLER) {
+		KdPrint(("[ DeadwingKM ] Unable to copy statuses to the controller buffer\n"));
+		Status = STATUS_ACCESS_VIOLATION;
+	}
+
+	ExFreePoolWithTag(Copy, COMM_POOL_TAG);
+
+	return Status;
+}
+
+/**
+ * \brief Changes limits of the SMI scheduler
+ * 
+ * \param MaxSmiPerSecond   Max count of SMIs per second, 0 - unlimited
+ * \param MaxSmmUsPerSecond Max time in microseconds spent in SMM per second, 0 - unlimited
+ * \param AverageCostUs     Measured average cost of the SMI round-trip
+ * 
+ * \return STATUS_SUCCESS - Limits have been changed
+ * \return STATUS_INVALID_PARAMETER - Time limit exceeds one second
+ */
+NTSTATUS
+NTAPI
+CommSetRateLimit(
+	_In_  UINT64  MaxSmiPerSecond,
+	_In_  UINT64  MaxSmmUsPerSecond,
+	_Out_ PUINT64 AverageCostUs
+) {
+	if(MaxSmmUsPerSecond > 1000000) {
+		KdPrint(("[ DeadwingKM ] SMM time limit can't exceed one second per second\n"));
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	SchedSetLimits(MaxSmiPerSecond, MaxSmmUsPerSecond);
+
+	*AverageCostUs = SchedGetAverageCostUs();
+
+	return STATUS_SUCCESS;
+}
+
+/**
+ * \brief Processes commands from controller process
+ * 
+ * \param Irp         I/O Request Packet
+ * \param IoStack     I/O Stack
+ * \param OutputValue Optional value for the I/O manager if the controller requires output values
+ * 
+ * \return STATUS_SUCCESS - The command was executed successfully
+ * \return Other - The command was not executed
+ */
+NTSTATUS
+NTAPI
+CommUmCmdHandler(
+	_In_  PIRP               Irp,
+	_In_  PIO_STACK_LOCATION IoStack,
+	_Out_ PUINT64            OutputValue
+) {
+	NTSTATUS Status;
+	
+	UINT64 Out = 0;
+	UINT64 VtopMem = 0;
+	PDEADWING_UM_KM_COMMUNICATION UmPacket = (PDEADWING_UM_KM_COMMUNICATION)Irp->AssociatedIrp.SystemBuffer;
+
+	// request owns the channel until it's completed
+	PDEADWING_CHANNEL Channel = CommAcquireChannel(TRUE);
+
+	// dispatch request
+	switch(IoStack->Parameters.DeviceIoControl.IoControlCode) {
+		case IOCTL_DEADWING_PING_SMI:
+			Status = CommPingSmi(Channel);
+			if(!NT_SUCCESS(Status))
+				KdPrint(("[ DeadwingKM ] SMI handler is unavailable\n"));
+		break;
+		case IOCTL_DEADWING_CACHE_SESSION:
+			Status = CommCacheSessionInfo(Channel, UmPacket->ProcessId);
+			if(!NT_SUCCESS(Status))
+				KdPrint(("[ DeadwingKM ] Unable to cache session info\n"));
+		break;
+		case IOCTL_DEADWING_READ_PHYS:
+			Status = CommPhysRead(Channel, UmPacket->Read.PhysReadAddress, UmPacket->Read.VaReadResultAddress, UmPacket->Read.ReadLength);
+			if(!NT_SUCCESS(Status))
+				KdPrint(("[ DeadwingKM ] Unable to read from physical address\n"));
+		break;
+		case IOCTL_DEADWING_READ_VIRTUAL:
+			Status = CommVirtualRead(Channel, UmPacket->ProcessId, UmPacket->Read.VaReadAddress, UmPacket->Read.VaReadResultAddress, UmPacket->Read.ReadLength);
+			if(!NT_SUCCESS(Status))
+				KdPrint(("[ DeadwingKM ] Unable to read data from provided address\n"));
+		break;
+		case IOCTL_DEADWING_WRITE_PHYS:
+			Status = CommPhysWrite(Channel, UmPacket->Write.PhysWriteAddress, UmPacket->Write.VaDataAddress, UmPacket->Write.WriteLength);
+			if(!NT_SUCCESS(Status))
+				KdPrint(("[ DeadwingKM ] Unable to write data to the provided physical address\n"));
+		break;
+		case IOCTL_DEADWING_WRITE_VIRTUAL:
+			Status = CommVirtualWrite(Channel, UmPacket->ProcessId, UmPacket->Write.VaWriteAddress, UmPacket->Write.VaDataAddress, UmPacket->Write.WriteLength);
+			if(!NT_SUCCESS(Status))
+				KdPrint(("[ DeadwingKM ] Unable to write data to the provided address\n"));
+		break;
+		case IOCTL_DEADWING_VIRT_TO_PHYS:
+			Status = CommVtop(Channel, UmPacket->ProcessId, UmPacket->Vtop.AddressToTranslate, &VtopMem);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to translate virtual address to physical\n"));
+				break;
+			}
+
+			// fill output request
+			UmPacket->Vtop.Translated = VtopMem;
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_PRIV_ESC:
+			Status = CommPrivEsc(Channel);
+			if(!NT_SUCCESS(Status))
+				KdPrint(("[ DeadwingKM ] Unable to leverage privileges\n"));
+		break;
+		case IOCTL_DEADWING_HASH_RANGES:
+			Status = CommHashRanges(Channel, UmPacket->Hash.Request, UmPacket->Hash.PageDigests, UmPacket->Hash.PageDigestsLength);
+			if(!NT_SUCCESS(Status))
+				KdPrint(("[ DeadwingKM ] Unable to hash provided ranges\n"));
+		break;
+		case IOCTL_DEADWING_SCAN:
+			Status = CommScan(Channel, UmPacket->Scan.Request, UmPacket->Scan.Matches, UmPacket->Scan.MaxMatches, &UmPacket->Scan.MatchCount, &UmPacket->Scan.Truncated);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to scan provided range\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_SPARSE_READ:
+			Status = CommSparseRead(Channel, UmPacket->Sparse.Request, &UmPacket->Sparse.DataPages);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to read provided range\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_TRACK_REGION:
+			Status = CommTrackRegion(Channel, UmPacket->ProcessId, UmPacket->Track.Address, UmPacket->Track.Length, &UmPacket->Track.Handle);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to track provided range\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_CHANGES_SINCE:
+			Status = CommChangesSince(Channel, UmPacket->Track.Request, &UmPacket->Track.ChangeCount, &UmPacket->Track.Truncated);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to collect changes of the tracked range\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_HARVEST_AD:
+			Status = CommHarvestAccessDirty(Channel, UmPacket->Harvest.Request, &UmPacket->Harvest.PageCount, &UmPacket->Harvest.Truncated);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to harvest accessed and dirty bits\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_MONITOR_START:
+			Status = CommMonitorStart(Channel, UmPacket->Monitor.Request);
+			if(!NT_SUCCESS(Status))
+				KdPrint(("[ DeadwingKM ] Unable to start access monitor\n"));
+		break;
+		case IOCTL_DEADWING_MONITOR_SAMPLE:
+			Status = CommMonitorSample(Channel, UmPacket->Monitor.Heatmap, UmPacket->Monitor.MaxEntries, &UmPacket->Monitor.EntryCount, &UmPacket->Monitor.Samples, &UmPacket->Monitor.Aggregated);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to sample monitored regions\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_ENTROPY_MAP:
+			Status = CommEntropyMap(Channel, UmPacket->Entropy.Request);
+			if(!NT_SUCCESS(Status))
+				KdPrint(("[ DeadwingKM ] Unable to build entropy map\n"));
+		break;
+		case IOCTL_DEADWING_DRAIN_LOG:
+			Status = CommDrainLog(Channel, UmPacket->Log.Records, UmPacket->Log.MaxRecords, &UmPacket->Log.RecordCount, &UmPacket->Log.Dropped);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to drain SMM log\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_DRAIN_TRACE:
+			Status = CommDrainTrace(Channel, UmPacket->Trace.Records, UmPacket->Trace.MaxRecords, &UmPacket->Trace.RecordCount, &UmPacket->Trace.Dropped);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to drain SMM trace\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_GET_STATS:
+			Status = CommGetStats(Channel, UmPacket->Stats.Buffer, UmPacket->Stats.Reset);
+			if(!NT_SUCCESS(Status))
+				KdPrint(("[ DeadwingKM ] Unable to get SMM stats\n"));
+		break;
+		case IOCTL_DEADWING_PROFILE_START:
+			Status = CommProfileStart(UmPacket->Profile.IntervalUs);
+			if(!NT_SUCCESS(Status))
+				KdPrint(("[ DeadwingKM ] Unable to start profiler\n"));
+		break;
+		case IOCTL_DEADWING_PROFILE_STOP:
+			Status = CommProfileStop(&UmPacket->Profile.SampleCount, &UmPacket->Profile.Dropped);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to stop profiler\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_DRAIN_PROFILE:
+			Status = CommDrainProfile(Channel, UmPacket->Profile.Samples, UmPacket->Profile.MaxSamples, &UmPacket->Profile.SampleCount, &UmPacket->Profile.Dropped);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to drain profile\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_SNAPSHOT_REGS:
+			Status = CommSnapshotRegisters(Channel, UmPacket->Registers.Buffer, UmPacket->Registers.MaxCpus, &UmPacket->Registers.CpuCount);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to snapshot registers\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_SUBMIT_BATCH:
+			Status = CommSubmitBatch(Channel, UmPacket->Batch.Entries, UmPacket->Batch.Count, &UmPacket->Batch.Completed);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to submit batch\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_GET_MEMORY_MAP:
+			Status = CommGetMemoryMap(Channel, UmPacket->MemoryMap.Ranges, UmPacket->MemoryMap.MaxRanges, &UmPacket->MemoryMap.RangeCount);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to get memory map\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_GET_ACPI_TABLE:
+			Status = CommGetAcpiTable(Channel, &UmPacket->Acpi.Signature, UmPacket->Acpi.Instance, UmPacket->Acpi.Buffer, UmPacket->Acpi.MaxLength, &UmPacket->Acpi.Address, &UmPacket->Acpi.Length);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to get ACPI table\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		case IOCTL_DEADWING_SET_RATE_LIMIT:
+			Status = CommSetRateLimit(UmPacket->RateLimit.MaxSmiPerSecond, UmPacket->RateLimit.MaxSmmUsPerSecond, &UmPacket->RateLimit.AverageSmiCostUs);
+			if(!NT_SUCCESS(Status)) {
+				KdPrint(("[ DeadwingKM ] Unable to change rate limits\n"));
+				break;
+			}
+
+			Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+		break;
+		default:
+			KdPrint(("[ DeadwingKM ] Received unknown command\n"));
+			Status = STATUS_INVALID_DEVICE_REQUEST;
+		break;
+	}
+
+	// report phase timings of the command if controller has provided output buffer
+	if(NT_SUCCESS(Status) && IoStack->Parameters.DeviceIoControl.OutputBufferLength >= sizeof(DEADWING_UM_KM_COMMUNICATION)) {
+		UmPacket->Timing = Channel->Timing;
+		UmPacket->SmiCount = Channel->SmiCount;
+		Out = sizeof(DEADWING_UM_KM_COMMUNICATION);
+	}
+
+	CommReleaseChannel(Channel);
+
 	*OutputValue = Out;
 
 	return Status;
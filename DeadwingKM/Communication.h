@@ -1,5 +1,18 @@
 #pragma once
 
+VOID
+NTAPI
+CommInitialize(
+	VOID
+);
+
+NTSTATUS
+NTAPI
+CommProfileStop(
+	_Out_opt_ PUINT64 SampleCount,
+	_Out_opt_ PUINT64 Skipped
+);
+
 NTSTATUS
 NTAPI
 CommUmCmdHandler(
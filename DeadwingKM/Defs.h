@@ -6,72 +6,59 @@
 
 #define EFI_INVALID_PARAMETER    0x8000000000000002ULL
 #define EFI_UNSUPPORTED          0x8000000000000003ULL
+#define EFI_BUFFER_TOO_SMALL     0x8000000000000005ULL
 #define EFI_NOT_READY            0x8000000000000006ULL
+#define EFI_OUT_OF_RESOURCES     0x8000000000000009ULL
+#define EFI_NOT_STARTED          0x8000000000000013ULL
 #define EFI_NOT_FOUND            0x8000000000000014ULL
 #define EFI_ABORTED              0x8000000000000021ULL
 
-#define CMD_DEADWING_PING_SMI             0xD700DEADULL
-#define CMD_DEADWING_READ_PHYS            0xD800AAABULL
-#define CMD_DEADWING_WRITE_PHYS           0xD800BBCDULL
-#define CMD_DEADWING_VIRT_TO_PHYS         0xD800FF11ULL
-#define CMD_DEADWING_READ_VIRTUAL         0xD900CCEFULL
-#define CMD_DEADWING_WRITE_VIRTUAL        0xD900DDAFULL
-#define CMD_DEADWING_PRIV_ESC             0xD100AC91ULL
-#define CMD_DEADWING_CACHE_SESSION_INFO   0xD110A110ULL
-
-static CONST GUID gDeadwingTransferVarGuid = { 0xE8E00F56, 0x2350, 0x49BF, { 0x9E, 0x25, 0x3A, 0x36, 0x8E, 0x8B, 0xB3, 0x73 } };
-
-UINT32 gBufSize;
-
 typedef UINT64 EFI_STATUS;
 
-typedef struct _DEADWING_COMMUNICATION {
-	UINT32      Command;
-	UINT64      SmiRetStatus;
+#include "../Common/DeadwingComm.h"
 
-	UINT64      CommBufSize;
+/// \note should be in sync with Deadwing/Conf.h
+#define DEADWING_MAX_TRANSFER_LENGTH      0x1000000ULL
 
-	struct {
-		UINT64  TargetProcessId;
-		PVOID   PhysReadAddress;
-		PVOID   VaReadAddress;
-		PVOID   ReadResult;
-		UINT64  ReadLength;
-	} Read;
+// max capacity of the scan matches buffer (16 bytes per match)
+#define DEADWING_SCAN_MAX_MATCHES         0x100000ULL
 
-	struct {
-		UINT64  TargetProcessId;
-		PVOID   PhysWriteAddress;
-		PVOID   VaWriteAddress;
-		PVOID   DataToWrite;
-		UINT64  WriteLength;
-	} Write;
-
-	struct {
-		UINT64  ControllerProcessId;
-		PVOID   VaPsInitialSysProcess;
-		UINT64  DirBase;
-	} Cache;
-
-	struct {
-		UINT64  TargetPid;
-		PVOID   AddressToTranslate;
-		PVOID   Translated;
-	} Vtop;
-} DEADWING_COMMUNICATION, *PDEADWING_COMMUNICATION;
-
-typedef struct _DEADWING_TRANSFER {
-	struct {
-		PVOID  CommBufVirtual;
-		PVOID  CommBufPhys;
-		UINT64 CommBufSize;
-	} Buffer;
+static CONST GUID gDeadwingTransferVarGuid = { 0xE8E00F56, 0x2350, 0x49BF, { 0x9E, 0x25, 0x3A, 0x36, 0x8E, 0x8B, 0xB3, 0x73 } };
 
-	struct {
-		PVOID  SetupBufFunction;
-		PVOID  SmmCommunicateFunction;
-	} API;
-} DEADWING_TRANSFER, *PDEADWING_TRANSFER;
+// channels of the communication buffer, each one has its own packet and inline data region
+PVOID  gCommBuf;
+UINT64 gChannelCount;
+UINT64 gChannelSize;
+UINT64 gInlineOffset;
+UINT64 gInlineSize;
+
+// APM ports and value of the doorbell SMI, command port is 0 if DXE driver doesn't advertise doorbell
+UINT64 gDoorbellCommandPort;
+UINT64 gDoorbellDataPort;
+UINT64 gDoorbellSwSmi;
+
+// submission and completion rings which follow the channels, NULL if DXE driver doesn't provide them
+PDEADWING_RING            gRing;
+PDEADWING_RING_SUBMISSION gRingSq;
+PDEADWING_RING_COMPLETION gRingCq;
+UINT64                    gRingPhys;
+
+// channel of the communication buffer, owned by a single request at a time
+typedef struct _DEADWING_CHANNEL {
+	UINT64           Index;
+	PVOID            InlineData;
+	DEADWING_TIMING  Timing;
+	UINT64           SmiCount;
+} DEADWING_CHANNEL, *PDEADWING_CHANNEL;
+
+// command of the batch, status and value are filled on completion
+typedef struct _DEADWING_BATCH_ENTRY {
+	UINT64     Command;
+	UINT64     ProcessId;
+	UINT64     Args[3];
+	EFI_STATUS Status;
+	UINT64     Value;
+} DEADWING_BATCH_ENTRY, *PDEADWING_BATCH_ENTRY;
 
 typedef struct _DEADWING_UM_KM_COMMUNICATION {
 	UINT64 ProcessId;
@@ -94,4 +81,114 @@ typedef struct _DEADWING_UM_KM_COMMUNICATION {
 		PVOID  AddressToTranslate;
 		UINT64 Translated;
 	} Vtop;
+
+	struct {
+		UINT64 MaxSmiPerSecond;
+		UINT64 MaxSmmUsPerSecond;
+		UINT64 AverageSmiCostUs;
+	} RateLimit;
+
+	struct {
+		PVOID  Request;
+		PVOID  PageDigests;
+		UINT64 PageDigestsLength;
+	} Hash;
+
+	struct {
+		PVOID  Request;
+		PVOID  Matches;
+		UINT64 MaxMatches;
+		UINT64 MatchCount;
+		UINT64 Truncated;
+	} Scan;
+
+	struct {
+		PVOID  Request;
+		UINT64 DataPages;
+	} Sparse;
+
+	struct {
+		PVOID  Address;
+		UINT64 Length;
+		UINT64 Handle;
+		PVOID  Request;
+		UINT64 ChangeCount;
+		UINT64 Truncated;
+	} Track;
+
+	struct {
+		PVOID  Request;
+		UINT64 PageCount;
+		UINT64 Truncated;
+	} Harvest;
+
+	struct {
+		PVOID  Request;
+		PVOID  Heatmap;
+		UINT64 MaxEntries;
+		UINT64 EntryCount;
+		UINT64 Samples;
+		UINT64 Aggregated;
+	} Monitor;
+
+	struct {
+		PVOID  Request;
+	} Entropy;
+
+	struct {
+		PVOID  Records;
+		UINT64 MaxRecords;
+		UINT64 RecordCount;
+		UINT64 Dropped;
+	} Log;
+
+	struct {
+		PVOID  Records;
+		UINT64 MaxRecords;
+		UINT64 RecordCount;
+		UINT64 Dropped;
+	} Trace;
+
+	struct {
+		PVOID  Buffer;
+		UINT64 Reset;
+	} Stats;
+
+	struct {
+		UINT64 IntervalUs;
+		PVOID  Samples;
+		UINT64 MaxSamples;
+		UINT64 SampleCount;
+		UINT64 Dropped;
+	} Profile;
+
+	struct {
+		PVOID  Buffer;
+		UINT64 MaxCpus;
+		UINT64 CpuCount;
+	} Registers;
+
+	struct {
+		PVOID  Entries;
+		UINT64 Count;
+		UINT64 Completed;
+	} Batch;
+
+	struct {
+		PVOID  Ranges;
+		UINT64 MaxRanges;
+		UINT64 RangeCount;
+	} MemoryMap;
+
+	struct {
+		UINT32 Signature;
+		UINT32 Instance;
+		PVOID  Buffer;
+		UINT64 MaxLength;
+		UINT64 Address;
+		UINT64 Length;
+	} Acpi;
+
+	DEADWING_TIMING Timing;
+	UINT64          SmiCount;
 } DEADWING_UM_KM_COMMUNICATION, *PDEADWING_UM_KM_COMMUNICATION;
@@ -3,6 +3,7 @@
 #include "Defs.h"
 #include "Communication.h"
 #include "Utils.h"
+#include "Scheduler.h"
 
 
 /**
@@ -132,6 +133,9 @@ NTAPI
 DriverUnload(
 	_In_ PDRIVER_OBJECT DriverObject
 ) {
+	// profiler thread shouldn't outlive the driver
+	CommProfileStop(NULL, NULL);
+
 	UNICODE_STRING DosDevice = RTL_CONSTANT_STRING(L"\\DosDevices\\DeadwingKM");
 	IoDeleteSymbolicLink(&DosDevice);
 	
@@ -165,6 +169,12 @@ DriverEntry(
 	if(!NT_SUCCESS(Status))
 		return Status;
 
+	// initialize SMI rate limiter
+	SchedInitialize();
+
+	// initialize lock of the communication buffer
+	CommInitialize();
+
 	for(INT i = 0; i < IRP_MJ_MAXIMUM_FUNCTION; i++)
 		DriverObject->MajorFunction[i] = DriverUnimplemented;
 
@@ -0,0 +1,207 @@
+#include <ntddk.h>
+
+#include "Defs.h"
+#include "Scheduler.h"
+
+#define SCHED_US_PER_SECOND 1000000ULL
+
+/// \note both buckets are kept in integer units scaled by performance counter
+/// frequency, so refilling doesn't require any division:
+/// SMI bucket  - one SMI costs Frequency units, refill is MaxSmiPerSecond units per tick
+/// Time bucket - one tick of SMM time costs 1000000 units, refill is MaxSmmUsPerSecond units per tick
+typedef struct _DEADWING_SCHEDULER {
+	KSPIN_LOCK Lock;
+
+	UINT64 Frequency;
+	UINT64 LastRefill;
+
+	UINT64 MaxSmiPerSecond;
+	UINT64 MaxSmmUsPerSecond;
+
+	INT64  SmiTokens;
+	INT64  TimeTokens;
+
+	UINT64 AverageCost;
+} DEADWING_SCHEDULER, *PDEADWING_SCHEDULER;
+
+DEADWING_SCHEDULER gScheduler;
+
+
+/**
+ * \brief Refills both token buckets according to the elapsed time.
+ * Scheduler lock should be held by caller
+ * 
+ * \param Now Current value of performance counter
+ */
+VOID
+NTAPI
+SchedRefill(
+	_In_ UINT64 Now
+) {
+	UINT64 Elapsed = Now - gScheduler.LastRefill;
+	gScheduler.LastRefill = Now;
+
+	// buckets can't hold more than burst anyway, so there's no reason to count more than a second
+	if(Elapsed > gScheduler.Frequency)
+		Elapsed = gScheduler.Frequency;
+
+	INT64 SmiCapacity = (INT64)(gScheduler.Frequency * max(gScheduler.MaxSmiPerSecond * DEADWING_SCHED_BURST_MS / 1000, 1));
+	INT64 TimeCapacity = (INT64)(gScheduler.Frequency * gScheduler.MaxSmmUsPerSecond * DEADWING_SCHED_BURST_MS / 1000);
+
+	// time bucket should be able to hold at least one average SMI, otherwise we'll wait forever
+	if(TimeCapacity < (INT64)(gScheduler.AverageCost * SCHED_US_PER_SECOND))
+		TimeCapacity = (INT64)(gScheduler.AverageCost * SCHED_US_PER_SECOND);
+
+	gScheduler.SmiTokens = min(gScheduler.SmiTokens + (INT64)(Elapsed * gScheduler.MaxSmiPerSecond), SmiCapacity);
+	gScheduler.TimeTokens = min(gScheduler.TimeTokens + (INT64)(Elapsed * gScheduler.MaxSmmUsPerSecond), TimeCapacity);
+}
+
+/**
+ * \brief Initializes SMI scheduler with default limits
+ */
+VOID
+NTAPI
+SchedInitialize(
+	VOID
+) {
+	LARGE_INTEGER Frequency;
+	LARGE_INTEGER Now = KeQueryPerformanceCounter(&Frequency);
+
+	RtlZeroMemory(&gScheduler, sizeof(DEADWING_SCHEDULER));
+	KeInitializeSpinLock(&gScheduler.Lock);
+
+	gScheduler.Frequency = (UINT64)Frequency.QuadPart;
+	gScheduler.MaxSmiPerSecond = DEADWING_SCHED_DEFAULT_SMI_PER_SECOND;
+	gScheduler.MaxSmmUsPerSecond = DEADWING_SCHED_DEFAULT_SMM_US_PER_SECOND;
+
+	// start with full buckets
+	gScheduler.LastRefill = (UINT64)Now.QuadPart - gScheduler.Frequency;
+	SchedRefill((UINT64)Now.QuadPart);
+}
+
+/**
+ * \brief Changes limits of the SMI scheduler
+ * 
+ * \param MaxSmiPerSecond   Max count of SMIs per second, 0 - unlimited
+ * \param MaxSmmUsPerSecond Max time in microseconds which can be spent in SMM per second, 0 - unlimited
+ */
+VOID
+NTAPI
+SchedSetLimits(
+	_In_ UINT64 MaxSmiPerSecond,
+	_In_ UINT64 MaxSmmUsPerSecond
+) {
+	KIRQL Irql;
+
+	KeAcquireSpinLock(&gScheduler.Lock, &Irql);
+
+	gScheduler.MaxSmiPerSecond = MaxSmiPerSecond;
+	gScheduler.MaxSmmUsPerSecond = min(MaxSmmUsPerSecond, SCHED_US_PER_SECOND);
+
+	// drop accumulated debts, new limits are applied from now
+	gScheduler.SmiTokens = 0;
+	gScheduler.TimeTokens = 0;
+
+	KeReleaseSpinLock(&gScheduler.Lock, Irql);
+
+	KdPrint(("[ DeadwingKM ] Rate limits: %llu SMI/s, %llu us of SMM per second\n", MaxSmiPerSecond, MaxSmmUsPerSecond));
+}
+
+/**
+ * \brief Returns measured average cost of the SMI round-trip
+ * 
+ * \returns Average cost in microseconds
+ */
+UINT64
+NTAPI
+SchedGetAverageCostUs(
+	VOID
+) {
+	if(gScheduler.Frequency == 0)
+		return 0;
+
+	return gScheduler.AverageCost * SCHED_US_PER_SECOND / gScheduler.Frequency;
+}
+
+/**
+ * \brief Waits until SMI can be fired without exceeding configured limits.
+ * 
+ * Requests are never rejected: if there are not enough tokens, the caller sleeps until 
+ * buckets are refilled. Expected SMM time is reserved from the measured average cost
+ * and corrected by SchedComplete once the real cost is known
+ * 
+ * \returns Reserved SMM time (in performance counter ticks) which should be passed to SchedComplete
+ */
+UINT64
+NTAPI
+SchedAcquire(
+	VOID
+) {
+	KIRQL Irql;
+	LARGE_INTEGER Delay;
+
+	while(TRUE) {
+		KeAcquireSpinLock(&gScheduler.Lock, &Irql);
+
+		SchedRefill((UINT64)KeQueryPerformanceCounter(NULL).QuadPart);
+
+		UINT64 Reserved = gScheduler.MaxSmmUsPerSecond ? gScheduler.AverageCost : 0;
+		INT64 SmiNeed = gScheduler.MaxSmiPerSecond ? (INT64)gScheduler.Frequency : 0;
+		INT64 TimeNeed = (INT64)(Reserved * SCHED_US_PER_SECOND);
+
+		// take tokens if both buckets are ready
+		if(gScheduler.SmiTokens >= SmiNeed && gScheduler.TimeTokens >= TimeNeed) {
+			gScheduler.SmiTokens -= SmiNeed;
+			gScheduler.TimeTokens -= TimeNeed;
+
+			KeReleaseSpinLock(&gScheduler.Lock, Irql);
+
+			return Reserved;
+		}
+
+		// calculate how long we should wait for the slowest bucket
+		UINT64 WaitTicks = 0;
+		if(gScheduler.SmiTokens < SmiNeed)
+			WaitTicks = (UINT64)(SmiNeed - gScheduler.SmiTokens) / gScheduler.MaxSmiPerSecond + 1;
+
+		if(gScheduler.TimeTokens < TimeNeed)
+			WaitTicks = max(WaitTicks, (UINT64)(TimeNeed - gScheduler.TimeTokens) / gScheduler.MaxSmmUsPerSecond + 1);
+
+		UINT64 Frequency = gScheduler.Frequency;
+
+		KeReleaseSpinLock(&gScheduler.Lock, Irql);
+
+		// delay request, interval is relative and measured in 100ns units
+		Delay.QuadPart = -(LONGLONG)max(WaitTicks * 10000000ULL / Frequency, 1);
+		KeDelayExecutionThread(KernelMode, FALSE, &Delay);
+	}
+}
+
+/**
+ * \brief Accounts real cost of the fired SMI
+ * 
+ * \param Reserved SMM time reserved by SchedAcquire
+ * \param Cost     Measured round-trip time in performance counter ticks
+ */
+VOID
+NTAPI
+SchedComplete(
+	_In_ UINT64 Reserved,
+	_In_ UINT64 Cost
+) {
+	KIRQL Irql;
+
+	KeAcquireSpinLock(&gScheduler.Lock, &Irql);
+
+	// correct reservation with real cost. Bucket may go below zero, next requests will wait longer
+	if(gScheduler.MaxSmmUsPerSecond)
+		gScheduler.TimeTokens += ((INT64)Reserved - (INT64)Cost) * (INT64)SCHED_US_PER_SECOND;
+
+	// exponentially weighted moving average, 1/8 of the new sample
+	if(gScheduler.AverageCost == 0)
+		gScheduler.AverageCost = Cost;
+	else
+		gScheduler.AverageCost = gScheduler.AverageCost - (gScheduler.AverageCost >> 3) + (Cost >> 3);
+
+	KeReleaseSpinLock(&gScheduler.Lock, Irql);
+}
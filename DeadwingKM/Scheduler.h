@@ -0,0 +1,41 @@
+#pragma once
+
+/// \note default limits of the SMI scheduler. Both limits can be changed
+/// at runtime through IOCTL_DEADWING_SET_RATE_LIMIT, zero disables specific limit
+#define DEADWING_SCHED_DEFAULT_SMI_PER_SECOND    2000
+#define DEADWING_SCHED_DEFAULT_SMM_US_PER_SECOND 100000
+
+/// \note size of the token buckets in milliseconds of refill
+#define DEADWING_SCHED_BURST_MS                  50
+
+VOID
+NTAPI
+SchedInitialize(
+	VOID
+);
+
+VOID
+NTAPI
+SchedSetLimits(
+	_In_ UINT64 MaxSmiPerSecond,
+	_In_ UINT64 MaxSmmUsPerSecond
+);
+
+UINT64
+NTAPI
+SchedGetAverageCostUs(
+	VOID
+);
+
+UINT64
+NTAPI
+SchedAcquire(
+	VOID
+);
+
+VOID
+NTAPI
+SchedComplete(
+	_In_ UINT64 Reserved,
+	_In_ UINT64 Cost
+);
@@ -3,6 +3,7 @@
 #include "Defs.h"
 #include "Triggers.h"
 
+#define CR4_PGE (1ULL << 7)
 
 /**
  * \brief Caches transfered info from boot environment. Should be
@@ -33,16 +34,55 @@ TransferWorker(
 	KdPrint(("[ DeadwingKM ] Virtual address of communication buffer: 0x%llX\n", TransferInfo.Buffer.CommBufVirtual));
 	KdPrint(("[ DeadwingKM ] Physical address of communication buffer: 0x%llX\n", TransferInfo.Buffer.CommBufPhys));
 	KdPrint(("[ DeadwingKM ] Size of communication buffer: 0x%llX\n", TransferInfo.Buffer.CommBufSize));
-	KdPrint(("[ DeadwingKM ] Setup communication buffer function: 0x%llX\n", TransferInfo.API.SetupBufFunction));
-	KdPrint(("[ DeadwingKM ] Communication trigger function: 0x%llX\n", TransferInfo.API.SmmCommunicateFunction));
+	KdPrint(("[ DeadwingKM ] Offset of inline data region: 0x%llX\n", TransferInfo.Buffer.DataOffset));
+	KdPrint(("[ DeadwingKM ] Size of inline data region: 0x%llX\n", TransferInfo.Buffer.DataSize));
+	KdPrint(("[ DeadwingKM ] Count of communication channels: %lld\n", TransferInfo.Buffer.ChannelCount));
+	KdPrint(("[ DeadwingKM ] Size of communication channel: 0x%llX\n", TransferInfo.Buffer.ChannelSize));
+	KdPrint(("[ DeadwingKM ] Offset of rings: 0x%llX\n", TransferInfo.Ring.Offset));
+	KdPrint(("[ DeadwingKM ] Entries of submission/completion rings: %lld/%lld\n", TransferInfo.Ring.SqEntries, TransferInfo.Ring.CqEntries));
+	KdPrint(("[ DeadwingKM ] Doorbell SMI: 0x%llX (ports 0x%llX/0x%llX)\n", TransferInfo.Doorbell.SwSmiValue, TransferInfo.Doorbell.CommandPort, TransferInfo.Doorbell.DataPort));
+	KdPrint(("[ DeadwingKM ] Acquire packet function: 0x%llX\n", TransferInfo.API.AcquirePacketFunction));
+	KdPrint(("[ DeadwingKM ] Submit packet function: 0x%llX\n", TransferInfo.API.SubmitPacketFunction));
 
-	// cache size of buffer
-	gBufSize = TransferInfo.Buffer.CommBufSize;
+	// cache channels, all of them lie one after another
+	gCommBuf = TransferInfo.Buffer.CommBufVirtual;
+	gChannelCount = TransferInfo.Buffer.ChannelCount;
+	gChannelSize = TransferInfo.Buffer.ChannelSize;
+	if(gChannelCount == 0 || gChannelSize < TransferInfo.Buffer.CommBufSize) {
+		KdPrint(("[ DeadwingKM ] Invalid communication channels\n"));
+		return STATUS_NOT_FOUND;
+	}
+
+	// cache inline data region. Reads are copied to the consumer buffer by SMI handler if there is no region
+	if(TransferInfo.Buffer.DataSize != 0 && TransferInfo.Buffer.DataOffset + TransferInfo.Buffer.DataSize <= TransferInfo.Buffer.CommBufSize) {
+		gInlineOffset = TransferInfo.Buffer.DataOffset;
+		gInlineSize = TransferInfo.Buffer.DataSize;
+	}
+
+	// cache rings. Batches aren't supported if there are no rings or their layout is unknown
+	UINT64 SqEnd = TransferInfo.Ring.SqOffset + TransferInfo.Ring.SqEntries * sizeof(DEADWING_RING_SUBMISSION);
+	UINT64 CqEnd = TransferInfo.Ring.CqOffset + TransferInfo.Ring.CqEntries * sizeof(DEADWING_RING_COMPLETION);
+	if(TransferInfo.Ring.Size != 0 && TransferInfo.Ring.Offset >= gChannelCount * gChannelSize
+		&& TransferInfo.Ring.SqOffset >= sizeof(DEADWING_RING) && SqEnd <= TransferInfo.Ring.CqOffset && CqEnd <= TransferInfo.Ring.Size
+		&& TransferInfo.Ring.SqEntries != 0 && (TransferInfo.Ring.SqEntries & (TransferInfo.Ring.SqEntries - 1)) == 0
+		&& TransferInfo.Ring.CqEntries != 0 && (TransferInfo.Ring.CqEntries & (TransferInfo.Ring.CqEntries - 1)) == 0) {
+		gRing = (PDEADWING_RING)((PUINT8)gCommBuf + TransferInfo.Ring.Offset);
+		gRingSq = (PDEADWING_RING_SUBMISSION)((PUINT8)gRing + TransferInfo.Ring.SqOffset);
+		gRingCq = (PDEADWING_RING_COMPLETION)((PUINT8)gRing + TransferInfo.Ring.CqOffset);
+		gRingPhys = (UINT64)TransferInfo.Buffer.CommBufPhys + TransferInfo.Ring.Offset;
+	}
+
+	// cache doorbell, channel index should fit the data port
+	if(TransferInfo.Doorbell.CommandPort != 0 && gChannelCount <= MAXUCHAR) {
+		gDoorbellCommandPort = TransferInfo.Doorbell.CommandPort;
+		gDoorbellDataPort = TransferInfo.Doorbell.DataPort;
+		gDoorbellSwSmi = TransferInfo.Doorbell.SwSmiValue;
+	}
 
 	// setup functions
-	SetupCommunicationBuffer = (__T_SetupCommunicationBuffer)TransferInfo.API.SetupBufFunction;
-	DeadwingSmmCommunicate = (__T_DeadwingSmmCommunicate)TransferInfo.API.SmmCommunicateFunction;
-	if(SetupCommunicationBuffer == NULL || DeadwingSmmCommunicate == NULL) {
+	AcquirePacket = (__T_AcquirePacket)TransferInfo.API.AcquirePacketFunction;
+	SubmitPacket = (__T_SubmitPacket)TransferInfo.API.SubmitPacketFunction;
+	if(AcquirePacket == NULL || SubmitPacket == NULL) {
 		KdPrint(("[ DeadwingKM ] Unable to setup communication functions\n"));
 		return STATUS_NOT_FOUND;
 	}
@@ -51,8 +91,9 @@ TransferWorker(
 }
 
 /**
- * \brief Forms request/response packet which will be used by
- * SMI handler and KM driver for communication
+ * \brief Forms request/response packet with a single command which will
+ * be used by SMI handler and KM driver for communication. Packet is written
+ * in place, usually right into the communication buffer
  * 
  * \param Command   Command for SMI handler
  * \param ProcessId Target PID
@@ -61,62 +102,136 @@ TransferWorker(
  * \param Arg3      Optional argument 3
  * \param Packet    Output packet
  * 
- * \return STATUS_SUCCESS - Succesfully formed and copied packet
+ * \return STATUS_SUCCESS - Succesfully formed packet
  * \return STATUS_INVALID_PARAMETER_1 - Invalid commnad for SMI handler
  */
 NTSTATUS
 NTAPI
 FormPacket(
-	_In_     UINT64                  Command,
-	_In_opt_ UINT64                  ProcessId,
-	_In_opt_ UINT64                  Arg1,
-	_In_opt_ UINT64                  Arg2,
-	_In_opt_ UINT64                  Arg3,
-	_Out_    PDEADWING_COMMUNICATION Packet
+	_In_     UINT64           Command,
+	_In_opt_ UINT64           ProcessId,
+	_In_opt_ UINT64           Arg1,
+	_In_opt_ UINT64           Arg2,
+	_In_opt_ UINT64           Arg3,
+	_Out_    PDEADWING_PACKET Packet
 ) {
+	PDEADWING_COMMAND Header = DEADWING_PACKET_COMMANDS(Packet);
+	PDEADWING_PAYLOAD Payload = DEADWING_COMMAND_PAYLOAD(Header);
+	UINT64 PayloadSize = 0;
 
-	DEADWING_COMMUNICATION Communication = { 0 };
-
-	// set default status and size
-	Communication.Command = Command;
-	Communication.SmiRetStatus = EFI_ABORTED;
-	Communication.CommBufSize = gBufSize;
+	RtlZeroMemory(Packet, sizeof(DEADWING_PACKET) + sizeof(DEADWING_COMMAND) + sizeof(DEADWING_PAYLOAD));
 
-	// check command type
+	// check command type, only payload of the command is sent
 	switch(Command) {
 		case CMD_DEADWING_PING_SMI:
 		case CMD_DEADWING_PRIV_ESC:
 		break;
-		case CMD_DEADWING_READ_PHYS:
-			Communication.Read.PhysReadAddress = (PVOID)Arg1;
-			Communication.Read.ReadResult = (PVOID)Arg2;
-			Communication.Read.ReadLength = Arg3;
+		case CMD_DEADWING_PROFILE_SAMPLE:
+			PayloadSize = sizeof(Payload->Profile);
 		break;
+		case CMD_DEADWING_READ_PHYS:
 		case CMD_DEADWING_READ_VIRTUAL:
-			Communication.Read.TargetProcessId = ProcessId;
-			Communication.Read.VaReadAddress = (PVOID)Arg1;
-			Communication.Read.ReadResult = (PVOID)Arg2;
-			Communication.Read.ReadLength = Arg3;
+			Payload->Read.ProcessId = ProcessId;
+			Payload->Read.Address = (PVOID)Arg1;
+			Payload->Read.Buffer = (PVOID)Arg2;
+			Payload->Read.Length = Arg3;
+			PayloadSize = sizeof(Payload->Read);
 		break;
 		case CMD_DEADWING_WRITE_PHYS:
-			Communication.Write.PhysWriteAddress = (PVOID)Arg1;
-			Communication.Write.DataToWrite = (PVOID)Arg2;
-			Communication.Write.WriteLength = Arg3;
-		break;
 		case CMD_DEADWING_WRITE_VIRTUAL:
-			Communication.Write.TargetProcessId = ProcessId;
-			Communication.Write.VaWriteAddress = (PVOID)Arg1;
-			Communication.Write.DataToWrite = (PVOID)Arg2;
-			Communication.Write.WriteLength = Arg3;
+			Payload->Write.ProcessId = ProcessId;
+			Payload->Write.Address = (PVOID)Arg1;
+			Payload->Write.Buffer = (PVOID)Arg2;
+			Payload->Write.Length = Arg3;
+			PayloadSize = sizeof(Payload->Write);
 		break;
 		case CMD_DEADWING_CACHE_SESSION_INFO:
-			Communication.Cache.ControllerProcessId = ProcessId;
-			Communication.Cache.VaPsInitialSysProcess = (PVOID)Arg1;
-			Communication.Cache.DirBase = Arg2;
+			Payload->Cache.ControllerProcessId = ProcessId;
+			Payload->Cache.VaPsInitialSysProcess = (PVOID)Arg1;
+			Payload->Cache.DirBase = Arg2;
+			PayloadSize = sizeof(Payload->Cache);
 		break;
 		case CMD_DEADWING_VIRT_TO_PHYS:
-			Communication.Vtop.TargetPid = ProcessId;
-			Communication.Vtop.AddressToTranslate = (PVOID)Arg1;
+			Payload->Vtop.ProcessId = ProcessId;
+			Payload->Vtop.Address = (PVOID)Arg1;
+			PayloadSize = sizeof(Payload->Vtop);
+		break;
+		case CMD_DEADWING_HASH_RANGES:
+			Payload->Hash.Request = (PVOID)Arg1;
+			Payload->Hash.PageDigests = (PVOID)Arg2;
+			Payload->Hash.PageDigestsLength = Arg3;
+			PayloadSize = sizeof(Payload->Hash);
+		break;
+		case CMD_DEADWING_SCAN:
+			Payload->Scan.Request = (PVOID)Arg1;
+			Payload->Scan.Matches = (PVOID)Arg2;
+			Payload->Scan.MaxMatches = Arg3;
+			PayloadSize = sizeof(Payload->Scan);
+		break;
+		case CMD_DEADWING_SPARSE_READ:
+			Payload->Sparse.Request = (PVOID)Arg1;
+			PayloadSize = sizeof(Payload->Sparse);
+		break;
+		case CMD_DEADWING_TRACK_REGION:
+			Payload->Track.ProcessId = ProcessId;
+			Payload->Track.Address = (PVOID)Arg1;
+			Payload->Track.Length = Arg2;
+			PayloadSize = sizeof(Payload->Track);
+		break;
+		case CMD_DEADWING_CHANGES_SINCE:
+			Payload->Changes.Request = (PVOID)Arg1;
+			PayloadSize = sizeof(Payload->Changes);
+		break;
+		case CMD_DEADWING_HARVEST_AD:
+			Payload->Harvest.Request = (PVOID)Arg1;
+			PayloadSize = sizeof(Payload->Harvest);
+		break;
+		case CMD_DEADWING_MONITOR_START:
+			Payload->MonitorStart.Request = (PVOID)Arg1;
+			PayloadSize = sizeof(Payload->MonitorStart);
+		break;
+		case CMD_DEADWING_MONITOR_SAMPLE:
+			Payload->MonitorSample.Heatmap = (PVOID)Arg1;
+			Payload->MonitorSample.MaxEntries = Arg2;
+			PayloadSize = sizeof(Payload->MonitorSample);
+		break;
+		case CMD_DEADWING_ENTROPY_MAP:
+			Payload->Entropy.Request = (PVOID)Arg1;
+			PayloadSize = sizeof(Payload->Entropy);
+		break;
+		case CMD_DEADWING_DRAIN_LOG:
+		case CMD_DEADWING_DRAIN_TRACE:
+		case CMD_DEADWING_DRAIN_PROFILE:
+			Payload->Drain.Records = (PVOID)Arg1;
+			Payload->Drain.MaxRecords = Arg2;
+			PayloadSize = sizeof(Payload->Drain);
+		break;
+		case CMD_DEADWING_GET_STATS:
+			Payload->Stats.Buffer = (PVOID)Arg1;
+			Payload->Stats.Reset = Arg2;
+			PayloadSize = sizeof(Payload->Stats);
+		break;
+		case CMD_DEADWING_SNAPSHOT_REGISTERS:
+			Payload->Registers.Buffer = (PVOID)Arg1;
+			Payload->Registers.MaxCpus = Arg2;
+			PayloadSize = sizeof(Payload->Registers);
+		break;
+		case CMD_DEADWING_DRAIN_RING:
+			Payload->Ring.Address = (PVOID)Arg1;
+			PayloadSize = sizeof(Payload->Ring);
+		break;
+		case CMD_DEADWING_GET_MEMORY_MAP:
+			Payload->MemoryMap.Ranges = (PVOID)Arg1;
+			Payload->MemoryMap.MaxRanges = Arg2;
+			PayloadSize = sizeof(Payload->MemoryMap);
+		break;
+		case CMD_DEADWING_GET_ACPI_TABLE:
+			// signature and instance share the first argument
+			Payload->Acpi.Signature = (UINT32)Arg1;
+			Payload->Acpi.Instance = (UINT32)(Arg1 >> 32);
+			Payload->Acpi.Buffer = (PVOID)Arg2;
+			Payload->Acpi.MaxLength = Arg3;
+			PayloadSize = sizeof(Payload->Acpi);
 		break;
 		default:
 			KdPrint(("[ DeadwingKM ] Received unknown command\n"));
@@ -124,8 +239,15 @@ FormPacket(
 		break;
 	}
 
-	// save packet
-	*Packet = Communication;
+	// set default status and size
+	Header->Command = (UINT32)Command;
+	Header->Length = DEADWING_COMMAND_LENGTH(PayloadSize);
+	Header->Status = EFI_NOT_READY;
+
+	Packet->Signature = DEADWING_PACKET_SIGNATURE;
+	Packet->Count = 1;
+	Packet->Length = sizeof(DEADWING_PACKET) + Header->Length;
+	Packet->Status = EFI_ABORTED;
 
 	return STATUS_SUCCESS;
 }
@@ -157,6 +279,15 @@ EfiStatusToNtStatus(
 		case EFI_UNSUPPORTED:
 			Converted = STATUS_NOT_SUPPORTED;
 		break;
+		case EFI_BUFFER_TOO_SMALL:
+			Converted = STATUS_BUFFER_TOO_SMALL;
+		break;
+		case EFI_OUT_OF_RESOURCES:
+			Converted = STATUS_INSUFFICIENT_RESOURCES;
+		break;
+		case EFI_NOT_STARTED:
+			Converted = STATUS_DEVICE_NOT_READY;
+		break;
 		case EFI_NOT_READY:
 		case EFI_NOT_FOUND:
 			Converted = STATUS_NOT_FOUND;
@@ -171,3 +302,37 @@ EfiStatusToNtStatus(
 
 	return Converted;
 }
+
+/**
+ * \brief Flushes TLB of the current CPU, including global entries of all PCIDs
+ * 
+ * \param Argument Unused
+ * 
+ * \returns 0
+ */
+ULONG_PTR
+NTAPI
+FlushTbIpiRoutine(
+	_In_ ULONG_PTR Argument
+) {
+	UNREFERENCED_PARAMETER(Argument);
+
+	// any change of CR4.PGE invalidates the whole TLB
+	ULONG64 Cr4 = __readcr4();
+	__writecr4(Cr4 ^ CR4_PGE);
+	__writecr4(Cr4);
+
+	return 0;
+}
+
+/**
+ * \brief Flushes TLBs of all CPUs. Should be called after SMI handler
+ * changed bits of the page table entries
+ */
+VOID
+NTAPI
+FlushTbAllProcessors(
+	VOID
+) {
+	KeIpiGenericCall(FlushTbIpiRoutine, 0);
+}
@@ -9,12 +9,12 @@ TransferWorker(
 NTSTATUS
 NTAPI
 FormPacket(
-	_In_     UINT64                  Command,
-	_In_opt_ UINT64                  ProcessId,
-	_In_opt_ UINT64                  Arg1,
-	_In_opt_ UINT64                  Arg2,
-	_In_opt_ UINT64                  Arg3,
-	_Out_    PDEADWING_COMMUNICATION Packet
+	_In_     UINT64           Command,
+	_In_opt_ UINT64           ProcessId,
+	_In_opt_ UINT64           Arg1,
+	_In_opt_ UINT64           Arg2,
+	_In_opt_ UINT64           Arg3,
+	_Out_    PDEADWING_PACKET Packet
 );
 
 NTSTATUS
@@ -22,3 +22,9 @@ NTAPI
 EfiStatusToNtStatus(
 	_In_ UINT64 EfiStatus
 );
+
+VOID
+NTAPI
+FlushTbAllProcessors(
+	VOID
+);
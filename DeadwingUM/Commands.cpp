@@ -2,11 +2,18 @@
 
 #include <Windows.h>
 #include <memoryapi.h>
+#include <psapi.h>
 #include <iostream>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <algorithm>
 
 #include "HexDump.hpp"
 #include "DeadwingCppLib.hpp"
 
+#pragma comment(lib, "psapi.lib")
+
 namespace Commands {
 	/**
 	* \brief Shows available commands
@@ -24,6 +31,23 @@ namespace Commands {
 			{ L"[+] physwrite - Write to the specific physical address\n" },
 			{ L"[+] vtop - Translates virtual address to the physical\n" },
 			{ L"[+] priv - Leverages privileges of the current process\n" },
+			{ L"[+] limit - Changes SMI rate limits of the KM driver\n" },
+			{ L"[+] hash - Hashes physical or virtual range inside SMM\n" },
+			{ L"[+] scan - Scans physical or virtual range for byte pattern inside SMM\n" },
+			{ L"[+] sparse - Reads range skipping zero and non-present pages\n" },
+			{ L"[+] track - Records hash baseline of the range inside SMRAM\n" },
+			{ L"[+] changes - Shows pages of the tracked range changed since the last call\n" },
+			{ L"[+] harvest - Shows pages of the process with accessed or dirty bit set\n" },
+			{ L"[+] monitor - Monitors access frequency of the process range and shows heatmap\n" },
+			{ L"[+] entropy - Shows content class and entropy of every page of the range\n" },
+			{ L"[+] log - Shows messages buffered by the SMM driver\n" },
+			{ L"[+] trace - Saves binary trace of the SMM driver to the file (decode it with DwTrace.py)\n" },
+			{ L"[+] stats - Shows performance counters of the SMM driver\n" },
+			{ L"[+] profile - Samples all CPUs through SMM and shows hottest drivers and processes\n" },
+			{ L"[+] regs - Shows registers of every CPU and detects CPUs stuck at the same RIP\n" },
+			{ L"[+] batch - Translates consecutive pages of the process with a single SMI\n" },
+			{ L"[+] memmap - Shows physical memory map cached by the SMM driver at boot\n" },
+			{ L"[+] acpi - Lists ACPI tables indexed by the SMM driver or saves one of them to the file\n" },
 			{ L"[+] exit - Exit from the program (without service termination)\n"},
 			{ L"[+] term - Exit from the program and terminate service\n"}
 		};
@@ -32,6 +56,117 @@ namespace Commands {
 			std::wprintf(L"%s", CommandList[i]);
 	}
 
+	/**
+	 * \brief Parses pattern like "488B05????????" (?? - wildcard)
+	 * 
+	 * \param String  Pattern string
+	 * \param Pattern Receives bytes and mask of the pattern
+	 * 
+	 * \returns false if pattern is malformed or too long
+	 */
+	bool
+	WINAPI
+	CmdParsePattern(
+		_In_  const wchar_t         *String,
+		_Out_ PDEADWING_SCAN_PATTERN Pattern
+	) {
+		size_t Length = std::wcslen(String);
+		if(Length == 0 || (Length % 2) != 0 || (Length / 2) > DEADWING_SCAN_MAX_PATTERN_LENGTH)
+			return false;
+
+		for(size_t i = 0; i < Length; i += 2) {
+			if(String[i] == L'?' && String[i + 1] == L'?') {
+				Pattern->Bytes[i / 2] = 0;
+				Pattern->Mask[i / 2] = 0;
+				continue;
+			}
+
+			wchar_t Byte[3] = { String[i], String[i + 1], L'\0' };
+			wchar_t *End = nullptr;
+
+			Pattern->Bytes[i / 2] = (UINT8)std::wcstoul(Byte, &End, 16);
+			Pattern->Mask[i / 2] = 0xFF;
+			if(*End != L'\0')
+				return false;
+		}
+
+		Pattern->Length = (UINT32)(Length / 2);
+
+		return true;
+	}
+
+	/**
+	 * \brief Aggregates profiler samples and shows hottest locations.
+	 * 
+	 * Kernel samples are attributed to the loaded driver containing RIP, user samples
+	 * are attributed to the address space (CR3) since SMM doesn't know about processes
+	 * 
+	 * \param Samples Drained samples
+	 */
+	void
+	WINAPI
+	CmdPrintProfile(
+		_In_ const std::vector<DEADWING_PROFILE_SAMPLE> &Samples
+	) {
+		// collect loaded drivers, sorted by base
+		std::vector<LPVOID> Drivers(1024);
+		DWORD Needed = 0;
+		if(EnumDeviceDrivers(Drivers.data(), (DWORD)(Drivers.size() * sizeof(LPVOID)), &Needed))
+			Drivers.resize(std::min<size_t>(Drivers.size(), Needed / sizeof(LPVOID)));
+		else
+			Drivers.clear();
+
+		std::sort(Drivers.begin(), Drivers.end());
+
+		std::map<LPVOID, UINT64> KernelHits;
+		std::map<UINT64, UINT64> UserHits;
+		UINT64 Unresolved = 0;
+
+		for(const DEADWING_PROFILE_SAMPLE &Sample : Samples) {
+			if(Sample.Cpl != 0) {
+				UserHits[Sample.Cr3]++;
+				continue;
+			}
+
+			// driver with the highest base below RIP
+			auto Driver = std::upper_bound(Drivers.begin(), Drivers.end(), (LPVOID)Sample.Rip);
+			if(Driver == Drivers.begin()) {
+				Unresolved++;
+				continue;
+			}
+
+			KernelHits[*(Driver - 1)]++;
+		}
+
+		std::vector<std::pair<UINT64, LPVOID>> Kernel;
+		for(const auto &Hit : KernelHits)
+			Kernel.push_back({ Hit.second, Hit.first });
+
+		std::sort(Kernel.rbegin(), Kernel.rend());
+
+		std::wprintf(L"[ DwUM ] Kernel mode samples:\n");
+		for(size_t i = 0; i < Kernel.size() && i < 16; i++) {
+			wchar_t Name[MAX_PATH] = { 0 };
+			if(!GetDeviceDriverBaseNameW(Kernel[i].second, Name, MAX_PATH))
+				std::wcscpy(Name, L"?");
+
+			std::wprintf(L"\t%-24s 0x%p: %lld (%.1f%%)\n", Name, Kernel[i].second, Kernel[i].first, Kernel[i].first * 100.0 / Samples.size());
+		}
+
+		if(Unresolved != 0)
+			std::wprintf(L"\t%-24s %lld (%.1f%%)\n", L"<unresolved>", Unresolved, Unresolved * 100.0 / Samples.size());
+
+		std::vector<std::pair<UINT64, UINT64>> User;
+		for(const auto &Hit : UserHits)
+			User.push_back({ Hit.second, Hit.first });
+
+		std::sort(User.rbegin(), User.rend());
+
+		std::wprintf(L"[ DwUM ] User mode samples:\n");
+		for(size_t i = 0; i < User.size() && i < 16; i++)
+			std::wprintf(L"\tCR3 0x%llX: %lld (%.1f%%)\n", User[i].second, User[i].first, User[i].first * 100.0 / Samples.size());
+	}
+
 	/**
 	 * \brief Main command dispatcher
 	 *
@@ -171,6 +306,556 @@ namespace Commands {
 		} else if(!std::wcscmp(Command, L"priv")) {
 			if(!DwCommands->EscPriv())
 				std::wprintf(L"[ DwUM ] Unable to spawn elevated shell\n");
+		} else if(!std::wcscmp(Command, L"hash")) {
+			UINT64 Algorithm = 0;
+			DEADWING_HASH_REQUEST Request = { 0 };
+
+			std::wprintf(L"[ DwUM ] Provide algorithm (1 - xxHash64, 2 - SHA-256): ");
+			std::wscanf(L"%lld", &Algorithm);
+
+			std::wprintf(L"[ DwUM ] Provide target process ID (0 - physical address): ");
+			std::wscanf(L"%lld", &Request.Ranges[0].ProcessId);
+
+			std::wprintf(L"[ DwUM ] Provide address: ");
+			std::wscanf(L"%lld", &Request.Ranges[0].Address);
+
+			std::wprintf(L"[ DwUM ] Provide length to hash: ");
+			std::wscanf(L"%lld", &Request.Ranges[0].Length);
+
+			Request.Algorithm = (UINT32)Algorithm;
+			Request.RangeCount = 1;
+
+			// one digest per page, SHA-256 digest is the largest one
+			UINT64 Address = Request.Ranges[0].Address;
+			UINT64 Length = Request.Ranges[0].Length;
+			UINT64 Pages = (Length != 0) ? (((Address + Length - 1) >> 12) - (Address >> 12) + 1) : 0;
+			UINT64 DigestsLength = Pages * 32;
+
+			PVOID PageDigests = (DigestsLength != 0) ? VirtualAlloc(nullptr, DigestsLength, (MEM_RESERVE | MEM_COMMIT), PAGE_READWRITE) : nullptr;
+			if(PageDigests == nullptr) {
+				std::wprintf(L"[ DwUM ] Cannot allocate page digests buffer\n");
+			} else {
+				if(DwCommands->HashRanges(&Request, PageDigests, DigestsLength)) {
+					std::wprintf(L"[ DwUM ] Range digest: \n");
+					Hex::HexDump(Request.Ranges[0].Digest, (Algorithm == DEADWING_HASH_XXH64) ? sizeof(UINT64) : sizeof(Request.Ranges[0].Digest));
+				} else {
+					std::wprintf(L"[ DwUM ] Unable to hash provided range\n");
+				}
+
+				VirtualFree(PageDigests, 0, MEM_RELEASE);
+			}
+		} else if(!std::wcscmp(Command, L"scan")) {
+			wchar_t PatternString[DEADWING_SCAN_MAX_PATTERN_LENGTH * 2 + 1] = { 0 };
+			PDEADWING_SCAN_REQUEST Request = new DEADWING_SCAN_REQUEST();
+
+			std::wprintf(L"[ DwUM ] Provide target process ID (0 - physical address): ");
+			std::wscanf(L"%lld", &Request->ProcessId);
+
+			std::wprintf(L"[ DwUM ] Provide address: ");
+			std::wscanf(L"%lld", &Request->Address);
+
+			std::wprintf(L"[ DwUM ] Provide length to scan: ");
+			std::wscanf(L"%lld", &Request->Length);
+
+			std::wprintf(L"[ DwUM ] Provide pattern (e.g. 488B05????????): ");
+			std::wscanf(L"%64ls", PatternString);
+
+			Request->PatternCount = 1;
+
+			// show first page of matches
+			const UINT64 MaxMatches = 0x1000 / sizeof(DEADWING_SCAN_MATCH);
+			PDEADWING_SCAN_MATCH Matches = new DEADWING_SCAN_MATCH[MaxMatches];
+			UINT64 MatchCount = 0;
+			bool Truncated = false;
+
+			if(!CmdParsePattern(PatternString, &Request->Patterns[0])) {
+				std::wprintf(L"[ DwUM ] Invalid pattern\n");
+			} else if(DwCommands->Scan(Request, Matches, MaxMatches, MatchCount, &Truncated)) {
+				std::wprintf(L"[ DwUM ] Found %lld match(es)%s\n", MatchCount, Truncated ? L" (truncated)" : L"");
+				for(UINT64 i = 0; i < MatchCount; i++)
+					std::wprintf(L"[ DwUM ] 0x%llX\n", Matches[i].Address);
+			} else {
+				std::wprintf(L"[ DwUM ] Unable to scan provided range\n");
+			}
+
+			delete[] Matches;
+			delete Request;
+		} else if(!std::wcscmp(Command, L"sparse")) {
+			UINT64 ProcessId = 0;
+			UINT64 Address = 0;
+			UINT64 Length = 0;
+
+			std::wprintf(L"[ DwUM ] Provide target process ID (0 - physical address): ");
+			std::wscanf(L"%lld", &ProcessId);
+
+			std::wprintf(L"[ DwUM ] Provide address: ");
+			std::wscanf(L"%lld", &Address);
+
+			std::wprintf(L"[ DwUM ] Provide length to read: ");
+			std::wscanf(L"%lld", &Length);
+
+			// sparse read works with whole pages
+			UINT64 Start = Address & ~0xFFFULL;
+			UINT64 End = (Address + Length + 0xFFF) & ~0xFFFULL;
+
+			Deadwing::SparseRange Range;
+			if(Length != 0 && DwCommands->SparseRead(ProcessId, Start, End - Start, Range)) {
+				UINT64 Absent = 0;
+				for(UINT64 i = 0; i < Range.GetPageCount(); i++) {
+					if(Range.GetPageState(i) == DEADWING_SPARSE_PAGE_ABSENT)
+						Absent++;
+				}
+
+				std::wprintf(L"[ DwUM ] Pages: %lld, data: %lld, zero: %lld, absent: %lld\n", Range.GetPageCount(), Range.GetDataPageCount(), Range.GetPageCount() - Range.GetDataPageCount() - Absent, Absent);
+
+				// show requested part of the first page
+				UINT8 Page[0x1000];
+				UINT64 Offset = Address - Start;
+				Range.ReadPage(0, Page);
+				Hex::HexDump(Page + Offset, (size_t)((Length < 0x1000 - Offset) ? Length : 0x1000 - Offset));
+			} else {
+				std::wprintf(L"[ DwUM ] Unable to read provided range\n");
+			}
+		} else if(!std::wcscmp(Command, L"track")) {
+			UINT64 ProcessId = 0;
+			UINT64 Address = 0;
+			UINT64 Length = 0;
+			UINT64 Handle = 0;
+
+			std::wprintf(L"[ DwUM ] Provide target process ID (0 - physical address): ");
+			std::wscanf(L"%lld", &ProcessId);
+
+			std::wprintf(L"[ DwUM ] Provide address: ");
+			std::wscanf(L"%lld", &Address);
+
+			std::wprintf(L"[ DwUM ] Provide length to track: ");
+			std::wscanf(L"%lld", &Length);
+
+			if(DwCommands->TrackRegion(ProcessId, Address, Length, Handle))
+				std::wprintf(L"[ DwUM ] Range is tracked, handle: 0x%llX\n", Handle);
+			else
+				std::wprintf(L"[ DwUM ] Unable to track provided range\n");
+		} else if(!std::wcscmp(Command, L"changes")) {
+			UINT64 Handle = 0;
+
+			std::wprintf(L"[ DwUM ] Provide handle of the tracked range: ");
+			std::wscanf(L"%llx", &Handle);
+
+			const UINT64 MaxChanges = 0x1000 / sizeof(DEADWING_TRACK_CHANGE);
+			PDEADWING_TRACK_CHANGE Changes = new DEADWING_TRACK_CHANGE[MaxChanges];
+			UINT64 ChangeCount = 0;
+			bool Truncated = false;
+
+			if(DwCommands->ChangesSince(Handle, Changes, MaxChanges, nullptr, ChangeCount, &Truncated)) {
+				std::wprintf(L"[ DwUM ] Changed %lld page(s)%s\n", ChangeCount, Truncated ? L" (more on the next call)" : L"");
+				for(UINT64 i = 0; i < ChangeCount; i++)
+					std::wprintf(L"[ DwUM ] 0x%llX (0x%X bytes)%s\n", Changes[i].Address, Changes[i].Length, Changes[i].Present ? L"" : L" - not present");
+			} else {
+				std::wprintf(L"[ DwUM ] Unable to collect changes of the tracked range\n");
+			}
+
+			delete[] Changes;
+		} else if(!std::wcscmp(Command, L"harvest")) {
+			UINT64 ProcessId = 0;
+			UINT64 Address = 0;
+			UINT64 Length = 0;
+			UINT64 Flags = 0;
+
+			std::wprintf(L"[ DwUM ] Provide target process ID: ");
+			std::wscanf(L"%lld", &ProcessId);
+
+			std::wprintf(L"[ DwUM ] Provide address: ");
+			std::wscanf(L"%lld", &Address);
+
+			std::wprintf(L"[ DwUM ] Provide length: ");
+			std::wscanf(L"%lld", &Length);
+
+			std::wprintf(L"[ DwUM ] Provide flags (1 - accessed, 2 - dirty, 4 - clear): ");
+			std::wscanf(L"%lld", &Flags);
+
+			const UINT64 MaxPages = 0x1000 / sizeof(DEADWING_HARVEST_PAGE);
+			PDEADWING_HARVEST_PAGE Pages = new DEADWING_HARVEST_PAGE[MaxPages];
+			UINT64 PageCount = 0;
+			bool Truncated = false;
+
+			if(DwCommands->HarvestAccessDirty(ProcessId, Address, Length, (UINT32)Flags, Pages, MaxPages, PageCount, &Truncated)) {
+				std::wprintf(L"[ DwUM ] Found %lld page(s)%s\n", PageCount, Truncated ? L" (more on the next call)" : L"");
+				for(UINT64 i = 0; i < PageCount; i++)
+					std::wprintf(L"[ DwUM ] 0x%llX (0x%X bytes) %s%s\n", Pages[i].Address, Pages[i].PageSize, (Pages[i].Flags & DEADWING_HARVEST_ACCESSED) ? L"A" : L"-", (Pages[i].Flags & DEADWING_HARVEST_DIRTY) ? L"D" : L"-");
+			} else {
+				std::wprintf(L"[ DwUM ] Unable to harvest accessed and dirty bits\n");
+			}
+
+			delete[] Pages;
+		} else if(!std::wcscmp(Command, L"monitor")) {
+			UINT64 ProcessId = 0;
+			UINT64 Intervals = 0;
+			DEADWING_MONITOR_RANGE Range = { 0 };
+
+			std::wprintf(L"[ DwUM ] Provide target process ID: ");
+			std::wscanf(L"%lld", &ProcessId);
+
+			std::wprintf(L"[ DwUM ] Provide address: ");
+			std::wscanf(L"%lld", &Range.Address);
+
+			std::wprintf(L"[ DwUM ] Provide length: ");
+			std::wscanf(L"%lld", &Range.Length);
+
+			std::wprintf(L"[ DwUM ] Provide count of aggregation intervals: ");
+			std::wscanf(L"%lld", &Intervals);
+
+			if(DwCommands->MonitorStart(ProcessId, &Range, 1, 10, DEADWING_MONITOR_MAX_REGIONS, 20)) {
+				PDEADWING_MONITOR_ENTRY Heatmap = new DEADWING_MONITOR_ENTRY[DEADWING_MONITOR_MAX_REGIONS];
+
+				// sample every 5 ms, heatmap is shown once per aggregation interval
+				for(UINT64 Interval = 0; Interval < Intervals; ) {
+					UINT64 EntryCount = 0;
+					bool Aggregated = false;
+
+					if(!DwCommands->MonitorSample(Heatmap, DEADWING_MONITOR_MAX_REGIONS, EntryCount, &Aggregated)) {
+						std::wprintf(L"[ DwUM ] Unable to sample monitored range\n");
+						break;
+					}
+
+					if(Aggregated) {
+						std::wprintf(L"[ DwUM ] Interval %lld:\n", Interval++);
+						for(UINT64 i = 0; i < EntryCount; i++)
+							std::wprintf(L"[ DwUM ] 0x%llX (%d page(s)) accesses %d/20, age %d\n", Heatmap[i].Address, Heatmap[i].Pages, Heatmap[i].Accesses, Heatmap[i].Age);
+					}
+
+					Sleep(5);
+				}
+
+				delete[] Heatmap;
+			} else {
+				std::wprintf(L"[ DwUM ] Unable to start access monitor\n");
+			}
+		} else if(!std::wcscmp(Command, L"entropy")) {
+			UINT64 ProcessId = 0;
+			UINT64 Address = 0;
+			UINT64 Length = 0;
+
+			std::wprintf(L"[ DwUM ] Provide target process ID (0 - physical address): ");
+			std::wscanf(L"%lld", &ProcessId);
+
+			std::wprintf(L"[ DwUM ] Provide address: ");
+			std::wscanf(L"%lld", &Address);
+
+			std::wprintf(L"[ DwUM ] Provide length: ");
+			std::wscanf(L"%lld", &Length);
+
+			// map is built for whole pages
+			UINT64 Start = Address & ~0xFFFULL;
+			UINT64 End = (Address + Length + 0xFFF) & ~0xFFFULL;
+
+			std::vector<UINT8> Map;
+			if(Length != 0 && DwCommands->EntropyMap(ProcessId, Start, End - Start, Map)) {
+				const wchar_t *Classes[] = { L"absent", L"zero", L"ascii", L"utf-16", L"code", L"high entropy", L"data", L"unknown" };
+
+				// show runs of pages with the same class
+				for(size_t i = 0; i < Map.size(); ) {
+					size_t j = i + 1;
+					while(j < Map.size() && DEADWING_PAGE_CLASS(Map[j]) == DEADWING_PAGE_CLASS(Map[i]))
+						j++;
+
+					std::wprintf(L"[ DwUM ] 0x%llX - 0x%llX: %s (entropy %.2f)\n", Start + i * 0x1000ULL, Start + j * 0x1000ULL, Classes[DEADWING_PAGE_CLASS(Map[i])], DEADWING_PAGE_ENTROPY(Map[i]));
+					i = j;
+				}
+			} else {
+				std::wprintf(L"[ DwUM ] Unable to build entropy map\n");
+			}
+		} else if(!std::wcscmp(Command, L"log")) {
+			const UINT64 MaxRecords = 64;
+			PDEADWING_LOG_RECORD Records = new DEADWING_LOG_RECORD[MaxRecords];
+			const wchar_t *Levels[] = { L"NONE", L"ERROR", L"INFO", L"DEBUG" };
+
+			// drain until the ring is empty
+			UINT64 RecordCount = 0;
+			UINT64 Dropped = 0;
+			do {
+				if(!DwCommands->DrainLog(Records, MaxRecords, RecordCount, &Dropped)) {
+					std::wprintf(L"[ DwUM ] Unable to drain SMM log\n");
+					break;
+				}
+
+				if(Dropped != 0)
+					std::wprintf(L"[ DwUM ] %lld record(s) have been dropped\n", Dropped);
+
+				for(UINT64 i = 0; i < RecordCount; i++)
+					std::wprintf(L"[ DwUM ] [%lld] [%s] %hs", Records[i].Tsc, (Records[i].Level <= DEADWING_LOG_LEVEL_DEBUG) ? Levels[Records[i].Level] : L"?", Records[i].Message);
+			} while(RecordCount == MaxRecords);
+
+			delete[] Records;
+		} else if(!std::wcscmp(Command, L"trace")) {
+			wchar_t Path[MAX_PATH] = { 0 };
+
+			std::wprintf(L"[ DwUM ] Provide output file: ");
+			std::wscanf(L"%259ls", Path);
+
+			FILE *Output = _wfopen(Path, L"ab");
+			if(Output != nullptr) {
+				const UINT64 MaxRecords = 64;
+				PDEADWING_TRACE_RECORD Records = new DEADWING_TRACE_RECORD[MaxRecords];
+
+				// drain until the ring is empty, records are written without unused arguments
+				UINT64 Total = 0;
+				UINT64 RecordCount = 0;
+				UINT64 Dropped = 0;
+				do {
+					if(!DwCommands->DrainTrace(Records, MaxRecords, RecordCount, &Dropped)) {
+						std::wprintf(L"[ DwUM ] Unable to drain SMM trace\n");
+						break;
+					}
+
+					if(Dropped != 0)
+						std::wprintf(L"[ DwUM ] %lld record(s) have been dropped\n", Dropped);
+
+					for(UINT64 i = 0; i < RecordCount; i++)
+						std::fwrite(&Records[i], FIELD_OFFSET(DEADWING_TRACE_RECORD, Args) + Records[i].ArgCount * sizeof(UINT64), 1, Output);
+
+					Total += RecordCount;
+				} while(RecordCount == MaxRecords);
+
+				std::wprintf(L"[ DwUM ] %lld record(s) have been saved\n", Total);
+
+				std::fclose(Output);
+				delete[] Records;
+			} else {
+				std::wprintf(L"[ DwUM ] Unable to open output file\n");
+			}
+		} else if(!std::wcscmp(Command, L"stats")) {
+			UINT64 Reset = 0;
+			DEADWING_STATS Stats;
+
+			std::wprintf(L"[ DwUM ] Reset counters after read (0 - no, 1 - yes): ");
+			std::wscanf(L"%lld", &Reset);
+
+			if(DwCommands->GetStats(Stats, Reset != 0)) {
+				std::wprintf(L"[ DwUM ] SMIs: %lld, residency total: %lld, max: %lld TSC ticks\n", Stats.Smis, Stats.SmiTscTotal, Stats.SmiTscMax);
+				std::wprintf(L"[ DwUM ] Remaps: %lld, TLB flushes: %lld\n", Stats.Remaps, Stats.TlbFlushes);
+				std::wprintf(L"[ DwUM ] Page walks: PML4 %lld, PDPT %lld, PD %lld, PT %lld\n", Stats.WalkPml4, Stats.WalkPdpt, Stats.WalkPd, Stats.WalkPt);
+				std::wprintf(L"[ DwUM ] Translation cache: %lld hit(s), %lld miss(es)\n", Stats.TranslateCacheHits, Stats.TranslateCacheMisses);
+				std::wprintf(L"[ DwUM ] PID cache: %lld hit(s), %lld miss(es)\n", Stats.PidCacheHits, Stats.PidCacheMisses);
+				std::wprintf(L"[ DwUM ] Bytes copied: %lld, interim pages: %lld\n", Stats.BytesCopied, Stats.InterimPages);
+
+				for(UINT64 i = 0; i < Stats.CommandCount && i < DEADWING_STATS_MAX_COMMANDS; i++)
+					std::wprintf(L"\t0x%08X: %lld SMI(s)\n", Stats.Commands[i].Command, Stats.Commands[i].Smis);
+			} else {
+				std::wprintf(L"[ DwUM ] Unable to get SMM stats\n");
+			}
+		} else if(!std::wcscmp(Command, L"profile")) {
+			UINT64 Seconds = 0;
+			UINT64 IntervalUs = 0;
+
+			std::wprintf(L"[ DwUM ] Provide duration in seconds: ");
+			std::wscanf(L"%lld", &Seconds);
+
+			std::wprintf(L"[ DwUM ] Provide interval between samples in microseconds (at least 1000): ");
+			std::wscanf(L"%lld", &IntervalUs);
+
+			if(Seconds != 0 && DwCommands->ProfileStart(IntervalUs)) {
+				UINT64 Taken = 0;
+				UINT64 Skipped = 0;
+
+				Sleep((DWORD)(Seconds * 1000));
+				DwCommands->ProfileStop(&Taken, &Skipped);
+
+				std::wprintf(L"[ DwUM ] %lld sample(s) have been taken, %lld interval(s) skipped\n", Taken, Skipped);
+
+				const UINT64 MaxSamples = 256;
+				PDEADWING_PROFILE_SAMPLE Buffer = new DEADWING_PROFILE_SAMPLE[MaxSamples];
+				std::vector<DEADWING_PROFILE_SAMPLE> Samples;
+
+				// drain until the ring is empty
+				UINT64 SampleCount = 0;
+				UINT64 Dropped = 0;
+				do {
+					if(!DwCommands->DrainProfile(Buffer, MaxSamples, SampleCount, &Dropped)) {
+						std::wprintf(L"[ DwUM ] Unable to drain profile\n");
+						break;
+					}
+
+					if(Dropped != 0)
+						std::wprintf(L"[ DwUM ] %lld sample(s) have been dropped\n", Dropped);
+
+					Samples.insert(Samples.end(), Buffer, Buffer + SampleCount);
+				} while(SampleCount == MaxSamples);
+
+				delete[] Buffer;
+
+				if(!Samples.empty())
+					CmdPrintProfile(Samples);
+			} else {
+				std::wprintf(L"[ DwUM ] Unable to start profiler\n");
+			}
+		} else if(!std::wcscmp(Command, L"regs")) {
+			UINT64 Snapshots = 0;
+			std::vector<DEADWING_CPU_REGISTERS> First;
+			std::vector<DEADWING_CPU_REGISTERS> Registers;
+
+			std::wprintf(L"[ DwUM ] Provide count of snapshots taken every second (1 - just show registers): ");
+			std::wscanf(L"%lld", &Snapshots);
+
+			if(Snapshots != 0 && DwCommands->SnapshotRegisters(First)) {
+				const wchar_t *Names[] = { L"RAX", L"RBX", L"RCX", L"RDX", L"RSI", L"RDI", L"RBP", L"RSP", L"R8", L"R9", L"R10", L"R11", L"R12", L"R13", L"R14", L"R15" };
+
+				for(const DEADWING_CPU_REGISTERS &Cpu : First) {
+					if(!Cpu.Valid) {
+						std::wprintf(L"[ DwUM ] CPU %d: no save state\n", Cpu.Cpu);
+						continue;
+					}
+
+					std::wprintf(L"[ DwUM ] CPU %d: RIP 0x%llX RFLAGS 0x%llX CS 0x%llX (%lld-bit)\n", Cpu.Cpu, Cpu.Rip, Cpu.Rflags, Cpu.Cs, Cpu.Lma);
+					std::wprintf(L"\tCR0 0x%llX CR3 0x%llX CR4 0x%llX\n", Cpu.Cr0, Cpu.Cr3, Cpu.Cr4);
+
+					for(int i = 0; i < 16; i++)
+						std::wprintf(L"%s%-3s 0x%016llX%s", (i % 4) ? L" " : L"\t", Names[i], Cpu.Gpr[i], (i % 4 == 3) ? L"\n" : L"");
+				}
+
+				// CPU is considered stuck if it has the same RIP, RSP and RFLAGS in every snapshot
+				std::vector<bool> Stuck(First.size(), true);
+				UINT64 Taken = 1;
+				for(; Taken < Snapshots; Taken++) {
+					Sleep(1000);
+
+					if(!DwCommands->SnapshotRegisters(Registers)) {
+						std::wprintf(L"[ DwUM ] Unable to snapshot registers\n");
+						break;
+					}
+
+					for(size_t i = 0; i < First.size() && i < Registers.size(); i++) {
+						if(!Registers[i].Valid || Registers[i].Rip != First[i].Rip || Registers[i].Gpr[7] != First[i].Gpr[7] || Registers[i].Rflags != First[i].Rflags)
+							Stuck[i] = false;
+					}
+				}
+
+				for(size_t i = 0; Taken > 1 && i < First.size(); i++) {
+					if(First[i].Valid && Stuck[i])
+						std::wprintf(L"[ DwUM ] CPU %d hasn't moved from RIP 0x%llX for %lld second(s)\n", First[i].Cpu, First[i].Rip, Taken - 1);
+				}
+			} else {
+				std::wprintf(L"[ DwUM ] Unable to snapshot registers\n");
+			}
+		} else if(!std::wcscmp(Command, L"batch")) {
+			UINT64 Address = 0;
+			UINT64 PID = 0;
+			UINT64 Pages = 0;
+
+			std::wprintf(L"[ DwUM ] Provide virtual address of the first page: ");
+			std::wscanf(L"%lld", &Address);
+
+			std::wprintf(L"[ DwUM ] Provide target process ID: ");
+			std::wscanf(L"%lld", &PID);
+
+			std::wprintf(L"[ DwUM ] Provide count of pages: ");
+			std::wscanf(L"%lld", &Pages);
+
+			// every page is a separate command of the batch
+			std::vector<DEADWING_BATCH_ENTRY> Entries(Pages);
+			for(UINT64 i = 0; i < Pages; i++) {
+				Entries[i].Command = DEADWING_BATCH_VIRT_TO_PHYS;
+				Entries[i].ProcessId = PID;
+				Entries[i].Args[0] = (Address & ~0xFFFULL) + i * 0x1000;
+			}
+
+			UINT64 Completed = 0;
+			if(Pages != 0 && DwCommands->SubmitBatch(Entries, &Completed)) {
+				for(const DEADWING_BATCH_ENTRY &Entry : Entries) {
+					if(Entry.Status == 0)
+						std::wprintf(L"[ DwUM ] 0x%llX (VA) => 0x%llX (Physical)\n", Entry.Args[0], Entry.Value);
+					else
+						std::wprintf(L"[ DwUM ] 0x%llX (VA) => not translated (0x%llX)\n", Entry.Args[0], Entry.Status);
+				}
+
+				DEADWING_TIMING Timing = { 0 };
+				UINT64 SmiCount = 0;
+				DwCommands->GetLastTiming(Timing, &SmiCount);
+
+				std::wprintf(L"[ DwUM ] %lld of %lld page(s) have been translated with %lld SMI(s)\n", Completed, Pages, SmiCount);
+			} else {
+				std::wprintf(L"[ DwUM ] Unable to submit batch\n");
+			}
+		} else if(!std::wcscmp(Command, L"memmap")) {
+			std::vector<DEADWING_MEMORY_RANGE> Ranges;
+
+			if(DwCommands->GetMemoryMap(Ranges)) {
+				const wchar_t *Types[] = { L"Reserved", L"LoaderCode", L"LoaderData", L"BootServicesCode", L"BootServicesData", L"RuntimeServicesCode", L"RuntimeServicesData", L"Conventional", L"Unusable", L"ACPIReclaim", L"ACPINVS", L"MMIO", L"MMIOPortSpace", L"PalCode", L"Persistent", L"Unaccepted" };
+
+				UINT64 Total = 0;
+				for(const DEADWING_MEMORY_RANGE &Range : Ranges) {
+					const wchar_t *Type = Range.Type < (sizeof(Types) / sizeof(*Types)) ? Types[Range.Type] : L"Unknown";
+
+					std::wprintf(L"[ DwUM ] 0x%016llX - 0x%016llX %-20s 0x%llX\n", Range.Base, Range.Base + Range.Length - 1, Type, Range.Attribute);
+					Total += Range.Length;
+				}
+
+				std::wprintf(L"[ DwUM ] %zu range(s) cover %lld MB\n", Ranges.size(), Total >> 20);
+			} else {
+				std::wprintf(L"[ DwUM ] Unable to get memory map\n");
+			}
+		} else if(!std::wcscmp(Command, L"acpi")) {
+			wchar_t Name[5] = { 0 };
+			UINT64 Instance = 0;
+			wchar_t Path[MAX_PATH] = { 0 };
+
+			std::wprintf(L"[ DwUM ] Provide signature of the table (* - list all tables): ");
+			std::wscanf(L"%4ls", Name);
+
+			if(!std::wcscmp(Name, L"*")) {
+				std::vector<UINT8> Table;
+				UINT64 Address = 0;
+
+				// signature 0 enumerates the whole index
+				for(UINT32 i = 0; ; i++) {
+					UINT32 Signature = 0;
+					if(!DwCommands->GetAcpiTable(Signature, i, Table, &Address))
+						break;
+
+					std::wprintf(L"[ DwUM ] %c%c%c%c at 0x%llX, %zu byte(s)\n", Signature & 0xFF, (Signature >> 8) & 0xFF, (Signature >> 16) & 0xFF, Signature >> 24, Address, Table.size());
+				}
+			} else {
+				std::wprintf(L"[ DwUM ] Provide instance of the table (0 - the first one): ");
+				std::wscanf(L"%lld", &Instance);
+
+				std::wprintf(L"[ DwUM ] Provide output file: ");
+				std::wscanf(L"%259ls", Path);
+
+				// signature is stored as little endian string
+				UINT32 Signature = 0;
+				for(int i = 0; i < 4 && Name[i]; i++)
+					Signature |= (UINT32)(Name[i] & 0xFF) << (i * 8);
+
+				std::vector<UINT8> Table;
+				UINT64 Address = 0;
+				if(DwCommands->GetAcpiTable(Signature, (UINT32)Instance, Table, &Address)) {
+					FILE *Output = _wfopen(Path, L"wb");
+					if(Output != nullptr) {
+						std::fwrite(Table.data(), 1, Table.size(), Output);
+						std::fclose(Output);
+
+						std::wprintf(L"[ DwUM ] Table at 0x%llX (%zu byte(s)) has been saved\n", Address, Table.size());
+					} else {
+						std::wprintf(L"[ DwUM ] Unable to open output file\n");
+					}
+				} else {
+					std::wprintf(L"[ DwUM ] Unable to get ACPI table\n");
+				}
+			}
+		} else if(!std::wcscmp(Command, L"limit")) {
+			UINT64 MaxSmi = 0;
+			UINT64 MaxSmmUs = 0;
+			UINT64 AverageCost = 0;
+
+			std::wprintf(L"[ DwUM ] Provide max SMIs per second (0 - unlimited): ");
+			std::wscanf(L"%lld", &MaxSmi);
+
+			std::wprintf(L"[ DwUM ] Provide max microseconds in SMM per second (0 - unlimited): ");
+			std::wscanf(L"%lld", &MaxSmmUs);
+
+			if(DwCommands->SetRateLimit(MaxSmi, MaxSmmUs, &AverageCost))
+				std::wprintf(L"[ DwUM ] Limits have been changed, average SMI cost: %lld us\n", AverageCost);
+			else
+				std::wprintf(L"[ DwUM ] Unable to change SMI rate limits\n");
 		} else if(!std::wcscmp(Command, L"exit")) {
 			ExitSignal = true;
 		} else if(!std::wcscmp(Command, L"term")) {
@@ -182,4 +867,39 @@ namespace Commands {
 
 		return ExitSignal;
 	}
+
+	/**
+	 * \brief Shows per-phase timing of the last command
+	 *
+	 * \param DwCommands Class instance
+	 */
+	void
+	WINAPI
+	CmdPrintTiming(
+		_In_ Deadwing::Commands *DwCommands
+	) {
+		DEADWING_TIMING Timing = { 0 };
+		UINT64 SmiCount = 0;
+
+		// nothing to show if the last command didn't reach SMM
+		DwCommands->GetLastTiming(Timing, &SmiCount);
+		if(SmiCount == 0)
+			return;
+
+		const struct {
+			const wchar_t *Name;
+			UINT64         Cycles;
+		} Phases[] = {
+			{ L"validate", Timing.Validate },
+			{ L"dir base", Timing.DirBase },
+			{ L"target translate", Timing.TargetTranslate },
+			{ L"consumer translate", Timing.ConsumerTranslate },
+			{ L"copy", Timing.Copy },
+			{ L"restore", Timing.Restore }
+		};
+
+		std::wprintf(L"[ DwUM ] Timing: %lld cycles in SMM over %lld SMI(s)\n", Timing.Total, SmiCount);
+		for(int i = 0; i < (sizeof(Phases) / sizeof(*Phases)); i++)
+			std::wprintf(L"\t%-20s %16lld (%3lld%%)\n", Phases[i].Name, Phases[i].Cycles, Timing.Total != 0 ? (Phases[i].Cycles * 100) / Timing.Total : 0);
+	}
 }
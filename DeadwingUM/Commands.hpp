@@ -8,4 +8,10 @@ namespace Commands {
 		_In_  wchar_t            *Command,
 		_Out_ bool               *TerminationSignal
 	);
+
+	void
+	WINAPI
+	CmdPrintTiming(
+		_In_ Deadwing::Commands *DwCommands
+	);
 }
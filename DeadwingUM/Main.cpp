@@ -2,6 +2,7 @@
 
 #include <Windows.h>
 #include <iostream>
+#include <cstring>
 
 #include "DeadwingCppLib.hpp"
 #include "Service.hpp"
@@ -27,8 +28,16 @@ TerminateKmSession(
 int
 WINAPI
 main(
-	void
+	int   argc,
+	char *argv[]
 ) {
+	// -v shows per-phase timing after every command
+	bool Verbose = false;
+	for(int i = 1; i < argc; i++) {
+		if(!std::strcmp(argv[i], "-v"))
+			Verbose = true;
+	}
+
 	std::wprintf(L"\t\t  =[ DwUM ]=  \n");
 	std::wprintf(L"[ An UM application for inter-mode communication ]\n\n");
 
@@ -67,6 +76,9 @@ main(
 		// exit form program if true returned
 		if(Commands::CmdMainDispatcher(&DwCommands, Command, &TerminationSignal))
 			break;
+
+		if(Verbose)
+			Commands::CmdPrintTiming(&DwCommands);
 	}
 
 	TerminateKmSession(TerminationSignal);
@@ -0,0 +1,137 @@
+import sys
+import csv
+import struct
+import argparse
+
+# should be in sync with Deadwing/Defs.h, Deadwing/Trace.h and DeadwingDxe/Trace.h
+TRACE_SYNC = 0xD7A3
+TRACE_MAX_ARGS = 4
+TRACE_HEADER = struct.Struct('<HHBBHQ')
+
+SOURCES = {
+    1: 'SMM',
+    2: 'DXE',
+}
+
+# event ID -> (name, argument names)
+EVENTS = {
+    0x0101: ('SMI_ENTER', ['command', 'cursor', 'comm_buffer']),
+    0x0102: ('SMI_EXIT', ['command', 'status', 'cycles', 'cursor']),
+    0x0103: ('MP_DISPATCH', ['start', 'length', 'cpus', 'cycles']),
+    0x0104: ('TRANSLATE_FAULT', ['address', 'dir_base', 'level']),
+    0x0201: ('DXE_COMMUNICATE', ['command', 'status', 'smi_status', 'cycles']),
+    0x0202: ('DXE_GONE_VIRTUAL', ['comm_buffer_phys', 'comm_buffer_virtual']),
+}
+
+# EFI_STATUS error codes
+EFI_STATUSES = {
+    0: 'EFI_SUCCESS',
+    2: 'EFI_INVALID_PARAMETER',
+    3: 'EFI_UNSUPPORTED',
+    5: 'EFI_BUFFER_TOO_SMALL',
+    6: 'EFI_NOT_READY',
+    9: 'EFI_OUT_OF_RESOURCES',
+    14: 'EFI_NOT_FOUND',
+    15: 'EFI_ACCESS_DENIED',
+    19: 'EFI_NOT_STARTED',
+    20: 'EFI_ALREADY_STARTED',
+    21: 'EFI_ABORTED',
+    33: 'EFI_COMPROMISED_DATA',
+}
+
+
+# Parses records from the binary stream. Bytes between records (e.g. text
+# messages in the serial output) are skipped
+#
+# data - Raw trace stream
+def parse_records(data):
+    records = []
+    offset = 0
+
+    while offset + TRACE_HEADER.size <= len(data):
+        sync, event, arg_count, source, _, tsc = TRACE_HEADER.unpack_from(data, offset)
+        length = TRACE_HEADER.size + arg_count * 8
+
+        # resynchronize on the next byte if header is not valid
+        if sync != TRACE_SYNC or arg_count > TRACE_MAX_ARGS or source not in SOURCES or offset + length > len(data):
+            offset += 1
+            continue
+
+        args = list(struct.unpack_from('<%dQ' % arg_count, data, offset + TRACE_HEADER.size))
+        records.append((tsc, source, event, args))
+        offset += length
+
+    return records
+
+
+# Formats argument of the record
+#
+# name  - Argument name
+# value - Argument value
+def format_arg(name, value):
+    if 'status' in name:
+        code = value & 0x7FFFFFFFFFFFFFFF
+        if value == 0 or value & (1 << 63):
+            return EFI_STATUSES.get(code, '0x%X' % value)
+
+    if name in ('cycles', 'cpus', 'level'):
+        return '%d' % value
+
+    return '0x%X' % value
+
+
+# Writes records as text, one record per line
+#
+# records - Parsed records
+# output  - Output stream
+def write_text(records, output):
+    first = records[0][0] if records else 0
+
+    for tsc, source, event, args in records:
+        name, arg_names = EVENTS.get(event, ('EVENT_0x%04X' % event, []))
+        fields = []
+        for i, value in enumerate(args):
+            arg_name = arg_names[i] if i < len(arg_names) else 'arg%d' % i
+            fields.append('%s=%s' % (arg_name, format_arg(arg_name, value)))
+
+        output.write('[ %s ] +%-14d %-18s %s\n' % (SOURCES[source], tsc - first, name, ' '.join(fields)))
+
+
+# Writes records as CSV
+#
+# records - Parsed records
+# output  - Output stream
+def write_csv(records, output):
+    writer = csv.writer(output)
+    writer.writerow(['tsc', 'source', 'event', 'arg0', 'arg1', 'arg2', 'arg3'])
+
+    for tsc, source, event, args in records:
+        name = EVENTS.get(event, ('EVENT_0x%04X' % event, []))[0]
+        writer.writerow([tsc, SOURCES[source], name] + ['0x%X' % value for value in args] + [''] * (TRACE_MAX_ARGS - len(args)))
+
+
+# Main routine of the decoder
+def main():
+    parser = argparse.ArgumentParser(description='Decodes binary trace of Deadwing drivers (DwUM "trace" output or serial/QEMU debug port capture)')
+    parser.add_argument('input', help='path to the binary trace')
+    parser.add_argument('-o', '--output', help='path for output file (stdout by default)')
+    parser.add_argument('--csv', action='store_true', help='write CSV instead of text')
+    args = parser.parse_args()
+
+    records = parse_records(open(args.input, 'rb').read())
+
+    output = open(args.output, 'w', newline='') if args.output else sys.stdout
+    if args.csv:
+        write_csv(records, output)
+    else:
+        write_text(records, output)
+
+    if args.output:
+        output.close()
+
+    print('[+] Decoded %d record(s)' % len(records), file=sys.stderr)
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())